@@ -0,0 +1,494 @@
+/******************************************************************************
+ *  File:         bench.c
+ *
+ *  Description:  Encoder/decoder benchmark, no radio needed.
+ *
+ *                Sweeps nof_prb, MCS index, l_sub_channel and SCI format and
+ *                for every combination measures
+ *                  encode: srsran_ue_sl_encode() alone,
+ *                  decode: srsran_ue_sl_decode_fft_estimate() and
+ *                          srsran_ue_sl_decode_subch() on every sub channel,
+ *                  e2e:    subframe generation through the TX pipeline
+ *                          (encoder thread -> ring -> consumer), as the
+ *                          transmitter runs it minus the radio,
+ *                reporting subframes/s, ns/subframe and heap allocations per
+ *                subframe. Allocations are counted by interposing malloc and
+ *                friends, so allocations inside libsrsran count too.
+ *
+ *                `make bench` builds and runs it; `-c` also writes the results
+ *                as CSV for comparing runs.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srsran/phy/common/phy_common_sl.h>
+#include <srsran/phy/utils/debug.h>
+#include "tx_pipeline.h"
+#include "ue_sl.h"
+
+}
+
+#define BENCH_MAX_VALUES (16)
+
+// === Allocation counting ===
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+static bool     count_allocs = false;
+static uint64_t nof_allocs   = 0;
+
+static inline void count_alloc() {
+    if (__atomic_load_n(&count_allocs, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&nof_allocs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+extern "C" {
+void* malloc(size_t size) __THROW {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) __THROW {
+    count_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) __THROW {
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) __THROW {
+    count_alloc();
+    void* p = __libc_memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) __THROW {
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+}
+
+static void start_counting() {
+    __atomic_store_n(&nof_allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&count_allocs, true, __ATOMIC_RELAXED);
+}
+
+static uint64_t stop_counting() {
+    __atomic_store_n(&count_allocs, false, __ATOMIC_RELAXED);
+    return __atomic_load_n(&nof_allocs, __ATOMIC_RELAXED);
+}
+
+// === Program arguments ===
+
+/**
+ * -n : subframes per measurement (default 500)
+ * -p : comma separated nof_prb values (default 50,100)
+ * -m : comma separated MCS indices (default 4,11,20)
+ * -l : comma separated l_sub_channel values (default 1,2)
+ * -f : comma separated SCI formats (default 0,1); format 0 is encoded only, the TM4 receiver expects format 1
+ * -d : TX pipeline depth for the e2e measurement (default TX_PIPELINE_DEFAULT_DEPTH)
+ * -c : also write the results to this CSV file
+*/
+
+typedef struct {
+    uint32_t values[BENCH_MAX_VALUES];
+    uint32_t nof_values;
+} value_list_t;
+
+typedef struct {
+    uint32_t nof_subframes;
+    value_list_t prb;
+    value_list_t mcs;
+    value_list_t l_sub_channel;
+    value_list_t sci_format;
+    uint32_t pipeline_depth;
+    char* csv_file_name;
+} prog_args_t;
+
+static int parse_list(value_list_t* list, const char* str) {
+    list->nof_values = 0;
+    while (*str != '\0') {
+        char* end;
+        unsigned long v = strtoul(str, &end, 10);
+        if (end == str || list->nof_values == BENCH_MAX_VALUES) {
+            printf("Invalid list: %s\n", str);
+            return SRSRAN_ERROR;
+        }
+        list->values[list->nof_values++] = (uint32_t)v;
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return list->nof_values > 0 ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+}
+
+void args_default(prog_args_t* args) {
+    args->nof_subframes = 500;
+    parse_list(&args->prb, "50,100");
+    parse_list(&args->mcs, "4,11,20");
+    parse_list(&args->l_sub_channel, "1,2");
+    parse_list(&args->sci_format, "0,1");
+    args->pipeline_depth = TX_PIPELINE_DEFAULT_DEPTH;
+    args->csv_file_name = NULL;
+}
+
+static prog_args_t prog_args;
+
+void usage(char* prog) {
+    printf("Usage: %s [-n subframes] [-p prb,...] [-m mcs,...] [-l l_sub_channel,...] [-f sci_format,...] [-d depth] [-c results.csv]\n", prog);
+}
+
+void parse_args(prog_args_t* args, int argc, char** argv) {
+    int option;
+    args_default(args);
+
+    while ((option = getopt(argc, argv, "c:d:f:l:m:n:p:")) != -1) {
+        int ret = SRSRAN_SUCCESS;
+        switch (option) {
+            case 'c':
+                args->csv_file_name = optarg;
+                break;
+            case 'd':
+                args->pipeline_depth = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                ret = parse_list(&args->sci_format, optarg);
+                break;
+            case 'l':
+                ret = parse_list(&args->l_sub_channel, optarg);
+                break;
+            case 'm':
+                ret = parse_list(&args->mcs, optarg);
+                break;
+            case 'n':
+                args->nof_subframes = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                ret = parse_list(&args->prb, optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(-1);
+        }
+        if (ret != SRSRAN_SUCCESS) {
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (args->nof_subframes == 0) {
+        usage(argv[0]);
+        exit(-1);
+    }
+}
+
+// === Benchmarks ===
+
+/**
+ * One combination of the sweep and the UE encoding it.
+*/
+typedef struct {
+    uint32_t nof_prb;
+    uint32_t mcs_idx;
+    uint32_t l_sub_channel;
+    uint32_t sci_format;
+
+    srsran_ue_sl_t ue;
+    srsran_ue_sl_res_t res;
+    uint8_t* tb;
+    uint32_t nof_positions; // sub channel start positions for l_sub_channel
+} bench_case_t;
+
+typedef struct {
+    const char* stage;
+    uint64_t nof_subframes;
+    uint64_t nof_ok; // decode only: TBs decoded
+    uint64_t nof_allocs;
+    double time;
+} bench_result_t;
+
+static double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//- Same SCI the transmitter uses, alternating initial transmission and re-transmission, spread over sub channels and subframes
+static void prepare_subframe(bench_case_t* c, uint64_t n, srsran_sl_sf_cfg_t* sf, srsran_pssch_data_t* data) {
+    srsran_set_sci(&c->ue.sci_tx, 1, 100, 3, n % 2 == 1, 0, c->mcs_idx);
+    c->ue.sci_tx.format = c->sci_format == 0 ? SRSRAN_SCI_FORMAT0 : SRSRAN_SCI_FORMAT1;
+    data->ptr = c->tb;
+    data->sub_channel_start_idx = (uint32_t)(n / 2 % c->nof_positions);
+    data->l_sub_channel = c->l_sub_channel;
+    sf->tti = (uint32_t)(n % 10);
+}
+
+static int bench_encode(bench_case_t* c, uint32_t nof_subframes, bench_result_t* r) {
+    srsran_sl_sf_cfg_t sf;
+    srsran_pssch_data_t data;
+
+    r->stage = "encode";
+    start_counting();
+    double start = now_s();
+    for (uint32_t n = 0; n < nof_subframes; n++) {
+        prepare_subframe(c, n, &sf, &data);
+        if (srsran_ue_sl_encode(&c->ue, &sf, &data)) {
+            stop_counting();
+            return SRSRAN_ERROR;
+        }
+    }
+    r->time = now_s() - start;
+    r->nof_allocs = stop_counting();
+    r->nof_subframes = nof_subframes;
+    return SRSRAN_SUCCESS;
+}
+
+static int bench_decode(bench_case_t* c, uint32_t nof_subframes, bench_result_t* r) {
+    srsran_sl_sf_cfg_t sf;
+    srsran_pssch_data_t data;
+    uint32_t nof_subch = c->ue.sl_comm_resource_pool.num_sub_channel;
+
+    r->stage = "decode";
+    r->time = 0.0;
+    r->nof_allocs = 0;
+    for (uint32_t n = 0; n < nof_subframes; n++) {
+        //- Only the decode is timed; the subframe it works on is encoded fresh every time
+        prepare_subframe(c, n, &sf, &data);
+        if (srsran_ue_sl_encode(&c->ue, &sf, &data)) {
+            return SRSRAN_ERROR;
+        }
+        srsran_vec_cf_copy(c->ue.signal_buffer_rx[0], c->ue.signal_buffer_tx, c->ue.sf_len);
+
+        start_counting();
+        double start = now_s();
+        if (srsran_ue_sl_decode_fft_estimate(&c->ue)) {
+            stop_counting();
+            return SRSRAN_ERROR;
+        }
+        for (uint32_t i = 0; i < nof_subch; i++) {
+            if (srsran_ue_sl_decode_subch(&c->ue, &sf, i, &c->res) == SRSRAN_SUCCESS) {
+                r->nof_ok++;
+            }
+        }
+        r->time += now_s() - start;
+        r->nof_allocs += stop_counting();
+    }
+    r->nof_subframes = nof_subframes;
+    return SRSRAN_SUCCESS;
+}
+
+//- Encoder callback of the e2e measurement: what the transmitter's encoder thread does for a busy subframe, without the cache
+static int e2e_encode_subframe(void* arg, uint64_t sf_idx, cf_t* output) {
+    bench_case_t* c = (bench_case_t*)arg;
+    srsran_sl_sf_cfg_t sf;
+    srsran_pssch_data_t data;
+
+    prepare_subframe(c, sf_idx, &sf, &data);
+    if (srsran_ue_sl_encode(&c->ue, &sf, &data)) {
+        return SRSRAN_ERROR;
+    }
+    srsran_vec_cf_copy(output, c->ue.signal_buffer_tx, c->ue.sf_len);
+    return 1;
+}
+
+static int bench_e2e(bench_case_t* c, uint32_t nof_subframes, uint32_t depth, bench_result_t* r) {
+    tx_pipeline_t pipeline;
+    if (tx_pipeline_init(&pipeline, c->ue.sf_len, depth, e2e_encode_subframe, c)) {
+        return SRSRAN_ERROR;
+    }
+
+    r->stage = "e2e";
+    start_counting();
+    double start = now_s();
+    if (tx_pipeline_start(&pipeline)) {
+        stop_counting();
+        tx_pipeline_free(&pipeline);
+        return SRSRAN_ERROR;
+    }
+    uint32_t n = 0;
+    while (n < nof_subframes) {
+        tx_pipeline_slot_t* slot = tx_pipeline_front(&pipeline);
+        if (slot == NULL) {
+            if (__atomic_load_n(&pipeline.producer_stats.nof_errors, __ATOMIC_RELAXED) > 0) {
+                break;
+            }
+            continue;
+        }
+        //- No radio: the subframe taken out is the one on air
+        tx_pipeline_set_air_sf(&pipeline, slot->sf_idx);
+        tx_pipeline_pop(&pipeline, 0.0);
+        n++;
+    }
+    r->time = now_s() - start;
+    tx_pipeline_stop(&pipeline);
+    r->nof_allocs = stop_counting();
+    r->nof_subframes = n;
+
+    tx_pipeline_free(&pipeline);
+    return n == nof_subframes ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+}
+
+static int bench_case_init(bench_case_t* c) {
+    srsran_cell_sl_t cell = {
+        .tm = SRSRAN_SIDELINK_TM4,
+        .N_sl_id = 19,
+        .nof_prb = c->nof_prb,
+        .cp = SRSRAN_CP_NORM,
+    };
+    srsran_sl_comm_resource_pool_t pool;
+    if (srsran_sl_comm_resource_pool_get_default_config(&pool, cell)) {
+        ERROR("Error initializing resource pool for %d PRB\n", c->nof_prb);
+        return SRSRAN_ERROR;
+    }
+    if (c->l_sub_channel == 0 || c->l_sub_channel > pool.num_sub_channel) {
+        return SRSRAN_ERROR_INVALID_INPUTS;
+    }
+    c->nof_positions = pool.num_sub_channel - c->l_sub_channel + 1;
+
+    if (srsran_ue_sl_init(&c->ue, cell, pool, 1) || srsran_ue_sl_init_rx(&c->ue)) {
+        ERROR("Error initializing UE\n");
+        return SRSRAN_ERROR;
+    }
+    c->tb = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+    if (!c->tb) {
+        perror("malloc");
+        return SRSRAN_ERROR;
+    }
+    unsigned int seed = 1;
+    for (uint32_t i = 0; i < SRSRAN_SL_SCH_MAX_TB_LEN; i++) {
+        c->tb[i] = (uint8_t)(rand_r(&seed) & 1);
+    }
+    for (uint32_t i = 0; i < pool.num_sub_channel; i++) {
+        c->res.data[i] = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+        if (!c->res.data[i]) {
+            perror("malloc");
+            return SRSRAN_ERROR;
+        }
+    }
+    return SRSRAN_SUCCESS;
+}
+
+static void bench_case_free(bench_case_t* c) {
+    srsran_ue_sl_free(&c->ue);
+    if (c->tb) {
+        free(c->tb);
+    }
+    for (uint32_t i = 0; i < SRSRAN_MAX_NUM_SUB_CHANNEL; i++) {
+        if (c->res.data[i]) {
+            free(c->res.data[i]);
+        }
+    }
+}
+
+static void print_result(FILE* f, FILE* csv, bench_case_t* c, bench_result_t* r) {
+    double sf_per_s = r->time > 0.0 ? r->nof_subframes / r->time : 0.0;
+    double ns_per_sf = r->nof_subframes ? r->time * 1e9 / r->nof_subframes : 0.0;
+    double allocs_per_sf = r->nof_subframes ? (double)r->nof_allocs / r->nof_subframes : 0.0;
+
+    fprintf(f, "%4u %4u %3u %4u  %-7s %10.0f %12.0f %10.2f",
+            c->nof_prb, c->mcs_idx, c->l_sub_channel, c->sci_format, r->stage, sf_per_s, ns_per_sf, allocs_per_sf);
+    if (strcmp(r->stage, "decode") == 0) {
+        fprintf(f, "   (%lu/%lu TBs decoded)", (unsigned long)r->nof_ok, (unsigned long)r->nof_subframes);
+    }
+    fprintf(f, "\n");
+
+    if (csv) {
+        fprintf(csv, "%u,%u,%u,%u,%s,%lu,%.0f,%.1f,%.3f,%lu\n",
+                c->nof_prb, c->mcs_idx, c->l_sub_channel, c->sci_format, r->stage,
+                (unsigned long)r->nof_subframes, sf_per_s, ns_per_sf, allocs_per_sf, (unsigned long)r->nof_ok);
+    }
+}
+
+int main(int argc, char** argv) {
+    parse_args(&prog_args, argc, argv);
+
+    FILE* csv = NULL;
+    if (prog_args.csv_file_name) {
+        csv = fopen(prog_args.csv_file_name, "w");
+        if (csv == NULL) {
+            perror("fopen");
+            exit(-1);
+        }
+        fprintf(csv, "nof_prb,mcs_idx,l_sub_channel,sci_format,stage,subframes,subframes_per_s,ns_per_subframe,allocs_per_subframe,tbs_decoded\n");
+    }
+
+    printf(" prb  mcs   L  fmt  stage         sf/s        ns/sf  allocs/sf\n");
+
+    int ret = SRSRAN_SUCCESS;
+    for (uint32_t p = 0; p < prog_args.prb.nof_values; p++) {
+        for (uint32_t m = 0; m < prog_args.mcs.nof_values; m++) {
+            for (uint32_t l = 0; l < prog_args.l_sub_channel.nof_values; l++) {
+                for (uint32_t f = 0; f < prog_args.sci_format.nof_values; f++) {
+                    bench_case_t c;
+                    bzero(&c, sizeof(c));
+                    c.nof_prb = prog_args.prb.values[p];
+                    c.mcs_idx = prog_args.mcs.values[m];
+                    c.l_sub_channel = prog_args.l_sub_channel.values[l];
+                    c.sci_format = prog_args.sci_format.values[f];
+
+                    int init = bench_case_init(&c);
+                    if (init == SRSRAN_ERROR_INVALID_INPUTS) {
+                        //- Allocation doesn't fit this bandwidth's pool
+                        bench_case_free(&c);
+                        continue;
+                    }
+
+                    bench_result_t r;
+                    bzero(&r, sizeof(r));
+                    if (init || bench_encode(&c, prog_args.nof_subframes, &r)) {
+                        printf("%4u %4u %3u %4u  encode failed\n", c.nof_prb, c.mcs_idx, c.l_sub_channel, c.sci_format);
+                        ret = SRSRAN_ERROR;
+                        bench_case_free(&c);
+                        continue;
+                    }
+                    print_result(stdout, csv, &c, &r);
+
+                    if (c.sci_format == 1) {
+                        bzero(&r, sizeof(r));
+                        if (bench_decode(&c, prog_args.nof_subframes, &r)) {
+                            printf("%4u %4u %3u %4u  decode failed\n", c.nof_prb, c.mcs_idx, c.l_sub_channel, c.sci_format);
+                            ret = SRSRAN_ERROR;
+                        } else {
+                            print_result(stdout, csv, &c, &r);
+                        }
+                    }
+
+                    bzero(&r, sizeof(r));
+                    if (bench_e2e(&c, prog_args.nof_subframes, prog_args.pipeline_depth, &r)) {
+                        printf("%4u %4u %3u %4u  e2e failed\n", c.nof_prb, c.mcs_idx, c.l_sub_channel, c.sci_format);
+                        ret = SRSRAN_ERROR;
+                    } else {
+                        print_result(stdout, csv, &c, &r);
+                    }
+
+                    bench_case_free(&c);
+                }
+            }
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+    return ret;
+}
@@ -0,0 +1,196 @@
+/******************************************************************************
+ *  File:         decoder_pool.c
+ *
+ *  Description:  Parallel per-sub channel sidelink decoding (see decoder_pool.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+#include <time.h>
+
+#include "decoder_pool.h"
+}
+
+static void decode_sub_channels(decoder_pool_t* q)
+{
+  uint32_t i;
+  while ((i = __atomic_fetch_add(&q->next_sub_channel, 1, __ATOMIC_RELAXED)) < q->nof_sub_channels) {
+    q->subch_ret[i] = srsran_ue_sl_decode_subch(q->ue, &q->sf, i, q->res);
+  }
+}
+
+static void* worker_run(void* arg)
+{
+  decoder_pool_t* q    = (decoder_pool_t*)arg;
+  uint64_t        seen = 0;
+
+  pthread_mutex_lock(&q->mutex);
+  while (true) {
+    while (q->running && q->generation == seen) {
+      pthread_cond_wait(&q->start_cv, &q->mutex);
+    }
+    if (!q->running) {
+      break;
+    }
+    seen = q->generation;
+    pthread_mutex_unlock(&q->mutex);
+
+    decode_sub_channels(q);
+
+    pthread_mutex_lock(&q->mutex);
+    if (--q->nof_busy == 0) {
+      pthread_cond_signal(&q->done_cv);
+    }
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return NULL;
+}
+
+/**
+ * @param nof_threads total number of threads decoding a subframe, including the caller of decoder_pool_decode().
+ *                    1 decodes serially on the calling thread.
+ */
+int decoder_pool_init(decoder_pool_t* q, uint32_t nof_threads)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && nof_threads > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(decoder_pool_t));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->start_cv, NULL);
+    pthread_cond_init(&q->done_cv, NULL);
+    q->running     = true;
+    q->nof_threads = nof_threads - 1;
+
+    if (q->nof_threads > 0) {
+      q->threads = (pthread_t*)calloc(q->nof_threads, sizeof(pthread_t));
+      if (!q->threads) {
+        perror("calloc");
+        goto clean_exit;
+      }
+    }
+    for (uint32_t i = 0; i < q->nof_threads; i++) {
+      if (pthread_create(&q->threads[i], NULL, worker_run, q)) {
+        perror("pthread_create");
+        goto clean_exit;
+      }
+      q->nof_started++;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    decoder_pool_free(q);
+  }
+  return ret;
+}
+
+void decoder_pool_free(decoder_pool_t* q)
+{
+  if (q) {
+    pthread_mutex_lock(&q->mutex);
+    q->running = false;
+    pthread_cond_broadcast(&q->start_cv);
+    pthread_mutex_unlock(&q->mutex);
+
+    for (uint32_t i = 0; i < q->nof_started; i++) {
+      pthread_join(q->threads[i], NULL);
+    }
+    if (q->threads) {
+      free(q->threads);
+    }
+
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->start_cv);
+    pthread_cond_destroy(&q->done_cv);
+    bzero(q, sizeof(decoder_pool_t));
+  }
+}
+
+/**
+ * Decode every sub channel of the subframe in ue->signal_buffer_rx. Blocks until all sub channels are done.
+ *
+ * @param ue UE holding the received subframe; must have one equalization buffer per sub channel
+ * @param res results, sci[] and data[] are filled in for every decoded sub channel (data[] must be allocated)
+ * @return number of sub channels with a decoded TB; the per sub channel return values are in q->subch_ret[]
+ */
+int decoder_pool_decode(decoder_pool_t* q, srsran_ue_sl_t* ue, srsran_sl_sf_cfg_t* sf, srsran_ue_sl_res_t* res)
+{
+  if (q == NULL || ue == NULL || sf == NULL || res == NULL) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (srsran_ue_sl_decode_fft_estimate(ue)) {
+    return SRSRAN_ERROR;
+  }
+
+  q->ue               = ue;
+  q->sf               = *sf;
+  q->res              = res;
+  q->nof_sub_channels = ue->sl_comm_resource_pool.num_sub_channel;
+  q->next_sub_channel = 0;
+
+  pthread_mutex_lock(&q->mutex);
+  q->nof_busy = q->nof_threads;
+  q->generation++;
+  pthread_cond_broadcast(&q->start_cv);
+  pthread_mutex_unlock(&q->mutex);
+
+  decode_sub_channels(q);
+
+  pthread_mutex_lock(&q->mutex);
+  while (q->nof_busy > 0) {
+    pthread_cond_wait(&q->done_cv, &q->mutex);
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  int nof_decoded = 0;
+  for (uint32_t i = 0; i < q->nof_sub_channels; i++) {
+    if (q->subch_ret[i] == SRSRAN_SUCCESS) {
+      nof_decoded++;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  q->stats.nof_subframes++;
+  q->stats.nof_decoded += nof_decoded;
+  q->stats.decode_time_sum += t;
+  q->stats.decode_time_max = SRSRAN_MAX(q->stats.decode_time_max, t);
+  if (t > 1e-3) {
+    q->stats.nof_over_budget++;
+  }
+
+  return nof_decoded;
+}
+
+void decoder_pool_print_stats(decoder_pool_t* q, FILE* f)
+{
+  decoder_pool_stats_t* s = &q->stats;
+
+  fprintf(f,
+          "decoder pool: %lu subframes on %u threads, %lu sub channels decoded, %lu subframes over 1 ms\n",
+          (unsigned long)s->nof_subframes,
+          q->nof_threads + 1,
+          (unsigned long)s->nof_decoded,
+          (unsigned long)s->nof_over_budget);
+  if (s->nof_subframes > 0) {
+    fprintf(f,
+            "decoder pool: decode time avg/max %.3f/%.3f ms\n",
+            s->decode_time_sum / s->nof_subframes * 1e3,
+            s->decode_time_max * 1e3);
+  }
+}
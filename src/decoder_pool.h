@@ -0,0 +1,64 @@
+/******************************************************************************
+ *  File:         decoder_pool.h
+ *
+ *  Description:  Parallel per-sub channel sidelink decoding.
+ *
+ *                srsran_ue_sl_t keeps separate PSCCH/PSSCH, SCI, channel
+ *                estimation and equalization state for every sub channel, so
+ *                the sub channels of one received subframe are independent.
+ *                After the FFT, the pool fans srsran_ue_sl_decode_subch() out
+ *                over its worker threads and the calling thread, which pick
+ *                sub channels off a shared counter until all are done.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef DECODER_POOL_H
+#define DECODER_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ue_sl.h"
+
+typedef struct {
+  uint64_t nof_subframes;
+  uint64_t nof_decoded;     // sub channels with a decoded TB
+  uint64_t nof_over_budget; // subframes that took longer than 1 ms
+  double   decode_time_sum;
+  double   decode_time_max;
+} decoder_pool_stats_t;
+
+typedef struct {
+  pthread_t* threads;
+  uint32_t   nof_threads;
+  uint32_t   nof_started;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  start_cv;
+  pthread_cond_t  done_cv;
+  bool            running;
+  uint64_t        generation; // bumped for every subframe
+  uint32_t        nof_busy;   // workers still on the current subframe
+
+  // Current subframe
+  srsran_ue_sl_t*     ue;
+  srsran_sl_sf_cfg_t  sf;
+  srsran_ue_sl_res_t* res;
+  uint32_t            nof_sub_channels;
+  uint32_t            next_sub_channel;
+  int                 subch_ret[SRSRAN_MAX_NUM_SUB_CHANNEL];
+
+  decoder_pool_stats_t stats;
+} decoder_pool_t;
+
+int decoder_pool_init(decoder_pool_t* q, uint32_t nof_threads);
+
+void decoder_pool_free(decoder_pool_t* q);
+
+int decoder_pool_decode(decoder_pool_t* q, srsran_ue_sl_t* ue, srsran_sl_sf_cfg_t* sf, srsran_ue_sl_res_t* res);
+
+void decoder_pool_print_stats(decoder_pool_t* q, FILE* f);
+
+#endif // DECODER_POOL_H
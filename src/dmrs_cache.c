@@ -0,0 +1,202 @@
+/******************************************************************************
+ *  File:         dmrs_cache.c
+ *
+ *  Description:  Process-wide cache of PSSCH DMRS sequences (see dmrs_cache.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <pthread.h>
+#include <string.h>
+
+#include <srsran/phy/common/phy_common.h>
+#include <srsran/phy/utils/debug.h>
+
+#include "dmrs_cache.h"
+}
+
+// DMRS symbols of the PSSCH in transmission modes 3 and 4, normal CP
+static const uint32_t dmrs_symbols[DMRS_CACHE_NOF_SYMBOLS] = {2, 5, 8, 11};
+
+static dmrs_cache_entry_t* slots[DMRS_CACHE_NOF_SLOTS];
+static pthread_mutex_t     insert_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dmrs_cache_stats_t  stats;
+static bool                full; // set once an insert was dropped, so later ones don't queue on insert_mutex
+
+static uint32_t slot_of(uint32_t N_x_id, uint32_t sf_idx, uint32_t nof_prb)
+{
+  uint64_t key = ((uint64_t)N_x_id << 16) | (sf_idx << 8) | nof_prb;
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (DMRS_CACHE_NOF_SLOTS - 1);
+}
+
+static bool matches(const dmrs_cache_entry_t* e, uint32_t N_x_id, uint32_t sf_idx, uint32_t nof_prb)
+{
+  return e->N_x_id == N_x_id && e->sf_idx == sf_idx && e->nof_prb == nof_prb;
+}
+
+/**
+ * @return the cached DMRS, or NULL if this configuration hasn't been inserted
+ */
+const dmrs_cache_entry_t* dmrs_cache_lookup(uint32_t N_x_id, uint32_t sf_idx, uint32_t nof_prb)
+{
+  __atomic_fetch_add(&stats.nof_lookups, 1, __ATOMIC_RELAXED);
+
+  for (uint32_t i = slot_of(N_x_id, sf_idx, nof_prb);; i = (i + 1) & (DMRS_CACHE_NOF_SLOTS - 1)) {
+    dmrs_cache_entry_t* e = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE);
+    if (e == NULL) {
+      return NULL;
+    }
+    if (matches(e, N_x_id, sf_idx, nof_prb)) {
+      __atomic_fetch_add(&stats.nof_hits, 1, __ATOMIC_RELAXED);
+      return e;
+    }
+  }
+}
+
+/**
+ * Copy the DMRS REs of an allocation out of a resource grid into the cache.
+ *
+ * @param sf_symbols resource grid with the DMRS of this configuration already mapped by srsran_chest_sl_put_dmrs()
+ * @param cell_nof_prb PRBs of the grid
+ * @param prb_start_idx first PRB of the allocation in the grid
+ * @return the new (or already present) entry, NULL if the cache is full, in which case the caller keeps generating the
+ *         DMRS itself; once full, inserts return right away without taking the lock
+ */
+const dmrs_cache_entry_t* dmrs_cache_insert(uint32_t    N_x_id,
+                                            uint32_t    sf_idx,
+                                            uint32_t    nof_prb,
+                                            const cf_t* sf_symbols,
+                                            uint32_t    cell_nof_prb,
+                                            uint32_t    prb_start_idx)
+{
+  uint32_t            nof_re = nof_prb * SRSRAN_NRE;
+  size_t              bytes  = sizeof(cf_t) * nof_re * DMRS_CACHE_NOF_SYMBOLS;
+  dmrs_cache_entry_t* ret    = NULL;
+
+  // Entries are never removed, so once full every miss would only take the lock to find that out again
+  if (__atomic_load_n(&full, __ATOMIC_ACQUIRE)) {
+    __atomic_fetch_add(&stats.nof_full, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&insert_mutex);
+
+  uint32_t i = slot_of(N_x_id, sf_idx, nof_prb);
+  while (slots[i] != NULL && !matches(slots[i], N_x_id, sf_idx, nof_prb)) {
+    i = (i + 1) & (DMRS_CACHE_NOF_SLOTS - 1);
+  }
+
+  if (slots[i] != NULL) {
+    // Another thread got there first
+    ret = slots[i];
+  } else if (stats.nof_entries >= DMRS_CACHE_MAX_ENTRIES || stats.nof_bytes + bytes > DMRS_CACHE_MAX_BYTES) {
+    __atomic_fetch_add(&stats.nof_full, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&full, true, __ATOMIC_RELEASE);
+  } else {
+    dmrs_cache_entry_t* e = (dmrs_cache_entry_t*)calloc(1, sizeof(dmrs_cache_entry_t));
+    cf_t*               s = srsran_vec_cf_malloc(nof_re * DMRS_CACHE_NOF_SYMBOLS);
+    if (!e || !s) {
+      perror("malloc");
+      free(e);
+      free(s);
+    } else {
+      e->N_x_id  = N_x_id;
+      e->sf_idx  = sf_idx;
+      e->nof_prb = nof_prb;
+      e->symbols = s;
+      for (uint32_t k = 0; k < DMRS_CACHE_NOF_SYMBOLS; k++) {
+        srsran_vec_cf_copy(&s[k * nof_re],
+                           &sf_symbols[(dmrs_symbols[k] * cell_nof_prb + prb_start_idx) * SRSRAN_NRE],
+                           nof_re);
+      }
+      stats.nof_entries++;
+      stats.nof_bytes += bytes;
+      __atomic_store_n(&slots[i], e, __ATOMIC_RELEASE);
+      ret = e;
+    }
+  }
+
+  pthread_mutex_unlock(&insert_mutex);
+  return ret;
+}
+
+/**
+ * Map a cached DMRS into a resource grid, like srsran_chest_sl_put_dmrs() would for the same configuration.
+ */
+void dmrs_cache_put(const dmrs_cache_entry_t* entry, cf_t* sf_symbols, uint32_t cell_nof_prb, uint32_t prb_start_idx)
+{
+  uint32_t nof_re = entry->nof_prb * SRSRAN_NRE;
+  for (uint32_t k = 0; k < DMRS_CACHE_NOF_SYMBOLS; k++) {
+    srsran_vec_cf_copy(&sf_symbols[(dmrs_symbols[k] * cell_nof_prb + prb_start_idx) * SRSRAN_NRE],
+                       &entry->symbols[k * nof_re],
+                       nof_re);
+  }
+}
+
+/**
+ * Account one PSSCH TX configuration, so the time spent reconfiguring shows up next to the cache hit rate.
+ *
+ * @param reused the PSSCH object already had this configuration and srsran_pssch_set_cfg() was skipped
+ */
+void dmrs_cache_count_cfg(uint64_t time_ns, bool reused)
+{
+  __atomic_fetch_add(&stats.nof_cfg, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.cfg_time_ns, time_ns, __ATOMIC_RELAXED);
+  if (reused) {
+    __atomic_fetch_add(&stats.nof_cfg_reused, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void dmrs_cache_get_stats(dmrs_cache_stats_t* s)
+{
+  pthread_mutex_lock(&insert_mutex);
+  s->nof_lookups    = __atomic_load_n(&stats.nof_lookups, __ATOMIC_RELAXED);
+  s->nof_hits       = __atomic_load_n(&stats.nof_hits, __ATOMIC_RELAXED);
+  s->nof_entries    = stats.nof_entries;
+  s->nof_bytes      = stats.nof_bytes;
+  s->nof_full       = __atomic_load_n(&stats.nof_full, __ATOMIC_RELAXED);
+  s->nof_cfg_reused = __atomic_load_n(&stats.nof_cfg_reused, __ATOMIC_RELAXED);
+  s->nof_cfg        = __atomic_load_n(&stats.nof_cfg, __ATOMIC_RELAXED);
+  s->cfg_time_ns    = __atomic_load_n(&stats.cfg_time_ns, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&insert_mutex);
+}
+
+void dmrs_cache_print_stats(FILE* f)
+{
+  dmrs_cache_stats_t s;
+  dmrs_cache_get_stats(&s);
+
+  fprintf(f,
+          "dmrs cache: %lu lookups, %lu hits, %lu entries (%.1f KB), %lu not cached because full\n",
+          (unsigned long)s.nof_lookups,
+          (unsigned long)s.nof_hits,
+          (unsigned long)s.nof_entries,
+          s.nof_bytes / 1024.0,
+          (unsigned long)s.nof_full);
+  if (s.nof_cfg > 0) {
+    fprintf(f,
+            "dmrs cache: %lu PSSCH TX configurations, %lu unchanged, %.2f us avg\n",
+            (unsigned long)s.nof_cfg,
+            (unsigned long)s.nof_cfg_reused,
+            s.cfg_time_ns / 1e3 / s.nof_cfg);
+  }
+}
+
+/**
+ * Release all entries. No UE may be encoding while this runs.
+ */
+void dmrs_cache_free()
+{
+  pthread_mutex_lock(&insert_mutex);
+  for (uint32_t i = 0; i < DMRS_CACHE_NOF_SLOTS; i++) {
+    if (slots[i]) {
+      free(slots[i]->symbols);
+      free(slots[i]);
+      slots[i] = NULL;
+    }
+  }
+  bzero(&stats, sizeof(stats));
+  __atomic_store_n(&full, false, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&insert_mutex);
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+ *  File:         dmrs_cache.h
+ *
+ *  Description:  Process-wide cache of PSSCH DMRS sequences.
+ *
+ *                The PSSCH DMRS only depends on N_X_ID (from the SCI CRC),
+ *                the subframe index and the number of PRBs; the allocation
+ *                start only moves it in frequency. The cache keeps the four
+ *                DMRS symbols of every (N_X_ID, tti % 10, nof_prb) seen so far,
+ *                so repeated configurations skip srsran_chest_sl_set_cfg()
+ *                and srsran_chest_sl_put_dmrs() and copy the REs instead.
+ *
+ *                Entries are never changed or removed once published, so all
+ *                UE objects and threads share one cache: lookups are lock-free
+ *                and only inserts take a lock.
+ *
+ *  Reference:    3GPP TS 36.211 Section 9.8
+ *****************************************************************************/
+
+#ifndef DMRS_CACHE_H
+#define DMRS_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <srsran/phy/utils/vector.h>
+
+#define DMRS_CACHE_NOF_SLOTS (4096)                    // hash table size, a power of two
+#define DMRS_CACHE_MAX_ENTRIES (DMRS_CACHE_NOF_SLOTS / 2) // keeps the probe sequences short
+#define DMRS_CACHE_MAX_BYTES (32u * 1024u * 1024u)
+#define DMRS_CACHE_NOF_SYMBOLS (4) // DMRS symbols per subframe, TM3/TM4
+
+typedef struct {
+  uint32_t N_x_id;
+  uint32_t sf_idx;
+  uint32_t nof_prb;
+  cf_t*    symbols; // DMRS_CACHE_NOF_SYMBOLS * nof_prb * SRSRAN_NRE REs, one DMRS symbol after the other
+} dmrs_cache_entry_t;
+
+typedef struct {
+  uint64_t nof_lookups;
+  uint64_t nof_hits;
+  uint64_t nof_entries;
+  uint64_t nof_bytes;
+  uint64_t nof_full; // inserts dropped because the cache was full
+  uint64_t nof_cfg_reused; // srsran_pssch_set_cfg() calls skipped because the configuration didn't change
+  uint64_t nof_cfg;        // PSSCH TX (re)configurations, cached or not
+  uint64_t cfg_time_ns;    // time spent in them
+} dmrs_cache_stats_t;
+
+const dmrs_cache_entry_t* dmrs_cache_lookup(uint32_t N_x_id, uint32_t sf_idx, uint32_t nof_prb);
+
+const dmrs_cache_entry_t* dmrs_cache_insert(uint32_t    N_x_id,
+                                            uint32_t    sf_idx,
+                                            uint32_t    nof_prb,
+                                            const cf_t* sf_symbols,
+                                            uint32_t    cell_nof_prb,
+                                            uint32_t    prb_start_idx);
+
+void dmrs_cache_put(const dmrs_cache_entry_t* entry, cf_t* sf_symbols, uint32_t cell_nof_prb, uint32_t prb_start_idx);
+
+void dmrs_cache_count_cfg(uint64_t time_ns, bool reused);
+
+void dmrs_cache_get_stats(dmrs_cache_stats_t* stats);
+
+void dmrs_cache_print_stats(FILE* f);
+
+void dmrs_cache_free();
+
+#endif // DMRS_CACHE_H
@@ -0,0 +1,369 @@
+/******************************************************************************
+ *  File:         encoder_pool.c
+ *
+ *  Description:  Multi-threaded sidelink encoder pool (see encoder_pool.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "encoder_pool.h"
+#include "latency_stats.h"
+}
+
+// Resident set size of the process in bytes, 0 if /proc is not available
+static uint64_t resident_bytes()
+{
+  unsigned long size = 0, resident = 0;
+  FILE*         f    = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static int deque_init(encoder_deque_t* d, uint32_t capacity)
+{
+  d->jobs = (encoder_job_t**)calloc(capacity, sizeof(encoder_job_t*));
+  if (!d->jobs) {
+    perror("calloc");
+    return SRSRAN_ERROR;
+  }
+  d->capacity = capacity;
+  d->head     = 0;
+  d->count    = 0;
+  pthread_mutex_init(&d->mutex, NULL);
+  return SRSRAN_SUCCESS;
+}
+
+static void deque_free(encoder_deque_t* d)
+{
+  if (d->jobs) {
+    free(d->jobs);
+    pthread_mutex_destroy(&d->mutex);
+  }
+  bzero(d, sizeof(encoder_deque_t));
+}
+
+static bool deque_push_back(encoder_deque_t* d, encoder_job_t* job)
+{
+  bool ok = false;
+  pthread_mutex_lock(&d->mutex);
+  if (d->count < d->capacity) {
+    d->jobs[(d->head + d->count) % d->capacity] = job;
+    d->count++;
+    ok = true;
+  }
+  pthread_mutex_unlock(&d->mutex);
+  return ok;
+}
+
+// The owner takes the oldest job so its own work stays in TTI order
+static encoder_job_t* deque_pop_front(encoder_deque_t* d)
+{
+  encoder_job_t* job = NULL;
+  pthread_mutex_lock(&d->mutex);
+  if (d->count > 0) {
+    job     = d->jobs[d->head];
+    d->head = (d->head + 1) % d->capacity;
+    d->count--;
+  }
+  pthread_mutex_unlock(&d->mutex);
+  return job;
+}
+
+// Thieves take from the other end, away from the owner
+static encoder_job_t* deque_pop_back(encoder_deque_t* d)
+{
+  encoder_job_t* job = NULL;
+  pthread_mutex_lock(&d->mutex);
+  if (d->count > 0) {
+    d->count--;
+    job = d->jobs[(d->head + d->count) % d->capacity];
+  }
+  pthread_mutex_unlock(&d->mutex);
+  return job;
+}
+
+static encoder_job_t* take_job(encoder_worker_t* w)
+{
+  encoder_pool_t* q   = w->pool;
+  encoder_job_t*  job = deque_pop_front(&w->queue);
+
+  for (uint32_t i = 1; job == NULL && i < q->nof_workers; i++) {
+    job = deque_pop_back(&q->workers[(w->id + i) % q->nof_workers].queue);
+    if (job) {
+      w->nof_stolen++;
+    }
+  }
+  if (job) {
+    __atomic_fetch_sub(&q->pending, 1, __ATOMIC_RELAXED);
+  }
+  return job;
+}
+
+static void encode_job(encoder_worker_t* w, encoder_job_t* job)
+{
+  srsran_ue_sl_t* ue = &w->ue;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (job->grants) {
+    job->ret = srsran_ue_sl_encode_multi(ue, &job->sf, job->grants, job->nof_grants);
+  } else {
+    srsran_ue_sl_copy_sci(&ue->sci_tx, &job->sci);
+    job->ret = srsran_ue_sl_encode(ue, &job->sf, &job->data);
+  }
+  if (job->ret == SRSRAN_SUCCESS) {
+    uint64_t t = latency_now();
+    srsran_vec_cf_copy(job->output, ue->signal_buffer_tx, ue->sf_len);
+    latency_record(LATENCY_TX_COPY, t);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  job->encode_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  w->nof_encoded++;
+}
+
+static void* worker_run(void* arg)
+{
+  encoder_worker_t* w = (encoder_worker_t*)arg;
+  encoder_pool_t*   q = w->pool;
+
+  while (true) {
+    encoder_job_t* job = take_job(w);
+
+    if (job == NULL) {
+      pthread_mutex_lock(&q->mutex);
+      while (q->running && __atomic_load_n(&q->pending, __ATOMIC_RELAXED) == 0) {
+        pthread_cond_wait(&q->work_cv, &q->mutex);
+      }
+      bool stop = !q->running;
+      pthread_mutex_unlock(&q->mutex);
+      if (stop) {
+        break;
+      }
+      continue;
+    }
+
+    encode_job(w, job);
+
+    pthread_mutex_lock(&q->mutex);
+    q->reorder_done[job->seq & q->window_mask] = true;
+    pthread_cond_broadcast(&q->done_cv);
+    pthread_mutex_unlock(&q->mutex);
+  }
+
+  return NULL;
+}
+
+/**
+ * Create a pool of encoder workers, each with its own TX-only srsran_ue_sl_t.
+ *
+ * @param nof_workers number of encoder threads
+ * @param window maximum number of jobs in flight (submitted but not collected), rounded up to a power of two
+ */
+int encoder_pool_init(encoder_pool_t*                q,
+                      srsran_cell_sl_t               cell,
+                      srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                      uint32_t                       nof_workers,
+                      uint32_t                       window)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && nof_workers > 0 && window > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(encoder_pool_t));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->work_cv, NULL);
+    pthread_cond_init(&q->done_cv, NULL);
+
+    q->window = 1;
+    while (q->window < window) {
+      q->window <<= 1;
+    }
+    q->window_mask = q->window - 1;
+
+    q->reorder      = (encoder_job_t**)calloc(q->window, sizeof(encoder_job_t*));
+    q->reorder_done = (bool*)calloc(q->window, sizeof(bool));
+    if (!q->reorder || !q->reorder_done) {
+      perror("calloc");
+      goto clean_exit;
+    }
+
+    q->workers = (encoder_worker_t*)calloc(nof_workers, sizeof(encoder_worker_t));
+    if (!q->workers) {
+      perror("calloc");
+      goto clean_exit;
+    }
+    q->nof_workers = nof_workers;
+    q->running     = true;
+
+    struct timespec start, end;
+    uint64_t        rss = resident_bytes();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < nof_workers; i++) {
+      encoder_worker_t* w = &q->workers[i];
+      w->pool             = q;
+      w->id               = i;
+      if (srsran_ue_sl_init(&w->ue, cell, sl_comm_resource_pool, 0)) {
+        ERROR("Error initializing UE for encoder worker %d\n", i);
+        goto clean_exit;
+      }
+      if (deque_init(&w->queue, q->window)) {
+        goto clean_exit;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    q->ue_init_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    q->ue_init_rss  = SRSRAN_MAX(resident_bytes(), rss) - rss;
+    q->sf_len       = q->workers[0].ue.sf_len;
+
+    for (uint32_t i = 0; i < nof_workers; i++) {
+      if (pthread_create(&q->workers[i].thread, NULL, worker_run, &q->workers[i])) {
+        perror("pthread_create");
+        goto clean_exit;
+      }
+      q->workers[i].thread_started = true;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    encoder_pool_free(q);
+  }
+  return ret;
+}
+
+void encoder_pool_free(encoder_pool_t* q)
+{
+  if (q) {
+    pthread_mutex_lock(&q->mutex);
+    q->running = false;
+    pthread_cond_broadcast(&q->work_cv);
+    pthread_mutex_unlock(&q->mutex);
+
+    if (q->workers) {
+      for (uint32_t i = 0; i < q->nof_workers; i++) {
+        if (q->workers[i].thread_started) {
+          pthread_join(q->workers[i].thread, NULL);
+        }
+      }
+      for (uint32_t i = 0; i < q->nof_workers; i++) {
+        srsran_ue_sl_free(&q->workers[i].ue);
+        deque_free(&q->workers[i].queue);
+      }
+      free(q->workers);
+    }
+    if (q->reorder) {
+      free(q->reorder);
+    }
+    if (q->reorder_done) {
+      free(q->reorder_done);
+    }
+    pthread_cond_destroy(&q->work_cv);
+    pthread_cond_destroy(&q->done_cv);
+    pthread_mutex_destroy(&q->mutex);
+    bzero(q, sizeof(encoder_pool_t));
+  }
+}
+
+/**
+ * Queue a job. Never blocks: jobs are collected in submission order, so callers are expected to submit
+ * them in TTI order and collect before the reorder window fills up.
+ *
+ * @return SRSRAN_SUCCESS, or SRSRAN_ERROR if the reorder window is full
+ */
+int encoder_pool_submit(encoder_pool_t* q, encoder_job_t* job)
+{
+  pthread_mutex_lock(&q->mutex);
+  if (q->next_seq - q->next_collect_seq >= q->window) {
+    pthread_mutex_unlock(&q->mutex);
+    return SRSRAN_ERROR;
+  }
+  job->seq = q->next_seq++;
+  job->ret = SRSRAN_ERROR;
+
+  q->reorder[job->seq & q->window_mask]      = job;
+  q->reorder_done[job->seq & q->window_mask] = false;
+
+  // Round-robin placement; idle workers steal whatever is left unbalanced
+  encoder_worker_t* w = &q->workers[q->next_worker];
+  q->next_worker      = (q->next_worker + 1) % q->nof_workers;
+
+  __atomic_fetch_add(&q->pending, 1, __ATOMIC_RELAXED);
+  deque_push_back(&w->queue, job); // cannot fail, each deque holds a full window
+  pthread_cond_signal(&q->work_cv);
+  pthread_mutex_unlock(&q->mutex);
+
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Return the oldest submitted job once it is finished.
+ *
+ * @param blocking wait for the job instead of returning NULL when it is still being encoded
+ * @return the job (check job->ret), or NULL if nothing is in flight or (non-blocking) not yet done
+ */
+encoder_job_t* encoder_pool_collect(encoder_pool_t* q, bool blocking)
+{
+  encoder_job_t* job = NULL;
+
+  pthread_mutex_lock(&q->mutex);
+  while (q->next_collect_seq < q->next_seq) {
+    uint32_t idx = q->next_collect_seq & q->window_mask;
+    if (q->reorder_done[idx]) {
+      job                  = q->reorder[idx];
+      q->reorder[idx]      = NULL;
+      q->reorder_done[idx] = false;
+      q->next_collect_seq++;
+      break;
+    }
+    if (!blocking) {
+      break;
+    }
+    pthread_cond_wait(&q->done_cv, &q->mutex);
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return job;
+}
+
+uint32_t encoder_pool_in_flight(encoder_pool_t* q)
+{
+  pthread_mutex_lock(&q->mutex);
+  uint32_t n = (uint32_t)(q->next_seq - q->next_collect_seq);
+  pthread_mutex_unlock(&q->mutex);
+  return n;
+}
+
+void encoder_pool_print_stats(encoder_pool_t* q, FILE* f)
+{
+  fprintf(f,
+          "encoder pool: %d TX-only UEs initialized in %.3f ms, %.2f MB resident (%.2f ms, %.2f MB per UE)\n",
+          q->nof_workers,
+          q->ue_init_time * 1e3,
+          q->ue_init_rss / 1e6,
+          q->ue_init_time * 1e3 / q->nof_workers,
+          q->ue_init_rss / 1e6 / q->nof_workers);
+  for (uint32_t i = 0; i < q->nof_workers; i++) {
+    fprintf(f,
+            "encoder worker %d: %lu encoded, %lu stolen\n",
+            i,
+            (unsigned long)q->workers[i].nof_encoded,
+            (unsigned long)q->workers[i].nof_stolen);
+  }
+}
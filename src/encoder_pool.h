@@ -0,0 +1,107 @@
+/******************************************************************************
+ *  File:         encoder_pool.h
+ *
+ *  Description:  Multi-threaded sidelink encoder pool.
+ *
+ *                srsran_ue_sl_t keeps mutable scratch state (sf_symbols_tx,
+ *                signal_buffer_tx, pscch_tx, pssch_tx), so one instance can
+ *                only encode one subframe at a time. The pool gives every
+ *                worker thread its own TX-only srsran_ue_sl_t, hands jobs out
+ *                through per-worker work-stealing queues and returns finished
+ *                jobs in submission (TTI) order.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef ENCODER_POOL_H
+#define ENCODER_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ue_sl.h"
+
+#define ENCODER_POOL_DEFAULT_WINDOW (64)
+
+typedef struct {
+  // Input. sci carries the format and the fields set by srsran_set_sci(); riv is derived from data.
+  srsran_sl_sf_cfg_t  sf;
+  srsran_sci_t        sci;
+  srsran_pssch_data_t data; // data.ptr must stay valid until the job is collected
+  cf_t*               output; // sf_len samples
+
+  // If grants is set, sci and data are ignored and all grants are composed into one subframe
+  srsran_ue_sl_grant_t* grants;
+  uint32_t              nof_grants;
+
+  // Output
+  uint64_t seq;
+  int      ret;
+  double   encode_time; // seconds spent encoding on the worker
+  void*    user; // opaque to the pool
+} encoder_job_t;
+
+typedef struct encoder_pool_s encoder_pool_t;
+
+typedef struct {
+  encoder_job_t** jobs;
+  uint32_t        capacity;
+  uint32_t        head;
+  uint32_t        count;
+  pthread_mutex_t mutex;
+} encoder_deque_t;
+
+typedef struct {
+  encoder_pool_t* pool;
+  uint32_t        id;
+  pthread_t       thread;
+  bool            thread_started;
+  srsran_ue_sl_t  ue;
+  encoder_deque_t queue;
+
+  uint64_t nof_encoded;
+  uint64_t nof_stolen;
+} encoder_worker_t;
+
+struct encoder_pool_s {
+  encoder_worker_t* workers;
+  uint32_t          nof_workers;
+  uint32_t          sf_len;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  work_cv;
+  pthread_cond_t  done_cv;
+  uint32_t        pending; // queued jobs not yet taken by a worker
+  bool            running;
+
+  // Reorder window, indexed by seq & window_mask
+  encoder_job_t** reorder;
+  bool*           reorder_done;
+  uint32_t        window;
+  uint32_t        window_mask;
+  uint64_t        next_seq;
+  uint64_t        next_collect_seq;
+  uint32_t        next_worker;
+
+  double   ue_init_time; // seconds spent in srsran_ue_sl_init() for all workers
+  uint64_t ue_init_rss;  // resident memory those inits added, in bytes
+};
+
+int encoder_pool_init(encoder_pool_t*                q,
+                      srsran_cell_sl_t               cell,
+                      srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                      uint32_t                       nof_workers,
+                      uint32_t                       window);
+
+void encoder_pool_free(encoder_pool_t* q);
+
+int encoder_pool_submit(encoder_pool_t* q, encoder_job_t* job);
+
+encoder_job_t* encoder_pool_collect(encoder_pool_t* q, bool blocking);
+
+uint32_t encoder_pool_in_flight(encoder_pool_t* q);
+
+void encoder_pool_print_stats(encoder_pool_t* q, FILE* f);
+
+#endif // ENCODER_POOL_H
@@ -0,0 +1,455 @@
+/******************************************************************************
+ *  File:         fleet.c
+ *
+ *  Description:  Virtual fleet emulator (see fleet.h).
+ *
+ *  Reference:    3GPP TS 36.321 Section 5.14.1.1
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+#include <time.h>
+
+#include "fleet.h"
+}
+
+static uint32_t xorshift32(uint32_t* state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static uint32_t fleet_rand(fleet_t* q, uint32_t n)
+{
+  return xorshift32(&q->rng) % n;
+}
+
+static bool valid_reserv_intvl(uint32_t intvl)
+{
+  return intvl == 20 || intvl == 50 || (intvl % 100 == 0 && intvl > 0 && intvl <= 1000);
+}
+
+/**
+ * Draw a new SL_RESOURCE_RESELECTION_COUNTER (3GPP TS 36.321 Section 5.14.1.1).
+ */
+static uint32_t new_reselection_counter(fleet_t* q, uint32_t reserv_intvl_ms)
+{
+  if (reserv_intvl_ms == 20) {
+    return 25 + fleet_rand(q, 51);
+  } else if (reserv_intvl_ms == 50) {
+    return 10 + fleet_rand(q, 21);
+  }
+  return 5 + fleet_rand(q, 11);
+}
+
+static void wheel_push(fleet_t* q, fleet_vehicle_t* v)
+{
+  fleet_vehicle_t** bucket = &q->wheel[v->next_tx_sf % FLEET_WHEEL_SIZE];
+  v->wheel_next            = *bucket;
+  *bucket                  = v;
+}
+
+static void select_resource(fleet_t* q, fleet_vehicle_t* v)
+{
+  v->sub_channel_start_idx =
+      fleet_rand(q, q->sl_comm_resource_pool.num_sub_channel - q->cfg.l_sub_channel + 1);
+  v->reselection_counter = new_reselection_counter(q, v->reserv_intvl_ms);
+}
+
+/**
+ * Move a vehicle to its next reservation, running resource reselection when its counter expires.
+ */
+static void reschedule(fleet_t* q, fleet_vehicle_t* v, uint64_t sf_idx)
+{
+  v->reselection_counter--;
+  if (v->reselection_counter == 0) {
+    if ((float)fleet_rand(q, 1000) / 1000.0f < q->cfg.prob_resource_keep) {
+      v->reselection_counter = new_reselection_counter(q, v->reserv_intvl_ms);
+    } else {
+      // New resource somewhere in the selection window [n+1, n+min(100, P_rsvp)]
+      select_resource(q, v);
+      v->next_tx_sf = sf_idx + 1 + fleet_rand(q, SRSRAN_MIN(100, v->reserv_intvl_ms));
+      q->stats.nof_reselections++;
+      q->report.nof_reselections++;
+      wheel_push(q, v);
+      return;
+    }
+  }
+  v->next_tx_sf = sf_idx + v->reserv_intvl_ms;
+  wheel_push(q, v);
+}
+
+static void fill_payload(fleet_t* q, fleet_vehicle_t* v, uint8_t* tb)
+{
+  uint32_t state = 0x9e3779b9u * (v->id + 1);
+  if (q->cfg.payload == FLEET_PAYLOAD_COUNTER) {
+    state ^= 0x85ebca6bu * (v->nof_tx + 1);
+  }
+  if (state == 0) {
+    state = 1;
+  }
+  for (uint32_t i = 0; i < q->tb_len; i += 32) {
+    uint32_t word = xorshift32(&state);
+    for (uint32_t j = 0; j < 32 && i + j < q->tb_len; j++) {
+      tb[i + j] = (word >> j) & 1;
+    }
+  }
+}
+
+/**
+ * Collect every vehicle due in sf_idx into the TTI's grant list.
+ */
+static void schedule_tti(fleet_t* q, fleet_tti_t* tti, uint64_t sf_idx)
+{
+  bool     used[SRSRAN_MAX_NUM_SUB_CHANNEL] = {};
+  uint32_t nof_grants                       = 0;
+
+  tti->sf_idx = sf_idx;
+
+  // Every vehicle in this bucket is due now, since no interval reaches a full turn of the wheel
+  fleet_vehicle_t* v                  = q->wheel[sf_idx % FLEET_WHEEL_SIZE];
+  q->wheel[sf_idx % FLEET_WHEEL_SIZE] = NULL;
+  while (v) {
+    fleet_vehicle_t* next = v->wheel_next;
+
+    bool free_resource = true;
+    for (uint32_t k = v->sub_channel_start_idx; k < v->sub_channel_start_idx + q->cfg.l_sub_channel; k++) {
+      free_resource &= !used[k];
+    }
+
+    if (free_resource) {
+      srsran_ue_sl_grant_t* grant = &tti->grants[nof_grants];
+      srsran_set_sci(&grant->sci, q->cfg.priority, v->reserv_intvl_ms, 0, false, 0, q->cfg.mcs_idx);
+      grant->sci.format                 = SRSRAN_SCI_FORMAT1;
+      grant->data.ptr                   = &tti->tbs[nof_grants * q->tb_len];
+      grant->data.sub_channel_start_idx = v->sub_channel_start_idx;
+      grant->data.l_sub_channel         = q->cfg.l_sub_channel;
+      fill_payload(q, v, grant->data.ptr);
+
+      for (uint32_t k = v->sub_channel_start_idx; k < v->sub_channel_start_idx + q->cfg.l_sub_channel; k++) {
+        used[k] = true;
+      }
+      nof_grants++;
+      q->stats.nof_tx++;
+      q->report.nof_tx++;
+    } else {
+      // Two vehicles picked the same resource; on air they would collide, here only the first is sent
+      q->stats.nof_collisions++;
+      q->report.nof_collisions++;
+    }
+
+    v->nof_tx++;
+    reschedule(q, v, sf_idx);
+    v = next;
+  }
+
+  tti->busy           = nof_grants > 0;
+  tti->job.sf.tti     = (uint32_t)(sf_idx % 10240);
+  tti->job.grants     = tti->grants;
+  tti->job.nof_grants = nof_grants;
+  tti->job.output     = tti->output;
+}
+
+/**
+ * Find the TB length the PSSCH encoder will read for the fleet's allocation size and MCS.
+ */
+static int probe_tb_len(fleet_t* q, srsran_cell_sl_t cell)
+{
+  int            ret = SRSRAN_ERROR;
+  srsran_ue_sl_t ue;
+  uint8_t*       tb = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+
+  if (tb && srsran_ue_sl_init(&ue, cell, q->sl_comm_resource_pool, 0) == SRSRAN_SUCCESS) {
+    srsran_vec_u8_zero(tb, SRSRAN_SL_SCH_MAX_TB_LEN);
+    srsran_set_sci(&ue.sci_tx, q->cfg.priority, 100, 0, false, 0, q->cfg.mcs_idx);
+
+    srsran_sl_sf_cfg_t  sf   = {};
+    srsran_pssch_data_t data = {};
+    data.ptr                 = tb;
+    data.l_sub_channel       = q->cfg.l_sub_channel;
+    if (srsran_ue_sl_encode(&ue, &sf, &data) == SRSRAN_SUCCESS) {
+      q->tb_len = ue.pssch_tx.sl_sch_tb_len;
+      ret       = SRSRAN_SUCCESS;
+    }
+    srsran_ue_sl_free(&ue);
+  }
+  if (tb) {
+    free(tb);
+  }
+  return ret;
+}
+
+void fleet_cfg_default(fleet_cfg_t* cfg)
+{
+  bzero(cfg, sizeof(fleet_cfg_t));
+  cfg->nof_vehicles        = 0;
+  cfg->reserv_intvls_ms[0] = 100;
+  cfg->nof_reserv_intvls   = 1;
+  cfg->l_sub_channel       = 1;
+  cfg->mcs_idx             = 11;
+  cfg->priority            = 1;
+  cfg->prob_resource_keep  = 0.0f;
+  cfg->payload             = FLEET_PAYLOAD_COUNTER;
+  cfg->nof_workers         = 2;
+  cfg->lookahead_ms        = 32;
+  cfg->seed                = 1;
+  cfg->superposition       = false;
+  cfg->cache_bytes         = WF_CACHE_DEFAULT_BUDGET_BYTES;
+}
+
+/**
+ * Parse a comma separated list of reservation intervals in ms, e.g. "20,50,100".
+ */
+int fleet_parse_intvls(fleet_cfg_t* cfg, const char* list)
+{
+  uint32_t    n = 0;
+  const char* p = list;
+  while (*p != '\0' && n < FLEET_MAX_RESERV_INTVLS) {
+    char*    end   = NULL;
+    uint32_t intvl = (uint32_t)strtoul(p, &end, 10);
+    if (end == p || !valid_reserv_intvl(intvl)) {
+      ERROR("Invalid reservation interval list '%s'. Valid values are [20, 50, 100, 200, 300, ... 1000]\n", list);
+      return SRSRAN_ERROR;
+    }
+    cfg->reserv_intvls_ms[n++] = intvl;
+    p                          = (*end == ',') ? end + 1 : end;
+  }
+  cfg->nof_reserv_intvls = n;
+  return n > 0 ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+}
+
+int fleet_init(fleet_t* q, srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t sl_comm_resource_pool, fleet_cfg_t* cfg)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && cfg != NULL && cfg->nof_vehicles > 0 && cfg->nof_reserv_intvls > 0 && cfg->l_sub_channel > 0 &&
+      cfg->l_sub_channel <= sl_comm_resource_pool.num_sub_channel && cfg->lookahead_ms > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(fleet_t));
+    q->cfg                   = *cfg;
+    q->sl_comm_resource_pool = sl_comm_resource_pool;
+    q->rng                   = cfg->seed ? cfg->seed : 1;
+    q->nof_ttis              = cfg->lookahead_ms;
+
+    if (probe_tb_len(q, cell)) {
+      ERROR("Error probing TB length for fleet\n");
+      goto clean_exit;
+    }
+
+    if (cfg->superposition) {
+      // A counter payload never repeats, so its waveforms would only ever miss the cache
+      size_t cache_bytes = cfg->payload == FLEET_PAYLOAD_COUNTER ? 0 : cfg->cache_bytes;
+      if (wf_compose_init(&q->compose, cell, sl_comm_resource_pool, cache_bytes)) {
+        ERROR("Error initializing fleet waveform composition\n");
+        goto clean_exit;
+      }
+      q->sf_len = q->compose.sf_len;
+    } else {
+      if (encoder_pool_init(&q->encoder, cell, sl_comm_resource_pool, cfg->nof_workers, q->nof_ttis)) {
+        ERROR("Error initializing fleet encoder pool\n");
+        goto clean_exit;
+      }
+      q->sf_len = q->encoder.sf_len;
+    }
+
+    q->ttis = (fleet_tti_t*)calloc(q->nof_ttis, sizeof(fleet_tti_t));
+    if (!q->ttis) {
+      perror("calloc");
+      goto clean_exit;
+    }
+    for (uint32_t i = 0; i < q->nof_ttis; i++) {
+      // With superposition the subframe is composed straight into the pipeline's buffer
+      q->ttis[i].tbs    = srsran_vec_u8_malloc(sl_comm_resource_pool.num_sub_channel * q->tb_len);
+      q->ttis[i].output = cfg->superposition ? NULL : srsran_vec_cf_malloc(q->sf_len);
+      if (!q->ttis[i].tbs || (!cfg->superposition && !q->ttis[i].output)) {
+        perror("malloc");
+        goto clean_exit;
+      }
+    }
+
+    q->vehicles = (fleet_vehicle_t*)calloc(cfg->nof_vehicles, sizeof(fleet_vehicle_t));
+    if (!q->vehicles) {
+      perror("calloc");
+      goto clean_exit;
+    }
+    for (uint32_t i = 0; i < cfg->nof_vehicles; i++) {
+      fleet_vehicle_t* v = &q->vehicles[i];
+      v->id              = i;
+      v->reserv_intvl_ms = cfg->reserv_intvls_ms[fleet_rand(q, cfg->nof_reserv_intvls)];
+      v->next_tx_sf      = fleet_rand(q, v->reserv_intvl_ms);
+      select_resource(q, v);
+      wheel_push(q, v);
+    }
+
+    if (cfg->superposition) {
+      printf("Fleet: %d vehicles, TB length %d bits, waveform superposition%s\n",
+             cfg->nof_vehicles,
+             q->tb_len,
+             q->compose.use_cache ? "" : " without a cache (counter payload)");
+    } else {
+      printf("Fleet: %d vehicles, TB length %d bits, %d encoder workers, %d ms lookahead\n",
+             cfg->nof_vehicles,
+             q->tb_len,
+             cfg->nof_workers,
+             q->nof_ttis);
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid fleet parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    fleet_free(q);
+  }
+  return ret;
+}
+
+void fleet_free(fleet_t* q)
+{
+  if (q) {
+    if (q->cfg.superposition) {
+      wf_compose_free(&q->compose);
+    } else {
+      encoder_pool_free(&q->encoder);
+    }
+    if (q->ttis) {
+      for (uint32_t i = 0; i < q->nof_ttis; i++) {
+        if (q->ttis[i].tbs) {
+          free(q->ttis[i].tbs);
+        }
+        if (q->ttis[i].output) {
+          free(q->ttis[i].output);
+        }
+      }
+      free(q->ttis);
+    }
+    if (q->vehicles) {
+      free(q->vehicles);
+    }
+    bzero(q, sizeof(fleet_t));
+  }
+}
+
+static void account_tti(fleet_t* q, fleet_tti_t* tti)
+{
+  fleet_stats_t* stats[2] = {&q->stats, &q->report};
+  for (int i = 0; i < 2; i++) {
+    if (tti->busy) {
+      stats[i]->nof_busy_ttis++;
+      stats[i]->encode_time_sum += tti->job.encode_time;
+      stats[i]->encode_time_max = SRSRAN_MAX(stats[i]->encode_time_max, tti->job.encode_time);
+      if (tti->job.encode_time > 1e-3) {
+        stats[i]->nof_over_budget++;
+      }
+    }
+  }
+
+  if (tti->sf_idx % FLEET_REPORT_INTERVAL_MS == FLEET_REPORT_INTERVAL_MS - 1) {
+    fleet_stats_t* r = &q->report;
+    printf("fleet [%.3f s]: %lu tx, %lu dropped, %lu collisions, %lu reselections, %lu peak limited, encode cost per "
+           "TTI avg %.3f ms, max %.3f ms, %lu over 1 ms\n",
+           (tti->sf_idx + 1) / 1e3,
+           (unsigned long)r->nof_tx,
+           (unsigned long)r->nof_dropped,
+           (unsigned long)r->nof_collisions,
+           (unsigned long)r->nof_reselections,
+           (unsigned long)r->nof_peak_limited,
+           r->nof_busy_ttis ? r->encode_time_sum / r->nof_busy_ttis * 1e3 : 0.0,
+           r->encode_time_max * 1e3,
+           (unsigned long)r->nof_over_budget);
+    bzero(r, sizeof(fleet_stats_t));
+  }
+}
+
+/**
+ * TX pipeline encoder callback (see tx_pipeline_encode_fn). Must be called with consecutive sf_idx.
+ *
+ * Keeps lookahead_ms TTIs scheduled and submitted to the encoder pool, then returns the subframe for sf_idx.
+ */
+int fleet_encode_subframe(void* arg, uint64_t sf_idx, cf_t* output)
+{
+  fleet_t* q = (fleet_t*)arg;
+
+  if (sf_idx < q->next_schedule_sf && q->ttis[sf_idx % q->nof_ttis].sf_idx != sf_idx) {
+    ERROR("Fleet subframes must be requested in order (sf_idx: %lu)\n", (unsigned long)sf_idx);
+    return SRSRAN_ERROR;
+  }
+
+  while (q->next_schedule_sf < sf_idx + q->nof_ttis) {
+    // Scheduling moves the vehicles on to their next reservation, so leave them on the wheel until the pool has room
+    if (!q->cfg.superposition && encoder_pool_in_flight(&q->encoder) >= q->encoder.window) {
+      ERROR("Fleet encoder pool window is full\n");
+      return SRSRAN_ERROR;
+    }
+    fleet_tti_t* tti = &q->ttis[q->next_schedule_sf % q->nof_ttis];
+    schedule_tti(q, tti, q->next_schedule_sf);
+    if (tti->busy && !q->cfg.superposition && encoder_pool_submit(&q->encoder, &tti->job)) {
+      ERROR("Error submitting fleet subframe %lu, dropping %d transmissions\n",
+            (unsigned long)tti->sf_idx,
+            tti->job.nof_grants);
+      q->stats.nof_dropped += tti->job.nof_grants;
+      q->report.nof_dropped += tti->job.nof_grants;
+      tti->busy = false;
+    }
+    q->next_schedule_sf++;
+  }
+
+  fleet_tti_t* tti = &q->ttis[sf_idx % q->nof_ttis];
+  int          ret = 0;
+  if (tti->busy && q->cfg.superposition) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = wf_compose_subframe(&q->compose, &tti->job.sf, tti->grants, tti->job.nof_grants, q->tb_len, output);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tti->job.encode_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    ret                  = (ret == SRSRAN_SUCCESS) ? 1 : SRSRAN_ERROR;
+  } else if (tti->busy) {
+    encoder_job_t* job = encoder_pool_collect(&q->encoder, true);
+    if (job != &tti->job || job->ret != SRSRAN_SUCCESS) {
+      ERROR("Error encoding fleet subframe %lu\n", (unsigned long)sf_idx);
+      ret = SRSRAN_ERROR;
+    } else {
+      srsran_vec_cf_copy(output, tti->output, q->sf_len);
+      ret = 1;
+    }
+  }
+  // Same level whichever way the subframe was built
+  if (ret == 1 && wf_compose_scale(output, q->sf_len, tti->job.nof_grants)) {
+    q->stats.nof_peak_limited++;
+    q->report.nof_peak_limited++;
+  }
+  account_tti(q, tti);
+
+  return ret;
+}
+
+void fleet_print_stats(fleet_t* q, FILE* f)
+{
+  fleet_stats_t* s = &q->stats;
+  fprintf(f,
+          "fleet: %lu tx in %lu busy TTIs, %lu dropped by the encoder pool, %lu collisions, %lu reselections, %lu TTIs "
+          "scaled below the backoff to avoid clipping\n",
+          (unsigned long)s->nof_tx,
+          (unsigned long)s->nof_busy_ttis,
+          (unsigned long)s->nof_dropped,
+          (unsigned long)s->nof_collisions,
+          (unsigned long)s->nof_reselections,
+          (unsigned long)s->nof_peak_limited);
+  fprintf(f,
+          "fleet: encode cost per TTI avg %.3f ms, max %.3f ms, %lu TTIs over the 1 ms budget\n",
+          s->nof_busy_ttis ? s->encode_time_sum / s->nof_busy_ttis * 1e3 : 0.0,
+          s->encode_time_max * 1e3,
+          (unsigned long)s->nof_over_budget);
+  if (q->cfg.superposition) {
+    wf_compose_print_stats(&q->compose, f);
+  } else {
+    encoder_pool_print_stats(&q->encoder, f);
+  }
+}
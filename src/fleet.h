@@ -0,0 +1,118 @@
+/******************************************************************************
+ *  File:         fleet.h
+ *
+ *  Description:  Virtual fleet emulator.
+ *
+ *                Emulates N Mode 4 UEs from one process. Every vehicle has its
+ *                own reservation interval, sub channel, reselection counter
+ *                and payload. A timing wheel finds the vehicles due in each
+ *                TTI, their grants are composed into one subframe with
+ *                srsran_ue_sl_encode_multi() and encoded ahead of time on an
+ *                encoder pool, or summed from cached single-grant waveforms
+ *                (wf_compose.h). Either way the subframe is scaled with
+ *                wf_compose_scale().
+ *
+ *  Reference:    3GPP TS 36.321 Section 5.14.1.1 (SL_RESOURCE_RESELECTION_COUNTER)
+ *****************************************************************************/
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "encoder_pool.h"
+#include "ue_sl.h"
+#include "wf_compose.h"
+
+#define FLEET_MAX_RESERV_INTVLS (12)
+#define FLEET_WHEEL_SIZE (1024) // must exceed the largest reservation interval (1000 ms)
+#define FLEET_REPORT_INTERVAL_MS (1000)
+
+typedef enum {
+  FLEET_PAYLOAD_STATIC = 0, // same TB on every transmission of a vehicle
+  FLEET_PAYLOAD_COUNTER,    // TB changes with every transmission, like a BSM
+} fleet_payload_t;
+
+typedef struct {
+  uint32_t        nof_vehicles;
+  uint32_t        reserv_intvls_ms[FLEET_MAX_RESERV_INTVLS]; // each vehicle picks one at random
+  uint32_t        nof_reserv_intvls;
+  uint32_t        l_sub_channel;
+  uint32_t        mcs_idx;
+  uint32_t        priority;
+  float           prob_resource_keep;
+  fleet_payload_t payload;
+  uint32_t        nof_workers;
+  uint32_t        lookahead_ms; // how many TTIs are scheduled and encoded ahead
+  uint32_t        seed;
+  bool            superposition; // sum cached single-grant waveforms instead of encoding on the pool
+  size_t          cache_bytes;   // waveform cache budget for superposition, unused with a counter payload
+} fleet_cfg_t;
+
+typedef struct fleet_vehicle_s {
+  uint32_t id;
+  uint32_t reserv_intvl_ms;
+  uint32_t sub_channel_start_idx;
+  uint64_t next_tx_sf;
+  uint32_t reselection_counter;
+  uint32_t nof_tx;
+
+  struct fleet_vehicle_s* wheel_next;
+} fleet_vehicle_t;
+
+typedef struct {
+  uint64_t             sf_idx;
+  bool                 busy;
+  encoder_job_t        job;
+  srsran_ue_sl_grant_t grants[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  uint8_t*             tbs; // num_sub_channel * tb_len bits
+  cf_t*                output;
+} fleet_tti_t;
+
+typedef struct {
+  uint64_t nof_tx;
+  uint64_t nof_dropped; // scheduled, but the encoder pool did not take the subframe
+  uint64_t nof_collisions;
+  uint64_t nof_reselections;
+  uint64_t nof_busy_ttis;
+  uint64_t nof_peak_limited; // TTIs scaled below the backoff for their number of grants, see wf_compose_scale()
+  uint64_t nof_over_budget; // TTIs whose encode took longer than 1 ms
+  double   encode_time_sum;
+  double   encode_time_max;
+} fleet_stats_t;
+
+typedef struct {
+  fleet_cfg_t                    cfg;
+  srsran_sl_comm_resource_pool_t sl_comm_resource_pool;
+  uint32_t                       sf_len;
+  uint32_t                       tb_len;
+
+  fleet_vehicle_t* vehicles;
+  fleet_vehicle_t* wheel[FLEET_WHEEL_SIZE];
+
+  encoder_pool_t encoder; // used unless cfg.superposition
+  wf_compose_t   compose; // used if cfg.superposition
+  fleet_tti_t*   ttis;
+  uint32_t       nof_ttis;
+  uint64_t       next_schedule_sf;
+
+  uint32_t rng;
+
+  fleet_stats_t stats;
+  fleet_stats_t report; // reset every FLEET_REPORT_INTERVAL_MS
+} fleet_t;
+
+void fleet_cfg_default(fleet_cfg_t* cfg);
+
+int fleet_parse_intvls(fleet_cfg_t* cfg, const char* list);
+
+int fleet_init(fleet_t* q, srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t sl_comm_resource_pool, fleet_cfg_t* cfg);
+
+void fleet_free(fleet_t* q);
+
+int fleet_encode_subframe(void* arg, uint64_t sf_idx, cf_t* output);
+
+void fleet_print_stats(fleet_t* q, FILE* f);
+
+#endif // FLEET_H
@@ -0,0 +1,481 @@
+/******************************************************************************
+ *  File:         latency_stats.c
+ *
+ *  Description:  Always-on per-stage latency histograms (see latency_stats.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "latency_stats.h"
+}
+
+#define LATENCY_CALIBRATION_NS (20000000) // 20 ms
+#define LATENCY_UNIX_PREFIX "unix:"
+
+static const char* stage_names[LATENCY_NOF_STAGES] =
+    {"pscch_encode", "pssch_encode", "ofdm_tx", "tx_copy", "tx_slack", "ingest_queue", "ingest_to_air"};
+static const char* event_names[LATENCY_NOF_EVENTS] = {"late", "reset"};
+
+typedef struct {
+  latency_hist_t stages[LATENCY_NOF_STAGES];
+} latency_thread_t;
+
+static latency_thread_t*           threads[LATENCY_MAX_THREADS];
+static uint32_t                    nof_threads;
+static latency_thread_t            shared; // for threads past LATENCY_MAX_THREADS
+static uint64_t                    events[LATENCY_NOF_EVENTS];
+static __thread latency_thread_t*  local;
+static double                      ticks_per_ns = 1.0;
+static pthread_once_t              calibrated   = PTHREAD_ONCE_INIT;
+
+static uint64_t monotonic_ns()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns0    = monotonic_ns();
+  uint64_t ticks0 = latency_now();
+  struct timespec d = {0, LATENCY_CALIBRATION_NS};
+  nanosleep(&d, NULL);
+  uint64_t ns1    = monotonic_ns();
+  uint64_t ticks1 = latency_now();
+  ticks_per_ns    = (double)(ticks1 - ticks0) / (double)(ns1 - ns0);
+#endif
+}
+
+/**
+ * Measure the TSC rate. Called lazily otherwise, so call it at startup to keep the ~20 ms out of the TX path.
+ */
+void latency_stats_init()
+{
+  pthread_once(&calibrated, calibrate);
+}
+
+static uint32_t bucket_of(uint64_t v)
+{
+  if (v < LATENCY_SUB_BUCKETS) {
+    return (uint32_t)v;
+  }
+  uint32_t e   = 63 - __builtin_clzll(v); // >= 3
+  uint32_t sub = (uint32_t)(v >> (e - 3)) & (LATENCY_SUB_BUCKETS - 1);
+  return SRSRAN_MIN((e - 2) * LATENCY_SUB_BUCKETS + sub, LATENCY_NOF_BUCKETS - 1);
+}
+
+static uint64_t bucket_lower(uint32_t idx)
+{
+  if (idx < LATENCY_SUB_BUCKETS) {
+    return idx;
+  }
+  uint32_t e = idx / LATENCY_SUB_BUCKETS + 2;
+  return (uint64_t)(LATENCY_SUB_BUCKETS + idx % LATENCY_SUB_BUCKETS) << (e - 3);
+}
+
+static latency_thread_t* register_thread()
+{
+  latency_thread_t* t = NULL;
+  if (__atomic_load_n(&nof_threads, __ATOMIC_RELAXED) < LATENCY_MAX_THREADS &&
+      posix_memalign((void**)&t, 64, sizeof(latency_thread_t)) == 0) {
+    bzero(t, sizeof(latency_thread_t));
+    uint32_t idx = __atomic_fetch_add(&nof_threads, 1, __ATOMIC_RELAXED);
+    if (idx < LATENCY_MAX_THREADS) {
+      __atomic_store_n(&threads[idx], t, __ATOMIC_RELEASE);
+      return t;
+    }
+    free(t);
+  }
+  return &shared;
+}
+
+static void record_ticks(latency_stage_t stage, uint64_t ticks)
+{
+  if (local == NULL) {
+    local = register_thread();
+  }
+  latency_hist_t* h = &local->stages[stage];
+  uint32_t        b = bucket_of(ticks);
+
+  if (local == &shared) {
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&h->max, &max, ticks, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return;
+  }
+
+  // Only this thread writes its histograms, so plain increments are enough; the atomic stores just keep readers from
+  // seeing torn values
+  __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum, h->sum + ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->buckets[b], h->buckets[b] + 1, __ATOMIC_RELAXED);
+  if (ticks > h->max) {
+    __atomic_store_n(&h->max, ticks, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Record the time from start (a latency_now() value) until now.
+ */
+void latency_record(latency_stage_t stage, uint64_t start)
+{
+  uint64_t now = latency_now();
+  record_ticks(stage, now > start ? now - start : 0);
+}
+
+/**
+ * Record a duration measured by other means, e.g. against the radio clock. Negative values count as 0.
+ */
+void latency_record_s(latency_stage_t stage, double seconds)
+{
+  latency_stats_init();
+  record_ticks(stage, seconds > 0.0 ? (uint64_t)(seconds * 1e9 * ticks_per_ns) : 0);
+}
+
+void latency_count(latency_event_t event)
+{
+  __atomic_fetch_add(&events[event], 1, __ATOMIC_RELAXED);
+}
+
+static void merge(latency_hist_t* dst, const latency_hist_t* src)
+{
+  dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+  dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+  dst->max = SRSRAN_MAX(dst->max, __atomic_load_n(&src->max, __ATOMIC_RELAXED));
+  for (uint32_t b = 0; b < LATENCY_NOF_BUCKETS; b++) {
+    dst->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Merge the histograms of every thread. Safe to call while other threads record.
+ */
+void latency_snapshot(latency_snapshot_t* s)
+{
+  latency_stats_init();
+  bzero(s, sizeof(latency_snapshot_t));
+
+  uint32_t n = SRSRAN_MIN(__atomic_load_n(&nof_threads, __ATOMIC_RELAXED), LATENCY_MAX_THREADS);
+  for (uint32_t i = 0; i < n; i++) {
+    latency_thread_t* t = __atomic_load_n(&threads[i], __ATOMIC_ACQUIRE);
+    if (t == NULL) {
+      continue; // registered but not published yet
+    }
+    for (uint32_t k = 0; k < LATENCY_NOF_STAGES; k++) {
+      merge(&s->stages[k], &t->stages[k]);
+    }
+    s->nof_threads++;
+  }
+  for (uint32_t k = 0; k < LATENCY_NOF_STAGES; k++) {
+    merge(&s->stages[k], &shared.stages[k]);
+  }
+  for (uint32_t k = 0; k < LATENCY_NOF_EVENTS; k++) {
+    s->events[k] = __atomic_load_n(&events[k], __ATOMIC_RELAXED);
+  }
+  s->ticks_per_ns = ticks_per_ns;
+}
+
+/**
+ * @return the p-quantile in us, the middle of the bucket it falls in
+ */
+static double percentile_us(const latency_snapshot_t* s, const latency_hist_t* h, double p)
+{
+  if (h->count == 0) {
+    return 0.0;
+  }
+  uint64_t rank = (uint64_t)(p * (h->count - 1)) + 1;
+  uint64_t seen = 0;
+  uint32_t b    = 0;
+  for (; b < LATENCY_NOF_BUCKETS - 1; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  double ticks = 0.5 * (bucket_lower(b) + bucket_lower(b + 1));
+  return SRSRAN_MIN(ticks, (double)h->max) / s->ticks_per_ns * 1e-3;
+}
+
+static double ticks_to_us(const latency_snapshot_t* s, double ticks)
+{
+  return ticks / s->ticks_per_ns * 1e-3;
+}
+
+static void export_text(FILE* f, const latency_snapshot_t* s)
+{
+  fprintf(f,
+          "latency: %-13s %10s %10s %10s %10s %10s %10s (us, %u threads)\n",
+          "stage",
+          "count",
+          "mean",
+          "p50",
+          "p99",
+          "p99.9",
+          "max",
+          s->nof_threads);
+  for (uint32_t k = 0; k < LATENCY_NOF_STAGES; k++) {
+    const latency_hist_t* h = &s->stages[k];
+    fprintf(f,
+            "latency: %-13s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            stage_names[k],
+            (unsigned long)h->count,
+            h->count ? ticks_to_us(s, (double)h->sum / h->count) : 0.0,
+            percentile_us(s, h, 0.5),
+            percentile_us(s, h, 0.99),
+            percentile_us(s, h, 0.999),
+            ticks_to_us(s, (double)h->max));
+  }
+  fprintf(f,
+          "latency: %lu late, %lu resets\n",
+          (unsigned long)s->events[LATENCY_EVENT_LATE],
+          (unsigned long)s->events[LATENCY_EVENT_RESET]);
+}
+
+static void export_json(FILE* f, const latency_snapshot_t* s)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  fprintf(f, "{\"time\":%.3f,\"threads\":%u,\"stages\":{", now.tv_sec + now.tv_nsec * 1e-9, s->nof_threads);
+  for (uint32_t k = 0; k < LATENCY_NOF_STAGES; k++) {
+    const latency_hist_t* h = &s->stages[k];
+    fprintf(f,
+            "%s\"%s\":{\"count\":%lu,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+            "\"max_us\":%.3f}",
+            k ? "," : "",
+            stage_names[k],
+            (unsigned long)h->count,
+            h->count ? ticks_to_us(s, (double)h->sum / h->count) : 0.0,
+            percentile_us(s, h, 0.5),
+            percentile_us(s, h, 0.9),
+            percentile_us(s, h, 0.99),
+            percentile_us(s, h, 0.999),
+            ticks_to_us(s, (double)h->max));
+  }
+  fprintf(f, "},\"events\":{");
+  for (uint32_t k = 0; k < LATENCY_NOF_EVENTS; k++) {
+    fprintf(f, "%s\"%s\":%lu", k ? "," : "", event_names[k], (unsigned long)s->events[k]);
+  }
+  fprintf(f, "}}\n");
+}
+
+/**
+ * Write a snapshot, as a text table or as one line of JSON.
+ */
+void latency_stats_export(FILE* f, bool json)
+{
+  latency_snapshot_t* s = (latency_snapshot_t*)malloc(sizeof(latency_snapshot_t));
+  if (!s) {
+    perror("malloc");
+    return;
+  }
+  latency_snapshot(s);
+  if (json) {
+    export_json(f, s);
+  } else {
+    export_text(f, s);
+  }
+  free(s);
+}
+
+void latency_stats_print(FILE* f)
+{
+  latency_stats_export(f, false);
+}
+
+// === Reporter ===
+
+static struct {
+  pthread_t       thread;
+  bool            started;
+  bool            running;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+
+  char*  path;
+  bool   unix_socket;
+  int    fd;
+  bool   json;
+  double period_s;
+
+  uint64_t nof_reports;
+  uint64_t nof_errors;
+} reporter = {.thread      = 0,
+               .started     = false,
+               .running     = false,
+               .mutex       = PTHREAD_MUTEX_INITIALIZER,
+               .cond        = PTHREAD_COND_INITIALIZER,
+               .path        = NULL,
+               .unix_socket = false,
+               .fd          = -1,
+               .json        = false,
+               .period_s    = 0,
+               .nof_reports = 0,
+               .nof_errors  = 0};
+
+static int report()
+{
+  if (!reporter.unix_socket) {
+    FILE* f = fopen(reporter.path, "a");
+    if (f == NULL) {
+      return SRSRAN_ERROR;
+    }
+    latency_stats_export(f, reporter.json);
+    return fclose(f) == 0 ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+  }
+
+  // One datagram per snapshot; dropped (and counted) if nobody is listening
+  char*  buf = NULL;
+  size_t len = 0;
+  FILE*  f   = open_memstream(&buf, &len);
+  if (f == NULL) {
+    return SRSRAN_ERROR;
+  }
+  latency_stats_export(f, reporter.json);
+  fclose(f);
+
+  struct sockaddr_un addr;
+  bzero(&addr, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, reporter.path, sizeof(addr.sun_path) - 1);
+  ssize_t n = sendto(reporter.fd, buf, len, MSG_DONTWAIT, (struct sockaddr*)&addr, sizeof(addr));
+  free(buf);
+  return n == (ssize_t)len ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+}
+
+static void* reporter_run(void* arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&reporter.mutex);
+  while (reporter.running) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns       = deadline.tv_nsec + (uint64_t)(reporter.period_s * 1e9);
+    deadline.tv_sec  += ns / 1000000000ull;
+    deadline.tv_nsec  = ns % 1000000000ull;
+    while (reporter.running && pthread_cond_timedwait(&reporter.cond, &reporter.mutex, &deadline) == 0) {
+    }
+    if (!reporter.running) {
+      break;
+    }
+
+    pthread_mutex_unlock(&reporter.mutex);
+    if (report()) {
+      reporter.nof_errors++;
+    } else {
+      reporter.nof_reports++;
+    }
+    pthread_mutex_lock(&reporter.mutex);
+  }
+  pthread_mutex_unlock(&reporter.mutex);
+  return NULL;
+}
+
+/**
+ * Export a snapshot every period_s seconds from a background thread.
+ *
+ * @param dest file to append to, or "unix:/path" for a Unix datagram socket
+ */
+int latency_reporter_start(const char* dest, double period_s, bool json)
+{
+  if (dest == NULL || period_s <= 0.0 || reporter.started) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+  latency_stats_init();
+
+  reporter.unix_socket = strncmp(dest, LATENCY_UNIX_PREFIX, strlen(LATENCY_UNIX_PREFIX)) == 0;
+  reporter.path        = strdup(reporter.unix_socket ? dest + strlen(LATENCY_UNIX_PREFIX) : dest);
+  reporter.json        = json;
+  reporter.period_s    = period_s;
+  if (reporter.path == NULL) {
+    perror("strdup");
+    return SRSRAN_ERROR;
+  }
+  if (reporter.unix_socket) {
+    reporter.fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (reporter.fd < 0) {
+      perror("socket");
+      latency_reporter_stop();
+      return SRSRAN_ERROR;
+    }
+  }
+
+  reporter.running = true;
+  if (pthread_create(&reporter.thread, NULL, reporter_run, NULL)) {
+    perror("pthread_create");
+    reporter.running = false;
+    latency_reporter_stop();
+    return SRSRAN_ERROR;
+  }
+  reporter.started = true;
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Stop the reporter after one last export.
+ */
+void latency_reporter_stop()
+{
+  if (reporter.started) {
+    pthread_mutex_lock(&reporter.mutex);
+    reporter.running = false;
+    pthread_cond_signal(&reporter.cond);
+    pthread_mutex_unlock(&reporter.mutex);
+    pthread_join(reporter.thread, NULL);
+    reporter.started = false;
+
+    if (report()) {
+      reporter.nof_errors++;
+    } else {
+      reporter.nof_reports++;
+    }
+    printf("latency: %lu reports written to %s%s, %lu failed\n",
+           (unsigned long)reporter.nof_reports,
+           reporter.unix_socket ? LATENCY_UNIX_PREFIX : "",
+           reporter.path,
+           (unsigned long)reporter.nof_errors);
+  }
+  if (reporter.fd >= 0) {
+    close(reporter.fd);
+    reporter.fd = -1;
+  }
+  if (reporter.path) {
+    free(reporter.path);
+    reporter.path = NULL;
+  }
+}
+
+/**
+ * Release the per-thread histograms. Only call once every recording thread has exited.
+ */
+void latency_stats_free()
+{
+  latency_reporter_stop();
+  uint32_t n = SRSRAN_MIN(nof_threads, LATENCY_MAX_THREADS);
+  for (uint32_t i = 0; i < n; i++) {
+    if (threads[i]) {
+      free(threads[i]);
+      threads[i] = NULL;
+    }
+  }
+  nof_threads = 0;
+  local       = NULL;
+  bzero(&shared, sizeof(shared));
+  bzero(events, sizeof(events));
+}
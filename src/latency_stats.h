@@ -0,0 +1,105 @@
+/******************************************************************************
+ *  File:         latency_stats.h
+ *
+ *  Description:  Always-on per-stage latency histograms.
+ *
+ *                Every thread that records gets its own histogram set on
+ *                first use, so recording is a TSC read and a few plain
+ *                stores with no lock and no shared cache line. Readers merge
+ *                the per-thread histograms on demand; a snapshot taken while
+ *                threads record may be off by the samples in flight.
+ *
+ *                Buckets are log-linear (8 per power of two, in TSC ticks),
+ *                so percentiles are within 12.5 % of the true value. Ticks
+ *                are converted to time only when exporting.
+ *
+ *                A reporter thread can write a snapshot periodically, as
+ *                text or JSON, to a file (appended) or to a Unix datagram
+ *                socket ("unix:/path").
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LATENCY_MAX_THREADS (64) // threads past this share one histogram set, updated atomically
+#define LATENCY_SUB_BUCKETS (8)  // per power of two
+#define LATENCY_NOF_BUCKETS (LATENCY_SUB_BUCKETS * 48)
+#define LATENCY_DEFAULT_REPORT_PERIOD_S (10.0)
+
+typedef enum {
+  LATENCY_PSCCH_ENCODE = 0,
+  LATENCY_PSSCH_ENCODE,
+  LATENCY_OFDM_TX,
+  LATENCY_TX_COPY,  // copy of a finished subframe out of ue->signal_buffer_tx or the waveform cache
+  LATENCY_TX_SLACK, // how far ahead of its air time a subframe or window was handed to the radio
+  LATENCY_INGEST_QUEUE,  // ingested message arrival -> encoded
+  LATENCY_INGEST_TO_AIR, // ingested message arrival -> air time
+  LATENCY_NOF_STAGES
+} latency_stage_t;
+
+typedef enum {
+  LATENCY_EVENT_LATE = 0, // subframes or windows dropped because their air time had passed
+  LATENCY_EVENT_RESET,    // TX timeline restarted at a new start time
+  LATENCY_NOF_EVENTS
+} latency_event_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[LATENCY_NOF_BUCKETS];
+} latency_hist_t;
+
+typedef struct {
+  latency_hist_t stages[LATENCY_NOF_STAGES];
+  uint64_t       events[LATENCY_NOF_EVENTS];
+  uint32_t       nof_threads;
+  double         ticks_per_ns;
+} latency_snapshot_t;
+
+/**
+ * Current time in TSC ticks (or ns where there is no TSC).
+ */
+static inline uint64_t latency_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+void latency_stats_init();
+
+void latency_record(latency_stage_t stage, uint64_t start);
+
+void latency_record_s(latency_stage_t stage, double seconds);
+
+void latency_count(latency_event_t event);
+
+void latency_snapshot(latency_snapshot_t* s);
+
+void latency_stats_export(FILE* f, bool json);
+
+void latency_stats_print(FILE* f);
+
+int latency_reporter_start(const char* dest, double period_s, bool json);
+
+void latency_reporter_stop();
+
+void latency_stats_free();
+
+#endif // LATENCY_STATS_H
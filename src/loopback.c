@@ -0,0 +1,235 @@
+/******************************************************************************
+ *  File:         loopback.c
+ *
+ *  Description:  Encode->decode loopback harness (see loopback.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+#include <time.h>
+
+#include "loopback.h"
+}
+
+static double elapsed(struct timespec* start, struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int loopback_init(loopback_t* q, srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t sl_comm_resource_pool)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(loopback_t));
+
+    // RX objects built up front, so the first timed decode doesn't include them
+    if (srsran_ue_sl_init(&q->ue, cell, sl_comm_resource_pool, 1) || srsran_ue_sl_init_rx(&q->ue)) {
+      ERROR("Error initializing loopback UE\n");
+      goto clean_exit;
+    }
+
+    for (uint32_t i = 0; i < sl_comm_resource_pool.num_sub_channel; i++) {
+      q->res.data[i] = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+      if (!q->res.data[i]) {
+        perror("malloc");
+        goto clean_exit;
+      }
+    }
+
+    ret = SRSRAN_SUCCESS;
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    loopback_free(q);
+  }
+  return ret;
+}
+
+void loopback_free(loopback_t* q)
+{
+  if (q) {
+    srsran_ue_sl_free(&q->ue);
+    for (uint32_t i = 0; i < SRSRAN_MAX_NUM_SUB_CHANNEL; i++) {
+      if (q->res.data[i]) {
+        free(q->res.data[i]);
+      }
+    }
+    bzero(q, sizeof(loopback_t));
+  }
+}
+
+static bool sci_matches(srsran_sci_t* tx, uint32_t riv, srsran_sci_t* rx)
+{
+  // The RX path reports the reservation as an interval in ms, the TX side keeps the SCI field value
+  return rx->priority == tx->priority && rx->resource_reserv == srsran_intvl_from_reserv(tx->resource_reserv) &&
+         rx->time_gap == tx->time_gap && rx->retransmission == tx->retransmission &&
+         rx->transmission_format == tx->transmission_format && rx->mcs_idx == tx->mcs_idx && rx->riv == riv;
+}
+
+/**
+ * Check the decode result of one grant and count it in s.
+ */
+static int check_grant(loopback_t* q, loopback_stats_t* s, int decoded, srsran_sci_t* sci, srsran_pssch_data_t* data)
+{
+  uint32_t subch = data->sub_channel_start_idx;
+  uint32_t riv   = srsran_ra_sl_type0_to_riv(q->ue.sl_comm_resource_pool.num_sub_channel, subch, data->l_sub_channel);
+
+  s->nof_grants++;
+  if (decoded != SRSRAN_SUCCESS) {
+    s->nof_not_decoded++;
+    return SRSRAN_ERROR;
+  }
+  if (!sci_matches(sci, riv, &q->res.sci[subch])) {
+    s->nof_sci_errors++;
+    return SRSRAN_ERROR;
+  }
+  // All grants of a subframe use the same allocation size and MCS, hence the same TB length
+  if (memcmp(q->res.data[subch], data->ptr, q->ue.pssch_tx.sl_sch_tb_len) != 0) {
+    s->nof_tb_errors++;
+    return SRSRAN_ERROR;
+  }
+  s->nof_ok++;
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Encode one grant, decode the whole subframe from the UE's own TX buffer like a receiver that doesn't know
+ * where the grant is, and compare. Every other sub channel must come back empty.
+ *
+ * @param sci SCI to send (format and srsran_set_sci() fields)
+ * @param data TB bits and allocation; the TB is decoded from data->sub_channel_start_idx
+ * @return SRSRAN_SUCCESS if SCI and TB came back unchanged, SRSRAN_ERROR otherwise
+ */
+int loopback_run(loopback_t* q, decoder_pool_t* decoder, srsran_sl_sf_cfg_t* sf, srsran_sci_t* sci, srsran_pssch_data_t* data)
+{
+  if (q == NULL || decoder == NULL || sf == NULL || sci == NULL || data == NULL ||
+      data->sub_channel_start_idx >= q->ue.sl_comm_resource_pool.num_sub_channel) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  uint32_t        subch = data->sub_channel_start_idx;
+  struct timespec t0, t1, t2;
+
+  q->stats.nof_subframes++;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  srsran_ue_sl_copy_sci(&q->ue.sci_tx, sci);
+  if (srsran_ue_sl_encode(&q->ue, sf, data)) {
+    ERROR("Error encoding loopback subframe\n");
+    return SRSRAN_ERROR;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  srsran_vec_cf_copy(q->ue.signal_buffer_rx[0], q->ue.signal_buffer_tx, q->ue.sf_len);
+  bzero(q->res.sci, sizeof(q->res.sci));
+  decoder_pool_decode(decoder, &q->ue, sf, &q->res);
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  q->stats.encode_time += elapsed(&t0, &t1);
+  q->stats.decode_time += elapsed(&t1, &t2);
+
+  int ret = check_grant(q, &q->stats, decoder->subch_ret[subch], sci, data);
+  for (uint32_t i = 0; i < q->ue.sl_comm_resource_pool.num_sub_channel; i++) {
+    if (i != subch && decoder->subch_ret[i] == SRSRAN_SUCCESS) {
+      q->stats.nof_false_detections++;
+      ret = SRSRAN_ERROR;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Encode several grants into one subframe with srsran_ue_sl_encode_multi(), decode all sub channels on the
+ * decoder pool and check every grant.
+ *
+ * @param grants grants on disjoint sub channels, all with the same l_sub_channel and mcs_idx
+ * @return SRSRAN_SUCCESS if every grant came back intact
+ */
+int loopback_run_loaded(loopback_t*           q,
+                        decoder_pool_t*       decoder,
+                        srsran_sl_sf_cfg_t*   sf,
+                        srsran_ue_sl_grant_t* grants,
+                        uint32_t              nof_grants)
+{
+  if (q == NULL || decoder == NULL || sf == NULL || grants == NULL) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  struct timespec t0, t1, t2;
+  loopback_stats_t* s = &q->loaded_stats;
+
+  s->nof_subframes++;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (srsran_ue_sl_encode_multi(&q->ue, sf, grants, nof_grants)) {
+    ERROR("Error encoding loaded loopback subframe\n");
+    return SRSRAN_ERROR;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  srsran_vec_cf_copy(q->ue.signal_buffer_rx[0], q->ue.signal_buffer_tx, q->ue.sf_len);
+  bzero(q->res.sci, sizeof(q->res.sci));
+  decoder_pool_decode(decoder, &q->ue, sf, &q->res);
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  s->encode_time += elapsed(&t0, &t1);
+  s->decode_time += elapsed(&t1, &t2);
+
+  int ret = SRSRAN_SUCCESS;
+  for (uint32_t i = 0; i < nof_grants; i++) {
+    int decoded = decoder->subch_ret[grants[i].data.sub_channel_start_idx];
+    if (check_grant(q, s, decoded, &grants[i].sci, &grants[i].data)) {
+      ret = SRSRAN_ERROR;
+    }
+  }
+  return ret;
+}
+
+static void print_stats(loopback_stats_t* s, const char* name, FILE* f)
+{
+  if (s->nof_subframes == 0) {
+    return;
+  }
+  fprintf(f,
+          "loopback (%s): %lu subframes, %lu grants, %lu ok, %lu not decoded, %lu SCI mismatches, %lu TB mismatches, "
+          "%lu false detections\n",
+          name,
+          (unsigned long)s->nof_subframes,
+          (unsigned long)s->nof_grants,
+          (unsigned long)s->nof_ok,
+          (unsigned long)s->nof_not_decoded,
+          (unsigned long)s->nof_sci_errors,
+          (unsigned long)s->nof_tb_errors,
+          (unsigned long)s->nof_false_detections);
+  fprintf(f,
+          "loopback (%s): encode %.1f subframes/s (%.3f ms avg), decode %.1f subframes/s (%.3f ms avg)\n",
+          name,
+          s->encode_time > 0 ? s->nof_subframes / s->encode_time : 0.0,
+          s->encode_time / s->nof_subframes * 1e3,
+          s->decode_time > 0 ? s->nof_subframes / s->decode_time : 0.0,
+          s->decode_time / s->nof_subframes * 1e3);
+}
+
+void loopback_print_stats(loopback_t* q, FILE* f)
+{
+  print_stats(&q->stats, "single grant", f);
+  print_stats(&q->loaded_stats, "fully loaded", f);
+
+  srsran_ue_sl_rx_stats_t rx;
+  srsran_ue_sl_get_rx_stats(&q->ue, &rx);
+  fprintf(f,
+          "loopback: %lu sub channel searches, %lu skipped as idle, %lu cyclic shifts tried, %lu pruned, "
+          "%lu PSCCH / %lu PSSCH decoded\n",
+          (unsigned long)rx.nof_searches,
+          (unsigned long)rx.nof_gated,
+          (unsigned long)rx.nof_shifts_tried,
+          (unsigned long)rx.nof_shifts_pruned,
+          (unsigned long)rx.nof_pscch_decoded,
+          (unsigned long)rx.nof_pssch_decoded);
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+ *  File:         loopback.h
+ *
+ *  Description:  Encode->decode loopback harness.
+ *
+ *                Encodes a grant, copies the transmitted subframe straight into
+ *                the RX buffer of the same UE, runs the existing RX path
+ *                (srsran_ue_sl_decode_fft_estimate() and
+ *                srsran_ue_sl_decode_subch() on every sub channel) on it and
+ *                checks the decoded SCI fields and TB bits against the input. Checks the TX path for
+ *                correctness and measures encode/decode speed without radios.
+ *                Fully loaded subframes (one grant per sub channel) can be
+ *                decoded on a decoder pool to check the parallel RX path.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decoder_pool.h"
+#include "ue_sl.h"
+
+typedef struct {
+  uint64_t nof_subframes;
+  uint64_t nof_grants;
+  uint64_t nof_ok;               // grants that came back intact
+  uint64_t nof_not_decoded;      // neither PSCCH nor PSSCH decoded on the grant's sub channel
+  uint64_t nof_sci_errors;       // decoded SCI differs from the one sent
+  uint64_t nof_tb_errors;        // decoded TB differs from the one sent
+  uint64_t nof_false_detections; // TBs decoded on sub channels nothing was sent on
+  double   encode_time;
+  double   decode_time;
+} loopback_stats_t;
+
+typedef struct {
+  srsran_ue_sl_t     ue; // one RX antenna, looped back from its own TX buffer
+  srsran_ue_sl_res_t res;
+
+  loopback_stats_t stats;        // single grant subframes
+  loopback_stats_t loaded_stats; // multi grant subframes
+} loopback_t;
+
+int loopback_init(loopback_t* q, srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t sl_comm_resource_pool);
+
+void loopback_free(loopback_t* q);
+
+int loopback_run(loopback_t* q, decoder_pool_t* decoder, srsran_sl_sf_cfg_t* sf, srsran_sci_t* sci, srsran_pssch_data_t* data);
+
+int loopback_run_loaded(loopback_t*           q,
+                        decoder_pool_t*       decoder,
+                        srsran_sl_sf_cfg_t*   sf,
+                        srsran_ue_sl_grant_t* grants,
+                        uint32_t              nof_grants);
+
+void loopback_print_stats(loopback_t* q, FILE* f);
+
+#endif // LOOPBACK_H
@@ -0,0 +1,482 @@
+/******************************************************************************
+ *  File:         msg_ingest.c
+ *
+ *  Description:  Live message ingest over a local socket (see msg_ingest.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "latency_stats.h"
+#include "msg_ingest.h"
+#include "tx_pipeline.h"
+}
+
+#define MSG_INGEST_POLL_MS (100)      // how often the receive thread checks for a stop
+#define MSG_INGEST_NO_TIMELINE_S (1e-3) // encoder poll period until the TX side publishes its timeline
+#define MSG_INGEST_UNIX_PREFIX "unix:"
+#define MSG_INGEST_UDP_PREFIX "udp:"
+
+static int open_unix(msg_ingest_t* q, const char* path)
+{
+  struct sockaddr_un addr;
+  bzero(&addr, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    ERROR("Socket path too long: %s\n", path);
+    return SRSRAN_ERROR;
+  }
+  strcpy(addr.sun_path, path);
+
+  q->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (q->fd < 0) {
+    perror("socket");
+    return SRSRAN_ERROR;
+  }
+  unlink(path); // left over from a previous run
+  if (bind(q->fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    perror("bind");
+    return SRSRAN_ERROR;
+  }
+  q->unix_path = strdup(path);
+  return SRSRAN_SUCCESS;
+}
+
+static int open_udp(msg_ingest_t* q, const char* port)
+{
+  struct sockaddr_in addr;
+  bzero(&addr, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons((uint16_t)strtoul(port, NULL, 10));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local applications only
+
+  q->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (q->fd < 0) {
+    perror("socket");
+    return SRSRAN_ERROR;
+  }
+  if (bind(q->fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    perror("bind");
+    return SRSRAN_ERROR;
+  }
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * @param endpoint "unix:/path" or "udp:port" (bound to 127.0.0.1)
+ * @param max_len largest payload in bytes, i.e. what fits in one TB; longer datagrams are dropped
+ * @param log_file_name CSV file for one line per message, or NULL
+ */
+int msg_ingest_init(msg_ingest_t* q, const char* endpoint, uint32_t max_len, const char* log_file_name)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && endpoint != NULL && max_len > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(msg_ingest_t));
+    q->fd      = -1;
+    q->max_len = SRSRAN_MIN(max_len, MSG_INGEST_MAX_PAYLOAD);
+    q->stats.air_latency_min = INFINITY;
+
+    pthread_mutex_init(&q->wait_mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->wait_cv, &attr);
+    pthread_condattr_destroy(&attr);
+
+    q->queue    = (msg_ingest_msg_t*)calloc(MSG_INGEST_QUEUE_DEPTH, sizeof(msg_ingest_msg_t));
+    q->inflight = (msg_ingest_record_t*)calloc(MSG_INGEST_INFLIGHT_DEPTH, sizeof(msg_ingest_record_t));
+    if (!q->queue || !q->inflight) {
+      perror("calloc");
+      goto clean_exit;
+    }
+
+    if (strncmp(endpoint, MSG_INGEST_UNIX_PREFIX, strlen(MSG_INGEST_UNIX_PREFIX)) == 0) {
+      if (open_unix(q, endpoint + strlen(MSG_INGEST_UNIX_PREFIX))) {
+        goto clean_exit;
+      }
+    } else if (strncmp(endpoint, MSG_INGEST_UDP_PREFIX, strlen(MSG_INGEST_UDP_PREFIX)) == 0) {
+      if (open_udp(q, endpoint + strlen(MSG_INGEST_UDP_PREFIX))) {
+        goto clean_exit;
+      }
+    } else {
+      ERROR("Unknown ingest endpoint %s, expected unix:/path or udp:port\n", endpoint);
+      goto clean_exit;
+    }
+
+    if (log_file_name) {
+      q->log = fopen(log_file_name, "w");
+      if (q->log == NULL) {
+        perror("fopen");
+        goto clean_exit;
+      }
+      fprintf(q->log, "id,len,sf_idx,arrival_s,encoded_s,air_s,latency_ms\n");
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    msg_ingest_free(q);
+  }
+  return ret;
+}
+
+static void* receive_run(void* arg)
+{
+  msg_ingest_t* q = (msg_ingest_t*)arg;
+  uint8_t       discard[MSG_INGEST_MAX_PAYLOAD];
+
+  while (__atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+    struct pollfd pfd = {q->fd, POLLIN, 0};
+    if (poll(&pfd, 1, MSG_INGEST_POLL_MS) <= 0) {
+      continue;
+    }
+
+    uint64_t          head = q->queue_head; // only this thread writes head
+    bool              full = head - __atomic_load_n(&q->queue_tail, __ATOMIC_ACQUIRE) >= MSG_INGEST_QUEUE_DEPTH;
+    msg_ingest_msg_t* msg  = &q->queue[head & (MSG_INGEST_QUEUE_DEPTH - 1)];
+
+    // MSG_TRUNC returns the full datagram length, so oversized messages are caught rather than cut
+    ssize_t n = recv(q->fd, full ? discard : msg->payload, MSG_INGEST_MAX_PAYLOAD, MSG_TRUNC);
+    if (n <= 0) {
+      continue;
+    }
+    double now = tx_pipeline_host_time();
+    q->stats.nof_received++;
+    if (full) {
+      q->stats.nof_queue_full++;
+      continue;
+    }
+    if ((uint32_t)n > q->max_len) {
+      q->stats.nof_too_long++;
+      continue;
+    }
+
+    msg->rec.id           = q->next_id++;
+    msg->rec.len          = (uint32_t)n;
+    msg->rec.arrival_time = now;
+    __atomic_store_n(&q->queue_head, head + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&q->wait_mutex);
+    pthread_cond_signal(&q->wait_cv);
+    pthread_mutex_unlock(&q->wait_mutex);
+  }
+  return NULL;
+}
+
+int msg_ingest_start(msg_ingest_t* q)
+{
+  q->running = true;
+  if (pthread_create(&q->thread, NULL, receive_run, q)) {
+    perror("pthread_create");
+    q->running = false;
+    return SRSRAN_ERROR;
+  }
+  q->thread_started = true;
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Stop receiving and release an encoder waiting in msg_ingest_next().
+ */
+void msg_ingest_stop(msg_ingest_t* q)
+{
+  pthread_mutex_lock(&q->wait_mutex);
+  __atomic_store_n(&q->running, false, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&q->wait_cv);
+  pthread_mutex_unlock(&q->wait_mutex);
+
+  if (q->thread_started) {
+    pthread_join(q->thread, NULL);
+    q->thread_started = false;
+  }
+}
+
+void msg_ingest_free(msg_ingest_t* q)
+{
+  if (q) {
+    msg_ingest_stop(q);
+    if (q->fd >= 0) {
+      close(q->fd);
+    }
+    if (q->unix_path) {
+      unlink(q->unix_path);
+      free(q->unix_path);
+    }
+    if (q->log) {
+      fclose(q->log);
+    }
+    if (q->queue) {
+      free(q->queue);
+    }
+    if (q->inflight) {
+      free(q->inflight);
+    }
+    pthread_cond_destroy(&q->wait_cv);
+    pthread_mutex_destroy(&q->wait_mutex);
+    bzero(q, sizeof(msg_ingest_t));
+    q->fd = -1;
+  }
+}
+
+/**
+ * Publish that subframe sf_idx goes on air at host time host_air_time. Called again whenever the TX side restarts its
+ * timeline.
+ */
+void msg_ingest_set_timeline(msg_ingest_t* q, double host_air_time, uint64_t sf_idx)
+{
+  int64_t ns = llround(host_air_time * 1e9) - (int64_t)sf_idx * 1000000;
+  __atomic_store_n(&q->timeline_ns, ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->timeline_valid, true, __ATOMIC_RELEASE);
+}
+
+static double air_time(msg_ingest_t* q, uint64_t sf_idx)
+{
+  return (__atomic_load_n(&q->timeline_ns, __ATOMIC_RELAXED) + (int64_t)sf_idx * 1000000) * 1e-9;
+}
+
+/**
+ * Message to send in subframe sf_idx (encoder thread). Waits for one to arrive until the subframe has to be encoded.
+ *
+ * @return the oldest queued message, to be passed to msg_ingest_encoded() once it is encoded; NULL if the subframe
+ *         stays idle
+ */
+msg_ingest_msg_t* msg_ingest_next(msg_ingest_t* q, uint64_t sf_idx)
+{
+  msg_ingest_msg_t* msg = NULL;
+
+  pthread_mutex_lock(&q->wait_mutex);
+  while (__atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+    double now  = tx_pipeline_host_time();
+    double wake = now + MSG_INGEST_NO_TIMELINE_S;
+    if (__atomic_load_n(&q->timeline_valid, __ATOMIC_ACQUIRE)) {
+      wake = air_time(q, sf_idx) - MSG_INGEST_ENCODE_LEAD_S;
+      if (now >= wake) {
+        break; // too late for this one, the message goes into the next subframe
+      }
+    }
+    uint64_t tail = q->queue_tail; // only this thread writes tail
+    if (__atomic_load_n(&q->queue_head, __ATOMIC_ACQUIRE) != tail) {
+      msg = &q->queue[tail & (MSG_INGEST_QUEUE_DEPTH - 1)];
+      break;
+    }
+    struct timespec ts;
+    ts.tv_sec  = (time_t)wake;
+    ts.tv_nsec = (long)((wake - ts.tv_sec) * 1e9);
+    pthread_cond_timedwait(&q->wait_cv, &q->wait_mutex, &ts);
+  }
+  pthread_mutex_unlock(&q->wait_mutex);
+  return msg;
+}
+
+/**
+ * The message returned by msg_ingest_next() is encoded into subframe sf_idx; take it off the queue.
+ */
+void msg_ingest_encoded(msg_ingest_t* q, msg_ingest_msg_t* msg, uint64_t sf_idx)
+{
+  msg->rec.sf_idx       = sf_idx;
+  msg->rec.encoded_time = tx_pipeline_host_time();
+
+  double t = msg->rec.encoded_time - msg->rec.arrival_time;
+  q->stats.nof_encoded++;
+  q->stats.queue_time_sum += t;
+  q->stats.queue_time_max = SRSRAN_MAX(q->stats.queue_time_max, t);
+  latency_record_s(LATENCY_INGEST_QUEUE, t);
+
+  uint64_t head = q->inflight_head; // only this thread writes head
+  if (head - __atomic_load_n(&q->inflight_tail, __ATOMIC_ACQUIRE) < MSG_INGEST_INFLIGHT_DEPTH) {
+    q->inflight[head & (MSG_INGEST_INFLIGHT_DEPTH - 1)] = msg->rec;
+    __atomic_store_n(&q->inflight_head, head + 1, __ATOMIC_RELEASE);
+  } else {
+    q->stats.nof_inflight_full++;
+  }
+
+  __atomic_store_n(&q->queue_tail, q->queue_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Subframes [first_sf_idx, first_sf_idx + nof_sf) were handed to the radio (TX thread). Messages encoded into earlier
+ * subframes that were never sent count as lost.
+ */
+void msg_ingest_sent(msg_ingest_t* q, uint64_t first_sf_idx, uint32_t nof_sf)
+{
+  uint64_t tail = q->inflight_tail; // only this thread writes tail
+  uint64_t head = __atomic_load_n(&q->inflight_head, __ATOMIC_ACQUIRE);
+
+  for (; tail != head; tail++) {
+    msg_ingest_record_t* rec = &q->inflight[tail & (MSG_INGEST_INFLIGHT_DEPTH - 1)];
+    if (rec->sf_idx >= first_sf_idx + nof_sf) {
+      break;
+    }
+    if (rec->sf_idx < first_sf_idx) {
+      q->stats.nof_lost++;
+      if (q->log) {
+        fprintf(q->log, "%lu,%u,%lu,%.6f,%.6f,,\n", (unsigned long)rec->id, rec->len, (unsigned long)rec->sf_idx,
+                rec->arrival_time, rec->encoded_time);
+      }
+      continue;
+    }
+
+    double air     = air_time(q, rec->sf_idx);
+    double latency = air - rec->arrival_time;
+    q->stats.nof_sent++;
+    q->stats.air_latency_sum += latency;
+    q->stats.air_latency_min = SRSRAN_MIN(q->stats.air_latency_min, latency);
+    q->stats.air_latency_max = SRSRAN_MAX(q->stats.air_latency_max, latency);
+    latency_record_s(LATENCY_INGEST_TO_AIR, latency);
+    if (q->log) {
+      fprintf(q->log, "%lu,%u,%lu,%.6f,%.6f,%.6f,%.3f\n", (unsigned long)rec->id, rec->len, (unsigned long)rec->sf_idx,
+              rec->arrival_time, rec->encoded_time, air, latency * 1e3);
+    }
+  }
+  __atomic_store_n(&q->inflight_tail, tail, __ATOMIC_RELEASE);
+}
+
+void msg_ingest_print_stats(msg_ingest_t* q, FILE* f)
+{
+  msg_ingest_stats_t* s = &q->stats;
+  fprintf(f,
+          "ingest: %lu messages received (%lu dropped on a full queue, %lu too long), %lu encoded, %lu sent, %lu lost "
+          "late\n",
+          (unsigned long)s->nof_received,
+          (unsigned long)s->nof_queue_full,
+          (unsigned long)s->nof_too_long,
+          (unsigned long)s->nof_encoded,
+          (unsigned long)s->nof_sent,
+          (unsigned long)s->nof_lost);
+  if (s->nof_encoded > 0) {
+    fprintf(f,
+            "ingest: arrival -> encoded avg/max %.3f/%.3f ms\n",
+            s->queue_time_sum / s->nof_encoded * 1e3,
+            s->queue_time_max * 1e3);
+  }
+  if (s->nof_sent > 0) {
+    fprintf(f,
+            "ingest: arrival -> air min/avg/max %.3f/%.3f/%.3f ms\n",
+            s->air_latency_min * 1e3,
+            s->air_latency_sum / s->nof_sent * 1e3,
+            s->air_latency_max * 1e3);
+  }
+  if (s->nof_inflight_full > 0) {
+    fprintf(f, "ingest: %lu messages sent without a timing record\n", (unsigned long)s->nof_inflight_full);
+  }
+}
+
+// TB bits of every hex digit value, most significant first
+static const uint8_t hex_nibble_bits[16][4] = {
+    {0, 0, 0, 0}, {0, 0, 0, 1}, {0, 0, 1, 0}, {0, 0, 1, 1}, {0, 1, 0, 0}, {0, 1, 0, 1}, {0, 1, 1, 0}, {0, 1, 1, 1},
+    {1, 0, 0, 0}, {1, 0, 0, 1}, {1, 0, 1, 0}, {1, 0, 1, 1}, {1, 1, 0, 0}, {1, 1, 0, 1}, {1, 1, 1, 0}, {1, 1, 1, 1}};
+
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+#define HEX_SWAR_ONES (0x0101010101010101ULL)
+#define HEX_SWAR_HIGH (0x8080808080808080ULL)
+
+/**
+ * Digit values of 8 hex characters at once, one per byte of a 64-bit word (first character in the lowest byte).
+ *
+ * Every range check adds or subtracts a constant in each byte and looks at its top bit; as long as every character
+ * is ASCII, no byte carries or borrows into the next.
+ *
+ * @return false if any of the 8 characters isn't a hex digit
+ */
+static bool hex_swar_8(const char* hex, uint64_t* values)
+{
+  uint64_t x;
+  memcpy(&x, hex, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  x = __builtin_bswap64(x);
+#endif
+  if (x & HEX_SWAR_HIGH) {
+    return false;
+  }
+  uint64_t lower   = x | (0x20 * HEX_SWAR_ONES);
+  uint64_t digit   = (x + 0x50 * HEX_SWAR_ONES) & (0xb9 * HEX_SWAR_ONES - x);              // '0' <= c <= '9'
+  uint64_t letter  = (lower + 0x1f * HEX_SWAR_ONES) & (0xe6 * HEX_SWAR_ONES - lower);      // 'a' <= (c | 0x20) <= 'f'
+  if (((digit | letter) & HEX_SWAR_HIGH) != HEX_SWAR_HIGH) {
+    return false;
+  }
+  // Low nibble of '0'-'9' is the value, of 'a'-'f'/'A'-'F' it is the value - 9; bit 6 tells letters apart
+  *values = (x & (0x0f * HEX_SWAR_ONES)) + 9 * ((x >> 6) & HEX_SWAR_ONES);
+  return true;
+}
+
+/**
+ * Unpack len hex characters (optionally prefixed with 0x) into TB bits, most significant bit first. The characters
+ * don't need to be NUL terminated, so this works on a field in the middle of a mapped file.
+ *
+ * Runs of 8 characters are checked and converted as one 64-bit word, and every digit is written as 4 bits with one
+ * table lookup.
+ *
+ * @return number of bits written, SRSRAN_ERROR if the characters aren't hex or don't fit in max_bits
+ */
+int msg_ingest_hex_to_bits_len(const char* hex, size_t len, uint8_t* bits, uint32_t max_bits)
+{
+  if (len >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+    hex += 2;
+    len -= 2;
+  }
+  if (len > max_bits / 4) {
+    return SRSRAN_ERROR;
+  }
+
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t values;
+    if (!hex_swar_8(&hex[i], &values)) {
+      return SRSRAN_ERROR;
+    }
+    for (int k = 0; k < 8; k++) {
+      memcpy(&bits[(i + k) * 4], hex_nibble_bits[(values >> (8 * k)) & 0x0f], 4);
+    }
+  }
+  for (; i < len; i++) {
+    int v = hex_digit(hex[i]);
+    if (v < 0) {
+      return SRSRAN_ERROR;
+    }
+    memcpy(&bits[i * 4], hex_nibble_bits[v], 4);
+  }
+  return (int)(len * 4);
+}
+
+/**
+ * Unpack a hex string (optionally prefixed with 0x) into TB bits, most significant bit first.
+ *
+ * @return number of bits written, SRSRAN_ERROR if the string isn't hex or doesn't fit in max_bits
+ */
+int msg_ingest_hex_to_bits(const char* hex, uint8_t* bits, uint32_t max_bits)
+{
+  return msg_ingest_hex_to_bits_len(hex, strlen(hex), bits, max_bits);
+}
@@ -0,0 +1,118 @@
+/******************************************************************************
+ *  File:         msg_ingest.h
+ *
+ *  Description:  Live message ingest over a local socket.
+ *
+ *                A receive thread takes one V2X payload per datagram from a
+ *                Unix domain socket ("unix:/path") or a loopback UDP port
+ *                ("udp:port") and queues it, stamped with its arrival time.
+ *                The encoder asks for a message per subframe with
+ *                msg_ingest_next(), which waits until a message arrives or
+ *                the subframe is too close to its air time to be encoded,
+ *                so every message goes out in the first subframe that can
+ *                still make it. The TX thread reports what went on air with
+ *                msg_ingest_sent(), which closes the arrival -> encoded ->
+ *                air record of every message and optionally logs it.
+ *
+ *                Both queues are single-producer/single-consumer rings; the
+ *                receive thread only takes a lock to wake up the encoder.
+ *                All times are host CLOCK_MONOTONIC seconds.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef MSG_INGEST_H
+#define MSG_INGEST_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MSG_INGEST_MAX_PAYLOAD (6144)  // bytes, the largest TB of a 20 MHz channel
+#define MSG_INGEST_QUEUE_DEPTH (64)    // messages waiting for a subframe, a power of two
+#define MSG_INGEST_INFLIGHT_DEPTH (256) // messages encoded and waiting for air time, a power of two
+#define MSG_INGEST_ENCODE_LEAD_S (0.002) // latest a subframe is encoded before its air time
+
+typedef struct {
+  uint64_t id;
+  uint32_t len; // bytes
+  uint64_t sf_idx;
+  double   arrival_time;
+  double   encoded_time;
+} msg_ingest_record_t;
+
+typedef struct {
+  msg_ingest_record_t rec;
+  uint8_t             payload[MSG_INGEST_MAX_PAYLOAD];
+} msg_ingest_msg_t;
+
+typedef struct {
+  uint64_t nof_received;
+  uint64_t nof_queue_full; // dropped on arrival, the encoder is behind
+  uint64_t nof_too_long;   // dropped on arrival, larger than the TB
+  uint64_t nof_encoded;
+  uint64_t nof_sent;
+  uint64_t nof_lost;           // encoded, but their subframe was dropped late
+  uint64_t nof_inflight_full;  // encoded without a record, so their air time is unknown
+  double   queue_time_sum;     // arrival -> encoded
+  double   queue_time_max;
+  double   air_latency_sum;    // arrival -> air
+  double   air_latency_min;
+  double   air_latency_max;
+} msg_ingest_stats_t;
+
+typedef struct {
+  int   fd;
+  char* unix_path; // to unlink on exit, NULL for UDP
+  FILE* log;
+  uint32_t max_len;
+
+  pthread_t thread;
+  bool      running;
+  bool      thread_started;
+
+  // Receive thread -> encoder
+  msg_ingest_msg_t* queue;
+  uint64_t          queue_head __attribute__((aligned(64)));
+  uint64_t          queue_tail __attribute__((aligned(64)));
+  pthread_mutex_t   wait_mutex;
+  pthread_cond_t    wait_cv;
+
+  // Encoder -> TX thread
+  msg_ingest_record_t* inflight;
+  uint64_t             inflight_head __attribute__((aligned(64)));
+  uint64_t             inflight_tail __attribute__((aligned(64)));
+
+  // Host time at which subframe 0 would be on air, in ns; valid once timeline_valid is set
+  int64_t timeline_ns;
+  bool    timeline_valid;
+
+  uint64_t           next_id;
+  msg_ingest_stats_t stats;
+} msg_ingest_t;
+
+int msg_ingest_init(msg_ingest_t* q, const char* endpoint, uint32_t max_len, const char* log_file_name);
+
+int msg_ingest_start(msg_ingest_t* q);
+
+void msg_ingest_stop(msg_ingest_t* q);
+
+void msg_ingest_free(msg_ingest_t* q);
+
+void msg_ingest_set_timeline(msg_ingest_t* q, double host_air_time, uint64_t sf_idx);
+
+msg_ingest_msg_t* msg_ingest_next(msg_ingest_t* q, uint64_t sf_idx);
+
+void msg_ingest_encoded(msg_ingest_t* q, msg_ingest_msg_t* msg, uint64_t sf_idx);
+
+void msg_ingest_sent(msg_ingest_t* q, uint64_t first_sf_idx, uint32_t nof_sf);
+
+void msg_ingest_print_stats(msg_ingest_t* q, FILE* f);
+
+int msg_ingest_hex_to_bits(const char* hex, uint8_t* bits, uint32_t max_bits);
+
+int msg_ingest_hex_to_bits_len(const char* hex, size_t len, uint8_t* bits, uint32_t max_bits);
+
+#endif // MSG_INGEST_H
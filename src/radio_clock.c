@@ -0,0 +1,172 @@
+/******************************************************************************
+ *  File:         radio_clock.c
+ *
+ *  Description:  Local model of the radio clock (see radio_clock.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <string.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "radio_clock.h"
+#include "tx_pipeline.h"
+}
+
+#define RADIO_CLOCK_MAX_OUTLIERS_IN_ROW (3) // then the round trip itself got slower, so take the readings anyway
+
+/**
+ * @param read_fn reads the actual radio time
+ * @param period_s time between two readings
+ */
+int radio_clock_init(radio_clock_t* q, radio_clock_read_fn read_fn, void* read_arg, double period_s)
+{
+  if (q == NULL || read_fn == NULL || period_s <= 0) {
+    ERROR("Invalid parameters\n");
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+  bzero(q, sizeof(radio_clock_t));
+  q->read_fn       = read_fn;
+  q->read_arg      = read_arg;
+  q->period_s      = period_s;
+  q->stats.rtt_min = INFINITY;
+  return SRSRAN_SUCCESS;
+}
+
+static double predict_offset(radio_clock_t* q, double host)
+{
+  return q->fit_offset + q->fit_drift * (host - q->fit_host);
+}
+
+// Least squares fit of offset against host time over the window
+static void fit(radio_clock_t* q)
+{
+  double mean_host = 0, mean_offset = 0;
+  for (uint32_t i = 0; i < q->nof_samples; i++) {
+    mean_host += q->samples[i].host;
+    mean_offset += q->samples[i].offset;
+  }
+  mean_host /= q->nof_samples;
+  mean_offset /= q->nof_samples;
+
+  double sxy = 0, sxx = 0;
+  for (uint32_t i = 0; i < q->nof_samples; i++) {
+    double dx = q->samples[i].host - mean_host;
+    sxy += dx * (q->samples[i].offset - mean_offset);
+    sxx += dx * dx;
+  }
+  q->fit_host   = mean_host;
+  q->fit_offset = mean_offset;
+  q->fit_drift  = sxx > 0 ? sxy / sxx : 0;
+
+  q->fit_error = 0;
+  for (uint32_t i = 0; i < q->nof_samples; i++) {
+    radio_clock_sample_t* s = &q->samples[i];
+    q->fit_error            = SRSRAN_MAX(q->fit_error, fabs(s->offset - predict_offset(q, s->host)) + s->half_rtt);
+  }
+}
+
+/**
+ * Read the actual radio time and add it to the model.
+ */
+void radio_clock_read(radio_clock_t* q, time_t* secs, double* frac_secs)
+{
+  double before = tx_pipeline_host_time();
+  q->read_fn(q->read_arg, secs, frac_secs);
+  double after = tx_pipeline_host_time();
+
+  double rtt = after - before;
+  if (q->stats.nof_reads == 0) {
+    q->ref_secs = *secs;
+  }
+  q->stats.nof_reads++;
+  q->stats.rtt_min = SRSRAN_MIN(q->stats.rtt_min, rtt);
+  q->stats.rtt_max = SRSRAN_MAX(q->stats.rtt_max, rtt);
+
+  if (q->nof_samples > 0 && rtt > RADIO_CLOCK_RTT_OUTLIER * q->stats.rtt_min &&
+      ++q->nof_outliers_in_row < RADIO_CLOCK_MAX_OUTLIERS_IN_ROW) {
+    q->stats.nof_outliers++;
+    return; // the caller still gets the reading, the fit doesn't; last_read is unchanged, so the next call retries
+  }
+  q->nof_outliers_in_row = 0;
+
+  radio_clock_sample_t s;
+  s.host     = (before + after) / 2;
+  s.half_rtt = (after - before) / 2;
+  s.offset   = (double)(*secs - q->ref_secs) + *frac_secs - s.host;
+
+  if (q->nof_samples > 0) {
+    double residual = fabs(s.offset - predict_offset(q, s.host));
+    if (residual > RADIO_CLOCK_JUMP_S) {
+      // The radio time was set (or the host clock stalled); what we knew no longer applies
+      q->stats.nof_jumps++;
+      q->nof_samples = 0;
+      q->next        = 0;
+    } else {
+      q->stats.residual_max = SRSRAN_MAX(q->stats.residual_max, residual);
+    }
+  }
+  q->samples[q->next] = s;
+  q->next             = (q->next + 1) % RADIO_CLOCK_WINDOW;
+  q->nof_samples      = SRSRAN_MIN(q->nof_samples + 1, RADIO_CLOCK_WINDOW);
+  q->last_read        = s.host;
+  fit(q);
+}
+
+/**
+ * Bound on the error of a prediction made at host_time.
+ */
+double radio_clock_error(radio_clock_t* q, double host_time)
+{
+  if (q->nof_samples == 0) {
+    return INFINITY;
+  }
+  return q->fit_error + RADIO_CLOCK_DRIFT_MARGIN * fabs(host_time - q->last_read);
+}
+
+/**
+ * Current radio time, predicted from the host clock; reads the radio instead when the model is due for a new reading.
+ */
+void radio_clock_now(radio_clock_t* q, time_t* secs, double* frac_secs)
+{
+  double host = tx_pipeline_host_time();
+  if (q->nof_samples == 0 || host - q->last_read >= q->period_s) {
+    radio_clock_read(q, secs, frac_secs);
+    return;
+  }
+
+  double radio = host + predict_offset(q, host);
+  double whole = floor(radio);
+  *secs        = q->ref_secs + (time_t)whole;
+  *frac_secs   = radio - whole;
+  q->stats.nof_predictions++;
+}
+
+/**
+ * Host time at which the radio clock shows (secs, frac_secs).
+ */
+double radio_clock_to_host(radio_clock_t* q, time_t secs, double frac_secs)
+{
+  // radio = host + fit_offset + fit_drift * (host - fit_host), solved for host
+  double radio = (double)(secs - q->ref_secs) + frac_secs;
+  return (radio - q->fit_offset + q->fit_drift * q->fit_host) / (1 + q->fit_drift);
+}
+
+void radio_clock_print_stats(radio_clock_t* q, FILE* f)
+{
+  radio_clock_stats_t* s = &q->stats;
+  fprintf(f,
+          "radio clock: %lu reads (%lu outliers), %lu predictions, %lu jumps, drift %.3f ppm, worst prediction error "
+          "%.1f us, read round trip %.1f-%.1f us\n",
+          (unsigned long)s->nof_reads,
+          (unsigned long)s->nof_outliers,
+          (unsigned long)s->nof_predictions,
+          (unsigned long)s->nof_jumps,
+          q->fit_drift * 1e6,
+          s->residual_max * 1e6,
+          s->nof_reads > 0 ? s->rtt_min * 1e6 : 0.0,
+          s->rtt_max * 1e6);
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *  File:         radio_clock.h
+ *
+ *  Description:  Local model of the radio clock.
+ *
+ *                Reading the radio time is a round trip to the SDR, over
+ *                USB or Ethernet. Instead of one per subframe, the model reads
+ *                it occasionally, bracketed by two host CLOCK_MONOTONIC reads,
+ *                and fits offset and drift of the radio against the host
+ *                clock over the last RADIO_CLOCK_WINDOW readings. In between,
+ *                radio time is predicted from the host clock, and a deadline
+ *                in radio time can be turned into a host time to sleep
+ *                until.
+ *
+ *                A new reading is taken every period_s. Readings whose round
+ *                trip is RADIO_CLOCK_RTT_OUTLIER times the fastest one seen
+ *                (the thread was preempted mid-read) are left out of the fit,
+ *                unless several come in a row. The prediction error is then
+ *                bounded by the worst fit residual, half the worst round trip
+ *                in the window, and a drift margin growing with the time
+ *                since the last reading. A reading that disagrees with the
+ *                fit by more than RADIO_CLOCK_JUMP_S (the radio time was set)
+ *                restarts it.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef RADIO_CLOCK_H
+#define RADIO_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define RADIO_CLOCK_WINDOW (16)
+#define RADIO_CLOCK_DEFAULT_PERIOD_S (1.0)
+#define RADIO_CLOCK_RTT_OUTLIER (4)
+#define RADIO_CLOCK_DRIFT_MARGIN (2e-6) // s/s, allowance for error in the fitted drift
+#define RADIO_CLOCK_JUMP_S (1e-3)
+
+/**
+ * Read the actual radio time, e.g. srsran_rf_get_time().
+ */
+typedef void (*radio_clock_read_fn)(void* arg, time_t* secs, double* frac_secs);
+
+typedef struct {
+  double host;     // host time at the middle of the read
+  double offset;   // radio time - host time, radio time counted from ref_secs
+  double half_rtt; // half the read round trip, the uncertainty of host
+} radio_clock_sample_t;
+
+typedef struct {
+  uint64_t nof_reads;
+  uint64_t nof_predictions;
+  uint64_t nof_jumps;
+  uint64_t nof_outliers;
+  double   residual_max; // worst disagreement of a reading with the fit before it, i.e. prediction error seen
+  double   rtt_min;
+  double   rtt_max;
+} radio_clock_stats_t;
+
+typedef struct {
+  radio_clock_read_fn read_fn;
+  void*               read_arg;
+  double              period_s;
+
+  time_t               ref_secs; // radio times are kept relative to this, to keep double precision
+  radio_clock_sample_t samples[RADIO_CLOCK_WINDOW];
+  uint32_t             nof_samples;
+  uint32_t             next;
+
+  // offset(host) = fit_offset + fit_drift * (host - fit_host)
+  double   fit_host;
+  double   fit_offset;
+  double   fit_drift;
+  double   fit_error; // worst residual plus half the worst round trip over the window
+  double   last_read;
+  uint32_t nof_outliers_in_row;
+
+  radio_clock_stats_t stats;
+} radio_clock_t;
+
+int radio_clock_init(radio_clock_t* q, radio_clock_read_fn read_fn, void* read_arg, double period_s);
+
+void radio_clock_read(radio_clock_t* q, time_t* secs, double* frac_secs);
+
+void radio_clock_now(radio_clock_t* q, time_t* secs, double* frac_secs);
+
+double radio_clock_error(radio_clock_t* q, double host_time);
+
+double radio_clock_to_host(radio_clock_t* q, time_t secs, double frac_secs);
+
+void radio_clock_print_stats(radio_clock_t* q, FILE* f);
+
+#endif // RADIO_CLOCK_H
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *  File:         resampler.c
+ *
+ *  Description:  Streaming rational polyphase resampler (see resampler.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <string.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "resampler.h"
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+  while (b != 0) {
+    uint32_t r = a % b;
+    a          = b;
+    b          = r;
+  }
+  return a;
+}
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double bessel_i0(double x)
+{
+  double sum  = 1.0;
+  double term = 1.0;
+  for (uint32_t k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < 1e-12 * sum) {
+      break;
+    }
+  }
+  return sum;
+}
+
+/**
+ * Design the L * taps_per_phase prototype low-pass at the upsampled rate and split it into phases.
+ */
+static void design_filter(resampler_t* q)
+{
+  uint32_t L = q->interp;
+  uint32_t T = q->taps_per_phase;
+  uint32_t N = L * T;
+
+  // Cutoff in cycles per upsampled sample: the lower of the two Nyquist frequencies, with some margin
+  double fc     = RESAMPLER_PASSBAND * 0.5 / SRSRAN_MAX(L, q->decim);
+  double center = (N - 1) / 2.0;
+  double i0b    = bessel_i0(RESAMPLER_KAISER_BETA);
+  double sum    = 0.0;
+
+  double* h = (double*)malloc(sizeof(double) * N);
+  for (uint32_t n = 0; n < N; n++) {
+    double x    = n - center;
+    double sinc = (x == 0.0) ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+    double r    = 2.0 * n / (N - 1) - 1.0;
+    double w    = bessel_i0(RESAMPLER_KAISER_BETA * sqrt(SRSRAN_MAX(0.0, 1.0 - r * r))) / i0b;
+    h[n]        = sinc * w;
+    sum += h[n];
+  }
+
+  // Unity DC gain per phase: the L phases together sum to L
+  for (uint32_t p = 0; p < L; p++) {
+    for (uint32_t j = 0; j < T; j++) {
+      q->taps[p * T + j] = (float)(h[p + (T - 1 - j) * L] * L / sum);
+    }
+  }
+  free(h);
+}
+
+/**
+ * @param in_rate input sample rate in Hz
+ * @param out_rate output sample rate in Hz
+ * @param taps_per_phase filter length per phase in input samples; longer is sharper and slower
+ */
+int resampler_init(resampler_t* q, uint32_t in_rate, uint32_t out_rate, uint32_t taps_per_phase)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && in_rate > 0 && out_rate > 0 && taps_per_phase > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(resampler_t));
+    uint32_t g        = gcd(in_rate, out_rate);
+    q->interp         = out_rate / g;
+    q->decim          = in_rate / g;
+    q->taps_per_phase = taps_per_phase;
+
+    if (q->interp > RESAMPLER_MAX_INTERP) {
+      ERROR("Resampling %d to %d Hz needs %d filter phases, at most %d are supported\n",
+            in_rate,
+            out_rate,
+            q->interp,
+            RESAMPLER_MAX_INTERP);
+      goto clean_exit;
+    }
+
+    q->taps = srsran_vec_f_malloc(q->interp * taps_per_phase);
+    if (!q->taps) {
+      perror("malloc");
+      goto clean_exit;
+    }
+    design_filter(q);
+
+    q->buffer_len = taps_per_phase - 1;
+    q->buffer     = srsran_vec_cf_malloc(q->buffer_len);
+    if (!q->buffer) {
+      perror("malloc");
+      goto clean_exit;
+    }
+    srsran_vec_cf_zero(q->buffer, q->buffer_len);
+    q->t = (uint64_t)(taps_per_phase - 1) * q->interp;
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    resampler_free(q);
+  }
+  return ret;
+}
+
+void resampler_free(resampler_t* q)
+{
+  if (q) {
+    if (q->taps) {
+      free(q->taps);
+    }
+    if (q->buffer) {
+      free(q->buffer);
+    }
+    bzero(q, sizeof(resampler_t));
+  }
+}
+
+/**
+ * Upper bound of the number of samples resampler_process() returns for nof_input input samples.
+ */
+uint32_t resampler_max_output(resampler_t* q, uint32_t nof_input)
+{
+  return (uint32_t)(((uint64_t)nof_input * q->interp + q->decim - 1) / q->decim) + 1;
+}
+
+/**
+ * Resample the next nof_input samples of the stream.
+ *
+ * @param output room for resampler_max_output(q, nof_input) samples
+ * @return number of output samples written
+ */
+uint32_t resampler_process(resampler_t* q, const cf_t* input, uint32_t nof_input, cf_t* output)
+{
+  uint32_t T       = q->taps_per_phase;
+  uint32_t history = T - 1;
+
+  if (history + nof_input > q->buffer_len) {
+    cf_t* buffer = srsran_vec_cf_malloc(history + nof_input);
+    if (!buffer) {
+      perror("malloc");
+      return 0;
+    }
+    srsran_vec_cf_copy(buffer, q->buffer, history);
+    free(q->buffer);
+    q->buffer     = buffer;
+    q->buffer_len = history + nof_input;
+  }
+  srsran_vec_cf_copy(&q->buffer[history], input, nof_input);
+
+  uint32_t nof_output = 0;
+  uint64_t end        = (uint64_t)(history + nof_input) * q->interp;
+  while (q->t < end) {
+    uint32_t i = (uint32_t)(q->t / q->interp);
+    uint32_t p = (uint32_t)(q->t % q->interp);
+
+    output[nof_output++] = srsran_vec_dot_prod_cfc(&q->buffer[i + 1 - T], &q->taps[p * T], T);
+    q->t += q->decim;
+  }
+
+  // Keep the last T - 1 input samples and move the output position along with them
+  memmove(q->buffer, &q->buffer[nof_input], history * sizeof(cf_t));
+  q->t -= (uint64_t)nof_input * q->interp;
+
+  return nof_output;
+}
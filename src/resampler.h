@@ -0,0 +1,49 @@
+/******************************************************************************
+ *  File:         resampler.h
+ *
+ *  Description:  Streaming rational polyphase resampler.
+ *
+ *                Converts complex samples from one integer sample rate to
+ *                another by L/M (the rates divided by their gcd), e.g. a 7 Msps
+ *                spectrum analyzer capture to the 30.72 Msps srsran_ue_sl_t
+ *                expects. Each output sample is one dot product of the input
+ *                history with one phase of a Kaiser-windowed sinc low-pass,
+ *                computed with srsran_vec_dot_prod_cfc() (SIMD). State carries
+ *                over between calls, so arbitrarily long captures can be fed
+ *                in chunks.
+ *
+ *  Reference:    Crochiere, Rabiner, "Multirate Digital Signal Processing", 1983
+ *****************************************************************************/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+#include <srsran/phy/utils/vector.h>
+
+#define RESAMPLER_DEFAULT_TAPS_PER_PHASE (32)
+#define RESAMPLER_MAX_INTERP (8192) // largest L, bounds the filter to L * taps_per_phase coefficients
+#define RESAMPLER_PASSBAND (0.9f)   // cutoff as a fraction of the lower Nyquist frequency
+#define RESAMPLER_KAISER_BETA (8.0)
+
+typedef struct {
+  uint32_t interp; // L
+  uint32_t decim;  // M
+  uint32_t taps_per_phase;
+  float*   taps; // interp phases of taps_per_phase coefficients, each phase stored time-reversed
+
+  cf_t*    buffer; // taps_per_phase - 1 samples of history followed by the current input
+  uint32_t buffer_len;
+  uint64_t t; // position of the next output in the buffer, in units of 1/L input samples
+} resampler_t;
+
+int resampler_init(resampler_t* q, uint32_t in_rate, uint32_t out_rate, uint32_t taps_per_phase);
+
+void resampler_free(resampler_t* q);
+
+uint32_t resampler_max_output(resampler_t* q, uint32_t nof_input);
+
+uint32_t resampler_process(resampler_t* q, const cf_t* input, uint32_t nof_input, cf_t* output);
+
+#endif // RESAMPLER_H
@@ -0,0 +1,290 @@
+/******************************************************************************
+ *  File:         rt_profile.c
+ *
+ *  Description:  Real-time execution profile for the TX path (see
+ *                rt_profile.h).
+ *
+ *  Reference:    sched(7), mlockall(2), Documentation/admin-guide/mm/hugetlbpage.rst
+ *****************************************************************************/
+
+extern "C" {
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "rt_profile.h"
+}
+
+#define RT_PROFILE_ALLOC_HDR (64) // mapping length, in front of every buffer; keeps the samples 64-byte aligned
+
+// Process-wide, like the memory lock itself
+static bool     use_huge_pages = false;
+static bool     memory_locked  = false;
+static uint32_t nof_huge_allocs, nof_thp_allocs, nof_small_allocs;
+
+void rt_profile_cfg_default(rt_profile_cfg_t* cfg)
+{
+  cfg->enabled         = false;
+  cfg->tx_cpu          = -1;
+  cfg->encode_cpu      = -1;
+  cfg->tx_priority     = RT_PROFILE_DEFAULT_TX_PRIORITY;
+  cfg->encode_priority = RT_PROFILE_DEFAULT_ENCODE_PRIORITY;
+  cfg->lock_memory     = true;
+  cfg->huge_pages      = false;
+}
+
+/**
+ * Enable the profile from a command line spec: "on" for the defaults, or a comma separated list of tx_cpu=N,
+ * encode_cpu=N, tx_prio=N, encode_prio=N (1-99, 0 = default scheduler), huge (huge-page sample buffers) and nolock.
+ */
+int rt_profile_parse(rt_profile_cfg_t* cfg, const char* spec)
+{
+  char* copy = strdup(spec);
+  char* save = NULL;
+  int   ret  = SRSRAN_SUCCESS;
+
+  for (char* tok = strtok_r(copy, ",", &save); tok != NULL && ret == SRSRAN_SUCCESS; tok = strtok_r(NULL, ",", &save)) {
+    char* value = strchr(tok, '=');
+    if (value) {
+      *value++ = '\0';
+    }
+    int n = value ? atoi(value) : 0;
+
+    if (strcmp(tok, "on") == 0 && !value) {
+      // defaults
+    } else if (strcmp(tok, "huge") == 0 && !value) {
+      cfg->huge_pages = true;
+    } else if (strcmp(tok, "nolock") == 0 && !value) {
+      cfg->lock_memory = false;
+    } else if (strcmp(tok, "tx_cpu") == 0 && value) {
+      cfg->tx_cpu = n;
+    } else if (strcmp(tok, "encode_cpu") == 0 && value) {
+      cfg->encode_cpu = n;
+    } else if (strcmp(tok, "tx_prio") == 0 && value && n >= 0 && n <= 99) {
+      cfg->tx_priority = n;
+    } else if (strcmp(tok, "encode_prio") == 0 && value && n >= 0 && n <= 99) {
+      cfg->encode_priority = n;
+    } else {
+      ERROR("Unknown real-time option %s\n", tok);
+      ret = SRSRAN_ERROR;
+    }
+  }
+  free(copy);
+
+  cfg->enabled = (ret == SRSRAN_SUCCESS);
+  return ret;
+}
+
+/**
+ * Process-wide part of the profile, to be called before the sample buffers are allocated. A refused memory lock is
+ * not fatal; rt_profile_check() reports it.
+ */
+int rt_profile_init(rt_profile_cfg_t* cfg)
+{
+  use_huge_pages = cfg->huge_pages;
+  if (cfg->lock_memory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+      perror("mlockall");
+    } else {
+      memory_locked = true;
+    }
+  }
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Pin a thread to one CPU and/or run it under SCHED_FIFO.
+ *
+ * @param name thread name, as shown by top -H (at most 15 characters)
+ * @param cpu CPU to pin to, -1 = leave the affinity alone
+ * @param priority SCHED_FIFO priority, 0 = leave the scheduler alone
+ */
+int rt_profile_apply_thread(pthread_t thread, const char* name, int cpu, int priority)
+{
+  int ret = SRSRAN_SUCCESS;
+  int err;
+
+  pthread_setname_np(thread, name);
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((err = pthread_setaffinity_np(thread, sizeof(set), &set))) {
+      ERROR("Can't pin the %s thread to CPU %d: %s\n", name, cpu, strerror(err));
+      ret = SRSRAN_ERROR;
+    }
+  }
+  if (priority > 0) {
+    struct sched_param param;
+    bzero(&param, sizeof(param));
+    param.sched_priority = priority;
+    if ((err = pthread_setschedparam(thread, SCHED_FIFO, &param))) {
+      ERROR("Can't run the %s thread under SCHED_FIFO %d: %s\n", name, priority, strerror(err));
+      ret = SRSRAN_ERROR;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Zeroed, prefaulted sample buffer, on reserved huge pages when the profile asks for them and the kernel has them,
+ * on transparent huge pages otherwise. Free with rt_profile_free().
+ */
+void* rt_profile_alloc(size_t size)
+{
+  size_t   len = size + RT_PROFILE_ALLOC_HDR;
+  uint8_t* p   = (uint8_t*)MAP_FAILED;
+
+  if (use_huge_pages) {
+    size_t huge_len = (len + RT_PROFILE_HUGE_PAGE_SIZE - 1) & ~(size_t)(RT_PROFILE_HUGE_PAGE_SIZE - 1);
+    p = (uint8_t*)mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                       -1, 0);
+    if (p != MAP_FAILED) {
+      len = huge_len;
+      nof_huge_allocs++;
+    }
+  }
+
+  if (p == MAP_FAILED) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    len         = (len + page - 1) & ~(page - 1);
+    p           = (uint8_t*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      return NULL;
+    }
+    if (use_huge_pages && madvise(p, len, MADV_HUGEPAGE) == 0) {
+      nof_thp_allocs++;
+    } else {
+      nof_small_allocs++;
+    }
+    // Fault every page in now (after the advice, so THP can back them), not on the first subframe
+    for (size_t i = 0; i < len; i += page) {
+      ((volatile uint8_t*)p)[i] = 0;
+    }
+  }
+
+  *(size_t*)p = len;
+  return p + RT_PROFILE_ALLOC_HDR;
+}
+
+void rt_profile_free(void* ptr)
+{
+  if (ptr) {
+    uint8_t* p = (uint8_t*)ptr - RT_PROFILE_ALLOC_HDR;
+    munmap(p, *(size_t*)p);
+  }
+}
+
+static void print_cpus(FILE* f, cpu_set_t* set)
+{
+  const char* sep = "";
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, set)) {
+      continue;
+    }
+    int j = i;
+    while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set)) {
+      j++;
+    }
+    fprintf(f, j > i ? "%s%d-%d" : "%s%d", sep, i, j);
+    sep = ",";
+    i   = j;
+  }
+}
+
+static int check_thread(FILE* f, pthread_t thread, const char* name, int cpu, int priority)
+{
+  int                nof_mismatches = 0;
+  int                policy;
+  struct sched_param param;
+  cpu_set_t          set;
+
+  pthread_getschedparam(thread, &policy, &param);
+  CPU_ZERO(&set);
+  pthread_getaffinity_np(thread, sizeof(set), &set);
+
+  if (priority > 0 && (policy != SCHED_FIFO || param.sched_priority != priority)) {
+    nof_mismatches++;
+  }
+  if (cpu >= 0 && (CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set))) {
+    nof_mismatches++;
+  }
+
+  fprintf(f, "rt: %s thread: %s", name, policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER");
+  if (policy == SCHED_FIFO || policy == SCHED_RR) {
+    fprintf(f, " %d", param.sched_priority);
+  }
+  fprintf(f, " on CPU ");
+  print_cpus(f, &set);
+  if (nof_mismatches > 0) {
+    fprintf(f, " (wanted %s", priority > 0 ? "SCHED_FIFO" : "default scheduling");
+    if (priority > 0) {
+      fprintf(f, " %d", priority);
+    }
+    if (cpu >= 0) {
+      fprintf(f, " on CPU %d", cpu);
+    }
+    fprintf(f, ")");
+  }
+  fprintf(f, "\n");
+  return nof_mismatches;
+}
+
+// Locked memory as the kernel accounts it, in kB; -1 if unknown
+static long locked_kb()
+{
+  long  kb = -1;
+  char  line[128];
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status) {
+    while (fgets(line, sizeof(line), status)) {
+      if (strncmp(line, "VmLck:", 6) == 0) {
+        kb = strtol(line + 6, NULL, 10);
+        break;
+      }
+    }
+    fclose(status);
+  }
+  return kb;
+}
+
+/**
+ * Startup self-check: print the scheduling, affinity, memory lock and huge page state the kernel actually granted.
+ *
+ * @return number of settings that differ from the profile
+ */
+int rt_profile_check(const rt_profile_cfg_t* cfg, pthread_t tx_thread, pthread_t encode_thread, FILE* f)
+{
+  int nof_mismatches = 0;
+
+  nof_mismatches += check_thread(f, tx_thread, "tx", cfg->tx_cpu, cfg->tx_priority);
+  nof_mismatches += check_thread(f, encode_thread, "encode", cfg->encode_cpu, cfg->encode_priority);
+
+  if (cfg->lock_memory) {
+    fprintf(f, "rt: memory %s (VmLck %ld kB)\n", memory_locked ? "locked" : "NOT locked", locked_kb());
+    if (!memory_locked) {
+      nof_mismatches++;
+    }
+  }
+  fprintf(f,
+          "rt: sample buffers: %u on huge pages, %u on transparent huge pages, %u on small pages\n",
+          nof_huge_allocs,
+          nof_thp_allocs,
+          nof_small_allocs);
+  if (cfg->huge_pages && nof_huge_allocs == 0) {
+    nof_mismatches++;
+  }
+
+  if (nof_mismatches > 0) {
+    fprintf(f, "rt: %d setting(s) not granted, expect latency spikes (missing CAP_SYS_NICE/CAP_IPC_LOCK or huge pages?)\n",
+            nof_mismatches);
+  }
+  return nof_mismatches;
+}
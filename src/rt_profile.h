@@ -0,0 +1,53 @@
+/******************************************************************************
+ *  File:         rt_profile.h
+ *
+ *  Description:  Real-time execution profile for the TX path.
+ *
+ *                Pins the TX and encoder threads to their own CPUs, runs
+ *                them under SCHED_FIFO, locks all current and future memory
+ *                (mlockall) so the hot path never takes a page fault, and
+ *                hands out prefaulted, optionally huge-page backed sample
+ *                buffers. rt_profile_check() reads back what the kernel
+ *                actually granted, since every step may be refused without
+ *                CAP_SYS_NICE / CAP_IPC_LOCK or reserved huge pages.
+ *
+ *  Reference:    sched(7), mlockall(2), Documentation/admin-guide/mm/hugetlbpage.rst
+ *****************************************************************************/
+
+#ifndef RT_PROFILE_H
+#define RT_PROFILE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define RT_PROFILE_DEFAULT_TX_PRIORITY (80)
+#define RT_PROFILE_DEFAULT_ENCODE_PRIORITY (79) // below TX, which holds the radio deadline
+#define RT_PROFILE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct {
+  bool enabled;
+  int  tx_cpu;     // -1 = not pinned
+  int  encode_cpu; // -1 = not pinned
+  int  tx_priority;
+  int  encode_priority; // SCHED_FIFO priorities, 0 = keep the default scheduler
+  bool lock_memory;
+  bool huge_pages;
+} rt_profile_cfg_t;
+
+void rt_profile_cfg_default(rt_profile_cfg_t* cfg);
+
+int rt_profile_parse(rt_profile_cfg_t* cfg, const char* spec);
+
+int rt_profile_init(rt_profile_cfg_t* cfg);
+
+int rt_profile_apply_thread(pthread_t thread, const char* name, int cpu, int priority);
+
+void* rt_profile_alloc(size_t size);
+
+void rt_profile_free(void* ptr);
+
+int rt_profile_check(const rt_profile_cfg_t* cfg, pthread_t tx_thread, pthread_t encode_thread, FILE* f);
+
+#endif // RT_PROFILE_H
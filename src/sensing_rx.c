@@ -0,0 +1,215 @@
+/******************************************************************************
+ *  File:         sensing_rx.c
+ *
+ *  Description:  Receive thread feeding the Mode 4 sensing engine (see sensing_rx.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <string.h>
+
+#include "sensing_rx.h"
+}
+
+/**
+ * @param radio opened radio, already tuned and set to the LTE sample rate on its RX side
+ * @param nof_decoder_threads threads decoding the sub channels of a subframe, see decoder_pool_init()
+ */
+int sensing_rx_init(sensing_rx_t*                  q,
+                    srsran_rf_t*                   radio,
+                    sps_sensing_t*                 sps,
+                    srsran_cell_sl_t               cell,
+                    srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                    uint32_t                       nof_decoder_threads)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && radio != NULL && sps != NULL) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(sensing_rx_t));
+    q->radio = radio;
+    q->sps   = sps;
+    q->srate = srsran_sampling_freq_hz(cell.nof_prb);
+
+    if (srsran_ue_sl_init(&q->ue, cell, sl_comm_resource_pool, 1) || srsran_ue_sl_init_rx(&q->ue)) {
+      ERROR("Error initializing sensing UE\n");
+      goto clean_exit;
+    }
+    for (uint32_t i = 0; i < sl_comm_resource_pool.num_sub_channel; i++) {
+      q->res.data[i] = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+      if (!q->res.data[i]) {
+        perror("malloc");
+        goto clean_exit;
+      }
+    }
+    if (decoder_pool_init(&q->decoder, nof_decoder_threads)) {
+      goto clean_exit;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    sensing_rx_free(q);
+  }
+  return ret;
+}
+
+/**
+ * Hand the sensing results of the subframe in ue.signal_buffer_rx to the engine.
+ */
+static void sense_subframe(sensing_rx_t* q, uint64_t sf_idx, uint32_t tti)
+{
+  srsran_sl_sf_cfg_t sf;
+  sf.tti = tti;
+  if (decoder_pool_decode(&q->decoder, &q->ue, &sf, &q->res) < 0) {
+    q->stats.nof_errors++;
+    return;
+  }
+
+  uint32_t          nof_subch = q->ue.sl_comm_resource_pool.num_sub_channel;
+  float             rssi[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  sps_sensing_sci_t sci[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  uint32_t          nof_sci = 0;
+
+  for (uint32_t s = 0; s < nof_subch; s++) {
+    rssi[s] = srsran_ue_sl_subch_rssi(&q->ue, s);
+    if (q->decoder.subch_ret[s] != SRSRAN_SUCCESS) {
+      continue;
+    }
+    sps_sensing_sci_t* d = &sci[nof_sci++];
+    srsran_ra_sl_type0_from_riv(q->res.sci[s].riv, nof_subch, &d->l_sub_channel, &d->sub_channel_start_idx);
+    d->priority              = q->res.sci[s].priority;
+    d->intvl_ms              = q->res.sci[s].resource_reserv; // already in ms, see pscch_decode()
+    d->rsrp_db               = 10.0f * log10f(SRSRAN_MAX(q->res.pssch_rsrp[s], 1e-20f));
+  }
+  q->stats.nof_decoded += nof_sci;
+  q->stats.nof_sensed++;
+
+  sps_sensing_sense(q->sps, sf_idx, rssi, sci, nof_sci);
+}
+
+static void* rx_run(void* arg)
+{
+  sensing_rx_t* q      = (sensing_rx_t*)arg;
+  uint32_t      sf_len = q->ue.sf_len;
+  cf_t*         buffer = q->ue.signal_buffer_rx[0];
+
+  while (__atomic_load_n(&q->running, __ATOMIC_ACQUIRE)) {
+    time_t secs = 0;
+    double frac = 0.0;
+    int    n    = srsran_rf_recv_with_time(q->radio, buffer, sf_len, true, &secs, &frac);
+    if (n < (int)sf_len) {
+      q->stats.nof_errors++;
+      continue;
+    }
+
+    // Sample offset of the buffer from the radio's 1 ms grid
+    double   ms     = frac * 1e3;
+    uint32_t offset = (uint32_t)lround((ms - floor(ms)) * sf_len) % sf_len;
+    if (offset != 0) {
+      // Drop the rest of this subframe so the next read starts on a boundary
+      q->stats.nof_realigns++;
+      srsran_rf_recv_with_time(q->radio, buffer, sf_len - offset, true, &secs, &frac);
+      continue;
+    }
+    q->stats.nof_subframes++;
+
+    int64_t radio_ms = (int64_t)secs * 1000 + llround(ms);
+    if (!__atomic_load_n(&q->timeline_valid, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    int64_t sf_idx = radio_ms - __atomic_load_n(&q->timeline_offset, __ATOMIC_RELAXED);
+    if (sf_idx < 0) {
+      continue;
+    }
+    sense_subframe(q, (uint64_t)sf_idx, (uint32_t)(radio_ms % 10240));
+  }
+  return NULL;
+}
+
+int sensing_rx_start(sensing_rx_t* q)
+{
+  if (srsran_rf_start_rx_stream(q->radio, false)) {
+    ERROR("Error starting RX stream\n");
+    return SRSRAN_ERROR;
+  }
+  q->running = true;
+  if (pthread_create(&q->thread, NULL, rx_run, q)) {
+    perror("pthread_create");
+    q->running = false;
+    srsran_rf_stop_rx_stream(q->radio);
+    return SRSRAN_ERROR;
+  }
+  q->thread_started = true;
+  return SRSRAN_SUCCESS;
+}
+
+void sensing_rx_stop(sensing_rx_t* q)
+{
+  if (q->thread_started) {
+    __atomic_store_n(&q->running, false, __ATOMIC_RELEASE);
+    pthread_join(q->thread, NULL);
+    q->thread_started = false;
+    srsran_rf_stop_rx_stream(q->radio);
+  }
+}
+
+void sensing_rx_free(sensing_rx_t* q)
+{
+  if (q) {
+    sensing_rx_stop(q);
+    decoder_pool_free(&q->decoder);
+    for (uint32_t i = 0; i < SRSRAN_MAX_NUM_SUB_CHANNEL; i++) {
+      if (q->res.data[i]) {
+        free(q->res.data[i]);
+      }
+    }
+    srsran_ue_sl_free(&q->ue);
+    bzero(q, sizeof(sensing_rx_t));
+  }
+}
+
+/**
+ * Publish that TX subframe sf_idx goes on air at radio time t. Called again whenever the TX side restarts its timeline.
+ */
+void sensing_rx_set_timeline(sensing_rx_t* q, const srsran_timestamp_t* t, uint64_t sf_idx)
+{
+  int64_t radio_ms = (int64_t)t->full_secs * 1000 + llround(t->frac_secs * 1e3);
+  __atomic_store_n(&q->timeline_offset, radio_ms - (int64_t)sf_idx, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->timeline_valid, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Radio subframe number (mod 10240) of TX subframe sf_idx, so our SCIs carry the same subframe index receivers see.
+ *
+ * @return false while no timeline has been published
+ */
+bool sensing_rx_tti(sensing_rx_t* q, uint64_t sf_idx, uint32_t* tti)
+{
+  if (!__atomic_load_n(&q->timeline_valid, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  int64_t radio_ms = (int64_t)sf_idx + __atomic_load_n(&q->timeline_offset, __ATOMIC_RELAXED);
+  *tti             = (uint32_t)(radio_ms % 10240);
+  return true;
+}
+
+void sensing_rx_print_stats(sensing_rx_t* q, FILE* f)
+{
+  sensing_rx_stats_t* s = &q->stats;
+  fprintf(f,
+          "sensing rx: %lu subframes received, %lu sensed, %lu SCIs decoded, %lu realignments, %lu errors\n",
+          (unsigned long)s->nof_subframes,
+          (unsigned long)s->nof_sensed,
+          (unsigned long)s->nof_decoded,
+          (unsigned long)s->nof_realigns,
+          (unsigned long)s->nof_errors);
+  decoder_pool_print_stats(&q->decoder, f);
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ *  File:         sensing_rx.h
+ *
+ *  Description:  Receive thread feeding the Mode 4 sensing engine.
+ *
+ *                Streams subframes from the radio's RX side, aligned to the
+ *                radio's 1 ms grid, decodes every sub channel with a
+ *                decoder_pool_t and hands the S-RSSI of each sub channel and
+ *                the decoded SCIs with their PSSCH-RSRP to sps_sensing_t.
+ *
+ *                The TX side counts subframes from its own start time, so
+ *                it publishes which radio time its subframe 0 maps to with
+ *                sensing_rx_set_timeline(); until then nothing is sensed.
+ *
+ *  Reference:    3GPP TS 36.213 Section 14.1.1.6
+ *****************************************************************************/
+
+#ifndef SENSING_RX_H
+#define SENSING_RX_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <srsran/phy/common/timestamp.h>
+#include <srsran/phy/rf/rf.h>
+
+#include "decoder_pool.h"
+#include "sps_sensing.h"
+#include "ue_sl.h"
+
+typedef struct {
+  uint64_t nof_subframes;
+  uint64_t nof_sensed;   // subframes handed to the sensing engine
+  uint64_t nof_decoded;  // SCIs decoded
+  uint64_t nof_realigns; // times the stream lost the 1 ms grid (overflows)
+  uint64_t nof_errors;
+} sensing_rx_stats_t;
+
+typedef struct {
+  srsran_rf_t*       radio;
+  sps_sensing_t*     sps;
+  srsran_ue_sl_t     ue;
+  decoder_pool_t     decoder;
+  srsran_ue_sl_res_t res;
+  int                srate;
+
+  // radio ms - TX subframe index, valid once timeline_valid is set
+  int64_t timeline_offset;
+  bool    timeline_valid;
+
+  bool      running;
+  bool      thread_started;
+  pthread_t thread;
+
+  sensing_rx_stats_t stats;
+} sensing_rx_t;
+
+int sensing_rx_init(sensing_rx_t*                  q,
+                    srsran_rf_t*                   radio,
+                    sps_sensing_t*                 sps,
+                    srsran_cell_sl_t               cell,
+                    srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                    uint32_t                       nof_decoder_threads);
+
+int sensing_rx_start(sensing_rx_t* q);
+
+void sensing_rx_stop(sensing_rx_t* q);
+
+void sensing_rx_free(sensing_rx_t* q);
+
+void sensing_rx_set_timeline(sensing_rx_t* q, const srsran_timestamp_t* t, uint64_t sf_idx);
+
+bool sensing_rx_tti(sensing_rx_t* q, uint64_t sf_idx, uint32_t* tti);
+
+void sensing_rx_print_stats(sensing_rx_t* q, FILE* f);
+
+#endif // SENSING_RX_H
@@ -0,0 +1,350 @@
+/******************************************************************************
+ *  File:         shm_ring.c
+ *
+ *  Description:  Zero-copy message ring in POSIX shared memory (see
+ *                shm_ring.h).
+ *
+ *  Reference:    futex(2), shm_open(3)
+ *****************************************************************************/
+
+extern "C" {
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "latency_stats.h"
+#include "shm_ring.h"
+}
+
+#define SHM_RING_NO_TIMELINE_NS (1000000) // consumer poll period until the TX side publishes its timeline
+
+static int64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Shared between processes, so no FUTEX_PRIVATE_FLAG
+static long futex(uint32_t* addr, int op, uint32_t val, const struct timespec* timeout)
+{
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static shm_ring_slot_t* slot_at(shm_ring_t* q, uint64_t pos)
+{
+  shm_ring_hdr_t* h = q->hdr;
+  return (shm_ring_slot_t*)((uint8_t*)h + h->hdr_size + (size_t)(pos & (h->nof_slots - 1)) * h->slot_size);
+}
+
+// Consumer: free the slot at tail for the producers' next lap
+static void give_back(shm_ring_t* q, shm_ring_slot_t* slot)
+{
+  shm_ring_hdr_t* h    = q->hdr;
+  uint64_t        tail = h->tail;
+  __atomic_store_n(&slot->seq, tail + h->nof_slots, __ATOMIC_RELEASE);
+  __atomic_store_n(&h->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create the ring (transmitter side). A ring of the same name left over from a previous run is replaced.
+ *
+ * @param name shared memory object name, e.g. "/cv2x-tx"
+ * @param nof_slots messages the ring holds, a power of two
+ * @param max_bits TB length, the number of payload bits the encoder reads from every slot
+ */
+int shm_ring_create(shm_ring_t* q, const char* name, uint32_t nof_slots, uint32_t max_bits)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && name != NULL && nof_slots > 0 && (nof_slots & (nof_slots - 1)) == 0 && max_bits > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(shm_ring_t));
+    q->fd = -1;
+
+    uint32_t hdr_size  = (uint32_t)((sizeof(shm_ring_hdr_t) + 63) & ~(size_t)63);
+    uint32_t slot_size = (SHM_RING_SLOT_HDR_SIZE + max_bits + 63) & ~63u;
+    q->size            = hdr_size + (size_t)nof_slots * slot_size;
+
+    shm_unlink(name);
+    q->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (q->fd < 0) {
+      perror("shm_open");
+      goto clean_exit;
+    }
+    q->name = strdup(name);
+    if (ftruncate(q->fd, q->size)) {
+      perror("ftruncate");
+      goto clean_exit;
+    }
+    q->hdr = (shm_ring_hdr_t*)mmap(NULL, q->size, PROT_READ | PROT_WRITE, MAP_SHARED, q->fd, 0);
+    if (q->hdr == MAP_FAILED) {
+      perror("mmap");
+      q->hdr = NULL;
+      goto clean_exit;
+    }
+
+    // ftruncate() zeroed everything, including the payloads
+    q->hdr->version   = SHM_RING_VERSION;
+    q->hdr->nof_slots = nof_slots;
+    q->hdr->slot_size = slot_size;
+    q->hdr->hdr_size  = hdr_size;
+    q->hdr->max_bits  = max_bits;
+    for (uint32_t i = 0; i < nof_slots; i++) {
+      slot_at(q, i)->seq = i;
+    }
+    __atomic_store_n(&q->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    q->running = true;
+    ret        = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    shm_ring_free(q);
+  }
+  return ret;
+}
+
+/**
+ * Map a ring created by the transmitter (producer side).
+ */
+int shm_ring_open(shm_ring_t* q, const char* name)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && name != NULL) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(shm_ring_t));
+    struct stat st;
+    q->fd = shm_open(name, O_RDWR, 0);
+    if (q->fd < 0) {
+      perror("shm_open");
+      goto clean_exit;
+    }
+    if (fstat(q->fd, &st) || (size_t)st.st_size < sizeof(shm_ring_hdr_t)) {
+      ERROR("Shared memory %s is not a message ring\n", name);
+      goto clean_exit;
+    }
+    q->size = st.st_size;
+    q->hdr  = (shm_ring_hdr_t*)mmap(NULL, q->size, PROT_READ | PROT_WRITE, MAP_SHARED, q->fd, 0);
+    if (q->hdr == MAP_FAILED) {
+      perror("mmap");
+      q->hdr = NULL;
+      goto clean_exit;
+    }
+
+    shm_ring_hdr_t* h = q->hdr;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+        (size_t)h->hdr_size + (size_t)h->nof_slots * h->slot_size > q->size) {
+      ERROR("Shared memory %s is not a version %d message ring\n", name, SHM_RING_VERSION);
+      goto clean_exit;
+    }
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    shm_ring_free(q);
+  }
+  return ret;
+}
+
+void shm_ring_free(shm_ring_t* q)
+{
+  if (q) {
+    if (q->hdr) {
+      munmap(q->hdr, q->size);
+    }
+    if (q->fd >= 0) {
+      close(q->fd);
+    }
+    if (q->name) {
+      shm_unlink(q->name);
+      free(q->name);
+    }
+    bzero(q, sizeof(shm_ring_t));
+    q->fd = -1;
+  }
+}
+
+/**
+ * Claim the next free slot (producer). Fill in its bits and metadata, then publish it with shm_ring_commit().
+ *
+ * @return the slot, NULL if the ring is full
+ */
+shm_ring_slot_t* shm_ring_reserve(shm_ring_t* q)
+{
+  shm_ring_hdr_t* h   = q->hdr;
+  uint64_t        pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+
+  while (true) {
+    shm_ring_slot_t* slot = slot_at(q, pos);
+    int64_t          diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&h->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->nof_bits    = h->max_bits;
+        slot->deadline_ns = 0;
+        slot->priority    = 0;
+        slot->sub_channel = SHM_RING_ANY_SUB_CHANNEL;
+        return slot;
+      }
+    } else if (diff < 0) {
+      __atomic_fetch_add(&h->nof_full, 1, __ATOMIC_RELAXED);
+      return NULL;
+    } else {
+      pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED); // another producer got there first
+    }
+  }
+}
+
+/**
+ * TB bits of a slot, max_bits of them, one per byte.
+ *
+ * @return NULL if slot is not a slot of this mapping, or its bits would run past the end of it
+ */
+uint8_t* shm_ring_bits(shm_ring_t* q, shm_ring_slot_t* slot)
+{
+  shm_ring_hdr_t* h      = q->hdr;
+  size_t          offset = (size_t)((uint8_t*)slot - (uint8_t*)h);
+  if (h->slot_size == 0 || (uint8_t*)slot < (uint8_t*)h + h->hdr_size || (offset - h->hdr_size) % h->slot_size != 0 ||
+      offset + SHM_RING_SLOT_HDR_SIZE + h->max_bits > q->size) {
+    return NULL;
+  }
+  return (uint8_t*)slot + SHM_RING_SLOT_HDR_SIZE;
+}
+
+/**
+ * Publish a reserved slot (producer), waking up the transmitter if it waits for a message.
+ */
+void shm_ring_commit(shm_ring_t* q, shm_ring_slot_t* slot)
+{
+  shm_ring_hdr_t* h    = q->hdr;
+  uint8_t*        bits = shm_ring_bits(q, slot);
+  if (bits == NULL) {
+    return;
+  }
+
+  slot->nof_bits = SRSRAN_MIN(slot->nof_bits, h->max_bits);
+  bzero(bits + slot->nof_bits, h->max_bits - slot->nof_bits);
+  slot->enqueue_ns = now_ns();
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_SEQ_CST);
+
+  // Pairs with the consumer's sleeping -> futex -> seq sequence in shm_ring_next(): either it sees the slot, or its
+  // FUTEX_WAIT sees the bumped word, or we see it sleeping
+  __atomic_fetch_add(&h->futex, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->sleeping, __ATOMIC_SEQ_CST)) {
+    futex(&h->futex, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+/**
+ * Publish that subframe sf_idx goes on air at host time host_air_time. Called again whenever the TX side restarts its
+ * timeline.
+ */
+void shm_ring_set_timeline(shm_ring_t* q, double host_air_time, uint64_t sf_idx)
+{
+  int64_t ns = llround(host_air_time * 1e9) - (int64_t)sf_idx * 1000000;
+  __atomic_store_n(&q->timeline_ns, ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->timeline_valid, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Message to send in subframe sf_idx (encoder thread). Waits for one to be committed until the subframe has to be
+ * encoded, dropping messages whose deadline is before the subframe's air time.
+ *
+ * @return the oldest committed slot, to be passed to shm_ring_release() once it is encoded; NULL if the subframe stays
+ *         idle
+ */
+shm_ring_slot_t* shm_ring_next(shm_ring_t* q, uint64_t sf_idx)
+{
+  shm_ring_hdr_t* h = q->hdr;
+
+  while (__atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+    int64_t          now   = now_ns();
+    bool             timed = __atomic_load_n(&q->timeline_valid, __ATOMIC_ACQUIRE);
+    int64_t          air   = __atomic_load_n(&q->timeline_ns, __ATOMIC_RELAXED) + (int64_t)sf_idx * 1000000;
+    int64_t          wake  = timed ? air - (int64_t)(SHM_RING_ENCODE_LEAD_S * 1e9) : now + SHM_RING_NO_TIMELINE_NS;
+    uint64_t         tail  = h->tail; // only this thread writes tail
+    shm_ring_slot_t* slot  = slot_at(q, tail);
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == tail + 1) {
+      if (timed && slot->deadline_ns != 0 && (uint64_t)air > slot->deadline_ns) {
+        q->stats.nof_expired++;
+        give_back(q, slot);
+        continue;
+      }
+      return slot;
+    }
+    if (now >= wake) {
+      break; // too late for this one, the message goes into the next subframe
+    }
+
+    __atomic_store_n(&h->sleeping, 1, __ATOMIC_SEQ_CST);
+    uint32_t val = __atomic_load_n(&h->futex, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != tail + 1 && __atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+      struct timespec timeout;
+      timeout.tv_sec  = (wake - now) / 1000000000;
+      timeout.tv_nsec = (wake - now) % 1000000000;
+      futex(&h->futex, FUTEX_WAIT, val, &timeout);
+      q->stats.nof_wakeups++;
+    }
+    __atomic_store_n(&h->sleeping, 0, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+/**
+ * The slot returned by shm_ring_next() is encoded; hand it back to the producers.
+ */
+void shm_ring_release(shm_ring_t* q, shm_ring_slot_t* slot)
+{
+  double t = (now_ns() - (int64_t)slot->enqueue_ns) * 1e-9;
+  q->stats.nof_consumed++;
+  q->stats.queue_time_sum += t;
+  q->stats.queue_time_max = SRSRAN_MAX(q->stats.queue_time_max, t);
+  latency_record_s(LATENCY_INGEST_QUEUE, t);
+  give_back(q, slot);
+}
+
+/**
+ * Stop consuming and release an encoder waiting in shm_ring_next().
+ */
+void shm_ring_stop(shm_ring_t* q)
+{
+  __atomic_store_n(&q->running, false, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&q->hdr->futex, 1, __ATOMIC_SEQ_CST);
+  futex(&q->hdr->futex, FUTEX_WAKE, INT32_MAX, NULL);
+}
+
+void shm_ring_print_stats(shm_ring_t* q, FILE* f)
+{
+  shm_ring_stats_t* s = &q->stats;
+  fprintf(f,
+          "shm ring: %lu messages sent, %lu expired, %lu rejected on a full ring, %lu wakeups\n",
+          (unsigned long)s->nof_consumed,
+          (unsigned long)s->nof_expired,
+          (unsigned long)__atomic_load_n(&q->hdr->nof_full, __ATOMIC_RELAXED),
+          (unsigned long)s->nof_wakeups);
+  if (s->nof_consumed > 0) {
+    fprintf(f,
+            "shm ring: commit -> encoded avg/max %.3f/%.3f ms\n",
+            s->queue_time_sum / s->nof_consumed * 1e3,
+            s->queue_time_max * 1e3);
+  }
+}
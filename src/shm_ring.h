@@ -0,0 +1,126 @@
+/******************************************************************************
+ *  File:         shm_ring.h
+ *
+ *  Description:  Zero-copy message ring in POSIX shared memory, for V2X
+ *                applications on the same host as the transmitter.
+ *
+ *                The transmitter creates the ring (shm_ring_create()) and
+ *                producers map it by name (shm_ring_open()). A producer
+ *                claims a slot with shm_ring_reserve(), writes the TB bits
+ *                and metadata straight into it and publishes it with
+ *                shm_ring_commit(). The encoder points the PSSCH data at the
+ *                slot's bits, so the payload is never copied, and hands the
+ *                slot back with shm_ring_release() once it is encoded.
+ *
+ *                Layout of the shared object, in host byte order:
+ *
+ *                  offset 0      shm_ring_hdr_t (3 cache lines)
+ *                  hdr_size      slot 0: shm_ring_slot_t, then max_bits
+ *                                payload bytes at SHM_RING_SLOT_HDR_SIZE
+ *                  + slot_size   slot 1 ...
+ *
+ *                Payload bytes hold one TB bit each (0 or 1), most
+ *                significant bit of the message first, which is what
+ *                srsran_pssch_data_t.ptr expects. The encoder always reads
+ *                max_bits of them; shm_ring_commit() zeroes the bits past
+ *                nof_bits.
+ *
+ *                Slots follow a bounded MPSC protocol on their seq field:
+ *                slot i of lap n is free for position p = n * nof_slots + i
+ *                when seq == p, ready for the consumer when seq == p + 1,
+ *                and set to p + nof_slots on release. Producers claim
+ *                positions with a CAS on head, so any number of them can
+ *                share a ring; there is one consumer.
+ *
+ *                The consumer sleeps on the futex word in the header while
+ *                the ring is empty, until its subframe has to be encoded;
+ *                producers bump the word and wake it only if it sleeps. All
+ *                times are CLOCK_MONOTONIC ns.
+ *
+ *  Reference:    futex(2), shm_open(3)
+ *****************************************************************************/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SHM_RING_MAGIC (0x52325643) // "CV2R"
+#define SHM_RING_VERSION (1)
+#define SHM_RING_DEFAULT_SLOTS (64)     // a power of two
+#define SHM_RING_SLOT_HDR_SIZE (64)     // payload offset within a slot
+#define SHM_RING_ANY_SUB_CHANNEL (0xff) // no sub channel preference
+#define SHM_RING_ENCODE_LEAD_S (0.002)  // latest a subframe is encoded before its air time
+
+typedef struct {
+  uint32_t magic; // written last by the creator, once the ring is ready
+  uint32_t version;
+  uint32_t nof_slots;
+  uint32_t slot_size; // bytes, a multiple of 64
+  uint32_t hdr_size;  // bytes before slot 0
+  uint32_t max_bits;  // TB bits per slot
+
+  uint64_t head __attribute__((aligned(64))); // next position producers claim
+  uint64_t nof_full;                          // reserve attempts that found the ring full
+
+  uint64_t tail __attribute__((aligned(64))); // next position the consumer takes, for producers to look at
+  uint32_t futex;                             // bumped on every commit while the consumer sleeps
+  uint32_t sleeping;
+} shm_ring_hdr_t;
+
+typedef struct {
+  uint64_t seq;
+  uint64_t enqueue_ns;  // set by shm_ring_commit()
+  uint64_t deadline_ns; // latest air time, 0 = none; messages that would go out later are dropped
+  uint32_t nof_bits;    // payload bits written by the producer
+  uint8_t  priority;    // SCI priority, 0 (highest) to 7
+  uint8_t  sub_channel; // preferred start sub channel, or SHM_RING_ANY_SUB_CHANNEL
+} shm_ring_slot_t;
+
+typedef struct {
+  uint64_t nof_consumed;
+  uint64_t nof_expired; // dropped, their deadline was before the next air time
+  uint64_t nof_wakeups;
+  double   queue_time_sum; // commit -> encoded
+  double   queue_time_max;
+} shm_ring_stats_t;
+
+typedef struct {
+  int             fd;
+  char*           name; // to unlink on exit, creator only
+  shm_ring_hdr_t* hdr;
+  size_t          size;
+
+  // Consumer only
+  bool             running;
+  int64_t          timeline_ns; // host time at which subframe 0 would be on air, valid once timeline_valid is set
+  bool             timeline_valid;
+  shm_ring_stats_t stats;
+} shm_ring_t;
+
+int shm_ring_create(shm_ring_t* q, const char* name, uint32_t nof_slots, uint32_t max_bits);
+
+int shm_ring_open(shm_ring_t* q, const char* name);
+
+void shm_ring_free(shm_ring_t* q);
+
+shm_ring_slot_t* shm_ring_reserve(shm_ring_t* q);
+
+uint8_t* shm_ring_bits(shm_ring_t* q, shm_ring_slot_t* slot);
+
+void shm_ring_commit(shm_ring_t* q, shm_ring_slot_t* slot);
+
+void shm_ring_set_timeline(shm_ring_t* q, double host_air_time, uint64_t sf_idx);
+
+shm_ring_slot_t* shm_ring_next(shm_ring_t* q, uint64_t sf_idx);
+
+void shm_ring_release(shm_ring_t* q, shm_ring_slot_t* slot);
+
+void shm_ring_stop(shm_ring_t* q);
+
+void shm_ring_print_stats(shm_ring_t* q, FILE* f);
+
+#endif // SHM_RING_H
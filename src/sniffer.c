@@ -0,0 +1,576 @@
+/******************************************************************************
+ *  File:         sniffer.c
+ *
+ *  Description:  Offline sidelink sniffer.
+ *
+ *                Decodes every SCI and TB in an IQ capture (cf32 or cf64, as
+ *                written by sci_decoding/mat_converter.py) with the RX path of
+ *                ue_sl.c. The capture is memory-mapped, so multi-GB files are
+ *                streamed without being read into memory, and split into
+ *                contiguous ranges that are decoded in parallel.
+ *
+ *                Captures at other rates (`-r`, e.g. 7 or 12.5 Msps from a
+ *                spectrum analyzer) are resampled to
+ *                srsran_sampling_freq_hz(nof_prb) on the fly (resampler.h).
+ *                There is no synchronization: subframes are taken every `-s`
+ *                samples from `-O` on, so an unaligned capture needs a step
+ *                smaller than a subframe (e.g. one OFDM symbol).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srsran/phy/common/phy_common_sl.h>
+#include <srsran/phy/utils/debug.h>
+#include "resampler.h"
+#include "ue_sl.h"
+
+}
+
+#define SNIFFER_MAX_THREADS (64)
+#define SNIFFER_CHUNK (16384) // capture samples read and resampled at a time
+
+// === Program arguments ===
+
+/**
+ * -i : input capture file
+ * -f : sample format, "cf32" (default) or "cf64"
+ * -p : number of PRB of the captured channel (default 100, i.e. 20 MHz at 30.72 Msps)
+ * -O : number of samples to skip at the start of the capture
+ * -n : stop after this many ms of capture (default: whole file)
+ * -r : sample rate of the capture in Hz, if it differs from the LTE rate for -p
+ * -s : step in samples (at the LTE rate) between decoded subframes (default: one subframe)
+ * -t : subframe index (tti % 10) to assume for the PSSCH; default tries all 10 once a PSCCH decodes
+ * -w : number of decoding threads
+ * -T : PSCCH detector threshold below which a sub channel is skipped as idle (default 0.3); 0 searches every sub channel
+*/
+
+typedef enum {
+    SNIFFER_CF32 = 0,
+    SNIFFER_CF64,
+} sample_format_t;
+
+typedef struct {
+    char* input_file_name;
+    sample_format_t format;
+    uint32_t nof_prb;
+    uint64_t sample_offset;
+    uint64_t max_ms; // 0 = whole file
+    uint32_t capture_rate; // 0 = LTE rate
+    uint32_t step; // 0 = one subframe
+    int tti; // -1 = search
+    uint32_t nof_threads;
+    float detect_threshold;
+} prog_args_t;
+
+void args_default(prog_args_t* args) {
+    args->input_file_name = NULL;
+    args->format = SNIFFER_CF32;
+    args->nof_prb = 100;
+    args->sample_offset = 0;
+    args->max_ms = 0;
+    args->capture_rate = 0;
+    args->step = 0;
+    args->tti = -1;
+    args->nof_threads = 1;
+    args->detect_threshold = SRSRAN_UE_SL_DEFAULT_DETECT_THRESHOLD;
+}
+
+static prog_args_t prog_args;
+
+void usage(char* prog) {
+    printf("Usage: %s -i capture [-f cf32|cf64] [-p nof_prb] [-O sample_offset] [-n max_ms] [-r capture_rate] [-s step] [-t tti] [-w threads] [-T threshold]\n", prog);
+}
+
+void parse_args(prog_args_t* args, int argc, char** argv) {
+    int option;
+    args_default(args);
+
+    while ((option = getopt(argc, argv, "f:i:n:O:p:r:s:t:T:w:")) != -1) {
+        switch (option) {
+            case 'f':
+                if (strcmp(optarg, "cf32") == 0) {
+                    args->format = SNIFFER_CF32;
+                } else if (strcmp(optarg, "cf64") == 0) {
+                    args->format = SNIFFER_CF64;
+                } else {
+                    printf("Unknown sample format: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'i':
+                args->input_file_name = optarg;
+                break;
+            case 'n':
+                args->max_ms = strtoull(optarg, NULL, 10);
+                break;
+            case 'O':
+                args->sample_offset = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                args->nof_prb = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                args->capture_rate = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                args->step = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                args->tti = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'T':
+                args->detect_threshold = strtof(optarg, NULL);
+                break;
+            case 'w':
+                args->nof_threads = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                exit(-1);
+        }
+    }
+    if (args->input_file_name == NULL) {
+        usage(argv[0]);
+        exit(-1);
+    }
+    if (args->nof_threads == 0 || args->nof_threads > SNIFFER_MAX_THREADS) {
+        printf("Number of threads must be between 1 and %d\n", SNIFFER_MAX_THREADS);
+        exit(-1);
+    }
+}
+
+bool keep_running = true;
+
+void signal_interrupt_handler(int signal_number) {
+    if (signal_number == SIGINT) {
+        keep_running = false;
+    }
+}
+
+// === Capture ===
+
+typedef struct {
+    const void* data;
+    size_t size;
+    sample_format_t format;
+    uint64_t nof_samples;
+} capture_t;
+
+static uint32_t sample_size(sample_format_t format) {
+    return format == SNIFFER_CF64 ? 2 * sizeof(double) : sizeof(cf_t);
+}
+
+/**
+ * Map the whole capture read-only. Pages are only read in as the decoders get to them.
+*/
+static int capture_open(capture_t* c, const char* path, sample_format_t format) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return SRSRAN_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ERROR("Could not get the size of %s or it is empty\n", path);
+        close(fd);
+        return SRSRAN_ERROR;
+    }
+    c->size = st.st_size;
+    c->format = format;
+    c->nof_samples = c->size / sample_size(format);
+    c->data = mmap(NULL, c->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (c->data == MAP_FAILED) {
+        perror("mmap");
+        return SRSRAN_ERROR;
+    }
+    madvise((void*)c->data, c->size, MADV_SEQUENTIAL);
+    return SRSRAN_SUCCESS;
+}
+
+static void capture_close(capture_t* c) {
+    munmap((void*)c->data, c->size);
+}
+
+/**
+ * Copy nof_samples samples starting at sample idx into out, converting to cf32.
+*/
+static void capture_read(capture_t* c, uint64_t idx, uint32_t nof_samples, cf_t* out) {
+    if (c->format == SNIFFER_CF32) {
+        memcpy(out, (const cf_t*)c->data + idx, nof_samples * sizeof(cf_t));
+    } else {
+        const double* in = (const double*)c->data + 2 * idx;
+        float* o = (float*)out;
+        for (uint32_t i = 0; i < 2 * nof_samples; i++) {
+            o[i] = (float)in[i];
+        }
+    }
+}
+
+// === Decoding ===
+
+/**
+ * One decoding thread: its own UE, a contiguous range of the capture, and a memory buffer for its output so
+ * results can be printed in capture order at the end.
+ *
+ * The thread reads its range in chunks, converts (and if needed resamples) them into `stream`, and decodes
+ * subframes from the front of `stream` every `step` samples.
+*/
+typedef struct {
+    capture_t* capture;
+    uint64_t first_sample; // capture sample the thread starts reading at
+    uint64_t end_sample;   // no subframe may start at or after this capture sample
+    uint32_t step;
+    int tti;
+    double in_per_out; // capture samples per LTE rate sample
+    double delay;      // resampler group delay, in capture samples
+
+    srsran_ue_sl_t ue;
+    srsran_ue_sl_res_t res;
+
+    bool resample;
+    resampler_t resampler;
+    cf_t* chunk;  // SNIFFER_CHUNK capture samples converted to cf32
+    cf_t* stream; // LTE rate samples not decoded yet
+    uint32_t stream_len;
+    uint64_t stream_pos; // LTE rate samples consumed since first_sample
+    uint64_t read_pos;   // next capture sample to read
+
+    char* out_buf;
+    size_t out_len;
+    FILE* out;
+
+    uint64_t nof_subframes;
+    uint64_t nof_tb;
+
+    pthread_t thread;
+} sniffer_worker_t;
+
+static void print_tb(FILE* f, uint8_t* bits, uint32_t nof_bits) {
+    for (uint32_t i = 0; i + 8 <= nof_bits; i += 8) {
+        uint32_t byte = 0;
+        for (uint32_t b = 0; b < 8; b++) {
+            byte = (byte << 1) | (bits[i + b] & 1);
+        }
+        fprintf(f, "%02x", byte);
+    }
+    fprintf(f, "\n");
+}
+
+static void report(sniffer_worker_t* w, uint64_t sample, uint32_t subch, uint32_t tti, uint32_t capture_rate) {
+    char sci_msg[SRSRAN_SCI_MSG_MAX_LEN] = {};
+    srsran_sci_info(&w->res.sci[subch], sci_msg, sizeof(sci_msg));
+    size_t len = strlen(sci_msg);
+    while (len > 0 && sci_msg[len - 1] == '\n') {
+        sci_msg[--len] = '\0';
+    }
+
+    uint32_t nof_bits = w->ue.pssch_rx[subch].sl_sch_tb_len;
+    fprintf(w->out, "%.3f ms (sample %lu), sub channel %u, tti %u: %s\n",
+            sample * 1e3 / capture_rate, (unsigned long)sample, subch, tti, sci_msg);
+    fprintf(w->out, "  tb (%u bits): ", nof_bits);
+    print_tb(w->out, w->res.data[subch], nof_bits);
+}
+
+/**
+ * Decode all sub channels of the subframe in signal_buffer_rx[0].
+ * Without a known tti, sub channels whose PSCCH decoded but PSSCH didn't have their PSSCH retried with every
+ * subframe index, reusing the decoded SCI.
+ * Returns the number of TBs found.
+*/
+static uint32_t decode_subframe(sniffer_worker_t* w, uint64_t sample, uint32_t capture_rate) {
+    srsran_ue_sl_t* ue = &w->ue;
+    uint32_t nof_tb = 0;
+
+    srsran_ue_sl_decode_fft_estimate(ue);
+
+    for (uint32_t subch = 0; subch < ue->sl_comm_resource_pool.num_sub_channel; subch++) {
+        srsran_sl_sf_cfg_t sf;
+        sf.tti = w->tti >= 0 ? (uint32_t)w->tti : 0;
+
+        uint64_t nof_pscch = ue->rx_stats[subch].nof_pscch_decoded;
+        int ret = srsran_ue_sl_decode_subch(ue, &sf, subch, &w->res);
+        if (ret != SRSRAN_SUCCESS && w->tti < 0 && ue->rx_stats[subch].nof_pscch_decoded > nof_pscch) {
+            for (sf.tti = 1; sf.tti < 10 && ret != SRSRAN_SUCCESS; sf.tti++) {
+                ret = srsran_ue_sl_decode_subch_pssch(ue, &sf, subch, &w->res);
+            }
+            sf.tti--;
+        }
+        if (ret == SRSRAN_SUCCESS) {
+            report(w, sample, subch, sf.tti, capture_rate);
+            nof_tb++;
+        }
+    }
+    return nof_tb;
+}
+
+/**
+ * Top up the stream with the next chunk of the capture. Returns false at the end of the capture.
+*/
+static bool worker_refill(sniffer_worker_t* w) {
+    capture_t* c = w->capture;
+    if (w->read_pos >= c->nof_samples) {
+        return false;
+    }
+    uint32_t n = (uint32_t)SRSRAN_MIN((uint64_t)SNIFFER_CHUNK, c->nof_samples - w->read_pos);
+    if (w->resample) {
+        capture_read(c, w->read_pos, n, w->chunk);
+        w->stream_len += resampler_process(&w->resampler, w->chunk, n, &w->stream[w->stream_len]);
+    } else {
+        capture_read(c, w->read_pos, n, &w->stream[w->stream_len]);
+        w->stream_len += n;
+    }
+    w->read_pos += n;
+    return true;
+}
+
+static void* worker_run(void* arg) {
+    sniffer_worker_t* w = (sniffer_worker_t*)arg;
+    uint32_t sf_len = w->ue.sf_len;
+    uint32_t capture_rate = prog_args.capture_rate;
+
+    w->read_pos = w->first_sample;
+    while (keep_running) {
+        //- Capture sample the next subframe starts at; the resampler output lags its input by its group delay
+        double pos = w->first_sample + w->stream_pos * w->in_per_out;
+        if (pos >= w->end_sample) {
+            break;
+        }
+        uint64_t sample = (uint64_t)SRSRAN_MAX(pos - w->delay + 0.5, 0.0);
+
+        while (w->stream_len < sf_len && worker_refill(w)) {
+        }
+        if (w->stream_len < sf_len) {
+            break;
+        }
+
+        srsran_vec_cf_copy(w->ue.signal_buffer_rx[0], w->stream, sf_len);
+        w->nof_subframes++;
+
+        uint32_t nof_tb = decode_subframe(w, sample, capture_rate);
+        w->nof_tb += nof_tb;
+
+        //- A subframe holds at most one transmission per sub channel, so jump past it once something decoded
+        uint64_t advance = nof_tb > 0 ? sf_len : w->step;
+        w->stream_pos += advance;
+        //- A step of more than a subframe can run past what is buffered: skip the rest in the capture directly, or,
+        //-   when resampling, run it through the resampler so its phase stays right, and drop the output
+        while (advance > 0) {
+            uint32_t n = (uint32_t)SRSRAN_MIN(advance, (uint64_t)w->stream_len);
+            memmove(w->stream, &w->stream[n], (w->stream_len - n) * sizeof(cf_t));
+            w->stream_len -= n;
+            advance -= n;
+            if (advance > 0 && !w->resample) {
+                w->read_pos += advance;
+                advance = 0;
+            } else if (advance > 0 && !worker_refill(w)) {
+                break;
+            }
+        }
+    }
+    fflush(w->out);
+    return NULL;
+}
+
+static int worker_init(sniffer_worker_t* w, capture_t* capture, srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t pool) {
+    bzero(w, sizeof(sniffer_worker_t));
+    w->capture = capture;
+    if (srsran_ue_sl_init(&w->ue, cell, pool, 1)) {
+        ERROR("Error initializing UE\n");
+        return SRSRAN_ERROR;
+    }
+    srsran_ue_sl_set_detect_threshold(&w->ue, prog_args.detect_threshold);
+    for (uint32_t i = 0; i < pool.num_sub_channel; i++) {
+        w->res.data[i] = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN);
+        if (!w->res.data[i]) {
+            perror("malloc");
+            return SRSRAN_ERROR;
+        }
+    }
+
+    uint32_t srate = (uint32_t)srsran_sampling_freq_hz(cell.nof_prb);
+    uint32_t stream_size = w->ue.sf_len + SNIFFER_CHUNK;
+    w->in_per_out = (double)prog_args.capture_rate / srate;
+    w->resample = prog_args.capture_rate != srate;
+    if (w->resample) {
+        if (resampler_init(&w->resampler, prog_args.capture_rate, srate, RESAMPLER_DEFAULT_TAPS_PER_PHASE)) {
+            return SRSRAN_ERROR;
+        }
+        w->delay = (w->resampler.interp * RESAMPLER_DEFAULT_TAPS_PER_PHASE - 1) / (2.0 * w->resampler.interp);
+        stream_size = w->ue.sf_len + resampler_max_output(&w->resampler, SNIFFER_CHUNK);
+        w->chunk = srsran_vec_cf_malloc(SNIFFER_CHUNK);
+        if (!w->chunk) {
+            perror("malloc");
+            return SRSRAN_ERROR;
+        }
+    }
+    w->stream = srsran_vec_cf_malloc(stream_size);
+    if (!w->stream) {
+        perror("malloc");
+        return SRSRAN_ERROR;
+    }
+
+    w->out = open_memstream(&w->out_buf, &w->out_len);
+    if (!w->out) {
+        perror("open_memstream");
+        return SRSRAN_ERROR;
+    }
+    return SRSRAN_SUCCESS;
+}
+
+static void worker_free(sniffer_worker_t* w) {
+    if (w->out) {
+        fclose(w->out);
+    }
+    if (w->out_buf) {
+        free(w->out_buf);
+    }
+    for (uint32_t i = 0; i < SRSRAN_MAX_NUM_SUB_CHANNEL; i++) {
+        if (w->res.data[i]) {
+            free(w->res.data[i]);
+        }
+    }
+    if (w->chunk) {
+        free(w->chunk);
+    }
+    if (w->stream) {
+        free(w->stream);
+    }
+    resampler_free(&w->resampler);
+    srsran_ue_sl_free(&w->ue);
+}
+
+// === Primary code ===
+int main(int argc, char** argv) {
+    signal(SIGINT, signal_interrupt_handler);
+    parse_args(&prog_args, argc, argv);
+
+    srsran_cell_sl_t cell_sl = {
+        .tm = SRSRAN_SIDELINK_TM4,
+        .N_sl_id = 19,
+        .nof_prb = prog_args.nof_prb,
+        .cp = SRSRAN_CP_NORM,
+    };
+
+    srsran_sl_comm_resource_pool_t sl_comm_resource_pool;
+    if (srsran_sl_comm_resource_pool_get_default_config(&sl_comm_resource_pool, cell_sl)) {
+        ERROR("Error initializing sl_comm_resource_pool\n");
+        return SRSRAN_ERROR;
+    }
+
+    int srate = srsran_sampling_freq_hz(cell_sl.nof_prb);
+    if (srate == -1) {
+        ERROR("Invalid number of PRB %d\n", cell_sl.nof_prb);
+        return SRSRAN_ERROR;
+    }
+
+    if (prog_args.capture_rate == 0) {
+        prog_args.capture_rate = srate;
+    }
+    double in_per_out = (double)prog_args.capture_rate / srate;
+
+    capture_t capture;
+    if (capture_open(&capture, prog_args.input_file_name, prog_args.format)) {
+        return SRSRAN_ERROR;
+    }
+
+    uint32_t sf_len = SRSRAN_SF_LEN_PRB(cell_sl.nof_prb);
+    uint32_t step = prog_args.step > 0 ? prog_args.step : sf_len;
+
+    //- Range of subframe start positions in capture samples: every one must leave a full subframe in the capture
+    uint64_t first = prog_args.sample_offset;
+    uint64_t sf_in = (uint64_t)(sf_len * in_per_out + 0.5);
+    uint64_t end = capture.nof_samples >= sf_in ? capture.nof_samples - sf_in + 1 : 0;
+    if (prog_args.max_ms > 0) {
+        end = SRSRAN_MIN(end, first + prog_args.max_ms * prog_args.capture_rate / 1000);
+    }
+    if (first >= end) {
+        ERROR("Capture has fewer than one subframe (%u samples) after sample %lu\n", sf_len, (unsigned long)first);
+        capture_close(&capture);
+        return SRSRAN_ERROR;
+    }
+    printf("%s: %lu samples, %.3f s at %.2f Msps, %u threads\n",
+           prog_args.input_file_name, (unsigned long)capture.nof_samples,
+           capture.nof_samples / (double)prog_args.capture_rate, prog_args.capture_rate / 1e6, prog_args.nof_threads);
+    if (prog_args.capture_rate != (uint32_t)srate) {
+        printf("Resampling to %.2f Msps for %u PRB\n", srate / 1e6, cell_sl.nof_prb);
+    }
+
+    //- Split the start positions into contiguous, step-aligned ranges, one per thread. Steps are at the LTE rate.
+    static sniffer_worker_t workers[SNIFFER_MAX_THREADS];
+    uint32_t nof_threads = prog_args.nof_threads;
+    double step_in = step * in_per_out;
+    uint64_t nof_steps = (uint64_t)((end - first) / step_in) + 1;
+    uint64_t steps_per_thread = (nof_steps + nof_threads - 1) / nof_threads;
+
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    uint32_t nof_started = 0;
+    for (uint32_t i = 0; i < nof_threads; i++) {
+        sniffer_worker_t* w = &workers[i];
+        if (worker_init(w, &capture, cell_sl, sl_comm_resource_pool)) {
+            exit(-1);
+        }
+        w->step = step;
+        w->tti = prog_args.tti;
+        w->first_sample = SRSRAN_MIN(first + (uint64_t)(i * steps_per_thread * step_in), end);
+        w->end_sample = SRSRAN_MIN(first + (uint64_t)((i + 1) * steps_per_thread * step_in), end);
+        if (pthread_create(&w->thread, NULL, worker_run, w)) {
+            perror("pthread_create");
+            exit(-1);
+        }
+        nof_started++;
+    }
+
+    uint64_t nof_subframes = 0, nof_tb = 0;
+    srsran_ue_sl_rx_stats_t rx_total = {};
+    for (uint32_t i = 0; i < nof_started; i++) {
+        sniffer_worker_t* w = &workers[i];
+        pthread_join(w->thread, NULL);
+        fflush(w->out);
+        fwrite(w->out_buf, 1, w->out_len, stdout);
+
+        nof_subframes += w->nof_subframes;
+        nof_tb += w->nof_tb;
+        srsran_ue_sl_rx_stats_t rx;
+        srsran_ue_sl_get_rx_stats(&w->ue, &rx);
+        rx_total.nof_searches += rx.nof_searches;
+        rx_total.nof_gated += rx.nof_gated;
+        rx_total.nof_pscch_decoded += rx.nof_pscch_decoded;
+        rx_total.nof_pssch_decoded += rx.nof_pssch_decoded;
+        rx_total.nof_pssch_retries += rx.nof_pssch_retries;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+    double capture_s = (end - first) / (double)prog_args.capture_rate;
+
+    printf("%lu subframes decoded, %lu TBs found; %lu sub channel searches, %lu skipped as idle, %lu PSCCH / %lu PSSCH decoded, "
+           "%lu PSSCH retries\n",
+           (unsigned long)nof_subframes, (unsigned long)nof_tb, (unsigned long)rx_total.nof_searches,
+           (unsigned long)rx_total.nof_gated, (unsigned long)rx_total.nof_pscch_decoded,
+           (unsigned long)rx_total.nof_pssch_decoded, (unsigned long)rx_total.nof_pssch_retries);
+    printf("%.3f s of capture in %.3f s (%.1fx real time)\n", capture_s, elapsed, elapsed > 0 ? capture_s / elapsed : 0.0);
+
+    for (uint32_t i = 0; i < nof_started; i++) {
+        worker_free(&workers[i]);
+    }
+    capture_close(&capture);
+
+    return SRSRAN_SUCCESS;
+}
@@ -0,0 +1,384 @@
+/******************************************************************************
+ *  File:         sps_sensing.c
+ *
+ *  Description:  Sensing-based semi-persistent resource selection (see sps_sensing.h).
+ *
+ *  Reference:    3GPP TS 36.213 Section 14.1.1.6
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sps_sensing.h"
+}
+
+void sps_sensing_cfg_default(sps_sensing_cfg_t* cfg)
+{
+  cfg->priority          = 1;
+  cfg->intvl_ms          = 100;
+  cfg->l_sub_channel     = 1;
+  cfg->num_sub_channel   = 1;
+  cfg->rsrp_threshold_db = -60.0f;
+  cfg->priority_step_db  = 0.0f;
+  cfg->keep_prob         = 0.0f;
+  cfg->t1                = SPS_SENSING_DEFAULT_T1;
+  cfg->t2                = SPS_SENSING_DEFAULT_T2;
+  cfg->seed              = 0;
+}
+
+static uint32_t next_rand(sps_sensing_t* q)
+{
+  // xorshift32
+  uint32_t x = q->rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  q->rand_state = x;
+  return x;
+}
+
+// Uniform in [lo, hi]
+static uint32_t rand_range(sps_sensing_t* q, uint32_t lo, uint32_t hi)
+{
+  return lo + next_rand(q) % (hi - lo + 1);
+}
+
+// Reselection counter for our reservation interval
+static uint32_t draw_counter(sps_sensing_t* q)
+{
+  if (q->cfg.intvl_ms >= 100) {
+    return rand_range(q, 5, 15);
+  } else if (q->cfg.intvl_ms >= 50) {
+    return rand_range(q, 10, 30);
+  }
+  return rand_range(q, 25, 75);
+}
+
+// Subframes from the start of the selection window to its end
+static uint32_t window_len(const sps_sensing_cfg_t* cfg)
+{
+  return SRSRAN_MIN(cfg->t2, cfg->intvl_ms) - cfg->t1 + 1;
+}
+
+static uint32_t nof_positions(const sps_sensing_cfg_t* cfg)
+{
+  return cfg->num_sub_channel - cfg->l_sub_channel + 1;
+}
+
+/**
+ * @param cfg the selection window is [n + t1, n + min(t2, intvl_ms)], with t1 <= 4 and 20 <= t2 <= 100 per the spec
+ */
+int sps_sensing_init(sps_sensing_t* q, const sps_sensing_cfg_t* cfg)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && cfg != NULL && cfg->num_sub_channel > 0 && cfg->num_sub_channel <= SRSRAN_MAX_NUM_SUB_CHANNEL &&
+      cfg->l_sub_channel > 0 && cfg->l_sub_channel <= cfg->num_sub_channel && cfg->intvl_ms > 0 && cfg->t1 > 0 &&
+      SRSRAN_MIN(cfg->t2, cfg->intvl_ms) >= cfg->t1) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(sps_sensing_t));
+    q->cfg = *cfg;
+    pthread_mutex_init(&q->mutex, NULL);
+
+    q->rand_state = cfg->seed != 0 ? cfg->seed : (uint32_t)time(NULL) | 1;
+
+    uint32_t nof_candidates = window_len(cfg) * nof_positions(cfg);
+    q->history              = (sps_sensing_sf_t*)calloc(SPS_SENSING_WINDOW_MS, sizeof(sps_sensing_sf_t));
+    q->own_tx               = (uint64_t*)calloc(SPS_SENSING_WINDOW_MS, sizeof(uint64_t));
+    q->excluded             = (uint8_t*)calloc(nof_candidates, sizeof(uint8_t));
+    q->candidates           = (sps_sensing_candidate_t*)calloc(nof_candidates, sizeof(sps_sensing_candidate_t));
+    if (!q->history || !q->own_tx || !q->excluded || !q->candidates) {
+      perror("calloc");
+      goto clean_exit;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    sps_sensing_free(q);
+  }
+  return ret;
+}
+
+void sps_sensing_free(sps_sensing_t* q)
+{
+  if (q) {
+    if (q->history) {
+      free(q->history);
+    }
+    if (q->own_tx) {
+      free(q->own_tx);
+    }
+    if (q->excluded) {
+      free(q->excluded);
+    }
+    if (q->candidates) {
+      free(q->candidates);
+    }
+    pthread_mutex_destroy(&q->mutex);
+    bzero(q, sizeof(sps_sensing_t));
+  }
+}
+
+/**
+ * Record the sensing result of one subframe. Subframes must come in increasing order; gaps are fine.
+ *
+ * @param rssi S-RSSI of every sub channel of the pool, linear
+ * @param sci the SCIs decoded in this subframe, with their PSSCH-RSRP
+ */
+void sps_sensing_sense(sps_sensing_t* q, uint64_t sf_idx, const float* rssi, const sps_sensing_sci_t* sci, uint32_t nof_sci)
+{
+  uint32_t nof_subch = q->cfg.num_sub_channel;
+
+  pthread_mutex_lock(&q->mutex);
+
+  // Half duplex: whatever we received while transmitting is our own signal
+  if (q->own_tx[sf_idx % SPS_SENSING_WINDOW_MS] == sf_idx + 1) {
+    q->stats.nof_own_tx_skipped++;
+    pthread_mutex_unlock(&q->mutex);
+    return;
+  }
+
+  // The entry being overwritten leaves the sensing window
+  sps_sensing_sf_t* h = &q->history[sf_idx % SPS_SENSING_WINDOW_MS];
+  if (h->sensed) {
+    uint32_t old = h->sf_idx % SPS_SENSING_P_STEP_MS;
+    for (uint32_t k = 0; k < nof_subch; k++) {
+      q->rssi_sum[old][k] -= h->rssi[k];
+      q->rssi_cnt[old][k]--;
+    }
+  }
+
+  uint32_t slot = sf_idx % SPS_SENSING_P_STEP_MS;
+  h->sf_idx     = sf_idx;
+  h->sensed     = true;
+  for (uint32_t k = 0; k < nof_subch; k++) {
+    h->rssi[k] = rssi[k];
+    q->rssi_sum[slot][k] += rssi[k];
+    q->rssi_cnt[slot][k]++;
+  }
+  h->nof_sci = SRSRAN_MIN(nof_sci, SRSRAN_MAX_NUM_SUB_CHANNEL);
+  memcpy(h->sci, sci, h->nof_sci * sizeof(sps_sensing_sci_t));
+
+  q->stats.nof_sensed++;
+  q->stats.nof_sci += h->nof_sci;
+
+  pthread_mutex_unlock(&q->mutex);
+}
+
+/**
+ * Exclude every candidate that overlaps a reservation sensed above the threshold (step 6 of 14.1.1.6).
+ *
+ * Our transmissions would be at y + j * intvl_ms for j < counter, and the window is at most intvl_ms long, so
+ * every sensed reservation r in [wstart, wend + (counter - 1) * intvl_ms] lands on exactly one window subframe.
+ *
+ * @return number of candidates left
+ */
+static uint32_t exclude(sps_sensing_t* q, uint64_t n, float threshold_offset_db)
+{
+  sps_sensing_cfg_t* cfg     = &q->cfg;
+  uint32_t           len     = window_len(cfg);
+  uint32_t           npos    = nof_positions(cfg);
+  uint32_t           left    = len * npos;
+  uint64_t           wstart  = n + cfg->t1;
+  uint64_t           horizon = wstart + len - 1 + (uint64_t)(q->counter - 1) * cfg->intvl_ms;
+
+  memset(q->excluded, 0, len * npos);
+
+  for (uint32_t i = 0; i < SPS_SENSING_WINDOW_MS; i++) {
+    sps_sensing_sf_t* h = &q->history[i];
+    if (!h->sensed || h->sf_idx + SPS_SENSING_WINDOW_MS < n) {
+      continue;
+    }
+
+    for (uint32_t m = 0; m < h->nof_sci; m++) {
+      sps_sensing_sci_t* sci = &h->sci[m];
+      float threshold = cfg->rsrp_threshold_db + cfg->priority_step_db * ((float)sci->priority - (float)cfg->priority) +
+                        threshold_offset_db;
+      if (sci->intvl_ms == 0 || sci->rsrp_db <= threshold) {
+        continue;
+      }
+
+      // Candidate start positions whose sub channels overlap the sensed allocation
+      uint32_t first = sci->sub_channel_start_idx + 1 > cfg->l_sub_channel
+                           ? sci->sub_channel_start_idx + 1 - cfg->l_sub_channel
+                           : 0;
+      uint32_t last  = SRSRAN_MIN(sci->sub_channel_start_idx + sci->l_sub_channel - 1, npos - 1);
+
+      for (uint64_t r = h->sf_idx + sci->intvl_ms; r <= horizon; r += sci->intvl_ms) {
+        if (r < wstart) {
+          continue;
+        }
+        uint64_t y = (r - wstart) % cfg->intvl_ms;
+        if (y >= len) {
+          continue;
+        }
+        for (uint32_t s = first; s <= last; s++) {
+          uint8_t* e = &q->excluded[y * npos + s];
+          if (!*e) {
+            *e = 1;
+            left--;
+          }
+        }
+      }
+    }
+  }
+  return left;
+}
+
+static int compare_rssi(const void* a, const void* b)
+{
+  float x = ((const sps_sensing_candidate_t*)a)->rssi;
+  float y = ((const sps_sensing_candidate_t*)b)->rssi;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Pick a new reservation in the selection window of subframe n.
+ */
+static void select_resource(sps_sensing_t* q, uint64_t n)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  sps_sensing_cfg_t* cfg   = &q->cfg;
+  uint32_t           len   = window_len(cfg);
+  uint32_t           npos  = nof_positions(cfg);
+  uint32_t           total = len * npos;
+  uint64_t           wstart = n + cfg->t1;
+
+  // The counter is drawn first, it sets how far ahead our reservation has to be free
+  q->counter = draw_counter(q);
+
+  // Raise the threshold until enough candidates are left
+  uint32_t min_left = (uint32_t)ceilf(SPS_SENSING_MIN_CANDIDATES * total);
+  uint32_t left     = 0;
+  for (uint32_t step = 0; step < SPS_SENSING_MAX_THRESHOLD_STEPS; step++) {
+    left = exclude(q, n, step * SPS_SENSING_THRESHOLD_STEP_DB);
+    if (left >= min_left) {
+      break;
+    }
+    q->stats.nof_threshold_steps++;
+  }
+  if (left == 0) {
+    memset(q->excluded, 0, total);
+    left = total;
+  }
+
+  // Rank the rest by S-RSSI averaged over the sensed subframes P_step apart, and pick among the quietest 20 %
+  uint32_t nof_candidates = 0;
+  for (uint32_t y = 0; y < len; y++) {
+    uint32_t slot = (wstart + y) % SPS_SENSING_P_STEP_MS;
+    for (uint32_t s = 0; s < npos; s++) {
+      if (q->excluded[y * npos + s]) {
+        continue;
+      }
+      float rssi = 0.0f;
+      for (uint32_t k = s; k < s + cfg->l_sub_channel; k++) {
+        if (q->rssi_cnt[slot][k] > 0) {
+          rssi += q->rssi_sum[slot][k] / q->rssi_cnt[slot][k];
+        }
+      }
+      q->candidates[nof_candidates].rssi = rssi;
+      q->candidates[nof_candidates].idx  = y * npos + s;
+      nof_candidates++;
+    }
+  }
+
+  uint32_t nof_best = SRSRAN_MAX(1, (uint32_t)(SPS_SENSING_MIN_CANDIDATES * total));
+  nof_best          = SRSRAN_MIN(nof_best, nof_candidates);
+  qsort(q->candidates, nof_candidates, sizeof(sps_sensing_candidate_t), compare_rssi);
+
+  uint32_t pick            = q->candidates[rand_range(q, 0, nof_best - 1)].idx;
+  q->next_tx               = wstart + pick / npos;
+  q->sub_channel_start_idx = pick % npos;
+  q->reserved              = true;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  q->stats.nof_selections++;
+  q->stats.nof_candidates = total;
+  q->stats.nof_excluded   = total - left;
+  q->stats.selection_time_sum += t;
+  q->stats.selection_time_max = SRSRAN_MAX(q->stats.selection_time_max, t);
+}
+
+/**
+ * Whether we transmit in subframe sf_idx, selecting or reselecting the reservation as needed.
+ * Must be called for every subframe in increasing order (gaps trigger a reselection).
+ *
+ * @param sub_channel_start_idx set to the first sub channel to transmit in, if we transmit
+ */
+bool sps_sensing_tx(sps_sensing_t* q, uint64_t sf_idx, uint32_t* sub_channel_start_idx)
+{
+  bool tx = false;
+
+  pthread_mutex_lock(&q->mutex);
+
+  if (q->reserved && sf_idx > q->next_tx) {
+    q->stats.nof_missed++;
+    q->reserved = false;
+  }
+  if (!q->reserved) {
+    select_resource(q, sf_idx);
+  }
+
+  if (sf_idx == q->next_tx) {
+    tx                     = true;
+    *sub_channel_start_idx = q->sub_channel_start_idx;
+    q->own_tx[sf_idx % SPS_SENSING_WINDOW_MS] = sf_idx + 1;
+    q->stats.nof_tx++;
+
+    q->next_tx += q->cfg.intvl_ms;
+    if (--q->counter == 0) {
+      if (next_rand(q) < q->cfg.keep_prob * (float)UINT32_MAX) {
+        q->counter = draw_counter(q);
+        q->stats.nof_kept++;
+      } else {
+        q->reserved = false;
+        q->stats.nof_counter_expired++;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&q->mutex);
+  return tx;
+}
+
+void sps_sensing_print_stats(sps_sensing_t* q, FILE* f)
+{
+  pthread_mutex_lock(&q->mutex);
+  sps_sensing_stats_t* s = &q->stats;
+
+  fprintf(f,
+          "sps: %lu subframes sensed (%lu skipped while transmitting), %lu SCIs\n",
+          (unsigned long)s->nof_sensed,
+          (unsigned long)s->nof_own_tx_skipped,
+          (unsigned long)s->nof_sci);
+  fprintf(f,
+          "sps: %lu transmissions, %lu selections (%lu counter expired, %lu missed), %lu kept, %lu threshold steps\n",
+          (unsigned long)s->nof_tx,
+          (unsigned long)s->nof_selections,
+          (unsigned long)s->nof_counter_expired,
+          (unsigned long)s->nof_missed,
+          (unsigned long)s->nof_kept,
+          (unsigned long)s->nof_threshold_steps);
+  if (s->nof_selections > 0) {
+    fprintf(f,
+            "sps: last selection excluded %lu of %lu candidates, selection time avg/max %.1f/%.1f us\n",
+            (unsigned long)s->nof_excluded,
+            (unsigned long)s->nof_candidates,
+            s->selection_time_sum / s->nof_selections * 1e6,
+            s->selection_time_max * 1e6);
+  }
+  pthread_mutex_unlock(&q->mutex);
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+ *  File:         sps_sensing.h
+ *
+ *  Description:  Sensing-based semi-persistent resource selection (Mode 4).
+ *
+ *                Keeps the last 1000 ms of sensing results (S-RSSI of every
+ *                sub channel and the SCIs decoded with their PSSCH-RSRP) and
+ *                picks the sub channel and subframe this UE reserves:
+ *                candidates in the selection window [n + T1, n + T2] that
+ *                collide with a sensed reservation above the RSRP threshold
+ *                are excluded, the threshold is raised by 3 dB until at
+ *                least 20 % of the candidates are left, and one of the 20 %
+ *                with the lowest average S-RSSI is picked at random. The
+ *                reservation is kept for a random number of transmissions
+ *                (the reselection counter) and then, with probability
+ *                keep_prob, kept for another round.
+ *
+ *                The average S-RSSI of the subframes that are a multiple of
+ *                100 ms apart is maintained incrementally as subframes are
+ *                sensed, so sensing costs O(sub channels) per TTI and a
+ *                selection is one pass over the window and the sensed SCIs.
+ *
+ *                sps_sensing_sense() (RX thread) and sps_sensing_tx()
+ *                (encoder thread) may be called concurrently.
+ *
+ *  Reference:    3GPP TS 36.213 Section 14.1.1.6, TS 36.214 Sections 5.1.28-29
+ *****************************************************************************/
+
+#ifndef SPS_SENSING_H
+#define SPS_SENSING_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ue_sl.h"
+
+#define SPS_SENSING_WINDOW_MS (1000)
+#define SPS_SENSING_P_STEP_MS (100)
+#define SPS_SENSING_MIN_CANDIDATES (0.2f) // fraction of the candidates that must survive the exclusion
+#define SPS_SENSING_THRESHOLD_STEP_DB (3.0f)
+#define SPS_SENSING_MAX_THRESHOLD_STEPS (40)
+#define SPS_SENSING_DEFAULT_T1 (4)
+#define SPS_SENSING_DEFAULT_T2 (100)
+
+typedef struct {
+  uint32_t priority;        // of our transmissions, 0 (highest) to 7
+  uint32_t intvl_ms;        // our reservation interval, 20, 50 or a multiple of 100 up to 1000
+  uint32_t l_sub_channel;   // sub channels per transmission
+  uint32_t num_sub_channel; // of the resource pool
+  float    rsrp_threshold_db; // exclusion threshold when both priorities are equal, on the scale of the measurements
+  float    priority_step_db;  // threshold change per priority level between the sensed SCI and ours
+  float    keep_prob;         // probResourceKeep, 0 to 0.8
+  uint32_t t1;
+  uint32_t t2;
+  uint32_t seed; // 0 = seed from the clock
+} sps_sensing_cfg_t;
+
+typedef struct {
+  uint32_t sub_channel_start_idx;
+  uint32_t l_sub_channel;
+  uint32_t priority;
+  uint32_t intvl_ms; // reservation interval from the SCI, 0 = no reservation
+  float    rsrp_db;  // PSSCH-RSRP
+} sps_sensing_sci_t;
+
+typedef struct {
+  float    rssi; // average S-RSSI over the candidate's sub channels
+  uint32_t idx;  // subframe offset in the selection window * sub channel positions + sub channel
+} sps_sensing_candidate_t;
+
+typedef struct {
+  uint64_t          sf_idx;
+  bool              sensed;
+  float             rssi[SRSRAN_MAX_NUM_SUB_CHANNEL]; // S-RSSI, linear
+  sps_sensing_sci_t sci[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  uint32_t          nof_sci;
+} sps_sensing_sf_t;
+
+typedef struct {
+  uint64_t nof_sensed;
+  uint64_t nof_sci;
+  uint64_t nof_own_tx_skipped; // subframes we transmitted in, so could not sense
+  uint64_t nof_tx;
+  uint64_t nof_selections;
+  uint64_t nof_counter_expired; // reselections because the reselection counter ran out
+  uint64_t nof_missed;          // reselections because the reserved subframe was skipped
+  uint64_t nof_kept;            // times the counter ran out and the resource was kept
+  uint64_t nof_threshold_steps;
+  uint64_t nof_candidates;      // of the last selection
+  uint64_t nof_excluded;        // of the last selection
+  double   selection_time_sum;
+  double   selection_time_max;
+} sps_sensing_stats_t;
+
+typedef struct {
+  sps_sensing_cfg_t cfg;
+
+  sps_sensing_sf_t* history; // SPS_SENSING_WINDOW_MS entries, indexed by sf_idx % SPS_SENSING_WINDOW_MS
+  uint64_t*         own_tx;  // same indexing, sf_idx + 1 of our transmissions there (0 = none)
+
+  // Sum and count of the sensed S-RSSI per (sf_idx % P_step, sub channel) over the sensing window
+  double   rssi_sum[SPS_SENSING_P_STEP_MS][SRSRAN_MAX_NUM_SUB_CHANNEL];
+  uint32_t rssi_cnt[SPS_SENSING_P_STEP_MS][SRSRAN_MAX_NUM_SUB_CHANNEL];
+
+  // Selection scratch, one entry per candidate
+  uint8_t*                 excluded;
+  sps_sensing_candidate_t* candidates;
+
+  // Current reservation
+  bool     reserved;
+  uint64_t next_tx;
+  uint32_t sub_channel_start_idx;
+  uint32_t counter;
+
+  uint32_t            rand_state;
+  pthread_mutex_t     mutex;
+  sps_sensing_stats_t stats;
+} sps_sensing_t;
+
+void sps_sensing_cfg_default(sps_sensing_cfg_t* cfg);
+
+int sps_sensing_init(sps_sensing_t* q, const sps_sensing_cfg_t* cfg);
+
+void sps_sensing_free(sps_sensing_t* q);
+
+void sps_sensing_sense(sps_sensing_t* q, uint64_t sf_idx, const float* rssi, const sps_sensing_sci_t* sci, uint32_t nof_sci);
+
+bool sps_sensing_tx(sps_sensing_t* q, uint64_t sf_idx, uint32_t* sub_channel_start_idx);
+
+void sps_sensing_print_stats(sps_sensing_t* q, FILE* f);
+
+#endif // SPS_SENSING_H
@@ -0,0 +1,632 @@
+/******************************************************************************
+ *  File:         trace_replay.c
+ *
+ *  Description:  Timestamped trace replay for the `-i` input (see
+ *                trace_replay.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <endian.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/bit.h>
+#include <srsran/phy/utils/debug.h>
+
+#include "msg_ingest.h"
+#include "rt_profile.h"
+#include "trace_replay.h"
+#include "tx_pipeline.h"
+}
+
+#define TRACE_REPLAY_FULL_WAIT_US (1000) // parser sleep while the ring is full
+#define TRACE_REPLAY_END (-1)             // parse_row(): nothing left to parse
+#define TRACE_REPLAY_SKIPPED (0)          // parse_row(): no row in this line or record
+#define TRACE_REPLAY_READY (1)            // parse_row(): row filled in
+
+static void unmap_window(trace_replay_t* q)
+{
+  if (q->window != NULL) {
+    munmap((void*)q->window, q->window_len);
+    q->window     = NULL;
+    q->window_len = 0;
+  }
+}
+
+/**
+ * Map TRACE_REPLAY_WINDOW_BYTES of the trace (or up to its end) starting at the page holding off.
+ */
+static int map_window(trace_replay_t* q, size_t off)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t base = off & ~(page - 1);
+  size_t len  = SRSRAN_MIN((size_t)TRACE_REPLAY_WINDOW_BYTES, q->file_size - base);
+
+  unmap_window(q);
+  void* p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, q->fd, (off_t)base);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    return SRSRAN_ERROR;
+  }
+  // Read ahead of the parser, and drop what it has passed
+  madvise(p, len, MADV_SEQUENTIAL);
+  madvise(p, len, MADV_WILLNEED);
+
+  q->window     = (const char*)p;
+  q->window_off = base;
+  q->window_len = len;
+  q->parser_stats.nof_remaps++;
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Pointer to len bytes of the trace at off, moving the window if they are outside it.
+ *
+ * @return NULL if they run past the end of the trace
+ */
+static const char* trace_bytes(trace_replay_t* q, size_t off, size_t len)
+{
+  if (off + len > q->file_size) {
+    return NULL;
+  }
+  if (q->window == NULL || off < q->window_off || off + len > q->window_off + q->window_len) {
+    if (map_window(q, off) || off + len > q->window_off + q->window_len) {
+      return NULL;
+    }
+  }
+  return q->window + (off - q->window_off);
+}
+
+static void malformed(trace_replay_t* q, uint64_t line)
+{
+  if (q->parser_stats.nof_malformed++ == 0) {
+    q->parser_stats.first_malformed = line;
+  }
+}
+
+/**
+ * Fix the subframe of a row recorded at ns: the nearest one to its offset from the first row, but never before the
+ * previous row's, so the ring stays in subframe order.
+ */
+static void schedule_row(trace_replay_t* q, trace_replay_row_t* row, int64_t ns)
+{
+  if (!q->have_first) {
+    q->first_ns   = ns;
+    q->have_first = true;
+  }
+  row->offset_ns = ns - q->first_ns;
+
+  uint64_t sf_idx = row->offset_ns > 0 ? (uint64_t)((row->offset_ns + 500000) / 1000000) : 0;
+  row->sf_idx     = SRSRAN_MAX(sf_idx, q->last_sf_idx);
+  q->last_sf_idx  = row->sf_idx;
+}
+
+// Bits a row writes don't cover what a longer row left in the same slot before it; clear those
+static void clear_tail(trace_replay_row_t* row, uint32_t old_bits)
+{
+  if (old_bits > row->nof_bits) {
+    memset(&row->bits[row->nof_bits], 0, old_bits - row->nof_bits);
+  }
+}
+
+static bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+/**
+ * Seconds with up to 9 decimals, as ns. Digits past the 9th decimal are ignored.
+ */
+static bool parse_seconds(const char** p, const char* end, int64_t* ns)
+{
+  const char* s      = *p;
+  int64_t     secs   = 0;
+  int64_t     frac   = 0;
+  int         nof_fd = 0;
+  bool        any    = false;
+
+  for (; s < end && is_digit(*s); s++) {
+    secs = secs * 10 + (*s - '0');
+    any  = true;
+  }
+  if (s < end && *s == '.') {
+    for (s++; s < end && is_digit(*s); s++) {
+      if (nof_fd < 9) {
+        frac = frac * 10 + (*s - '0');
+        nof_fd++;
+      }
+      any = true;
+    }
+  }
+  if (!any) {
+    return false;
+  }
+  for (; nof_fd < 9; nof_fd++) {
+    frac *= 10;
+  }
+  *ns = secs * 1000000000 + frac;
+  *p  = s;
+  return true;
+}
+
+/**
+ * Optional small integer column. An empty (or missing) one is TRACE_REPLAY_ANY.
+ */
+static bool parse_column(const char** p, const char* end, uint8_t* value)
+{
+  const char* s = *p;
+  *value        = TRACE_REPLAY_ANY;
+  if (s >= end || *s != ',') {
+    return true;
+  }
+  s++;
+  while (s < end && *s == ' ') {
+    s++;
+  }
+  if (s < end && is_digit(*s)) {
+    uint32_t v = 0;
+    for (; s < end && is_digit(*s); s++) {
+      v = v * 10 + (*s - '0');
+      if (v >= TRACE_REPLAY_ANY) {
+        return false;
+      }
+    }
+    *value = (uint8_t)v;
+  }
+  while (s < end && *s == ' ') {
+    s++;
+  }
+  *p = s;
+  return s >= end || *s == ',';
+}
+
+static int parse_csv_row(trace_replay_t* q, trace_replay_row_t* row)
+{
+  if (q->cursor >= q->file_size) {
+    return TRACE_REPLAY_END;
+  }
+  if (trace_bytes(q, q->cursor, 1) == NULL) {
+    return TRACE_REPLAY_END;
+  }
+
+  // Find the end of the line, moving the window to the start of the line if it's cut off
+  const char* p  = q->window + (q->cursor - q->window_off);
+  const char* nl = (const char*)memchr(p, '\n', q->window + q->window_len - p);
+  if (nl == NULL && q->window_off + q->window_len < q->file_size) {
+    if (map_window(q, q->cursor)) {
+      return TRACE_REPLAY_END;
+    }
+    p  = q->window + (q->cursor - q->window_off);
+    nl = (const char*)memchr(p, '\n', q->window + q->window_len - p);
+    if (nl == NULL && q->window_off + q->window_len < q->file_size) {
+      ERROR("Trace line %lu is longer than %d bytes\n", (unsigned long)q->line, TRACE_REPLAY_WINDOW_BYTES);
+      return TRACE_REPLAY_END;
+    }
+  }
+  const char* end  = nl != NULL ? nl : q->window + q->window_len;
+  uint64_t    line = q->line++;
+  q->cursor += (end - p) + (nl != NULL ? 1 : 0);
+
+  if (end > p && end[-1] == '\r') {
+    end--;
+  }
+  if (p == end || *p == '#') {
+    return TRACE_REPLAY_SKIPPED;
+  }
+
+  int64_t ns;
+  if (!parse_seconds(&p, end, &ns)) {
+    if (line > 1) { // otherwise the header
+      malformed(q, line);
+    }
+    return TRACE_REPLAY_SKIPPED;
+  }
+  while (p < end && *p == ' ') {
+    p++;
+  }
+  if (p >= end || *p != ',') {
+    malformed(q, line);
+    return TRACE_REPLAY_SKIPPED;
+  }
+  p++;
+
+  const char* hex = p;
+  while (p < end && *p != ',') {
+    p++;
+  }
+  const char* hex_end = p;
+  while (hex < hex_end && *hex == ' ') {
+    hex++;
+  }
+  while (hex_end > hex && hex_end[-1] == ' ') {
+    hex_end--;
+  }
+
+  uint8_t priority, sub_channel;
+  if (!parse_column(&p, end, &priority) || !parse_column(&p, end, &sub_channel)) {
+    malformed(q, line);
+    return TRACE_REPLAY_SKIPPED;
+  }
+
+  uint32_t old_bits = row->nof_bits;
+  int      nof_bits = msg_ingest_hex_to_bits_len(hex, hex_end - hex, row->bits, q->max_bits);
+  if (nof_bits <= 0) {
+    row->nof_bits = q->max_bits; // what it wrote before failing is unknown, clear the whole slot next time
+    malformed(q, line);
+    return TRACE_REPLAY_SKIPPED;
+  }
+  row->nof_bits = (uint32_t)nof_bits;
+  clear_tail(row, old_bits);
+
+  row->priority    = priority != TRACE_REPLAY_ANY ? priority : q->default_priority;
+  row->sub_channel = sub_channel;
+  schedule_row(q, row, ns);
+  return TRACE_REPLAY_READY;
+}
+
+static int parse_binary_row(trace_replay_t* q, trace_replay_row_t* row)
+{
+  const char* p = trace_bytes(q, q->cursor, sizeof(trace_replay_record_t));
+  if (p == NULL) {
+    if (q->cursor < q->file_size) {
+      ERROR("Trace ends in the middle of record %lu\n", (unsigned long)q->line);
+    }
+    return TRACE_REPLAY_END;
+  }
+  trace_replay_record_t rec;
+  memcpy(&rec, p, sizeof(rec));
+  uint32_t nof_bits  = le16toh(rec.nof_bits);
+  size_t   nof_bytes = (nof_bits + 7) / 8;
+
+  const uint8_t* payload = (const uint8_t*)trace_bytes(q, q->cursor + sizeof(rec), nof_bytes);
+  if (payload == NULL) {
+    ERROR("Trace ends in the middle of record %lu\n", (unsigned long)q->line);
+    return TRACE_REPLAY_END;
+  }
+  uint64_t line = q->line++;
+  q->cursor += sizeof(rec) + nof_bytes;
+
+  if (nof_bits == 0 || nof_bits > q->max_bits) {
+    malformed(q, line);
+    return TRACE_REPLAY_SKIPPED;
+  }
+  uint32_t old_bits = row->nof_bits;
+  srsran_bit_unpack_vector(payload, row->bits, nof_bits);
+  row->nof_bits = nof_bits;
+  clear_tail(row, old_bits);
+
+  row->priority    = rec.priority != TRACE_REPLAY_ANY ? rec.priority : q->default_priority;
+  row->sub_channel = rec.sub_channel;
+  schedule_row(q, row, (int64_t)le64toh((uint64_t)rec.offset_ns));
+  return TRACE_REPLAY_READY;
+}
+
+static int parse_row(trace_replay_t* q, trace_replay_row_t* row)
+{
+  return q->format == TRACE_REPLAY_BINARY ? parse_binary_row(q, row) : parse_csv_row(q, row);
+}
+
+/**
+ * @param max_bits TB bits; longer rows are skipped as malformed
+ * @param default_priority SCI priority of rows that don't give one, or TRACE_REPLAY_ANY to leave it to the caller
+ */
+int trace_replay_init(trace_replay_t* q, const char* file_name, uint32_t max_bits, uint8_t default_priority)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && file_name != NULL && max_bits > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(trace_replay_t));
+    q->fd               = -1;
+    q->max_bits         = max_bits;
+    q->default_priority = default_priority;
+    q->line             = 1;
+
+    q->fd = open(file_name, O_RDONLY);
+    if (q->fd < 0) {
+      perror("open");
+      goto clean_exit;
+    }
+    struct stat st;
+    if (fstat(q->fd, &st)) {
+      perror("fstat");
+      goto clean_exit;
+    }
+    q->file_size = (size_t)st.st_size;
+
+    trace_replay_file_hdr_t hdr;
+    if (q->file_size >= sizeof(hdr) && pread(q->fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+        le32toh(hdr.magic) == TRACE_REPLAY_MAGIC) {
+      if (le32toh(hdr.version) != TRACE_REPLAY_VERSION) {
+        ERROR("Trace %s has version %u, expected %u\n", file_name, le32toh(hdr.version), TRACE_REPLAY_VERSION);
+        goto clean_exit;
+      }
+      q->format = TRACE_REPLAY_BINARY;
+      q->cursor = sizeof(hdr);
+      q->line   = 0;
+    }
+
+    q->rows        = (trace_replay_row_t*)calloc(TRACE_REPLAY_QUEUE_DEPTH, sizeof(trace_replay_row_t));
+    q->bits_buffer = (uint8_t*)rt_profile_alloc((size_t)TRACE_REPLAY_QUEUE_DEPTH * max_bits);
+    if (!q->rows) {
+      perror("calloc");
+      goto clean_exit;
+    }
+    if (!q->bits_buffer) {
+      goto clean_exit;
+    }
+    for (uint32_t i = 0; i < TRACE_REPLAY_QUEUE_DEPTH; i++) {
+      q->rows[i].bits = &q->bits_buffer[(size_t)i * max_bits];
+    }
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    trace_replay_free(q);
+  }
+  return ret;
+}
+
+static void* parser_run(void* arg)
+{
+  trace_replay_t* q = (trace_replay_t*)arg;
+
+  while (__atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+    uint64_t head = q->head; // only this thread writes head
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= TRACE_REPLAY_QUEUE_DEPTH) {
+      usleep(TRACE_REPLAY_FULL_WAIT_US);
+      continue;
+    }
+
+    double t = tx_pipeline_host_time();
+    int    r = parse_row(q, &q->rows[head & (TRACE_REPLAY_QUEUE_DEPTH - 1)]);
+    q->parser_stats.parse_time += tx_pipeline_host_time() - t;
+    if (r == TRACE_REPLAY_END) {
+      break;
+    }
+    if (r == TRACE_REPLAY_READY) {
+      q->parser_stats.nof_rows++;
+      __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+  unmap_window(q);
+  __atomic_store_n(&q->parser_done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+ * Start the parser thread, and wait until it has filled the ring (or parsed the whole trace), so replay starts with
+ * TRACE_REPLAY_QUEUE_DEPTH rows in hand.
+ */
+int trace_replay_start(trace_replay_t* q)
+{
+  q->running = true;
+  if (pthread_create(&q->thread, NULL, parser_run, q)) {
+    perror("pthread_create");
+    q->running = false;
+    return SRSRAN_ERROR;
+  }
+  q->thread_started = true;
+
+  while (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) < TRACE_REPLAY_QUEUE_DEPTH &&
+         !__atomic_load_n(&q->parser_done, __ATOMIC_ACQUIRE)) {
+    usleep(TRACE_REPLAY_FULL_WAIT_US);
+  }
+  return SRSRAN_SUCCESS;
+}
+
+void trace_replay_stop(trace_replay_t* q)
+{
+  if (q->thread_started) {
+    __atomic_store_n(&q->running, false, __ATOMIC_RELAXED);
+    pthread_join(q->thread, NULL);
+    q->thread_started = false;
+  }
+}
+
+void trace_replay_free(trace_replay_t* q)
+{
+  if (q) {
+    trace_replay_stop(q);
+    unmap_window(q);
+    if (q->fd >= 0) {
+      close(q->fd);
+    }
+    if (q->rows) {
+      free(q->rows);
+    }
+    if (q->bits_buffer) {
+      rt_profile_free(q->bits_buffer);
+    }
+    bzero(q, sizeof(trace_replay_t));
+    q->fd = -1;
+  }
+}
+
+/**
+ * Row to send in subframe sf_idx (encoder thread). Never waits: if the parser has fallen behind, the subframe stays
+ * idle and its row goes out in a later one.
+ *
+ * @return the next row if it is due in sf_idx or before, to be passed to trace_replay_release() once it is encoded;
+ *         NULL otherwise
+ */
+trace_replay_row_t* trace_replay_next(trace_replay_t* q, uint64_t sf_idx)
+{
+  trace_replay_encoder_stats_t* s    = &q->encoder_stats;
+  uint64_t                      tail = q->tail; // only this thread writes tail
+
+  if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+    if (!__atomic_load_n(&q->parser_done, __ATOMIC_ACQUIRE)) {
+      s->nof_underruns++;
+    } else if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) && !q->encoder_done) {
+      // Nothing was published after the last look, so every row is encoded; the TX side can stop once the last one
+      // is on air
+      __atomic_store_n(&q->end_sf_idx, tail > 0 ? q->last_sf_encoded + 1 : 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&q->encoder_done, true, __ATOMIC_RELEASE);
+    }
+    return NULL;
+  }
+
+  trace_replay_row_t* row = &q->rows[tail & (TRACE_REPLAY_QUEUE_DEPTH - 1)];
+  if (row->sf_idx > sf_idx) {
+    return NULL;
+  }
+
+  double error = fabs((double)sf_idx * 1e-3 - row->offset_ns * 1e-9);
+  s->nof_encoded++;
+  s->nof_deferred += sf_idx > row->sf_idx;
+  s->error_sum += error;
+  s->error_max       = SRSRAN_MAX(s->error_max, error);
+  q->last_sf_encoded = sf_idx;
+  return row;
+}
+
+/**
+ * Hand the slot of an encoded row back to the parser. Rows are released in the order trace_replay_next() gave them,
+ * so row must be the oldest one still held.
+ */
+void trace_replay_release(trace_replay_t* q, trace_replay_row_t* row)
+{
+  if (row != &q->rows[q->tail & (TRACE_REPLAY_QUEUE_DEPTH - 1)]) {
+    ERROR("Trace row released out of order\n");
+    return;
+  }
+  __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Whether the trace is over once every subframe before sf_idx has left the TX side (TX thread).
+ */
+bool trace_replay_finished(trace_replay_t* q, uint64_t sf_idx)
+{
+  return __atomic_load_n(&q->encoder_done, __ATOMIC_ACQUIRE) &&
+         sf_idx >= __atomic_load_n(&q->end_sf_idx, __ATOMIC_RELAXED);
+}
+
+void trace_replay_print_stats(trace_replay_t* q, FILE* f)
+{
+  trace_replay_parser_stats_t*  p = &q->parser_stats;
+  trace_replay_encoder_stats_t* s = &q->encoder_stats;
+
+  fprintf(f,
+          "trace: %lu rows parsed in %.3f s (%.0f rows/s), %lu window maps\n",
+          (unsigned long)p->nof_rows,
+          p->parse_time,
+          p->parse_time > 0 ? p->nof_rows / p->parse_time : 0.0,
+          (unsigned long)p->nof_remaps);
+  if (p->nof_malformed > 0) {
+    fprintf(f,
+            "trace: %lu malformed rows skipped, the first at %s %lu\n",
+            (unsigned long)p->nof_malformed,
+            q->format == TRACE_REPLAY_BINARY ? "record" : "line",
+            (unsigned long)p->first_malformed);
+  }
+  fprintf(f,
+          "trace: %lu rows encoded, %lu in a later subframe than their own, %lu subframes the parser was behind\n",
+          (unsigned long)s->nof_encoded,
+          (unsigned long)s->nof_deferred,
+          (unsigned long)s->nof_underruns);
+  if (s->nof_encoded > 0) {
+    fprintf(f,
+            "trace: schedule error avg/max %.3f/%.3f ms\n",
+            s->error_sum / s->nof_encoded * 1e3,
+            s->error_max * 1e3);
+  }
+}
+
+/**
+ * Convert a CSV trace into the binary format, on the calling thread.
+ *
+ * @param max_bits longest payload to accept, in bits
+ */
+int trace_replay_convert(const char* csv_name, const char* output_name, uint32_t max_bits)
+{
+  int             ret    = SRSRAN_ERROR;
+  FILE*           out    = NULL;
+  uint8_t*        packed = NULL;
+  trace_replay_t  q;
+  trace_replay_file_hdr_t hdr;
+
+  if (trace_replay_init(&q, csv_name, max_bits, TRACE_REPLAY_ANY)) {
+    return SRSRAN_ERROR;
+  }
+  if (q.format != TRACE_REPLAY_CSV) {
+    ERROR("%s is already a binary trace\n", csv_name);
+    goto clean_exit;
+  }
+  packed = (uint8_t*)malloc((max_bits + 7) / 8);
+  out    = fopen(output_name, "wb");
+  if (!packed) {
+    perror("malloc");
+    goto clean_exit;
+  }
+  if (!out) {
+    perror("fopen");
+    goto clean_exit;
+  }
+
+  hdr.magic    = htole32(TRACE_REPLAY_MAGIC);
+  hdr.version  = htole32(TRACE_REPLAY_VERSION);
+  hdr.nof_rows = 0;
+  if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+    perror("fwrite");
+    goto clean_exit;
+  }
+
+  int r;
+  while ((r = parse_row(&q, &q.rows[0])) != TRACE_REPLAY_END) {
+    if (r != TRACE_REPLAY_READY) {
+      continue;
+    }
+    trace_replay_row_t*   row = &q.rows[0];
+    trace_replay_record_t rec;
+    rec.offset_ns   = (int64_t)htole64((uint64_t)row->offset_ns);
+    rec.nof_bits    = htole16((uint16_t)row->nof_bits);
+    rec.priority    = row->priority;
+    rec.sub_channel = row->sub_channel;
+    srsran_bit_pack_vector(row->bits, packed, row->nof_bits);
+    if (fwrite(&rec, sizeof(rec), 1, out) != 1 || fwrite(packed, (row->nof_bits + 7) / 8, 1, out) != 1) {
+      perror("fwrite");
+      goto clean_exit;
+    }
+    q.parser_stats.nof_rows++;
+  }
+
+  hdr.nof_rows = htole64(q.parser_stats.nof_rows);
+  if (fseek(out, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+    perror("fwrite");
+    goto clean_exit;
+  }
+  printf("Converted %lu rows of %s to %s\n", (unsigned long)q.parser_stats.nof_rows, csv_name, output_name);
+  if (q.parser_stats.nof_malformed > 0) {
+    printf("Skipped %lu malformed rows, the first at line %lu\n",
+           (unsigned long)q.parser_stats.nof_malformed,
+           (unsigned long)q.parser_stats.first_malformed);
+  }
+  ret = SRSRAN_SUCCESS;
+
+clean_exit:
+  if (out) {
+    if (fclose(out) && ret == SRSRAN_SUCCESS) {
+      perror("fclose");
+      ret = SRSRAN_ERROR;
+    }
+  }
+  if (packed) {
+    free(packed);
+  }
+  trace_replay_free(&q);
+  return ret;
+}
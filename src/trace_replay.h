@@ -0,0 +1,154 @@
+/******************************************************************************
+ *  File:         trace_replay.h
+ *
+ *  Description:  Timestamped trace replay for the `-i` input.
+ *
+ *                A trace holds one message per row: the time it was recorded
+ *                at, its payload, and optionally the SCI priority and the
+ *                start sub channel to send it with. Every row goes out in the
+ *                subframe nearest to its offset from the first row, so the
+ *                trace is replayed with the recorded spacing, to within half
+ *                a subframe. Rows that land on a subframe already taken go
+ *                out in the next free one.
+ *
+ *                A parser thread walks the file through a sliding mmap window
+ *                and fills a single-producer/single-consumer ring with rows
+ *                already converted to TB bits, so the encoder only takes the
+ *                next row out of the ring and never parses or page faults on
+ *                the trace. The window keeps the mapped (and, with mlockall,
+ *                locked) part of an hour-long trace bounded.
+ *
+ *                Two formats are read, told apart by the first bytes:
+ *
+ *                CSV, one row per line, with an optional header line:
+ *
+ *                  timestamp,payload[,priority[,sub_channel]]
+ *                  12.000250,0x0014252a...,3,2
+ *
+ *                timestamp is in seconds, with up to ns resolution; payload
+ *                is hex, optionally prefixed with 0x. An empty priority or
+ *                sub channel keeps the transmitter's default. Lines starting
+ *                with '#' are skipped.
+ *
+ *                Binary, little endian: a trace_replay_file_hdr_t, then per
+ *                row a trace_replay_record_t followed by nof_bits payload
+ *                bits packed into bytes, most significant bit first.
+ *                trace_replay_convert() writes it from a CSV trace.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_REPLAY_MAGIC (0x54325643) // "CV2T"
+#define TRACE_REPLAY_VERSION (1)
+#define TRACE_REPLAY_QUEUE_DEPTH (1024)              // parsed rows waiting for their subframe, a power of two
+#define TRACE_REPLAY_WINDOW_BYTES (16 * 1024 * 1024) // mapped part of the trace
+#define TRACE_REPLAY_ANY (0xff)                      // no priority or sub channel given in the row
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t nof_rows;
+} trace_replay_file_hdr_t;
+
+typedef struct __attribute__((packed)) {
+  int64_t  offset_ns; // recorded time, relative to any fixed point
+  uint16_t nof_bits;
+  uint8_t  priority;    // or TRACE_REPLAY_ANY
+  uint8_t  sub_channel; // or TRACE_REPLAY_ANY
+} trace_replay_record_t;
+
+typedef struct {
+  uint64_t sf_idx;    // subframe the row is due in
+  int64_t  offset_ns; // recorded time, relative to the first row
+  uint32_t nof_bits;
+  uint8_t  priority;
+  uint8_t  sub_channel;
+  uint8_t* bits; // max_bits TB bits, zero past nof_bits
+} trace_replay_row_t;
+
+typedef enum {
+  TRACE_REPLAY_CSV = 0,
+  TRACE_REPLAY_BINARY,
+} trace_replay_format_t;
+
+typedef struct {
+  uint64_t nof_rows;
+  uint64_t nof_malformed; // skipped, with the line (CSV) or record of the first one in first_malformed
+  uint64_t first_malformed;
+  uint64_t nof_remaps;
+  double   parse_time; // s the parser thread spent parsing
+} trace_replay_parser_stats_t;
+
+typedef struct {
+  uint64_t nof_encoded;
+  uint64_t nof_deferred;  // went out in a later subframe than their own, which was taken
+  uint64_t nof_underruns; // subframes the encoder found the ring empty while the parser was still going
+  double   error_sum;     // |air offset - recorded offset|, s
+  double   error_max;
+} trace_replay_encoder_stats_t;
+
+typedef struct {
+  int                   fd;
+  size_t                file_size;
+  trace_replay_format_t format;
+  uint32_t              max_bits;
+  uint8_t               default_priority;
+
+  // Parser thread only
+  const char* window;      // mapping of the trace from window_off on
+  size_t      window_off;  // file offset of window, page aligned
+  size_t      window_len;
+  size_t      cursor;      // file offset of the next row
+  uint64_t    line;        // of the next row, counted from 1 (CSV), or its record index (binary)
+  bool        have_first;
+  int64_t     first_ns;    // recorded time of the first row
+  uint64_t    last_sf_idx; // of the previous row, so rows never go backwards
+
+  // Parser -> encoder
+  trace_replay_row_t* rows;
+  uint8_t*            bits_buffer; // TRACE_REPLAY_QUEUE_DEPTH * max_bits
+  uint64_t            head __attribute__((aligned(64)));
+  uint64_t            tail __attribute__((aligned(64)));
+  bool                parser_done;
+
+  // Encoder -> TX thread
+  uint64_t last_sf_encoded;
+  uint64_t end_sf_idx; // first subframe after the last row, valid once encoder_done is set
+  bool     encoder_done;
+
+  pthread_t thread;
+  bool      running;
+  bool      thread_started;
+
+  trace_replay_parser_stats_t  parser_stats;
+  trace_replay_encoder_stats_t encoder_stats;
+} trace_replay_t;
+
+int trace_replay_init(trace_replay_t* q, const char* file_name, uint32_t max_bits, uint8_t default_priority);
+
+int trace_replay_start(trace_replay_t* q);
+
+void trace_replay_stop(trace_replay_t* q);
+
+void trace_replay_free(trace_replay_t* q);
+
+trace_replay_row_t* trace_replay_next(trace_replay_t* q, uint64_t sf_idx);
+
+void trace_replay_release(trace_replay_t* q, trace_replay_row_t* row);
+
+bool trace_replay_finished(trace_replay_t* q, uint64_t sf_idx);
+
+void trace_replay_print_stats(trace_replay_t* q, FILE* f);
+
+int trace_replay_convert(const char* csv_name, const char* output_name, uint32_t max_bits);
+
+#endif // TRACE_REPLAY_H
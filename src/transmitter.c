@@ -24,17 +24,35 @@ extern "C" { // Necessary because C++ does "name wrangling", which breaks these
 #include <stdbool.h>    // Give our C code macro names for 'bool', 'true', and 'false'
 #include <stdio.h>      // Get printf() and file-reading capabilities
 #include <stdlib.h>     // For calling exit() and strtol()
+#include <string.h>     // For strcmp()
 #include <unistd.h>     // Get access to the 'getopt()' function, a common tool for processing user-arguments
 #include <signal.h>
+#include <math.h>
 
 
 #include <srsran/phy/rf/rf.h> // For accessing the USRP
+#include <srsran/phy/utils/bit.h>
 #include <srsran/phy/utils/debug.h> // for the ERROR messages
 #include <srsran/phy/common/timestamp.h>
 #include <srsran/phy/common/phy_common_sl.h>
 // #include <srsran/srsran.h>
 // #include <srsran/phy/phch/sci.h>
 #include "ue_sl.h"
+#include "dmrs_cache.h"
+#include "fleet.h"
+#include "latency_stats.h"
+#include "loopback.h"
+#include "msg_ingest.h"
+#include "rt_profile.h"
+#include "trace_replay.h"
+#include "tx_recovery.h"
+#include "shm_ring.h"
+#include "sensing_rx.h"
+#include "sps_sensing.h"
+#include "tx_burst.h"
+#include "tx_pipeline.h"
+#include "tx_sink.h"
+#include "wf_cache.h"
 
 }
 /**
@@ -56,8 +74,40 @@ extern "C" { // Necessary because C++ does "name wrangling", which breaks these
  * -m : Message body (in hex)
  * -i : input .csv file with messages to send
  * -t : time between messages (in ms)
+ * -c : waveform cache budget (in MB)
+ * -d : TX pipeline depth (number of finished subframes the encoder may run ahead)
+ * -n : fleet mode, number of virtual vehicles to emulate
+ * -R : fleet mode, comma separated reservation intervals (in ms) the vehicles choose from
+ * -w : fleet mode, number of encoder threads
+ * -P : fleet mode, payload type: "static" (same TB every time) or "counter" (TB changes every transmission)
+ * -s : fleet mode, build subframes by summing cached single-vehicle waveforms instead of encoding them; needs -P static,
+ *      since counter payloads never repeat and are encoded whole
+ * -b : burst mode, collect this many ms (10-100) of subframes and send them to the radio in one timed burst
+ * -B : streaming mode, like -b but the windows form one continuous burst that is only ended on exit
+ * -o : write the timed sample stream to this file, FIFO or "-" (stdout) instead of a radio, as fast as it can be encoded
+ * -F : sample format for -o: "cf32" (default) or "sc16"
+ * -L : loopback mode, encode and decode this many subframes without a radio, check the decoded SCI and TB, and exit
+ *      (-w sets the number of threads decoding the fully loaded subframes)
+ * -S : sensing mode, pick our sub channel and subframe by sensing the channel (Mode 4 SPS) instead of the fixed schedule,
+ *      excluding resources reserved by others above this PSSCH-RSRP threshold (in dB, relative to the receiver's FFT scale)
+ * -l : export the per-stage latency histograms every 10 s, appended to this file or sent to a Unix datagram socket ("unix:/path")
+ * -j : export them as JSON (one object per line) instead of text
+ * -D : daemon mode, send the payloads arriving on this socket ("unix:/path" or "udp:port" on 127.0.0.1), one per datagram,
+ *      each in the next subframe that can still be encoded in time (or the next one reserved by `-S`)
+ * -M : daemon mode, log the arrival, encoded and air time of every message to this CSV file
+ * -Q : shared memory mode, create a message ring with this POSIX shared memory name (e.g. "/cv2x-tx") and send what local
+ *      producers commit to it, encoded straight out of the ring (see shm_ring.h for the layout)
+ * -r : real-time mode, "on" or a comma separated list of tx_cpu=N, encode_cpu=N (pin the TX and encoder threads),
+ *      tx_prio=N, encode_prio=N (SCHED_FIFO priorities, default 80/79), huge (huge-page sample buffers) and nolock
+ *      (don't mlockall); the effective settings are checked and printed at startup
 */
 
+// Window length used by `-B` when no `-b` is given.
+#define TX_STREAM_DEFAULT_WINDOW_MS (20)
+
+// RX gain used by `-S` while sensing.
+#define TX_SENSING_RX_GAIN_DB (40)
+
 /**
  * Define a data structure to contain the arguments set by the user.
  * (i.e. a "class" without any methods)
@@ -69,6 +119,23 @@ typedef struct {
     int ms_between_messages;
     double rf_freq;
     float rf_gain;
+    size_t wf_cache_bytes;
+    uint32_t pipeline_depth;
+    uint32_t burst_window_ms; // 0 = one burst per subframe
+    bool continuous_stream;
+    char* output_path; // NULL = radio
+    tx_sink_format_t output_format;
+    uint32_t loopback_subframes; // 0 = normal transmission
+    bool sensing;
+    float sensing_threshold_db;
+    char* latency_dest; // NULL = only print the latency summary on exit
+    bool latency_json;
+    char* ingest_endpoint; // NULL = send the `-m` message on the fixed schedule
+    char* ingest_log_name;
+    char* shm_ring_name; // NULL = no shared memory ring
+    char* trace_output_name; // NULL = replay the `-i` trace, otherwise convert it to the binary format and exit
+    rt_profile_cfg_t rt_cfg;
+    fleet_cfg_t fleet_cfg;
 } prog_args_t;
 
 /**
@@ -81,6 +148,23 @@ void args_default(prog_args_t* args) {
     args->ms_between_messages = 10;
     args->rf_freq = 5915000000; // i.e. 5.915 GHz, the default frequency for our purposes.
     args->rf_gain = 75;
+    args->wf_cache_bytes = WF_CACHE_DEFAULT_BUDGET_BYTES;
+    args->pipeline_depth = TX_PIPELINE_DEFAULT_DEPTH;
+    args->burst_window_ms = 0;
+    args->continuous_stream = false;
+    args->output_path = NULL;
+    args->output_format = TX_SINK_CF32;
+    args->loopback_subframes = 0;
+    args->sensing = false;
+    args->sensing_threshold_db = 0;
+    args->latency_dest = NULL;
+    args->latency_json = false;
+    args->ingest_endpoint = NULL;
+    args->ingest_log_name = NULL;
+    args->shm_ring_name = NULL;
+    args->trace_output_name = NULL;
+    rt_profile_cfg_default(&args->rt_cfg);
+    fleet_cfg_default(&args->fleet_cfg);
 }
 
 // Create a global args object for storing user/default arguments, but 'static' to make it 'private' to other files.
@@ -93,16 +177,92 @@ void parse_args(prog_args_t* args, int argc, char** argv) {
     int option;
     args_default(args);
 
-    while ((option = getopt(argc, argv, "a:m:i:t:")) != -1) {
+    while ((option = getopt(argc, argv, "a:b:Bc:C:d:D:F:m:M:i:jl:L:n:o:P:Q:r:R:sS:t:w:")) != -1) {
         switch(option) {
             case 'a':
                 args->rf_args = optarg;
+                break;
+            case 'b':
+                args->burst_window_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                args->continuous_stream = true;
+                break;
+            case 'c':
+                args->wf_cache_bytes = (size_t)strtoul(optarg, NULL, 10) * 1024 * 1024;
+                args->fleet_cfg.cache_bytes = args->wf_cache_bytes;
+                break;
+            case 'C':
+                args->trace_output_name = optarg;
+                break;
+            case 'd':
+                args->pipeline_depth = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'D':
+                args->ingest_endpoint = optarg;
+                break;
+            case 'F':
+                if (tx_sink_parse_format(optarg, &args->output_format)) {
+                    exit(-1);
+                }
+                break;
             case 'i':
                 args->input_csv_name = optarg;
                 break;
+            case 'j':
+                args->latency_json = true;
+                break;
+            case 'l':
+                args->latency_dest = optarg;
+                break;
+            case 'L':
+                args->loopback_subframes = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
             case 'm':
                 args->message_body = optarg; //optarg is a special variable set by getopt() that points at the value of a provided argument.
                 break;
+            case 'M':
+                args->ingest_log_name = optarg;
+                break;
+            case 'n':
+                args->fleet_cfg.nof_vehicles = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                args->output_path = optarg;
+                break;
+            case 'Q':
+                args->shm_ring_name = optarg;
+                break;
+            case 'r':
+                if (rt_profile_parse(&args->rt_cfg, optarg)) {
+                    exit(-1);
+                }
+                break;
+            case 'R':
+                if (fleet_parse_intvls(&args->fleet_cfg, optarg)) {
+                    exit(-1);
+                }
+                break;
+            case 'P':
+                if (strcmp(optarg, "static") == 0) {
+                    args->fleet_cfg.payload = FLEET_PAYLOAD_STATIC;
+                } else if (strcmp(optarg, "counter") == 0) {
+                    args->fleet_cfg.payload = FLEET_PAYLOAD_COUNTER;
+                } else {
+                    printf("Unknown payload type: %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 's':
+                args->fleet_cfg.superposition = true;
+                break;
+            case 'S':
+                args->sensing = true;
+                args->sensing_threshold_db = strtof(optarg, NULL);
+                break;
+            case 'w':
+                args->fleet_cfg.nof_workers = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
             case 't':
                 // optind is a special var set by getopt() that is the index of the next element of the argv array
                 // strtol converts a string to an integer long. I've specified a NULL object to store leftover bits in, and the number-base 10.
@@ -115,8 +275,33 @@ void parse_args(prog_args_t* args, int argc, char** argv) {
                 exit(-1);
         }
     }
-    if (args->message_body == NULL && args->input_csv_name == NULL) {
-        printf("Error: Please specify either a message body (in hex) with `-m` or an input .csv with `-i`\n");
+    if (args->continuous_stream && args->burst_window_ms == 0) {
+        args->burst_window_ms = TX_STREAM_DEFAULT_WINDOW_MS;
+    }
+    if (args->message_body == NULL && args->input_csv_name == NULL && args->fleet_cfg.nof_vehicles == 0 && args->loopback_subframes == 0 &&
+        args->ingest_endpoint == NULL && args->shm_ring_name == NULL) {
+        printf("Error: Please specify either a message body (in hex) with `-m`, an input .csv with `-i`, a fleet size with `-n`, a loopback run with `-L`, "
+               "or a socket or shared memory ring to take messages from with `-D` or `-Q`\n");
+        exit(-1);
+    }
+    if (args->sensing && (args->output_path != NULL || args->fleet_cfg.nof_vehicles > 0)) {
+        printf("Error: `-S` needs a radio to sense the channel with, and can't be combined with `-o` or `-n`\n");
+        exit(-1);
+    }
+    if ((args->ingest_endpoint != NULL || args->shm_ring_name != NULL) && (args->output_path != NULL || args->fleet_cfg.nof_vehicles > 0)) {
+        printf("Error: `-D` and `-Q` schedule messages against the radio clock, and can't be combined with `-o` or `-n`\n");
+        exit(-1);
+    }
+    if (args->ingest_endpoint != NULL && args->shm_ring_name != NULL) {
+        printf("Error: take messages either from a socket (`-D`) or from shared memory (`-Q`), not both\n");
+        exit(-1);
+    }
+    if (args->input_csv_name != NULL && (args->ingest_endpoint != NULL || args->shm_ring_name != NULL || args->fleet_cfg.nof_vehicles > 0)) {
+        printf("Error: `-i` replays the messages of a trace, and can't be combined with `-D`, `-Q` or `-n`\n");
+        exit(-1);
+    }
+    if (args->trace_output_name != NULL && args->input_csv_name == NULL) {
+        printf("Error: `-C` converts the trace given with `-i`\n");
         exit(-1);
     }
 }
@@ -137,12 +322,13 @@ void signal_interrupt_handler(int signal_number) {
 /**
  * Originally written by Eckermann. Appears to get a starting time from the radio.
 */
-void get_start_time(srsran_rf_t* rf, srsran_timestamp_t* t)
+void get_start_time(tx_sink_t* sink, srsran_timestamp_t* t)
 {
   uint32_t start_time_full_ms;
   double   start_time_frac_ms;
 
-  srsran_rf_get_time(rf, &t->full_secs, &t->frac_secs);
+  //- An actual read of the radio clock: everything after is timed relative to it
+  tx_sink_read_time(sink, &t->full_secs, &t->frac_secs);
 
   fprintf(stdout, "start time: %f\n", srsran_timestamp_real(t));
   fflush(stdout);
@@ -157,9 +343,565 @@ void get_start_time(srsran_rf_t* rf, srsran_timestamp_t* t)
   srsran_timestamp_add(t, 0, 3 * 1e-3);
 }
 
-// TODO - Define a method that can read a `.csv` file and store the contents into an array of hex values
+// === Encoding ===
+
+// How far ahead of its air time (in seconds) a finished subframe is handed to the radio. Starts at the minimum, and
+//   repeated lateness raises it up to the maximum (see tx_recovery.h).
+#define TX_SUBMIT_LEAD_S (0.01)
+#define TX_SUBMIT_MAX_LEAD_S (0.08)
+
+// Longest the TX loop sleeps in one go, so it still notices Ctrl-C and timeline resets.
+#define TX_MAX_SLEEP_S (0.1)
+
+/**
+ * Everything the encoder thread needs to turn a subframe index into samples.
+*/
+typedef struct {
+    srsran_ue_sl_t* ue;
+    wf_cache_t* wf_cache;
+    srsran_pssch_data_t data;
+    uint32_t tb_len;
+    sps_sensing_t* sps; // NULL = fixed schedule
+    sensing_rx_t* rx;
+    msg_ingest_t* ingest; // NULL = send the TB in data
+    uint32_t ingest_bits; // TB bits set by the last ingested message
+    shm_ring_t* ring; // NULL = no shared memory ring
+    trace_replay_t* trace; // NULL = no trace replay
+} tx_encoder_ctx_t;
+
+/**
+ * Sensing mode: whether we transmit in sf_idx, and if so on which sub channel and radio subframe number.
+*/
+static bool sensing_slot(tx_encoder_ctx_t* ctx, uint64_t sf_idx, srsran_sl_sf_cfg_t* sf) {
+    uint32_t sub_channel_start_idx;
+    if (!sps_sensing_tx(ctx->sps, sf_idx, &sub_channel_start_idx)) {
+        return false;
+    }
+    ctx->data.sub_channel_start_idx = sub_channel_start_idx;
+    ctx->data.l_sub_channel = 1;
+    //- Use the radio's subframe number, so the receivers see our reservation where it actually is
+    if (!sensing_rx_tti(ctx->rx, sf_idx, &sf->tti)) {
+        sf->tti = sf_idx % 10;
+    }
+    return true;
+}
+
+/**
+ * Daemon mode: send the next ingested message, if one arrives before sf_idx has to be encoded.
+ * Every message is a new TB, so the waveform cache is bypassed.
+*/
+static int encode_ingested(tx_encoder_ctx_t* ctx, uint64_t sf_idx, srsran_sl_sf_cfg_t* sf, cf_t* output) {
+    msg_ingest_msg_t* msg = msg_ingest_next(ctx->ingest, sf_idx);
+    if (msg == NULL) {
+        return 0;
+    }
+
+    //- Payload bytes to TB bits, clearing whatever the previous (longer) message left behind
+    uint32_t nof_bits = msg->rec.len * 8;
+    srsran_bit_unpack_vector(msg->payload, ctx->data.ptr, nof_bits);
+    if (ctx->ingest_bits > nof_bits) {
+        srsran_vec_u8_zero(&ctx->data.ptr[nof_bits], ctx->ingest_bits - nof_bits);
+    }
+    ctx->ingest_bits = nof_bits;
+
+    if (srsran_ue_sl_encode(ctx->ue, sf, &ctx->data)) {
+        ERROR("Error encoding sidelink\n");
+        return SRSRAN_ERROR;
+    }
+    uint64_t t = latency_now();
+    srsran_vec_cf_copy(output, ctx->ue->signal_buffer_tx, ctx->ue->sf_len);
+    latency_record(LATENCY_TX_COPY, t);
+
+    msg_ingest_encoded(ctx->ingest, msg, sf_idx);
+    return 1;
+}
+
+/**
+ * Shared memory mode: send the next message committed to the ring, if one is committed before sf_idx has to be encoded.
+ * The encoder reads the TB straight out of the ring slot, which goes back to the producers as soon as it is encoded.
+*/
+static int encode_ring(tx_encoder_ctx_t* ctx, uint64_t sf_idx, srsran_sl_sf_cfg_t* sf, cf_t* output) {
+    shm_ring_slot_t* slot = shm_ring_next(ctx->ring, sf_idx);
+    if (slot == NULL) {
+        return 0;
+    }
+
+    //- The producer's sub channel is only a preference: the sensing engine's reservation wins
+    if (ctx->sps == NULL && slot->sub_channel < ctx->ue->sl_comm_resource_pool.num_sub_channel) {
+        ctx->data.sub_channel_start_idx = slot->sub_channel;
+    }
+    ctx->ue->sci_tx.priority = SRSRAN_MIN(slot->priority, 7);
+
+    srsran_pssch_data_t data = ctx->data;
+    data.ptr = shm_ring_bits(ctx->ring, slot);
+    int ret = data.ptr != NULL ? srsran_ue_sl_encode(ctx->ue, sf, &data) : SRSRAN_ERROR;
+    shm_ring_release(ctx->ring, slot);
+    if (ret) {
+        ERROR("Error encoding sidelink\n");
+        return SRSRAN_ERROR;
+    }
+    uint64_t t = latency_now();
+    srsran_vec_cf_copy(output, ctx->ue->signal_buffer_tx, ctx->ue->sf_len);
+    latency_record(LATENCY_TX_COPY, t);
+    return 1;
+}
+
+/**
+ * Trace replay mode: send the next trace row, if it is due in sf_idx or was put off from an earlier subframe.
+ * Like the ring, the encoder reads the TB straight out of the parsed row.
+*/
+static int encode_trace(tx_encoder_ctx_t* ctx, uint64_t sf_idx, srsran_sl_sf_cfg_t* sf, cf_t* output) {
+    trace_replay_row_t* row = trace_replay_next(ctx->trace, sf_idx);
+    if (row == NULL) {
+        return 0;
+    }
+
+    if (ctx->sps == NULL && row->sub_channel < ctx->ue->sl_comm_resource_pool.num_sub_channel) {
+        ctx->data.sub_channel_start_idx = row->sub_channel;
+    }
+    ctx->ue->sci_tx.priority = SRSRAN_MIN(row->priority, 7);
+
+    srsran_pssch_data_t data = ctx->data;
+    data.ptr = row->bits;
+    int ret = srsran_ue_sl_encode(ctx->ue, sf, &data);
+    trace_replay_release(ctx->trace, row);
+    if (ret) {
+        ERROR("Error encoding sidelink\n");
+        return SRSRAN_ERROR;
+    }
+    uint64_t t = latency_now();
+    srsran_vec_cf_copy(output, ctx->ue->signal_buffer_tx, ctx->ue->sf_len);
+    latency_record(LATENCY_TX_COPY, t);
+    return 1;
+}
+
+/**
+ * Encoder callback for the TX pipeline (runs on the encoder thread).
+ * Sends the initial message on the first subframe of every second, and its re-transmission 4 ms later.
+ * In sensing mode, sends on the subframes and sub channel the sensing engine reserved instead.
+ * In daemon, shared memory and trace replay mode, sends the ingested messages or trace rows, on sub channel 0 (or the
+ * one the producer or trace asks for) or on the sensing engine's reservation.
+*/
+static int encode_subframe(void* arg, uint64_t sf_idx, cf_t* output) {
+    tx_encoder_ctx_t* ctx = (tx_encoder_ctx_t*)arg;
+    srsran_sl_sf_cfg_t sf;
+
+    if (ctx->sps != NULL || ctx->ingest != NULL || ctx->ring != NULL || ctx->trace != NULL) {
+        if (ctx->sps != NULL) {
+            if (!sensing_slot(ctx, sf_idx, &sf)) {
+                return 0;
+            }
+        } else {
+            ctx->data.sub_channel_start_idx = 0;
+            ctx->data.l_sub_channel = 1;
+            sf.tti = sf_idx % 10;
+        }
+        if (ctx->ingest != NULL) {
+            return encode_ingested(ctx, sf_idx, &sf, output);
+        }
+        if (ctx->ring != NULL) {
+            return encode_ring(ctx, sf_idx, &sf, output);
+        }
+        if (ctx->trace != NULL) {
+            return encode_trace(ctx, sf_idx, &sf, output);
+        }
+        if (wf_cache_encode(ctx->wf_cache, ctx->ue, &sf, &ctx->data, ctx->tb_len, output)) {
+            ERROR("Error encoding sidelink\n");
+            return SRSRAN_ERROR;
+        }
+        return 1;
+    }
+
+    uint32_t ms = sf_idx % 1000;
+    if (ms != 0 && ms != 4) {
+        return 0;
+    }
+    uint32_t i = (ms == 0) ? 0 : 1; //- 0 = initial message, 1 = re-transmission
+
+    ctx->data.sub_channel_start_idx = i*4; //Default to "0" for now...
+    ctx->data.l_sub_channel = 1; //Default was "2", "1" seems most appropriate after testing. This modifies a calculated value placed in the SCI describing how many sub_channels this message will occupy.  "l" is probably "length". So the "length" of the sub channel "array", i.e. the number of subchannels in our channel we'd like to be writing to.
+
+    //- tti is probably "transmission time interval". I thought this was 1ms but in Eckermann's code, it is from 0 to 100.
+    //- It's possible that this time interval is a specific time duration, and is based off of some base time.
+    //- sf probably stands for "subframe", so Sidelink Subframe Configuration
+    sf.tti = 1;
+
+    //- Encode using our subframe (sf) and data, straight into the pipeline's buffer. The waveform cache is checked first, so the
+    //-   shared and control channel encoding only runs for (payload, subchannel, subframe, rv) combinations not seen before.
+    if (wf_cache_encode(ctx->wf_cache, ctx->ue, &sf, &ctx->data, ctx->tb_len, output)) {
+        ERROR("Error encoding sidelink\n");
+        return SRSRAN_ERROR;
+    }
+    return 1;
+}
+
+// === Transmission ===
 
-// TODO - Define some kind of helper function to convert the hex into an array of 1's and 0's
+/**
+ * A file sink that fails to write (e.g. the FIFO reader went away) won't recover, so stop instead of spinning.
+*/
+static void stop_on_sink_error(tx_sink_t* sink) {
+    if (sink->type == TX_SINK_FILE) {
+        keep_running = false;
+    }
+}
+
+//- Receive thread of sensing mode, NULL otherwise. Told about every new start time so it can line up what it senses with our subframes.
+static sensing_rx_t* sensing_rx = NULL;
+
+//- Message socket of daemon mode, or ring of shared memory mode, NULL otherwise. Need the start times too, to know how long
+//-   they can wait for a message.
+static msg_ingest_t* msg_ingest = NULL;
+static shm_ring_t* msg_ring = NULL;
+
+//- Trace of trace replay mode, NULL otherwise. The run ends once its last row is on air.
+static trace_replay_t* msg_trace = NULL;
+
+static void publish_timeline(tx_sink_t* sink, srsran_timestamp_t* startup_time, uint64_t sf_idx_base) {
+    if (sensing_rx != NULL) {
+        sensing_rx_set_timeline(sensing_rx, startup_time, sf_idx_base);
+    }
+    if (msg_ingest != NULL || msg_ring != NULL) {
+        //- Radio time to host time, which is what the ingest side timestamps with
+        srsran_timestamp_t now;
+        tx_sink_get_time(sink, &now.full_secs, &now.frac_secs);
+        double host_air_time = tx_pipeline_host_time() + srsran_timestamp_real(startup_time) - srsran_timestamp_real(&now);
+        if (msg_ingest != NULL) {
+            msg_ingest_set_timeline(msg_ingest, host_air_time, sf_idx_base);
+        }
+        if (msg_ring != NULL) {
+            shm_ring_set_timeline(msg_ring, host_air_time, sf_idx_base);
+        }
+    }
+}
+
+//- Tell the ingest side which subframes made it to the radio, closing the timing record of the messages in them
+static void report_sent(uint64_t first_sf_idx, uint32_t nof_sf) {
+    if (msg_ingest != NULL) {
+        msg_ingest_sent(msg_ingest, first_sf_idx, nof_sf);
+    }
+    if (msg_trace != NULL && trace_replay_finished(msg_trace, first_sf_idx + nof_sf)) {
+        keep_running = false;
+    }
+}
+
+/**
+ * Air time of a pipeline subframe, given the subframe index that lands exactly on startup_time.
+*/
+static void sf_tx_time(srsran_timestamp_t* startup_time, uint64_t sf_idx_base, uint64_t sf_idx, srsran_timestamp_t* tx_time) {
+    uint64_t ms_offset = sf_idx - sf_idx_base;
+    srsran_timestamp_copy(tx_time, startup_time);
+    srsran_timestamp_add(tx_time, ms_offset / 1000, (ms_offset % 1000) * 1e-3);
+}
+
+/**
+ * First pipeline subframe whose air time is at least lead_s after now, so something scheduled there is still on time.
+*/
+static uint64_t first_sf_after(srsran_timestamp_t* startup_time, uint64_t sf_idx_base, srsran_timestamp_t* now, double lead_s) {
+    double offset_s = srsran_timestamp_real(now) + lead_s - srsran_timestamp_real(startup_time);
+    return sf_idx_base + (offset_s > 0 ? (uint64_t)ceil(offset_s * 1e3) : 0);
+}
+
+/**
+ * Sleep until tx_time is inside the submit lead, but for at most max_s, so a far-off subframe doesn't hold up the loop.
+*/
+static void wait_for_submit(tx_sink_t* sink, srsran_timestamp_t* tx_time, srsran_timestamp_t* now, double lead_s, double max_s) {
+    srsran_timestamp_t wake;
+    srsran_timestamp_copy(&wake, tx_time);
+    srsran_timestamp_sub(&wake, 0, lead_s);
+    if (srsran_timestamp_real(&wake) - srsran_timestamp_real(now) > max_s) {
+        srsran_timestamp_copy(&wake, now);
+        srsran_timestamp_add(&wake, 0, max_s);
+    }
+    tx_sink_wait_until(sink, wake.full_secs, wake.frac_secs);
+}
+
+/**
+ * Send every busy subframe on its own, as a start+end-of-burst of one subframe.
+*/
+static void run_subframe_loop(tx_sink_t* sink, tx_pipeline_t* pipeline, tx_recovery_t* recovery, uint32_t sf_len, int srate) {
+    // === Timing ===
+    srsran_timestamp_t startup_time, tx_time, now;
+
+    get_start_time(sink, &startup_time); //- Retrieve the starting time from the radio and store it in &startup_time
+
+    //- Subframe index (from the encoder's timeline) that lands exactly on startup_time. Moves forward whenever we have to reset the start time.
+    uint64_t sf_idx_base = 0;
+    publish_timeline(sink, &startup_time, sf_idx_base);
+
+    while (keep_running) {
+        //- Current radio time, predicted on the host between occasional reads of the radio (see radio_clock.h)
+        tx_sink_get_time(sink, &now.full_secs, &now.frac_secs);
+        tx_pipeline_set_air_sf(pipeline, first_sf_after(&startup_time, sf_idx_base, &now, 0));
+
+        //- Grab the next finished subframe. If the encoder hasn't produced one yet, every subframe up to where it is now
+        //-   is idle, so sleep until that one would have to be submitted (or give it a moment if that time has passed).
+        tx_pipeline_slot_t* slot = tx_pipeline_front(pipeline);
+        if (slot == NULL) {
+            uint64_t encoded_until = tx_pipeline_encoded_until(pipeline);
+            //- The last trace row may have been dropped late, so don't count on report_sent() to end the replay
+            if (msg_trace != NULL && trace_replay_finished(msg_trace, encoded_until)) {
+                keep_running = false;
+                continue;
+            }
+            if (encoded_until > sf_idx_base) {
+                sf_tx_time(&startup_time, sf_idx_base, encoded_until, &tx_time);
+                if (srsran_timestamp_real(&tx_time) - srsran_timestamp_real(&now) > recovery->lead_s) {
+                    wait_for_submit(sink, &tx_time, &now, recovery->lead_s, TX_MAX_SLEEP_S);
+                    continue;
+                }
+            }
+            usleep(100);
+            continue;
+        }
+
+        sf_tx_time(&startup_time, sf_idx_base, slot->sf_idx, &tx_time);
+
+        // Check if tx_time is in the past. If so, drop this subframe.
+        if (srsran_timestamp_uint64(&now, srate) > srsran_timestamp_uint64(&tx_time, srate)) {
+            //- We need this so we don't attempt to schedule a transmission with the radio at a time that is in the past.
+            //-   The timeline stays put, so the subframes after this one keep their place on the reservation grid;
+            //-   only a subframe that is far behind (see tx_recovery.h) makes us pick a new start time.
+            uint64_t late_sf_idx = slot->sf_idx;
+            double late_s = srsran_timestamp_real(&now) - srsran_timestamp_real(&tx_time);
+            latency_count(LATENCY_EVENT_LATE);
+            tx_pipeline_drop_late(pipeline);
+            if (tx_recovery_late(recovery, late_s, 1) == TX_RECOVERY_RESYNC) {
+                ERROR("tx_time is in the past (tx_time: %f, now: %f). Setting new start time.\n",
+                    srsran_timestamp_real(&tx_time), srsran_timestamp_real(&now));
+                latency_count(LATENCY_EVENT_RESET);
+                get_start_time(sink, &startup_time);
+
+                sf_idx_base = late_sf_idx + 1;
+                publish_timeline(sink, &startup_time, sf_idx_base);
+            }
+            continue;
+        }
+
+        //- Don't hand the radio subframes that are too far in the future; wait until we're inside the submit window.
+        double lead = srsran_timestamp_real(&tx_time) - srsran_timestamp_real(&now);
+        if (lead > recovery->lead_s) {
+            wait_for_submit(sink, &tx_time, &now, recovery->lead_s, TX_MAX_SLEEP_S);
+            continue;
+        }
+
+        // Things look good, proceed with scheduling transmission
+        int tx_result = tx_sink_send_timed(sink,
+                                        slot->samples,       //-"data"
+                                        sf_len,              //-"nsamples"
+                                        tx_time.full_secs,   //-"secs"
+                                        tx_time.frac_secs,   //-"frac_secs"
+                                        true,                //-"is_start_of_burst"
+                                        true);               //-"is_end_of_burst"
+        if (tx_result < 0) {
+            ERROR("Error sending data: %d\n", tx_result);
+            stop_on_sink_error(sink);
+        }
+        latency_record_s(LATENCY_TX_SLACK, lead);
+        report_sent(slot->sf_idx, 1);
+        tx_pipeline_pop(pipeline, lead);
+        tx_recovery_on_time(recovery);
+    }
+}
+
+/**
+ * Close an open stream by sending one idle subframe flagged as end of burst.
+ * The window must have just been reset, so its first subframe is all zeros.
+*/
+static void end_stream(tx_sink_t* sink, tx_burst_t* burst, srsran_timestamp_t* tx_time) {
+    int tx_result = tx_sink_send_timed(sink, burst->buffer, burst->sf_len,
+                                       tx_time->full_secs, tx_time->frac_secs, false, true);
+    if (tx_result < 0) {
+        ERROR("Error ending stream: %d\n", tx_result);
+    }
+}
+
+/**
+ * Send the timeline in windows of burst->nof_sf subframes, one srsran_rf_send_timed2() call per window.
+ * Idle subframes inside a window go out as zeros.
+ *
+ * With continuous set, only the first window starts a burst and none ends it, so the radio sees one
+ * uninterrupted stream. A late window breaks the stream; it is ended and restarted with the next window on time,
+ * which stays on the same timeline.
+*/
+static void run_burst_loop(tx_sink_t* sink, tx_pipeline_t* pipeline, tx_burst_t* burst, tx_recovery_t* recovery,
+                           int srate, bool continuous) {
+    srsran_timestamp_t startup_time, tx_time, now;
+    double window_s = burst->nof_sf * 1e-3;
+    bool stream_open = false;
+    uint32_t nof_driver_calls = 0; //- radio calls spent on the current window
+
+    get_start_time(sink, &startup_time);
+    nof_driver_calls++;
+
+    uint64_t sf_idx_base = 0;
+    publish_timeline(sink, &startup_time, sf_idx_base);
+    tx_burst_reset(burst, sf_idx_base);
+
+    while (keep_running) {
+        bool complete = tx_burst_fill(burst, pipeline);
+        sf_tx_time(&startup_time, sf_idx_base, burst->start_sf_idx, &tx_time);
+
+        tx_sink_get_time(sink, &now.full_secs, &now.frac_secs); //- predicted, no radio call
+        tx_pipeline_set_air_sf(pipeline, first_sf_after(&startup_time, sf_idx_base, &now, 0));
+        double lead = srsran_timestamp_real(&tx_time) - srsran_timestamp_real(&now);
+
+        //- Late: either the encoder didn't finish the window in time, or we woke up too late to submit it.
+        //-   Skip the window and keep the timeline, so the windows after it keep their place on the reservation grid.
+        if (srsran_timestamp_uint64(&now, srate) > srsran_timestamp_uint64(&tx_time, srate)) {
+            uint32_t nof_skipped = burst->nof_busy;
+            tx_burst_drop_late(burst);
+            latency_count(LATENCY_EVENT_LATE);
+            tx_recovery_action_t action = tx_recovery_late(recovery, -lead, nof_skipped);
+
+            uint64_t next_sf_idx = burst->start_sf_idx + burst->nof_sf;
+            if (action == TX_RECOVERY_RESYNC) {
+                ERROR("Window at %f is late (now: %f). Setting new start time.\n",
+                    srsran_timestamp_real(&tx_time), srsran_timestamp_real(&now));
+                latency_count(LATENCY_EVENT_RESET);
+                get_start_time(sink, &startup_time);
+                sf_idx_base = next_sf_idx;
+                publish_timeline(sink, &startup_time, sf_idx_base);
+                nof_driver_calls = 1;
+                tx_sink_get_time(sink, &now.full_secs, &now.frac_secs);
+            }
+            tx_burst_reset(burst, next_sf_idx);
+            //- The end of burst must still be on time and on the grid: send it in the first subframe the radio can take,
+            //-   and start the next window after it
+            if (stream_open) {
+                uint64_t end_sf_idx = first_sf_after(&startup_time, sf_idx_base, &now, recovery->lead_s);
+                srsran_timestamp_t end_time;
+                sf_tx_time(&startup_time, sf_idx_base, end_sf_idx, &end_time);
+                end_stream(sink, burst, &end_time);
+                stream_open = false;
+                nof_driver_calls++;
+                tx_burst_reset(burst, SRSRAN_MAX(next_sf_idx, end_sf_idx + 1));
+            }
+            continue;
+        }
+
+        if (!complete) {
+            usleep(SRSRAN_MIN(lead * 1e6, 100));
+            continue;
+        }
+
+        //- Sleep until the window is inside the submit lead.
+        if (lead > recovery->lead_s) {
+            wait_for_submit(sink, &tx_time, &now, recovery->lead_s, window_s);
+            continue;
+        }
+
+        int tx_result = tx_sink_send_timed(sink,
+                                              burst->buffer,
+                                              tx_burst_nof_samples(burst),
+                                              tx_time.full_secs,
+                                              tx_time.frac_secs,
+                                              !continuous || !stream_open, //-"is_start_of_burst"
+                                              !continuous);                //-"is_end_of_burst"
+        nof_driver_calls++;
+        if (tx_result < 0) {
+            ERROR("Error sending data: %d\n", tx_result);
+            stop_on_sink_error(sink);
+        }
+        stream_open = continuous;
+        latency_record_s(LATENCY_TX_SLACK, lead);
+        tx_burst_sent(burst, lead, nof_driver_calls);
+        report_sent(burst->start_sf_idx, burst->nof_sf);
+        nof_driver_calls = 0;
+
+        tx_burst_reset(burst, burst->start_sf_idx + burst->nof_sf);
+    }
+
+    if (stream_open) {
+        tx_burst_reset(burst, burst->start_sf_idx); //- drop whatever was collected for the unsent window
+        sf_tx_time(&startup_time, sf_idx_base, burst->start_sf_idx, &tx_time);
+        end_stream(sink, burst, &tx_time);
+    }
+}
+
+// === Loopback ===
+
+/**
+ * Encode nof_subframes subframes, decode each one with the RX path of the same UE and check the result.
+ * Walks through every sub channel, subframe index and initial/re-transmission, with a new random TB every time,
+ * and decodes all sub channels, so the idle ones exercise the PSCCH detector. Then does the same with nof_subframes fully loaded subframes (one grant on every sub channel), decoded
+ * in parallel on nof_decoder_threads threads.
+ * Returns the number of grants that did not come back intact.
+*/
+static uint64_t run_loopback(srsran_cell_sl_t cell, srsran_sl_comm_resource_pool_t pool, uint32_t nof_subframes, uint32_t nof_decoder_threads) {
+    loopback_t loopback;
+    if (loopback_init(&loopback, cell, pool)) {
+        ERROR("Error initializing loopback\n");
+        exit(-1);
+    }
+
+    decoder_pool_t decoder;
+    if (decoder_pool_init(&decoder, nof_decoder_threads)) {
+        ERROR("Error initializing decoder pool\n");
+        exit(-1);
+    }
+
+    srsran_sci_t sci = {};
+    sci.format = SRSRAN_SCI_FORMAT1;
+
+    uint8_t* tb = srsran_vec_u8_malloc(SRSRAN_SL_SCH_MAX_TB_LEN * pool.num_sub_channel);
+    if (!tb) {
+        perror("malloc");
+        exit(-1);
+    }
+    unsigned int seed = 1;
+
+    for (uint32_t n = 0; n < nof_subframes && keep_running; n++) {
+        //- Same SCI the transmitter uses, alternating between initial transmission and re-transmission
+        srsran_set_sci(&sci, 1, 100, 3, n % 2 == 1, 0, 11);
+
+        for (uint32_t i = 0; i < SRSRAN_SL_SCH_MAX_TB_LEN; i++) {
+            tb[i] = (uint8_t)(rand_r(&seed) & 1);
+        }
+        srsran_pssch_data_t data;
+        data.ptr = tb;
+        data.sub_channel_start_idx = n % pool.num_sub_channel;
+        data.l_sub_channel = 1;
+
+        srsran_sl_sf_cfg_t sf;
+        sf.tti = n % 10;
+
+        if (loopback_run(&loopback, &decoder, &sf, &sci, &data) != SRSRAN_SUCCESS) {
+            printf("Loopback mismatch on subframe %u (sub channel %u, tti %u)\n", n, data.sub_channel_start_idx, sf.tti);
+        }
+    }
+
+    //- Fully loaded subframes, as a receiver in a dense fleet would see them
+    srsran_ue_sl_grant_t grants[SRSRAN_MAX_NUM_SUB_CHANNEL];
+    for (uint32_t n = 0; n < nof_subframes && keep_running; n++) {
+        for (uint32_t k = 0; k < pool.num_sub_channel; k++) {
+            grants[k].sci.format = SRSRAN_SCI_FORMAT1;
+            srsran_set_sci(&grants[k].sci, 1, 100, 3, n % 2 == 1, 0, 11);
+            grants[k].data.ptr = &tb[k * SRSRAN_SL_SCH_MAX_TB_LEN];
+            grants[k].data.sub_channel_start_idx = k;
+            grants[k].data.l_sub_channel = 1;
+            for (uint32_t i = 0; i < SRSRAN_SL_SCH_MAX_TB_LEN; i++) {
+                grants[k].data.ptr[i] = (uint8_t)(rand_r(&seed) & 1);
+            }
+        }
+        srsran_sl_sf_cfg_t sf;
+        sf.tti = n % 10;
+
+        if (loopback_run_loaded(&loopback, &decoder, &sf, grants, pool.num_sub_channel) != SRSRAN_SUCCESS) {
+            printf("Loopback mismatch on fully loaded subframe %u (tti %u)\n", n, sf.tti);
+        }
+    }
+
+    loopback_print_stats(&loopback, stdout);
+    decoder_pool_print_stats(&decoder, stdout);
+    uint64_t nof_failed = (loopback.stats.nof_grants - loopback.stats.nof_ok) +
+                          (loopback.loaded_stats.nof_grants - loopback.loaded_stats.nof_ok);
+
+    decoder_pool_free(&decoder);
+    free(tb);
+    loopback_free(&loopback);
+    return nof_failed;
+}
 
 // === Primary code ===
 int main(int argc, char** argv) {
@@ -173,13 +915,28 @@ int main(int argc, char** argv) {
     
     parse_args(&prog_args, argc, argv);
 
+    //- Lock memory before anything is allocated, so even the first subframe doesn't page fault
+    if (prog_args.rt_cfg.enabled) {
+        rt_profile_init(&prog_args.rt_cfg);
+    }
+
+    //- Calibrate the latency timestamps now, rather than on the first subframe
+    latency_stats_init();
+    if (prog_args.latency_dest != NULL &&
+        latency_reporter_start(prog_args.latency_dest, LATENCY_DEFAULT_REPORT_PERIOD_S, prog_args.latency_json)) {
+        ERROR("Error starting latency export to %s\n", prog_args.latency_dest);
+        exit(-1);
+    }
+
     printf("Arguments parsed\n");
     printf("message_body is: %s\n", prog_args.message_body);
     printf("input_csv_name is: %s\n", prog_args.input_csv_name);
     printf("ms_between_messages is: %i\n", prog_args.ms_between_messages);
 
-    //TODO - If an input_csv_name specified, read the .csv, otherwise read the message_body
-
+    //- With `-C`, only convert the `-i` trace to the binary format. Rows longer than the TB of the run are skipped at replay.
+    if (prog_args.trace_output_name != NULL) {
+        return trace_replay_convert(prog_args.input_csv_name, prog_args.trace_output_name, SRSRAN_SL_SCH_MAX_TB_LEN) == SRSRAN_SUCCESS ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+    }
 
     //Create a celular sidelink object with some default parameters
     srsran_cell_sl_t cell_sl = {
@@ -196,42 +953,74 @@ int main(int argc, char** argv) {
         return SRSRAN_ERROR;
     }
     
-    //Attempt to find and connect to a radio (in our case, the EttusResearch USRP X410), passing in any provided arguments.
-    srsran_rf_t radio;
-    printf("Opening RF device...\n");
-    if (srsran_rf_open(&radio, prog_args.rf_args)) {
-        printf("Error opening rf\n");
+    //- In loopback mode nothing is transmitted: check the encoder against our own decoder and exit.
+    if (prog_args.loopback_subframes > 0) {
+        return run_loopback(cell_sl, sl_comm_resource_pool, prog_args.loopback_subframes, prog_args.fleet_cfg.nof_workers) == 0 ? SRSRAN_SUCCESS : SRSRAN_ERROR;
+    }
+
+    int srate = srsran_sampling_freq_hz(cell_sl.nof_prb);
+    if (srate == -1) {
+        ERROR("Invalid number of PRB %d\n", cell_sl.nof_prb);
         exit(-1);
     }
 
-    printf("Attempting to set TX gain with prog_args of: %f\n", prog_args.rf_gain);
+    //- Everything we transmit goes through the sink: either the radio, or a file/pipe when `-o` is given.
+    srsran_rf_t radio;
+    tx_sink_t sink;
+    if (prog_args.output_path != NULL) {
+        printf("Writing samples to %s instead of a radio\n", prog_args.output_path);
+        if (tx_sink_init_file(&sink, prog_args.output_path, prog_args.output_format, srate)) {
+            ERROR("Error opening output %s\n", prog_args.output_path);
+            exit(-1);
+        }
+    } else {
+        //Attempt to find and connect to a radio (in our case, the EttusResearch USRP X410), passing in any provided arguments.
+        printf("Opening RF device...\n");
+        if (srsran_rf_open(&radio, prog_args.rf_args)) {
+            printf("Error opening rf\n");
+            exit(-1);
+        }
+
+        printf("Attempting to set TX gain with prog_args of: %f\n", prog_args.rf_gain);
 
-    //- Attempt to tune the radio to the user-provided frequency and sampling rate
-    printf("Set TX freq: %.6f MHz\n",
-         srsran_rf_set_tx_freq(&radio, 0, prog_args.rf_freq) / 1e6);
-    srsran_rf_set_tx_gain(&radio, prog_args.rf_gain);
-    printf("Set TX gain: %.1f dB\n", srsran_rf_get_tx_gain(&radio));
+        //- Attempt to tune the radio to the user-provided frequency and sampling rate
+        printf("Set TX freq: %.6f MHz\n",
+             srsran_rf_set_tx_freq(&radio, 0, prog_args.rf_freq) / 1e6);
+        srsran_rf_set_tx_gain(&radio, prog_args.rf_gain);
+        printf("Set TX gain: %.1f dB\n", srsran_rf_get_tx_gain(&radio));
     
-    int srate = srsran_sampling_freq_hz(cell_sl.nof_prb);
-    if (srate != -1) {
         fprintf(stdout, "Setting sampling rate %.2f MHz\n", (float)srate / 1000000);
         fflush(stdout);
         float srate_rf = srsran_rf_set_tx_srate(&radio, (double)srate);
         if (srate_rf != srate) {
-        ERROR("Could not set sampling rate\n");
-        exit(-1);
+            ERROR("Could not set sampling rate\n");
+            exit(-1);
         }
-    } else {
-        ERROR("Invalid number of PRB %d\n", cell_sl.nof_prb);
-        exit(-1);
+
+        if (prog_args.sensing) {
+            printf("Set RX freq: %.6f MHz\n", srsran_rf_set_rx_freq(&radio, 0, prog_args.rf_freq) / 1e6);
+            srsran_rf_set_rx_gain(&radio, TX_SENSING_RX_GAIN_DB);
+            if (srsran_rf_set_rx_srate(&radio, (double)srate) != srate) {
+                ERROR("Could not set RX sampling rate\n");
+                exit(-1);
+            }
+        }
+        sleep(1);
+        tx_sink_init_rf(&sink, &radio);
     }
-    sleep(1);
 
     //TODO - Create a sidelink "vue" (Virtual Ue?)
     // (i.e. the special object designed by Eckermann)
     srsran_ue_sl_t srsue_vue_sl;
     srsran_ue_sl_init(&srsue_vue_sl, cell_sl, sl_comm_resource_pool, 0);
 
+    //- Finished subframes are cached, so resending the same payload on the same resources skips the encoder entirely.
+    wf_cache_t wf_cache;
+    if (wf_cache_init(&wf_cache, srsue_vue_sl.sf_len, prog_args.wf_cache_bytes)) {
+        ERROR("Error initializing waveform cache\n");
+        exit(-1);
+    }
+
     // === Prepare TX data ===
     
     //- Initialize Sidelink Control Information
@@ -248,126 +1037,236 @@ int main(int argc, char** argv) {
     // srsue_vue_sl.sci_tx.format = SRSRAN_SCI_FORMAT0; // Format 1 should be the one we're using, but I tried 0 just in case.
     printf("SCI format is set to: %d\n", srsue_vue_sl.sci_tx.format);
     
-    // uint8_t transport_block[SRSRAN_SL_SCH_MAX_TB_LEN] = {};
-    uint8_t transport_block[320] = {};
+    //- The encoder reads a whole TB (`sl_sch_tb_len` bits, up to SRSRAN_SL_SCH_MAX_TB_LEN) out of this, so size it for the largest one
+    uint8_t transport_block[SRSRAN_SL_SCH_MAX_TB_LEN] = {};
+    uint32_t message_bits = 0;
 
-    // TODO - my_v2x_message needs to be assigned the value provided from earlier. (currently using this hard-coded value)
-    uint8_t my_v2x_message[320] = {0,0,0,0,0,0,0,0,0,0,0,1,0,1,0,0,0,0,1,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,1,1,0,1,0,1,0,1,0,1,0,1,0,0,1,1,1,1,1,0,0,0,0,1,0,1,1,0,0,1,1,1,1,1,0,0,0,1,1,1,0,0,1,1,0,1,1,0,1,0,0,1,0,0,1,0,1,0,0,1,1,1,0,0,1,0,0,1,0,1,0,0,1,0,1,0,0,0,1,0,1,1,1,0,1,0,1,1,1,1,1,1,1,0,1,0,0,0,0,1,0,1,0,1,0,0,0,1,1,0,1,1,1,1,0,1,1,0,0,1,1,1,1,1,1,0,1,1,1,1,0,1,1,1,0,0,1,0,0,0,1,0,0,0,1,1,0,0,1,0,0,0,1,1,1,1,0,1,1,1,1,1,0,0,1,1,1,0,1,0,0,1,1,0,0,1,1,0,1,1,0,0,1,0,0,0,1,1,1,1,1,0,1,1,0,1,1,1,0,1,0,1,0,1,0,1,0,0,1,0,1,1,1,0,1,1,0,1,0,0,1,0,1,1,1,0,0,0,0,0,0,0,0,0,1,1,0,0,1,0,1,1,0,1,1,1,1,0,0,1,0,1,0,1,0,0,1,1,1,1,1,0,1,1,0,1,1,1,0,0,0,1,1,1,0,0,0};
-    for (int i = 0; i < 319; i++) {
-        transport_block[i] = my_v2x_message[i];
+    if (prog_args.message_body != NULL) {
+        //- `-m` message, zero-padded to the TB
+        int nof_bits = msg_ingest_hex_to_bits(prog_args.message_body, transport_block, SRSRAN_SL_SCH_MAX_TB_LEN);
+        if (nof_bits <= 0) {
+            printf("Error: `-m` must be a non-empty hex string that fits in a TB\n");
+            exit(-1);
+        }
+        message_bits = nof_bits;
+    } else {
+        //- Otherwise, the default test message
+        uint8_t my_v2x_message[320] = {0,0,0,0,0,0,0,0,0,0,0,1,0,1,0,0,0,0,1,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,1,1,0,1,0,1,0,1,0,1,0,1,0,0,1,1,1,1,1,0,0,0,0,1,0,1,1,0,0,1,1,1,1,1,0,0,0,1,1,1,0,0,1,1,0,1,1,0,1,0,0,1,0,0,1,0,1,0,0,1,1,1,0,0,1,0,0,1,0,1,0,0,1,0,1,0,0,0,1,0,1,1,1,0,1,0,1,1,1,1,1,1,1,0,1,0,0,0,0,1,0,1,0,1,0,0,0,1,1,0,1,1,1,1,0,1,1,0,0,1,1,1,1,1,1,0,1,1,1,1,0,1,1,1,0,0,1,0,0,0,1,0,0,0,1,1,0,0,1,0,0,0,1,1,1,1,0,1,1,1,1,1,0,0,1,1,1,0,1,0,0,1,1,0,0,1,1,0,1,1,0,0,1,0,0,0,1,1,1,1,1,0,1,1,0,1,1,1,0,1,0,1,0,1,0,1,0,0,1,0,1,1,1,0,1,1,0,1,0,0,1,0,1,1,1,0,0,0,0,0,0,0,0,0,1,1,0,0,1,0,1,1,0,1,1,1,1,0,0,1,0,1,0,1,0,0,1,1,1,1,1,0,1,1,0,1,1,1,0,0,0,1,1,1,0,0,0};
+        for (int i = 0; i < 319; i++) {
+            transport_block[i] = my_v2x_message[i];
+        }
+        message_bits = sizeof(my_v2x_message);
     }
-    // for (int i = 320; i < srsue_vue_sl.pssch_tx.sl_sch_tb_len; i++) {
-    //     transport_block[i] = 0;
-    // }
 
     srsran_pssch_data_t data;
     data.ptr = transport_block;
+    data.sub_channel_start_idx = 0;
+    data.l_sub_channel = 1;
 
-    srsran_sl_sf_cfg_t sf; //- sf probably stands for "subframe", so Sidelink Subframe Configuration
-
-    printf("creating signal buffer...\n");
-
-    cf_t* signal_buffer_tx[2] = {}; //- Create a "signal buffer" of size 2 (for now)
+    //- One throwaway encode tells us how many bits a TB holds with this SCI on one sub channel
+    srsran_sl_sf_cfg_t probe_sf = {};
+    if (srsran_ue_sl_encode(&srsue_vue_sl, &probe_sf, &data)) {
+        ERROR("Error encoding sidelink\n");
+        exit(-1);
+    }
+    uint32_t sl_sch_tb_len = srsue_vue_sl.pssch_tx.sl_sch_tb_len;
+    if (message_bits > sl_sch_tb_len) {
+        printf("Error: the message is %u bits, but a TB only holds %u\n", message_bits, sl_sch_tb_len);
+        exit(-1);
+    }
 
-    //- Eventually, this will need to be a nested for loop. The outer loop will be "for each message, encode data", and the inner will be "for each encoding, encode for one frequency and then another."
-    //- (or I could just unroll the inner loop, since it will only ever need to execute twice.)
-    //- This loop is for generating the original message, and a repeat of that message
-    for (int i = 0; i < 2; ++i) {
+    //- Everything the encoder thread needs to produce our subframes. From here on, encoding happens on that thread,
+    //-   and this (main) thread only pulls finished subframes out of the pipeline and hands them to the radio.
+    tx_encoder_ctx_t encoder_ctx;
+    encoder_ctx.ue = &srsue_vue_sl;
+    encoder_ctx.wf_cache = &wf_cache;
+    encoder_ctx.data = data;
+    encoder_ctx.tb_len = message_bits; //- the rest of the TB is zero
+    encoder_ctx.sps = NULL;
+    encoder_ctx.rx = NULL;
+    encoder_ctx.ingest = NULL;
+    encoder_ctx.ingest_bits = message_bits;
+    encoder_ctx.ring = NULL;
+    encoder_ctx.trace = NULL;
 
-        //-?? Probably "allocate memory for our subframe's data"
-        signal_buffer_tx[i] = srsran_vec_cf_malloc(srsue_vue_sl.sf_len);
-        if (!signal_buffer_tx[i]) {
-            perror("malloc");
+    //- In sensing mode, a receive thread senses the channel and the encoder transmits on whatever the sensing engine reserves.
+    sps_sensing_t sps;
+    sensing_rx_t rx;
+    if (prog_args.sensing) {
+        sps_sensing_cfg_t sps_cfg;
+        sps_sensing_cfg_default(&sps_cfg);
+        sps_cfg.priority = srsue_vue_sl.sci_tx.priority;
+        sps_cfg.intvl_ms = srsran_intvl_from_reserv(srsue_vue_sl.sci_tx.resource_reserv);
+        sps_cfg.l_sub_channel = 1;
+        sps_cfg.num_sub_channel = sl_comm_resource_pool.num_sub_channel;
+        sps_cfg.rsrp_threshold_db = prog_args.sensing_threshold_db;
+        if (sps_sensing_init(&sps, &sps_cfg)) {
+            ERROR("Error initializing sensing\n");
+            exit(-1);
+        }
+        if (sensing_rx_init(&rx, &radio, &sps, cell_sl, sl_comm_resource_pool, prog_args.fleet_cfg.nof_workers) ||
+            sensing_rx_start(&rx)) {
+            ERROR("Error starting sensing receiver\n");
             exit(-1);
         }
+        sensing_rx = &rx;
+        encoder_ctx.sps = &sps;
+        encoder_ctx.rx = &rx;
+    }
 
-        data.sub_channel_start_idx = i*4; //Default to "0" for now...
-        data.l_sub_channel = 1; //Default was "2", "1" seems most appropriate after testing. This modifies a calculated value placed in the SCI describing how many sub_channels this message will occupy.  "l" is probably "length". So the "length" of the sub channel "array", i.e. the number of subchannels in our channel we'd like to be writing to.
+    //- In daemon mode, the encoder sends whatever arrives on the socket instead of the fixed TB.
+    msg_ingest_t ingest;
+    if (prog_args.ingest_endpoint != NULL) {
+        if (msg_ingest_init(&ingest, prog_args.ingest_endpoint, sl_sch_tb_len / 8, prog_args.ingest_log_name) ||
+            msg_ingest_start(&ingest)) {
+            ERROR("Error opening message socket %s\n", prog_args.ingest_endpoint);
+            exit(-1);
+        }
+        printf("Listening for messages of up to %u bytes on %s\n", sl_sch_tb_len / 8, prog_args.ingest_endpoint);
+        msg_ingest = &ingest;
+        encoder_ctx.ingest = &ingest;
+    }
 
-        //- tti is probably "transmission time interval". I thought this was 1ms but in Eckermann's code, it is from 0 to 100.
-        //- It's possible that this time interval is a specific time duration, and is based off of some base time.
-        sf.tti = 1;
+    //- In shared memory mode, it sends what local producers commit to the ring.
+    shm_ring_t ring;
+    if (prog_args.shm_ring_name != NULL) {
+        if (shm_ring_create(&ring, prog_args.shm_ring_name, SHM_RING_DEFAULT_SLOTS, sl_sch_tb_len)) {
+            ERROR("Error creating message ring %s\n", prog_args.shm_ring_name);
+            exit(-1);
+        }
+        printf("Taking messages of up to %u bits from shared memory %s\n", sl_sch_tb_len, prog_args.shm_ring_name);
+        msg_ring = &ring;
+        encoder_ctx.ring = &ring;
+    }
 
-        //- Attempt to encode a sidelink mesage (probably storing it in srsue_vue_sl) using our subframe (sf) and data.
-        //-   The source code seems to deal with both the shared and control channel stuff.
-        if (srsran_ue_sl_encode(&srsue_vue_sl, &sf, &data)) { 
-            ERROR("Error encoding sidelink\n");
+    //- In trace replay mode, it sends the rows of the `-i` trace, each in the subframe of its recorded time. The trace is
+    //-   parsed on its own thread, and the first rows are ready before the pipeline starts.
+    trace_replay_t trace;
+    if (prog_args.input_csv_name != NULL) {
+        if (trace_replay_init(&trace, prog_args.input_csv_name, sl_sch_tb_len, srsue_vue_sl.sci_tx.priority) ||
+            trace_replay_start(&trace)) {
+            ERROR("Error opening trace %s\n", prog_args.input_csv_name);
             exit(-1);
         }
+        printf("Replaying %s, messages of up to %u bits\n", prog_args.input_csv_name, sl_sch_tb_len);
+        msg_trace = &trace;
+        encoder_ctx.trace = &trace;
+    }
+
+    printf("creating TX pipeline...\n");
+
+    //- In fleet mode, the subframes come from the virtual fleet instead of our single UE.
+    bool fleet_mode = prog_args.fleet_cfg.nof_vehicles > 0;
+    fleet_t fleet;
+    if (fleet_mode && fleet_init(&fleet, cell_sl, sl_comm_resource_pool, &prog_args.fleet_cfg)) {
+        ERROR("Error initializing fleet\n");
+        exit(-1);
+    }
+
+    tx_pipeline_t pipeline;
+    if (tx_pipeline_init(&pipeline, srsue_vue_sl.sf_len, prog_args.pipeline_depth,
+                         fleet_mode ? fleet_encode_subframe : encode_subframe,
+                         fleet_mode ? (void*)&fleet : (void*)&encoder_ctx)) {
+        ERROR("Error initializing TX pipeline\n");
+        exit(-1);
+    }
+    if (tx_pipeline_start(&pipeline)) {
+        ERROR("Error starting encoder thread\n");
+        exit(-1);
+    }
 
-        //- Take our encoded information and copy it over into a transmission buffer, which we will pull from when we want to send a message.
-        memcpy(signal_buffer_tx[i], srsue_vue_sl.signal_buffer_tx, sizeof(cf_t) * srsue_vue_sl.sf_len);
+    //- In real-time mode, the encoder and this (TX) thread get their own CPUs and RT priorities. Every other thread
+    //-   (sensing, ingest, fleet workers, the radio driver's) was started before and keeps the default scheduler.
+    if (prog_args.rt_cfg.enabled) {
+        rt_profile_apply_thread(pipeline.encoder_thread, "cv2x-encode", prog_args.rt_cfg.encode_cpu, prog_args.rt_cfg.encode_priority);
+        rt_profile_apply_thread(pthread_self(), "cv2x-tx", prog_args.rt_cfg.tx_cpu, prog_args.rt_cfg.tx_priority);
+        rt_profile_check(&prog_args.rt_cfg, pthread_self(), pipeline.encoder_thread, stdout);
     }
 
-    
+    //- Late subframes are skipped on the grid, and the submit lead adapts to how often that happens
+    tx_recovery_t recovery;
+    tx_recovery_init(&recovery, TX_SUBMIT_LEAD_S, TX_SUBMIT_MAX_LEAD_S);
 
     //- Transmit the message, according to the number of times and the delay-between-messages specified
-    // === Timing ===
-    srsran_timestamp_t startup_time, tx_time, now;
+    if (prog_args.burst_window_ms > 0) {
+        tx_burst_t burst;
+        if (tx_burst_init(&burst, srsue_vue_sl.sf_len, prog_args.burst_window_ms)) {
+            ERROR("Error initializing TX burst window\n");
+            exit(-1);
+        }
+        run_burst_loop(&sink, &pipeline, &burst, &recovery, srate, prog_args.continuous_stream);
+        tx_burst_print_stats(&burst, stdout);
+        tx_burst_free(&burst);
+    } else {
+        run_subframe_loop(&sink, &pipeline, &recovery, srsue_vue_sl.sf_len, srate);
+    }
 
-    get_start_time(&radio, &startup_time); //- Retrieve the starting time from the radio and store it in &startup_time
+    //- Release an encoder waiting for a message before stopping the pipeline
+    if (msg_ingest != NULL) {
+        msg_ingest_stop(&ingest);
+    }
+    if (msg_ring != NULL) {
+        shm_ring_stop(&ring);
+    }
+    tx_pipeline_stop(&pipeline);
+    if (prog_args.sensing) {
+        sensing_rx_stop(&rx);
+    }
+    if (msg_trace != NULL) {
+        trace_replay_stop(&trace);
+    }
 
-    uint32_t tx_sec_offset = 0;
-    uint32_t tx_msec_offset = 0;
+    // Close connections to the USRP radio and free up memory.
+    tx_sink_print_stats(&sink, stdout);
+    if (sink.type == TX_SINK_RF) {
+        srsran_rf_close(&radio);
+    }
+    tx_sink_free(&sink);
+    srsran_ue_sl_free(&srsue_vue_sl);
 
-    while (keep_running) {
-        srsran_timestamp_copy(&tx_time, &startup_time);                         //- Overwrite tx_time with start_time. Why? Not sure. Possibly this value gets modified by `srsran_rf_send_timed2()`
-        srsran_timestamp_add(&tx_time, tx_sec_offset, tx_msec_offset * 1e-3);   //- Add a specific amount of offset to our start_time. Offset gets progressively larger as `while (keep_running)` loops.
+    tx_pipeline_print_stats(&pipeline, stdout);
+    tx_pipeline_free(&pipeline);
+    tx_recovery_print_stats(&recovery, stdout);
 
-        srsran_rf_get_time(&radio, &now.full_secs, &now.frac_secs); //- Get the current time from the radio and store it in `now`
+    wf_cache_print_stats(&wf_cache, stdout);
+    wf_cache_free(&wf_cache);
 
-        // Check if tx_time is in the past. If so, reset time.
-        if (srsran_timestamp_uint64(&now, srate) > srsran_timestamp_uint64(&tx_time, srate)) {
-            //- This is cause for an error because it indicates the code ran super slow since tx_time was last calculated.
-            //- We need this so we don't attempt to schedule a transmission with the radio at a time that is in the past.
-            ERROR("tx_time is in the past (tx_time: %f, now: %f). Setting new start time.\n", 
-                srsran_timestamp_real(&tx_time), srsran_timestamp_real(&now));
-            get_start_time(&radio, &startup_time);
+    if (fleet_mode) {
+        fleet_print_stats(&fleet, stdout);
+        fleet_free(&fleet);
+    }
 
-            tx_sec_offset = 0;
-            tx_msec_offset = 0;
-        }
-        // Things look good, proceed with scheduling transmission
-        else {
-            int tx_result = 0;
-            if (tx_msec_offset == 0) { //- Send the initial message
-                tx_result = srsran_rf_send_timed2(&radio,
-                                            signal_buffer_tx[0], //-"data"
-                                            srsue_vue_sl.sf_len, //-"nsamples"
-                                            tx_time.full_secs, // -"secs"
-                                            tx_time.frac_secs, //-"frac_secs"
-                                            true,              //-"is_start_of_burst"
-                                            true);             //-"is_end_of_burst"
-            
-            }
-            else if (tx_msec_offset == 4) { //- Send the re-transmission
-                tx_result = srsran_rf_send_timed2(&radio,
-                                            signal_buffer_tx[1], //-"data"
-                                            srsue_vue_sl.sf_len, //-"nsamples"
-                                            tx_time.full_secs, // -"secs"
-                                            tx_time.frac_secs, //-"frac_secs"
-                                            true,              //-"is_start_of_burst"
-                                            true);             //-"is_end_of_burst"
-            }
-            if (tx_result < 0) {
-            ERROR("Error sending data: %d\n", tx_result);
-            }
-        }
+    if (prog_args.sensing) {
+        sps_sensing_print_stats(&sps, stdout);
+        sensing_rx_print_stats(&rx, stdout);
+        sensing_rx_free(&rx);
+        sps_sensing_free(&sps);
+        sensing_rx = NULL;
+    }
 
+    if (msg_ingest != NULL) {
+        msg_ingest_print_stats(&ingest, stdout);
+        msg_ingest_free(&ingest);
+        msg_ingest = NULL;
+    }
 
-        //- Increment transmission time offsets, which will be added to tx_time (after being reset to our start_time) to determine our next scheduled transmission time
-        tx_msec_offset += 1;
-        if (tx_msec_offset == 1000) {
-            tx_sec_offset++;
-            tx_msec_offset = 0;
-        }
+    if (msg_ring != NULL) {
+        shm_ring_print_stats(&ring, stdout);
+        shm_ring_free(&ring);
+        msg_ring = NULL;
     }
 
-    // Close connections to the USRP radio and free up memory.
-    srsran_rf_close(&radio);
-    srsran_ue_sl_free(&srsue_vue_sl);
+    if (msg_trace != NULL) {
+        trace_replay_print_stats(&trace, stdout);
+        trace_replay_free(&trace);
+        msg_trace = NULL;
+    }
+
+    dmrs_cache_print_stats(stdout);
+    dmrs_cache_free();
 
-    free(signal_buffer_tx[0]);
+    latency_stats_print(stdout);
+    latency_stats_free();
 
     return SRSRAN_SUCCESS;
 }
\ No newline at end of file
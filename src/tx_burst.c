@@ -0,0 +1,167 @@
+/******************************************************************************
+ *  File:         tx_burst.c
+ *
+ *  Description:  Multi-subframe TX windows (see tx_burst.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <float.h>
+#include <string.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "rt_profile.h"
+#include "tx_burst.h"
+}
+
+/**
+ * @param sf_len samples per subframe
+ * @param nof_sf window length in subframes (ms), TX_BURST_MIN_WINDOW_MS to TX_BURST_MAX_WINDOW_MS
+ */
+int tx_burst_init(tx_burst_t* q, uint32_t sf_len, uint32_t nof_sf)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && sf_len > 0 && nof_sf >= TX_BURST_MIN_WINDOW_MS && nof_sf <= TX_BURST_MAX_WINDOW_MS) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(tx_burst_t));
+    q->sf_len = sf_len;
+    q->nof_sf = nof_sf;
+
+    q->buffer = (cf_t*)rt_profile_alloc(sizeof(cf_t) * sf_len * nof_sf); // zeroed
+    if (!q->buffer) {
+      goto clean_exit;
+    }
+
+    q->dirty = (bool*)calloc(nof_sf, sizeof(bool));
+    if (!q->dirty) {
+      perror("calloc");
+      goto clean_exit;
+    }
+
+    q->stats.lead_min = DBL_MAX;
+    q->stats.lead_max = -DBL_MAX;
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters (window must be %d to %d ms)\n", TX_BURST_MIN_WINDOW_MS, TX_BURST_MAX_WINDOW_MS);
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    tx_burst_free(q);
+  }
+  return ret;
+}
+
+void tx_burst_free(tx_burst_t* q)
+{
+  if (q) {
+    rt_profile_free(q->buffer);
+    if (q->dirty) {
+      free(q->dirty);
+    }
+    bzero(q, sizeof(tx_burst_t));
+  }
+}
+
+/**
+ * Start a new, all-idle window. Only subframes written by the previous window are cleared, so a mostly
+ * idle window costs next to nothing to reset.
+ *
+ * @param start_sf_idx pipeline subframe index of the first subframe in the window
+ */
+void tx_burst_reset(tx_burst_t* q, uint64_t start_sf_idx)
+{
+  for (uint32_t i = 0; i < q->nof_sf; i++) {
+    if (q->dirty[i]) {
+      srsran_vec_cf_zero(&q->buffer[i * q->sf_len], q->sf_len);
+      q->dirty[i] = false;
+    }
+  }
+  q->start_sf_idx = start_sf_idx;
+  q->nof_busy     = 0;
+}
+
+/**
+ * Move every ready subframe of the current window from the pipeline into the window buffer. Subframes
+ * older than the window are dropped as late; subframes of later windows stay in the pipeline.
+ *
+ * @return true once the encoder has moved past the end of the window, i.e. the window is complete
+ */
+bool tx_burst_fill(tx_burst_t* q, tx_pipeline_t* pipeline)
+{
+  uint64_t end_sf_idx = q->start_sf_idx + q->nof_sf;
+
+  // Read the encoder progress before draining: every subframe it covers is already visible in the ring
+  uint64_t encoded_until = tx_pipeline_encoded_until(pipeline);
+
+  tx_pipeline_slot_t* slot;
+  while ((slot = tx_pipeline_front(pipeline)) != NULL) {
+    if (slot->sf_idx < q->start_sf_idx) {
+      tx_pipeline_drop_late(pipeline);
+      continue;
+    }
+    if (slot->sf_idx >= end_sf_idx) {
+      break;
+    }
+    uint32_t i = (uint32_t)(slot->sf_idx - q->start_sf_idx);
+    srsran_vec_cf_copy(&q->buffer[i * q->sf_len], slot->samples, q->sf_len);
+    q->dirty[i] = true;
+    q->nof_busy++;
+    tx_pipeline_release(pipeline);
+  }
+
+  return encoded_until >= end_sf_idx;
+}
+
+uint32_t tx_burst_nof_samples(tx_burst_t* q)
+{
+  return q->nof_sf * q->sf_len;
+}
+
+/**
+ * Account for a window handed to the radio.
+ *
+ * @param lead_s how far ahead of its air time the window was submitted, in seconds
+ * @param nof_driver_calls srsran_rf_send_timed2() calls it took
+ */
+void tx_burst_sent(tx_burst_t* q, double lead_s, uint32_t nof_driver_calls)
+{
+  tx_burst_stats_t* s = &q->stats;
+
+  s->nof_windows++;
+  s->nof_busy_sf += q->nof_busy;
+  s->nof_driver_calls += nof_driver_calls;
+  s->lead_sum += lead_s;
+  s->lead_min = SRSRAN_MIN(s->lead_min, lead_s);
+  s->lead_max = SRSRAN_MAX(s->lead_max, lead_s);
+}
+
+void tx_burst_drop_late(tx_burst_t* q)
+{
+  q->stats.nof_late_windows++;
+}
+
+void tx_burst_print_stats(tx_burst_t* q, FILE* f)
+{
+  tx_burst_stats_t* s = &q->stats;
+
+  fprintf(f,
+          "tx burst: %lu windows of %u ms sent (%lu busy subframes), %lu late windows dropped, %lu driver calls\n",
+          (unsigned long)s->nof_windows,
+          q->nof_sf,
+          (unsigned long)s->nof_busy_sf,
+          (unsigned long)s->nof_late_windows,
+          (unsigned long)s->nof_driver_calls);
+  if (s->nof_windows > 0) {
+    fprintf(f,
+            "tx burst: lead time min/avg/max %.3f/%.3f/%.3f ms\n",
+            s->lead_min * 1e3,
+            s->lead_sum / s->nof_windows * 1e3,
+            s->lead_max * 1e3);
+  }
+}
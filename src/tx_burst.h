@@ -0,0 +1,65 @@
+/******************************************************************************
+ *  File:         tx_burst.h
+ *
+ *  Description:  Multi-subframe TX windows.
+ *
+ *                Collects the subframes of a 10-100 ms window from the TX
+ *                pipeline into one contiguous buffer, with idle subframes left
+ *                at zero, so the whole window can be handed to the radio with a
+ *                single srsran_rf_send_timed2() call. Used both for one burst
+ *                per window and for continuous streaming, where consecutive
+ *                windows form one never-ending burst.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TX_BURST_H
+#define TX_BURST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tx_pipeline.h"
+
+#define TX_BURST_MIN_WINDOW_MS (10)
+#define TX_BURST_MAX_WINDOW_MS (100)
+
+typedef struct {
+  uint64_t nof_windows;      // windows handed to the radio
+  uint64_t nof_late_windows; // windows dropped because their air time passed before they were complete
+  uint64_t nof_busy_sf;      // subframes carrying a transmission over all sent windows
+  uint64_t nof_driver_calls; // srsran_rf_send_timed2() calls
+  double   lead_sum;
+  double   lead_min;
+  double   lead_max;
+} tx_burst_stats_t;
+
+typedef struct {
+  uint32_t sf_len;
+  uint32_t nof_sf;
+  cf_t*    buffer; // nof_sf * sf_len samples
+  bool*    dirty;  // subframes holding samples that must be cleared before the next window
+  uint64_t start_sf_idx;
+  uint32_t nof_busy;
+
+  tx_burst_stats_t stats;
+} tx_burst_t;
+
+int tx_burst_init(tx_burst_t* q, uint32_t sf_len, uint32_t nof_sf);
+
+void tx_burst_free(tx_burst_t* q);
+
+void tx_burst_reset(tx_burst_t* q, uint64_t start_sf_idx);
+
+bool tx_burst_fill(tx_burst_t* q, tx_pipeline_t* pipeline);
+
+uint32_t tx_burst_nof_samples(tx_burst_t* q);
+
+void tx_burst_sent(tx_burst_t* q, double lead_s, uint32_t nof_driver_calls);
+
+void tx_burst_drop_late(tx_burst_t* q);
+
+void tx_burst_print_stats(tx_burst_t* q, FILE* f);
+
+#endif // TX_BURST_H
@@ -0,0 +1,282 @@
+/******************************************************************************
+ *  File:         tx_pipeline.c
+ *
+ *  Description:  Producer/consumer TX pipeline (see tx_pipeline.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <float.h>
+#include <string.h>
+#include <time.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "rt_profile.h"
+#include "tx_pipeline.h"
+}
+
+#define TX_PIPELINE_FULL_WAIT_NS (100000)
+#define TX_PIPELINE_AHEAD_WAIT_NS (500000) // the air time moves on by one subframe per ms
+
+double tx_pipeline_host_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* encoder_thread_run(void* arg)
+{
+  tx_pipeline_t* q = (tx_pipeline_t*)arg;
+
+  while (__atomic_load_n(&q->running, __ATOMIC_RELAXED)) {
+    uint64_t head = q->head; // only this thread writes head
+    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= q->capacity) {
+      q->producer_stats.nof_full_waits++;
+      struct timespec wait = {0, TX_PIPELINE_FULL_WAIT_NS};
+      nanosleep(&wait, NULL);
+      continue;
+    }
+
+    if (q->next_sf_idx >= __atomic_load_n(&q->air_sf_idx, __ATOMIC_ACQUIRE) + TX_PIPELINE_MAX_AHEAD_SF) {
+      q->producer_stats.nof_ahead_waits++;
+      struct timespec wait = {0, TX_PIPELINE_AHEAD_WAIT_NS};
+      nanosleep(&wait, NULL);
+      continue;
+    }
+
+    tx_pipeline_slot_t* slot = &q->slots[head & q->mask];
+    uint64_t            sf_idx = q->next_sf_idx++;
+
+    int n = q->encode_fn(q->encode_arg, sf_idx, slot->samples);
+    if (n < 0) {
+      q->producer_stats.nof_errors++;
+    } else if (n == 0) {
+      q->producer_stats.nof_idle++;
+    } else {
+      slot->sf_idx     = sf_idx;
+      slot->ready_time = tx_pipeline_host_time();
+      q->producer_stats.nof_pushed++;
+      __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&q->encoded_until, sf_idx + 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+/**
+ * Initialize the pipeline. The encoder thread is not started until tx_pipeline_start().
+ *
+ * @param sf_len samples per subframe
+ * @param depth ring capacity in subframes, rounded up to a power of two
+ * @param encode_fn encoder callback, see tx_pipeline_encode_fn
+ */
+int tx_pipeline_init(tx_pipeline_t*        q,
+                     uint32_t              sf_len,
+                     uint32_t              depth,
+                     tx_pipeline_encode_fn encode_fn,
+                     void*                 encode_arg)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && sf_len > 0 && depth > 0 && encode_fn != NULL) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(tx_pipeline_t));
+
+    q->sf_len   = sf_len;
+    q->capacity = 1;
+    while (q->capacity < depth) {
+      q->capacity <<= 1;
+    }
+    q->mask       = q->capacity - 1;
+    q->encode_fn  = encode_fn;
+    q->encode_arg = encode_arg;
+
+    q->slots = (tx_pipeline_slot_t*)calloc(q->capacity, sizeof(tx_pipeline_slot_t));
+    if (!q->slots) {
+      perror("calloc");
+      goto clean_exit;
+    }
+    q->sample_buffer = (cf_t*)rt_profile_alloc(sizeof(cf_t) * sf_len * q->capacity);
+    if (!q->sample_buffer) {
+      goto clean_exit;
+    }
+    for (uint32_t i = 0; i < q->capacity; i++) {
+      q->slots[i].samples = &q->sample_buffer[i * sf_len];
+    }
+
+    q->consumer_stats.depth_min = UINT32_MAX;
+    q->consumer_stats.lead_min  = DBL_MAX;
+    q->consumer_stats.lead_max  = -DBL_MAX;
+
+    ret = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    tx_pipeline_free(q);
+  }
+  return ret;
+}
+
+void tx_pipeline_free(tx_pipeline_t* q)
+{
+  if (q) {
+    tx_pipeline_stop(q);
+    if (q->slots) {
+      free(q->slots);
+    }
+    rt_profile_free(q->sample_buffer);
+    bzero(q, sizeof(tx_pipeline_t));
+  }
+}
+
+int tx_pipeline_start(tx_pipeline_t* q)
+{
+  q->running = true;
+  if (pthread_create(&q->encoder_thread, NULL, encoder_thread_run, q)) {
+    perror("pthread_create");
+    q->running = false;
+    return SRSRAN_ERROR;
+  }
+  q->thread_started = true;
+  return SRSRAN_SUCCESS;
+}
+
+void tx_pipeline_stop(tx_pipeline_t* q)
+{
+  if (q->thread_started) {
+    __atomic_store_n(&q->running, false, __ATOMIC_RELAXED);
+    pthread_join(q->encoder_thread, NULL);
+    q->thread_started = false;
+  }
+}
+
+/**
+ * Number of ready subframes waiting in the ring.
+ */
+uint32_t tx_pipeline_depth(tx_pipeline_t* q)
+{
+  uint64_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  return (uint32_t)(head - q->tail);
+}
+
+/**
+ * Index of the first subframe the encoder has not finished yet. Every busy subframe before it is already
+ * in the ring (or was consumed), which lets the consumer know when a window of subframes is complete.
+ */
+uint64_t tx_pipeline_encoded_until(tx_pipeline_t* q)
+{
+  return __atomic_load_n(&q->encoded_until, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Publish the subframe on air now, which lets the encoder run up to TX_PIPELINE_MAX_AHEAD_SF subframes past it.
+ * Consumer side only; until the first call the encoder stops TX_PIPELINE_MAX_AHEAD_SF subframes into the timeline.
+ */
+void tx_pipeline_set_air_sf(tx_pipeline_t* q, uint64_t sf_idx)
+{
+  __atomic_store_n(&q->air_sf_idx, sf_idx, __ATOMIC_RELEASE);
+}
+
+/**
+ * Oldest ready subframe, or NULL if the encoder has not produced one yet. Consumer side only.
+ */
+tx_pipeline_slot_t* tx_pipeline_front(tx_pipeline_t* q)
+{
+  uint64_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  if (head == q->tail) {
+    return NULL;
+  }
+  return &q->slots[q->tail & q->mask];
+}
+
+static void release_front(tx_pipeline_t* q)
+{
+  tx_pipeline_consumer_stats_t* s     = &q->consumer_stats;
+  uint32_t                      depth = tx_pipeline_depth(q);
+
+  s->depth_sum += depth;
+  s->depth_min = SRSRAN_MIN(s->depth_min, depth);
+  s->depth_max = SRSRAN_MAX(s->depth_max, depth);
+
+  __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Release the front slot after it was submitted.
+ *
+ * @param lead_s how far ahead of its air time the subframe was submitted, in seconds
+ */
+void tx_pipeline_pop(tx_pipeline_t* q, double lead_s)
+{
+  tx_pipeline_consumer_stats_t* s = &q->consumer_stats;
+
+  s->nof_popped++;
+  s->lead_sum += lead_s;
+  s->lead_min = SRSRAN_MIN(s->lead_min, lead_s);
+  s->lead_max = SRSRAN_MAX(s->lead_max, lead_s);
+
+  release_front(q);
+}
+
+/**
+ * Release the front slot after its samples were copied out by the consumer. Lead time is then accounted
+ * by whoever submits the copy.
+ */
+void tx_pipeline_release(tx_pipeline_t* q)
+{
+  q->consumer_stats.nof_released++;
+  release_front(q);
+}
+
+/**
+ * Release the front slot without submitting it because its air time has already passed.
+ */
+void tx_pipeline_drop_late(tx_pipeline_t* q)
+{
+  q->consumer_stats.nof_late++;
+  release_front(q);
+}
+
+void tx_pipeline_print_stats(tx_pipeline_t* q, FILE* f)
+{
+  tx_pipeline_producer_stats_t* p       = &q->producer_stats;
+  tx_pipeline_consumer_stats_t* c       = &q->consumer_stats;
+  uint64_t                      nof_out = c->nof_popped + c->nof_released + c->nof_late;
+
+  fprintf(f,
+          "tx pipeline: %lu encoded, %lu idle, %lu errors, %lu encoder waits on full ring (depth %u), %lu on the air "
+          "time (%d subframes ahead)\n",
+          (unsigned long)p->nof_pushed,
+          (unsigned long)p->nof_idle,
+          (unsigned long)p->nof_errors,
+          (unsigned long)p->nof_full_waits,
+          q->capacity,
+          (unsigned long)p->nof_ahead_waits,
+          TX_PIPELINE_MAX_AHEAD_SF);
+  if (nof_out > 0) {
+    fprintf(f,
+            "tx pipeline: %lu sent, %lu late; ring depth min/avg/max %u/%.1f/%u\n",
+            (unsigned long)(c->nof_popped + c->nof_released),
+            (unsigned long)c->nof_late,
+            c->depth_min,
+            (double)c->depth_sum / nof_out,
+            c->depth_max);
+  }
+  if (c->nof_popped > 0) {
+    fprintf(f,
+            "tx pipeline: lead time min/avg/max %.3f/%.3f/%.3f ms\n",
+            c->lead_min * 1e3,
+            c->lead_sum / c->nof_popped * 1e3,
+            c->lead_max * 1e3);
+  }
+}
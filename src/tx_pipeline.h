@@ -0,0 +1,126 @@
+/******************************************************************************
+ *  File:         tx_pipeline.h
+ *
+ *  Description:  Producer/consumer TX pipeline.
+ *
+ *                A dedicated encoder thread walks the subframe timeline ahead
+ *                of the radio clock and pushes every subframe that carries a
+ *                transmission into a single-producer/single-consumer
+ *                lock-free ring. The TX thread only dequeues and submits, so a
+ *                slow encode no longer stalls srsran_rf_send_timed2().
+ *
+ *                Besides the ring depth, the encoder is held to
+ *                TX_PIPELINE_MAX_AHEAD_SF subframes past the one on air, which
+ *                the TX thread publishes with tx_pipeline_set_air_sf(), so on a
+ *                sparse schedule it doesn't encode subframes far in the future
+ *                from inputs that are stale by the time they go out.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TX_PIPELINE_H
+#define TX_PIPELINE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <srsran/phy/utils/vector.h>
+
+#define TX_PIPELINE_DEFAULT_DEPTH (8)
+// Longest burst window (100 ms), plus the largest submit lead (80 ms), plus the longest the TX loop sleeps between
+// two updates of the air time (100 ms), with some margin
+#define TX_PIPELINE_MAX_AHEAD_SF (300)
+
+/**
+ * Encoder callback, called from the encoder thread once per subframe index in increasing order.
+ *
+ * @param arg user argument given to tx_pipeline_init()
+ * @param sf_idx subframe (ms) index since the start of the timeline
+ * @param output sf_len samples to fill in
+ * @return 1 if output holds a subframe to transmit, 0 if the subframe is idle, < 0 on error
+ */
+typedef int (*tx_pipeline_encode_fn)(void* arg, uint64_t sf_idx, cf_t* output);
+
+typedef struct {
+  uint64_t sf_idx;
+  cf_t*    samples;
+  double   ready_time; // host monotonic time (s) at which encoding finished
+} tx_pipeline_slot_t;
+
+typedef struct {
+  uint64_t nof_pushed;
+  uint64_t nof_idle;
+  uint64_t nof_errors;
+  uint64_t nof_full_waits;  // times the encoder had to wait for the TX thread
+  uint64_t nof_ahead_waits; // times the encoder had to wait for the air time to catch up
+} tx_pipeline_producer_stats_t;
+
+typedef struct {
+  uint64_t nof_popped;
+  uint64_t nof_released; // copied out by the consumer (e.g. into a burst) instead of submitted one by one
+  uint64_t nof_late;
+  uint64_t depth_sum;
+  uint32_t depth_min;
+  uint32_t depth_max;
+  double   lead_sum;
+  double   lead_min;
+  double   lead_max;
+} tx_pipeline_consumer_stats_t;
+
+typedef struct {
+  uint32_t            sf_len;
+  uint32_t            capacity; // power of two
+  uint32_t            mask;
+  tx_pipeline_slot_t* slots;
+  cf_t*               sample_buffer; // capacity * sf_len samples, one prefaulted block the slots point into
+
+  // Producer and consumer indices live on separate cache lines to avoid false sharing
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t tail __attribute__((aligned(64)));
+
+  tx_pipeline_encode_fn encode_fn;
+  void*                 encode_arg;
+  uint64_t              next_sf_idx;
+  uint64_t              encoded_until; // every subframe before this index is either idle or in the ring
+  uint64_t              air_sf_idx;    // subframe on air, set by the consumer
+
+  pthread_t encoder_thread;
+  bool      running;
+  bool      thread_started;
+
+  tx_pipeline_producer_stats_t producer_stats;
+  tx_pipeline_consumer_stats_t consumer_stats;
+} tx_pipeline_t;
+
+int tx_pipeline_init(tx_pipeline_t*        q,
+                     uint32_t              sf_len,
+                     uint32_t              depth,
+                     tx_pipeline_encode_fn encode_fn,
+                     void*                 encode_arg);
+
+void tx_pipeline_free(tx_pipeline_t* q);
+
+int tx_pipeline_start(tx_pipeline_t* q);
+
+void tx_pipeline_stop(tx_pipeline_t* q);
+
+uint32_t tx_pipeline_depth(tx_pipeline_t* q);
+
+uint64_t tx_pipeline_encoded_until(tx_pipeline_t* q);
+
+void tx_pipeline_set_air_sf(tx_pipeline_t* q, uint64_t sf_idx);
+
+tx_pipeline_slot_t* tx_pipeline_front(tx_pipeline_t* q);
+
+void tx_pipeline_pop(tx_pipeline_t* q, double lead_s);
+
+void tx_pipeline_release(tx_pipeline_t* q);
+
+void tx_pipeline_drop_late(tx_pipeline_t* q);
+
+double tx_pipeline_host_time(void);
+
+void tx_pipeline_print_stats(tx_pipeline_t* q, FILE* f);
+
+#endif // TX_PIPELINE_H
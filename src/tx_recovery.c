@@ -0,0 +1,107 @@
+/******************************************************************************
+ *  File:         tx_recovery.c
+ *
+ *  Description:  Late-transmission recovery for the TX loop (see
+ *                tx_recovery.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "tx_pipeline.h"
+#include "tx_recovery.h"
+}
+
+/**
+ * @param min_lead_s submit lead to start with and to decay back to
+ * @param max_lead_s largest submit lead repeated lateness may push it to
+ */
+void tx_recovery_init(tx_recovery_t* q, double min_lead_s, double max_lead_s)
+{
+  bzero(q, sizeof(tx_recovery_t));
+  q->min_lead_s     = min_lead_s;
+  q->max_lead_s     = SRSRAN_MAX(min_lead_s, max_lead_s);
+  q->lead_s         = min_lead_s;
+  q->stats.lead_max = min_lead_s;
+  q->last_change    = tx_pipeline_host_time();
+}
+
+/**
+ * A subframe or window reached the TX loop after its air time.
+ *
+ * @param late_s how long ago its air time was
+ * @param nof_skipped busy subframes dropped with it
+ * @return whether to skip it on the grid, or restart the timeline
+ */
+tx_recovery_action_t tx_recovery_late(tx_recovery_t* q, double late_s, uint32_t nof_skipped)
+{
+  double now = tx_pipeline_host_time();
+
+  if (late_s > TX_RECOVERY_RESYNC_S) {
+    q->stats.nof_resyncs++;
+    q->last_late   = now;
+    q->last_change = now;
+    return TX_RECOVERY_RESYNC;
+  }
+
+  q->stats.nof_skipped += nof_skipped;
+  bool new_event = q->stats.nof_late_events == 0 || now - q->last_late > TX_RECOVERY_EVENT_GAP_S;
+  q->last_late   = now;
+  if (!new_event) {
+    return TX_RECOVERY_SKIP;
+  }
+
+  q->stats.nof_late_events++;
+  q->last_change = now;
+  if (q->nof_recent_events == 0 || now - q->recent_start > TX_RECOVERY_LATE_WINDOW_S) {
+    q->nof_recent_events = 0;
+    q->recent_start      = now;
+  }
+  if (++q->nof_recent_events >= TX_RECOVERY_LATE_EVENTS && q->lead_s < q->max_lead_s) {
+    q->lead_s = SRSRAN_MIN(q->lead_s * 2, q->max_lead_s);
+    q->stats.nof_lead_increases++;
+    q->stats.lead_max    = SRSRAN_MAX(q->stats.lead_max, q->lead_s);
+    q->nof_recent_events = 0;
+    printf("tx: %d late events within %.0f s, submit lead raised to %.0f ms\n",
+           TX_RECOVERY_LATE_EVENTS,
+           TX_RECOVERY_LATE_WINDOW_S,
+           q->lead_s * 1e3);
+  }
+  return TX_RECOVERY_SKIP;
+}
+
+/**
+ * A subframe or window went out on time. Steps the submit lead back down after a long enough quiet period.
+ */
+void tx_recovery_on_time(tx_recovery_t* q)
+{
+  if (q->lead_s <= q->min_lead_s) {
+    return;
+  }
+  double now = tx_pipeline_host_time();
+  if (now - q->last_change > TX_RECOVERY_DECAY_S) {
+    q->lead_s      = SRSRAN_MAX(q->lead_s / 2, q->min_lead_s);
+    q->last_change = now;
+    q->stats.nof_lead_decreases++;
+  }
+}
+
+void tx_recovery_print_stats(tx_recovery_t* q, FILE* f)
+{
+  tx_recovery_stats_t* s = &q->stats;
+  fprintf(f,
+          "tx recovery: %lu late events, %lu busy subframes skipped on the grid, %lu timeline restarts\n",
+          (unsigned long)s->nof_late_events,
+          (unsigned long)s->nof_skipped,
+          (unsigned long)s->nof_resyncs);
+  fprintf(f,
+          "tx recovery: submit lead %.0f ms now, %.0f ms at most (%lu increases, %lu decreases)\n",
+          q->lead_s * 1e3,
+          s->lead_max * 1e3,
+          (unsigned long)s->nof_lead_increases,
+          (unsigned long)s->nof_lead_decreases);
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+ *  File:         tx_recovery.h
+ *
+ *  Description:  Late-transmission recovery for the TX loop.
+ *
+ *                A subframe (or window) that reaches the TX loop after its
+ *                air time is skipped, and the timeline stays where it is, so
+ *                every later transmission keeps its place on the reservation
+ *                grid. Late subframes less than TX_RECOVERY_EVENT_GAP_S apart
+ *                count as one late event. After TX_RECOVERY_LATE_EVENTS late
+ *                events within TX_RECOVERY_LATE_WINDOW_S, the submit lead
+ *                (how long before its air time a subframe goes to the radio)
+ *                is doubled, up to max_lead_s. After TX_RECOVERY_DECAY_S
+ *                without a late event it is halved again, down to min_lead_s.
+ *
+ *                Only a subframe more than TX_RECOVERY_RESYNC_S late restarts
+ *                the timeline: the radio time jumped, or the encoder fell too
+ *                far behind to catch up.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TX_RECOVERY_H
+#define TX_RECOVERY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TX_RECOVERY_EVENT_GAP_S (0.01)
+#define TX_RECOVERY_LATE_EVENTS (3)
+#define TX_RECOVERY_LATE_WINDOW_S (1.0)
+#define TX_RECOVERY_DECAY_S (10.0)
+#define TX_RECOVERY_RESYNC_S (1.0)
+
+typedef enum {
+  TX_RECOVERY_SKIP = 0, // drop what is late, keep the timeline
+  TX_RECOVERY_RESYNC,   // pick a new start time
+} tx_recovery_action_t;
+
+typedef struct {
+  uint64_t nof_late_events;
+  uint64_t nof_skipped; // busy subframes dropped late, their slots on the grid left empty
+  uint64_t nof_resyncs;
+  uint64_t nof_lead_increases;
+  uint64_t nof_lead_decreases;
+  double   lead_max;
+} tx_recovery_stats_t;
+
+typedef struct {
+  double lead_s;
+  double min_lead_s;
+  double max_lead_s;
+
+  uint32_t nof_recent_events; // late events since recent_start
+  double   recent_start;
+  double   last_late;   // host time of the last late subframe
+  double   last_change; // host time of the last late event or lead change, the decay counts from here
+
+  tx_recovery_stats_t stats;
+} tx_recovery_t;
+
+void tx_recovery_init(tx_recovery_t* q, double min_lead_s, double max_lead_s);
+
+tx_recovery_action_t tx_recovery_late(tx_recovery_t* q, double late_s, uint32_t nof_skipped);
+
+void tx_recovery_on_time(tx_recovery_t* q);
+
+void tx_recovery_print_stats(tx_recovery_t* q, FILE* f);
+
+#endif // TX_RECOVERY_H
@@ -0,0 +1,304 @@
+/******************************************************************************
+ *  File:         tx_sink.c
+ *
+ *  Description:  Destination of the timed TX sample stream (see tx_sink.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#include "tx_pipeline.h"
+#include "tx_sink.h"
+}
+
+static uint32_t sample_size(tx_sink_format_t format)
+{
+  return format == TX_SINK_SC16 ? 2 * sizeof(int16_t) : sizeof(cf_t);
+}
+
+static void read_rf_time(void* arg, time_t* secs, double* frac_secs)
+{
+  srsran_rf_get_time((srsran_rf_t*)arg, secs, frac_secs);
+}
+
+int tx_sink_init_rf(tx_sink_t* q, srsran_rf_t* rf)
+{
+  if (q == NULL || rf == NULL) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+  bzero(q, sizeof(tx_sink_t));
+  q->type             = TX_SINK_RF;
+  q->rf               = rf;
+  q->fd               = -1;
+  q->stats.host_start = tx_pipeline_host_time();
+  return radio_clock_init(&q->clock_model, read_rf_time, rf, RADIO_CLOCK_DEFAULT_PERIOD_S);
+}
+
+/**
+ * Open a file sink. The file is truncated; a FIFO blocks here until a reader opens it.
+ *
+ * @param path output path, or "-" for stdout. In that case the program's own stdout is moved to stderr so
+ *             the log messages don't end up in the sample stream.
+ * @param srate sampling rate, used to turn timestamps into file offsets
+ */
+int tx_sink_init_file(tx_sink_t* q, const char* path, tx_sink_format_t format, double srate)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && path != NULL && srate > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(tx_sink_t));
+    q->type   = TX_SINK_FILE;
+    q->format = format;
+    q->srate  = srate;
+
+    if (strcmp(path, "-") == 0) {
+      fflush(stdout);
+      q->fd = dup(STDOUT_FILENO);
+      if (q->fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        perror("dup2");
+        goto clean_exit;
+      }
+    } else {
+      q->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (q->fd < 0) {
+      perror("open");
+      goto clean_exit;
+    }
+
+    // A reader closing the FIFO must turn into a write error, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    q->zeros = calloc(TX_SINK_ZERO_CHUNK, sample_size(format));
+    if (!q->zeros) {
+      perror("calloc");
+      goto clean_exit;
+    }
+
+    q->stats.host_start = tx_pipeline_host_time();
+    ret                 = SRSRAN_SUCCESS;
+  } else {
+    ERROR("Invalid parameters\n");
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    tx_sink_free(q);
+  }
+  return ret;
+}
+
+void tx_sink_free(tx_sink_t* q)
+{
+  if (q) {
+    if (q->type == TX_SINK_FILE && q->fd >= 0) {
+      close(q->fd);
+    }
+    if (q->conv_buffer) {
+      free(q->conv_buffer);
+    }
+    if (q->zeros) {
+      free(q->zeros);
+    }
+    bzero(q, sizeof(tx_sink_t));
+  }
+}
+
+/**
+ * @param str "cf32" or "sc16"
+ */
+int tx_sink_parse_format(const char* str, tx_sink_format_t* format)
+{
+  if (strcmp(str, "cf32") == 0) {
+    *format = TX_SINK_CF32;
+  } else if (strcmp(str, "sc16") == 0) {
+    *format = TX_SINK_SC16;
+  } else {
+    ERROR("Unknown sample format: %s (expected cf32 or sc16)\n", str);
+    return SRSRAN_ERROR;
+  }
+  return SRSRAN_SUCCESS;
+}
+
+static uint64_t time_to_samples(tx_sink_t* q, time_t secs, double frac_secs)
+{
+  return (uint64_t)secs * (uint64_t)q->srate + (uint64_t)round(frac_secs * q->srate);
+}
+
+/**
+ * Current time of the sink: the radio clock as predicted by the clock model (within its error bound, see
+ * radio_clock.h), or for files the virtual clock, which is never behind what has already been written.
+ */
+void tx_sink_get_time(tx_sink_t* q, time_t* secs, double* frac_secs)
+{
+  if (q->type == TX_SINK_RF) {
+    radio_clock_now(&q->clock_model, secs, frac_secs);
+    return;
+  }
+
+  uint64_t now   = SRSRAN_MAX(q->clock, q->position);
+  uint64_t srate = (uint64_t)q->srate;
+  *secs          = (time_t)(now / srate);
+  *frac_secs     = (double)(now % srate) / q->srate;
+}
+
+/**
+ * Like tx_sink_get_time(), but asks the radio itself (and refreshes the clock model with the answer). For the rare
+ * occasions where the exact time matters more than the round trip, e.g. picking a new start time.
+ */
+void tx_sink_read_time(tx_sink_t* q, time_t* secs, double* frac_secs)
+{
+  if (q->type == TX_SINK_RF) {
+    radio_clock_read(&q->clock_model, secs, frac_secs);
+  } else {
+    tx_sink_get_time(q, secs, frac_secs);
+  }
+}
+
+/**
+ * Let time pass until the sink's clock shows (secs, frac_secs). Sleeps on the host clock until the predicted host
+ * time of that instant on a radio; for files it just moves the virtual clock on.
+ */
+void tx_sink_wait_until(tx_sink_t* q, time_t secs, double frac_secs)
+{
+  if (q->type == TX_SINK_RF) {
+    double          host = radio_clock_to_host(&q->clock_model, secs, frac_secs);
+    struct timespec ts;
+    ts.tv_sec  = (time_t)host;
+    ts.tv_nsec = (long)((host - ts.tv_sec) * 1e9);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL); // returns at once if host has passed
+  } else {
+    q->clock = SRSRAN_MAX(q->clock, time_to_samples(q, secs, frac_secs));
+  }
+}
+
+static int write_all(tx_sink_t* q, const void* buf, size_t len)
+{
+  const uint8_t* ptr = (const uint8_t*)buf;
+  while (len > 0) {
+    ssize_t n = write(q->fd, ptr, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write");
+      return SRSRAN_ERROR;
+    }
+    ptr += n;
+    len -= n;
+  }
+  return SRSRAN_SUCCESS;
+}
+
+static int write_zeros(tx_sink_t* q, uint64_t nof_samples)
+{
+  while (nof_samples > 0) {
+    uint32_t n = (uint32_t)SRSRAN_MIN(nof_samples, (uint64_t)TX_SINK_ZERO_CHUNK);
+    if (write_all(q, q->zeros, (size_t)n * sample_size(q->format))) {
+      return SRSRAN_ERROR;
+    }
+    nof_samples -= n;
+  }
+  return SRSRAN_SUCCESS;
+}
+
+static int write_samples(tx_sink_t* q, cf_t* data, uint32_t nof_samples)
+{
+  if (q->format == TX_SINK_CF32) {
+    return write_all(q, data, (size_t)nof_samples * sizeof(cf_t));
+  }
+
+  if (q->conv_len < nof_samples) {
+    if (q->conv_buffer) {
+      free(q->conv_buffer);
+    }
+    q->conv_buffer = srsran_vec_malloc(nof_samples * sample_size(TX_SINK_SC16));
+    if (!q->conv_buffer) {
+      perror("malloc");
+      q->conv_len = 0;
+      return SRSRAN_ERROR;
+    }
+    q->conv_len = nof_samples;
+  }
+  srsran_vec_convert_fi((const float*)data, INT16_MAX, (int16_t*)q->conv_buffer, 2 * nof_samples);
+  return write_all(q, q->conv_buffer, (size_t)nof_samples * sample_size(TX_SINK_SC16));
+}
+
+/**
+ * Timed send, with the same meaning as srsran_rf_send_timed2(). For files, the burst flags carry no
+ * information: the stream between bursts is zeros either way. Samples that would overlap what was
+ * already written are dropped.
+ *
+ * @return nof_samples (or the radio's return value), < 0 on error
+ */
+int tx_sink_send_timed(tx_sink_t* q,
+                       cf_t*      data,
+                       uint32_t   nof_samples,
+                       time_t     secs,
+                       double     frac_secs,
+                       bool       is_start_of_burst,
+                       bool       is_end_of_burst)
+{
+  q->stats.nof_sends++;
+  q->stats.nof_samples += nof_samples;
+
+  if (q->type == TX_SINK_RF) {
+    return srsran_rf_send_timed2(q->rf, data, nof_samples, secs, frac_secs, is_start_of_burst, is_end_of_burst);
+  }
+
+  uint64_t timestamp = time_to_samples(q, secs, frac_secs);
+  uint32_t skip      = 0;
+  if (timestamp < q->position) {
+    q->stats.nof_overlaps++;
+    skip = (uint32_t)SRSRAN_MIN(q->position - timestamp, (uint64_t)nof_samples);
+  } else if (timestamp > q->position) {
+    if (write_zeros(q, timestamp - q->position)) {
+      return SRSRAN_ERROR;
+    }
+    q->stats.nof_gap_samples += timestamp - q->position;
+    q->position = timestamp;
+  }
+
+  if (skip < nof_samples && write_samples(q, &data[skip], nof_samples - skip)) {
+    return SRSRAN_ERROR;
+  }
+  q->position += nof_samples - skip;
+
+  return (int)nof_samples;
+}
+
+void tx_sink_print_stats(tx_sink_t* q, FILE* f)
+{
+  tx_sink_stats_t* s       = &q->stats;
+  double           elapsed = tx_pipeline_host_time() - s->host_start;
+
+  fprintf(f,
+          "tx sink: %lu sends, %lu samples sent in %.2f s (%.2f Msamples/s)\n",
+          (unsigned long)s->nof_sends,
+          (unsigned long)s->nof_samples,
+          elapsed,
+          elapsed > 0 ? s->nof_samples / elapsed / 1e6 : 0.0);
+  if (q->type == TX_SINK_FILE) {
+    double stream_s = q->position / q->srate;
+    fprintf(f,
+            "tx sink: %.3f s of stream written (%lu gap samples), %.2fx real time, %lu overlapping sends\n",
+            stream_s,
+            (unsigned long)s->nof_gap_samples,
+            elapsed > 0 ? stream_s / elapsed : 0.0,
+            (unsigned long)s->nof_overlaps);
+  } else {
+    radio_clock_print_stats(&q->clock_model, f);
+  }
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *  File:         tx_sink.h
+ *
+ *  Description:  Destination of the timed TX sample stream.
+ *
+ *                Either the SDR opened with srsran_rf_open(), or a file, FIFO
+ *                or stdout receiving the exact sample stream the radio would
+ *                put on air, as cf32 or sc16 IQ. For files, the gaps between
+ *                timed sends are written as zeros so every sample sits at the
+ *                offset its timestamp asks for, and time is virtual: it only
+ *                advances as samples are written or the TX loop waits, so the
+ *                generator runs as fast as it can encode.
+ *
+ *                For the radio, tx_sink_get_time() predicts the radio clock
+ *                from the host clock (radio_clock.h) instead of asking the
+ *                SDR every time, and tx_sink_wait_until() sleeps on the host
+ *                clock until the radio shows a given time.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TX_SINK_H
+#define TX_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <srsran/phy/rf/rf.h>
+#include <srsran/phy/utils/vector.h>
+
+#include "radio_clock.h"
+
+#define TX_SINK_ZERO_CHUNK (30720) // samples written per call while filling gaps
+
+typedef enum {
+  TX_SINK_RF = 0,
+  TX_SINK_FILE,
+} tx_sink_type_t;
+
+typedef enum {
+  TX_SINK_CF32 = 0, // interleaved float I/Q, 8 bytes per sample
+  TX_SINK_SC16,     // interleaved int16 I/Q scaled to full scale, 4 bytes per sample
+} tx_sink_format_t;
+
+typedef struct {
+  uint64_t nof_sends;
+  uint64_t nof_samples;      // samples handed over by the TX loop
+  uint64_t nof_gap_samples;  // zeros written to honor timestamps
+  uint64_t nof_overlaps;     // sends whose timestamp lies before the end of the previous one
+  double   host_start;
+} tx_sink_stats_t;
+
+typedef struct {
+  tx_sink_type_t type;
+  srsran_rf_t*   rf;
+  radio_clock_t  clock_model;
+
+  int              fd;
+  tx_sink_format_t format;
+  double           srate;
+  uint64_t         clock;    // virtual time in samples
+  uint64_t         position; // timestamp (in samples) of the next sample in the file
+  void*            conv_buffer;
+  uint32_t         conv_len; // samples conv_buffer can hold
+  void*            zeros;    // TX_SINK_ZERO_CHUNK samples in the output format
+
+  tx_sink_stats_t stats;
+} tx_sink_t;
+
+int tx_sink_init_rf(tx_sink_t* q, srsran_rf_t* rf);
+
+int tx_sink_init_file(tx_sink_t* q, const char* path, tx_sink_format_t format, double srate);
+
+void tx_sink_free(tx_sink_t* q);
+
+int tx_sink_parse_format(const char* str, tx_sink_format_t* format);
+
+void tx_sink_get_time(tx_sink_t* q, time_t* secs, double* frac_secs);
+
+void tx_sink_read_time(tx_sink_t* q, time_t* secs, double* frac_secs);
+
+void tx_sink_wait_until(tx_sink_t* q, time_t secs, double frac_secs);
+
+int tx_sink_send_timed(tx_sink_t* q,
+                       cf_t*      data,
+                       uint32_t   nof_samples,
+                       time_t     secs,
+                       double     frac_secs,
+                       bool       is_start_of_burst,
+                       bool       is_end_of_burst);
+
+void tx_sink_print_stats(tx_sink_t* q, FILE* f);
+
+#endif // TX_SINK_H
@@ -55,7 +55,10 @@ extern "C" {
 #include <complex.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 
+#include "dmrs_cache.h"
+#include "latency_stats.h"
 #include "ue_sl.h"
 
 }
@@ -68,7 +71,17 @@ extern "C" {
 
 #define MAX_SFLEN SRSRAN_SF_LEN(srsran_symbol_sz(max_prb))
 
+// DMRS symbols of PSCCH and PSSCH in transmission modes 3 and 4, normal CP (3GPP TS 36.211 Section 9.8)
+static const uint32_t sl_dmrs_symbols_tm34[] = {2, 5, 8, 11};
+#define SL_NOF_DMRS_SYMBOLS_TM34 (4)
+#define SL_NOF_PSCCH_CYCLIC_SHIFTS (4) // 0, 3, 6 and 9
+#define SL_MRC_POWER_FLOOR (1e-12f)     // keeps the MRC normalization finite where no port has any channel
 
+
+/**
+ * @param nof_rx_antennas number of receive ports; 0 builds a TX-only UE with no RX buffers or objects at all.
+ *                        With RX ports, the per sub channel RX objects are built later, see srsran_ue_sl_init_rx().
+ */
 int srsran_ue_sl_init(srsran_ue_sl_t* q,
                       srsran_cell_sl_t cell,
                       srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
@@ -76,7 +89,7 @@ int srsran_ue_sl_init(srsran_ue_sl_t* q,
 {
   int ret = SRSRAN_ERROR_INVALID_INPUTS;
 
-  if (q != NULL) {
+  if (q != NULL && nof_rx_antennas <= SRSRAN_MAX_PORTS) {
     ret = SRSRAN_ERROR;
 
     bzero(q, sizeof(srsran_ue_sl_t));
@@ -85,12 +98,14 @@ int srsran_ue_sl_init(srsran_ue_sl_t* q,
     q->sl_comm_resource_pool = sl_comm_resource_pool;
     q->nof_rx_antennas = nof_rx_antennas;
     q->sf_len = SRSRAN_SF_LEN_PRB(q->cell.nof_prb);  // 1ms worth of samples
+    q->detect_threshold = SRSRAN_UE_SL_DEFAULT_DETECT_THRESHOLD;
 
     q->sf_symbols_tx = srsran_vec_cf_malloc(q->sf_len);
     if (!q->sf_symbols_tx) {
       perror("malloc");
       goto clean_exit;
     }
+    srsran_vec_cf_zero(q->sf_symbols_tx, q->sf_len);
 
     q->signal_buffer_tx = srsran_vec_cf_malloc(q->sf_len);
     if (!q->signal_buffer_tx) {
@@ -130,7 +145,6 @@ int srsran_ue_sl_init(srsran_ue_sl_t* q,
     }
 
     q->sf_n_re = SRSRAN_CP_NSYMB(SRSRAN_CP_NORM) * SRSRAN_NRE * 2 * q->cell.nof_prb;
-    q->equalized_sf_buffer = srsran_vec_cf_malloc(sizeof(cf_t) * q->sf_n_re);
 
     srsran_ofdm_cfg_t ofdm_cfg_rx = {};
     ofdm_cfg_rx.nof_prb           = q->cell.nof_prb;
@@ -141,8 +155,8 @@ int srsran_ue_sl_init(srsran_ue_sl_t* q,
     ofdm_cfg_rx.sf_type           = SRSRAN_SF_NORM;
 
     for (int i = 0; i < q->nof_rx_antennas; i++) {
-      ofdm_cfg_rx.in_buffer  = q->signal_buffer_rx[0];
-      ofdm_cfg_rx.out_buffer = q->sf_symbols_rx[0];
+      ofdm_cfg_rx.in_buffer  = q->signal_buffer_rx[i];
+      ofdm_cfg_rx.out_buffer = q->sf_symbols_rx[i];
 
       if (srsran_ofdm_rx_init_cfg(&q->fft[i], &ofdm_cfg_rx)) {
         ERROR("Error initiating FFT\n");
@@ -176,34 +190,7 @@ int srsran_ue_sl_init(srsran_ue_sl_t* q,
       goto clean_exit;
     }
 
-    // init rx
-    for (uint32_t subch_idx = 0; subch_idx < q->sl_comm_resource_pool.num_sub_channel; subch_idx++)
-    {
-      if (srsran_pscch_init(&q->pscch_rx[subch_idx], SRSRAN_MAX_PRB)) {
-        ERROR("Error creating PSCCH object\n");
-        goto clean_exit;
-      }
-
-      if (srsran_sci_init(&q->sci_rx[subch_idx], &(q->cell), &(q->sl_comm_resource_pool))) {
-        ERROR("Error creating SCI RX object for sub channel %d\n", subch_idx);
-        goto clean_exit;
-      }
-
-      if (srsran_pssch_init(&q->pssch_rx[subch_idx], &(q->cell), &(q->sl_comm_resource_pool))) {
-        ERROR("Error creating PSSCH object\n");
-        goto clean_exit;
-      }
-
-      if (srsran_chest_sl_init(&q->pscch_chest_rx[subch_idx], SRSRAN_SIDELINK_PSCCH, q->cell, &(q->sl_comm_resource_pool))) {
-        ERROR("Error creating PSCCH chest object\n");
-        goto clean_exit;
-      }
-
-      if (srsran_chest_sl_init(&q->pssch_chest_rx[subch_idx], SRSRAN_SIDELINK_PSSCH, q->cell, &(q->sl_comm_resource_pool))) {
-        ERROR("Error creating PSSCH chest object\n");
-        goto clean_exit;
-      }
-    }
+    // The per sub channel RX objects are built by srsran_ue_sl_init_rx(), at the latest on the first decode
 
     if (srsran_ue_sl_set_cell(q, q->cell)) {
       ERROR("Error setting cell\n");
@@ -222,6 +209,115 @@ clean_exit:
   return ret;
 }
 
+/* Free the per sub channel RX objects of srsran_ue_sl_init_rx() and clear them
+ */
+static void ue_sl_free_rx(srsran_ue_sl_t* q)
+{
+  for (uint32_t subch_idx = 0; subch_idx < SRSRAN_MAX_NUM_SUB_CHANNEL; subch_idx++) {
+    srsran_pscch_free(&q->pscch_rx[subch_idx]);
+    srsran_pssch_free(&q->pssch_rx[subch_idx]);
+    srsran_sci_free(&q->sci_rx[subch_idx]);
+    srsran_chest_sl_free(&q->pscch_chest_rx[subch_idx]);
+    srsran_chest_sl_free(&q->pssch_chest_rx[subch_idx]);
+    bzero(&q->pscch_rx[subch_idx], sizeof(q->pscch_rx[subch_idx]));
+    bzero(&q->pssch_rx[subch_idx], sizeof(q->pssch_rx[subch_idx]));
+    bzero(&q->sci_rx[subch_idx], sizeof(q->sci_rx[subch_idx]));
+    bzero(&q->pscch_chest_rx[subch_idx], sizeof(q->pscch_chest_rx[subch_idx]));
+    bzero(&q->pssch_chest_rx[subch_idx], sizeof(q->pssch_chest_rx[subch_idx]));
+    if (q->equalized_sf_buffer[subch_idx]) {
+      free(q->equalized_sf_buffer[subch_idx]);
+      q->equalized_sf_buffer[subch_idx] = NULL;
+    }
+    if (q->mrc_buffer[subch_idx]) {
+      free(q->mrc_buffer[subch_idx]);
+      q->mrc_buffer[subch_idx] = NULL;
+    }
+    if (q->mrc_power[subch_idx]) {
+      free(q->mrc_power[subch_idx]);
+      q->mrc_power[subch_idx] = NULL;
+    }
+  }
+  q->rx_initialized = false;
+}
+
+/**
+ * Build the per sub channel RX objects (PSCCH, PSSCH, SCI, channel estimation and equalization buffers).
+ *
+ * They are most of the memory and init time of a UE, so srsran_ue_sl_init() leaves them out and the first
+ * srsran_ue_sl_decode_fft_estimate() builds them. Call this right after init to keep that cost out of the first
+ * decoded subframe. Does nothing if already done.
+ *
+ * @return SRSRAN_ERROR_INVALID_INPUTS for a TX-only UE (no RX antennas)
+ */
+int srsran_ue_sl_init_rx(srsran_ue_sl_t* q)
+{
+  if (q == NULL || q->nof_rx_antennas == 0) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+  if (q->rx_initialized) {
+    return SRSRAN_SUCCESS;
+  }
+
+  int ret = SRSRAN_ERROR;
+
+  for (uint32_t subch_idx = 0; subch_idx < q->sl_comm_resource_pool.num_sub_channel; subch_idx++) {
+    // One equalization buffer per sub channel, so sub channels can be decoded concurrently
+    q->equalized_sf_buffer[subch_idx] = srsran_vec_cf_malloc(q->sf_n_re);
+    if (!q->equalized_sf_buffer[subch_idx]) {
+      perror("malloc");
+      goto clean_exit;
+    }
+    if (q->nof_rx_antennas > 1) {
+      q->mrc_buffer[subch_idx] = srsran_vec_cf_malloc(q->sf_n_re);
+      q->mrc_power[subch_idx]  = srsran_vec_f_malloc(q->sf_n_re);
+      if (!q->mrc_buffer[subch_idx] || !q->mrc_power[subch_idx]) {
+        perror("malloc");
+        goto clean_exit;
+      }
+    }
+
+    if (srsran_pscch_init(&q->pscch_rx[subch_idx], SRSRAN_MAX_PRB)) {
+      ERROR("Error creating PSCCH object\n");
+      goto clean_exit;
+    }
+
+    if (srsran_pscch_set_cell(&q->pscch_rx[subch_idx], q->cell)) {
+      ERROR("Error resizing PSCCH object\n");
+      goto clean_exit;
+    }
+
+    if (srsran_sci_init(&q->sci_rx[subch_idx], &(q->cell), &(q->sl_comm_resource_pool))) {
+      ERROR("Error creating SCI RX object for sub channel %d\n", subch_idx);
+      goto clean_exit;
+    }
+
+    if (srsran_pssch_init(&q->pssch_rx[subch_idx], &(q->cell), &(q->sl_comm_resource_pool))) {
+      ERROR("Error creating PSSCH object\n");
+      goto clean_exit;
+    }
+
+    if (srsran_chest_sl_init(&q->pscch_chest_rx[subch_idx], SRSRAN_SIDELINK_PSCCH, q->cell, &(q->sl_comm_resource_pool))) {
+      ERROR("Error creating PSCCH chest object\n");
+      goto clean_exit;
+    }
+
+    if (srsran_chest_sl_init(&q->pssch_chest_rx[subch_idx], SRSRAN_SIDELINK_PSSCH, q->cell, &(q->sl_comm_resource_pool))) {
+      ERROR("Error creating PSSCH chest object\n");
+      goto clean_exit;
+    }
+  }
+
+  q->rx_initialized = true;
+  ret               = SRSRAN_SUCCESS;
+
+clean_exit:
+  // Leave nothing half built behind, so a later call starts over cleanly
+  if (ret != SRSRAN_SUCCESS) {
+    ue_sl_free_rx(q);
+  }
+  return ret;
+}
+
 void srsran_ue_sl_free(srsran_ue_sl_t* q)
 {
   if (q) {
@@ -239,19 +335,18 @@ void srsran_ue_sl_free(srsran_ue_sl_t* q)
       if (q->sf_symbols_rx[port]) {
         free(q->sf_symbols_rx[port]);
       }
+      if (q->signal_buffer_rx[port]) {
+        free(q->signal_buffer_rx[port]);
+      }
     }
-    for (uint32_t subch_idx = 0; subch_idx < SRSRAN_MAX_NUM_SUB_CHANNEL; subch_idx++)
-    {
-      srsran_pscch_free(&q->pscch_rx[subch_idx]);
-      srsran_pssch_free(&q->pssch_rx[subch_idx]);
-      srsran_sci_free(&q->sci_rx[subch_idx]);
-      srsran_chest_sl_free(&q->pscch_chest_rx[subch_idx]);
-      srsran_chest_sl_free(&q->pssch_chest_rx[subch_idx]);
-    }
+    ue_sl_free_rx(q);
 
     if (q->sf_symbols_tx) {
       free(q->sf_symbols_tx);
     }
+    if (q->signal_buffer_tx) {
+      free(q->signal_buffer_tx);
+    }
 
     bzero(q, sizeof(srsran_ue_sl_t));
   }
@@ -278,7 +373,7 @@ int srsran_ue_sl_set_cell(srsran_ue_sl_t* q, srsran_cell_sl_t cell)
     }
   }
 
-  for (uint32_t subch_idx = 0; subch_idx < q->sl_comm_resource_pool.num_sub_channel; subch_idx++) {
+  for (uint32_t subch_idx = 0; q->rx_initialized && subch_idx < q->sl_comm_resource_pool.num_sub_channel; subch_idx++) {
     if (srsran_pscch_set_cell(&q->pscch_rx[subch_idx], q->cell)) {
       ERROR("Error resizing PSCCH object\n");
       return SRSRAN_ERROR;
@@ -380,6 +475,26 @@ void srsran_set_sci(srsran_sci_t* sci,
   sci->mcs_idx             = mcs_idx;
 }
 
+/**
+ * Copy the user-set sci fields (format and everything set by srsran_set_sci()).
+ *
+ * The remaining fields of an srsran_sci_t are set up by srsran_sci_init() for a specific cell and resource
+ * pool and must not be copied between objects.
+ *
+ * @param dst destination sci, e.g. srsran_ue_sl_t.sci_tx
+ * @param src source sci
+ */
+void srsran_ue_sl_copy_sci(srsran_sci_t* dst, const srsran_sci_t* src)
+{
+  dst->format              = src->format;
+  dst->priority            = src->priority;
+  dst->resource_reserv     = src->resource_reserv;
+  dst->time_gap            = src->time_gap;
+  dst->retransmission      = src->retransmission;
+  dst->transmission_format = src->transmission_format;
+  dst->mcs_idx             = src->mcs_idx;
+}
+
 void srsran_set_sci_riv(srsran_ue_sl_t* q, uint32_t sub_channel_start_idx, uint32_t l_sub_channel)
 {
   q->sci_tx.riv = srsran_ra_sl_type0_to_riv(
@@ -395,8 +510,6 @@ static int pscch_encode(srsran_ue_sl_t* q, uint32_t sub_channel_start_idx)
 
   if (q != NULL) {
 
-    srsran_vec_cf_zero(q->sf_symbols_tx, SRSRAN_NOF_RE(q->cell));
-
     uint32_t pscch_prb_start_idx = sub_channel_start_idx * q->sl_comm_resource_pool.size_sub_channel;
 
     uint8_t sci_tx[SRSRAN_SCI_MAX_LEN] = {};
@@ -443,10 +556,8 @@ static int pssch_encode(srsran_ue_sl_t* q,
     uint32_t pscch_prb_start_idx = data->sub_channel_start_idx * q->sl_comm_resource_pool.size_sub_channel;
     uint32_t pssch_prb_start_idx_tx = pscch_prb_start_idx + q->pscch_tx.pscch_nof_prb;
 
-    uint8_t *sci_crc = srsran_vec_u8_malloc(SRSRAN_SCI_CRC_LEN);
-    memcpy(sci_crc, &q->pscch_tx.c[q->pscch_tx.sci_len], sizeof(uint8_t) * SRSRAN_SCI_CRC_LEN);
-    uint32_t N_x_id = srsran_n_x_id_from_crc(sci_crc, SRSRAN_SCI_CRC_LEN);
-    free(sci_crc);
+    // The CRC bits follow the SCI bits in the PSCCH codeword; read them in place, no per-subframe allocation
+    uint32_t N_x_id = srsran_n_x_id_from_crc(&q->pscch_tx.c[q->pscch_tx.sci_len], SRSRAN_SCI_CRC_LEN);
 
     uint32_t rv_idx = 0;
     if (q->sci_tx.retransmission == true) {
@@ -455,12 +566,24 @@ static int pssch_encode(srsran_ue_sl_t* q,
     uint32_t nof_prb_pssch = data->l_sub_channel * q->sl_comm_resource_pool.size_sub_channel - q->pscch_tx.pscch_nof_prb;
     nof_prb_pssch = srsran_dft_precoding_get_valid_prb(nof_prb_pssch);
 
+    struct timespec cfg_start, cfg_end;
+    clock_gettime(CLOCK_MONOTONIC, &cfg_start);
+
+    // Back-to-back transmissions of the same SCI and allocation keep the PSSCH configuration
     srsran_pssch_cfg_t pssch_cfg = {pssch_prb_start_idx_tx, nof_prb_pssch, N_x_id, q->sci_tx.mcs_idx, rv_idx, sf->tti % 10};
-    if (srsran_pssch_set_cfg(&q->pssch_tx, pssch_cfg)) {
-      ERROR("Error configuring PSSCH\n");
-      return SRSRAN_ERROR;
+    bool cfg_reused = q->pssch_tx_configured && memcmp(&pssch_cfg, &q->pssch_tx.pssch_cfg, sizeof(pssch_cfg)) == 0;
+    if (!cfg_reused) {
+      q->pssch_tx_configured = false;
+      if (srsran_pssch_set_cfg(&q->pssch_tx, pssch_cfg)) {
+        ERROR("Error configuring PSSCH\n");
+        return SRSRAN_ERROR;
+      }
+      q->pssch_tx_configured = true;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &cfg_end);
+    uint64_t cfg_time_ns = (cfg_end.tv_sec - cfg_start.tv_sec) * 1000000000ull + (cfg_end.tv_nsec - cfg_start.tv_nsec);
+
     INFO("PSSCH TX: prb_start_idx: %d, nof_prb: %d, N_x_id: %d, mcs_idx: %d, rv_idx: %d, sf_idx: %d\n",
          q->pssch_tx.pssch_cfg.prb_start_idx,
          q->pssch_tx.pssch_cfg.nof_prb,
@@ -474,13 +597,26 @@ static int pssch_encode(srsran_ue_sl_t* q,
       return SRSRAN_ERROR;
     }
 
-    srsran_chest_sl_cfg_t pssch_chest_sl_cfg;
-    pssch_chest_sl_cfg.N_x_id        = N_x_id;
-    pssch_chest_sl_cfg.sf_idx        = sf->tti % 10;
-    pssch_chest_sl_cfg.prb_start_idx = pssch_prb_start_idx_tx;
-    pssch_chest_sl_cfg.nof_prb       = nof_prb_pssch;
-    srsran_chest_sl_set_cfg(&q->pssch_chest_tx, pssch_chest_sl_cfg);
-    srsran_chest_sl_put_dmrs(&q->pssch_chest_tx, q->sf_symbols_tx);
+    clock_gettime(CLOCK_MONOTONIC, &cfg_start);
+
+    // The DMRS only depends on N_x_id, the subframe and the number of PRBs, see dmrs_cache.h
+    const dmrs_cache_entry_t* dmrs = dmrs_cache_lookup(N_x_id, sf->tti % 10, nof_prb_pssch);
+    if (dmrs) {
+      dmrs_cache_put(dmrs, q->sf_symbols_tx, q->cell.nof_prb, pssch_prb_start_idx_tx);
+    } else {
+      srsran_chest_sl_cfg_t pssch_chest_sl_cfg;
+      pssch_chest_sl_cfg.N_x_id        = N_x_id;
+      pssch_chest_sl_cfg.sf_idx        = sf->tti % 10;
+      pssch_chest_sl_cfg.prb_start_idx = pssch_prb_start_idx_tx;
+      pssch_chest_sl_cfg.nof_prb       = nof_prb_pssch;
+      srsran_chest_sl_set_cfg(&q->pssch_chest_tx, pssch_chest_sl_cfg);
+      srsran_chest_sl_put_dmrs(&q->pssch_chest_tx, q->sf_symbols_tx);
+      dmrs_cache_insert(N_x_id, sf->tti % 10, nof_prb_pssch, q->sf_symbols_tx, q->cell.nof_prb, pssch_prb_start_idx_tx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &cfg_end);
+    cfg_time_ns += (cfg_end.tv_sec - cfg_start.tv_sec) * 1000000000ull + (cfg_end.tv_nsec - cfg_start.tv_nsec);
+    dmrs_cache_count_cfg(cfg_time_ns, cfg_reused);
 
     ret = SRSRAN_SUCCESS;
   }
@@ -488,6 +624,24 @@ static int pssch_encode(srsran_ue_sl_t* q,
   return ret;
 }
 
+/* PSCCH and PSSCH of one grant, each timed into the latency histograms
+ */
+static int timed_encode(srsran_ue_sl_t* q, srsran_sl_sf_cfg_t* sf, srsran_pssch_data_t* data)
+{
+  uint64_t t = latency_now();
+  if (pscch_encode(q, data->sub_channel_start_idx)) {
+    return SRSRAN_ERROR;
+  }
+  latency_record(LATENCY_PSCCH_ENCODE, t);
+
+  t = latency_now();
+  if (pssch_encode(q, sf, data)) {
+    return SRSRAN_ERROR;
+  }
+  latency_record(LATENCY_PSSCH_ENCODE, t);
+  return SRSRAN_SUCCESS;
+}
+
 int srsran_ue_sl_encode(srsran_ue_sl_t* q,
                         srsran_sl_sf_cfg_t* sf,
                         srsran_pssch_data_t* data)
@@ -496,14 +650,78 @@ int srsran_ue_sl_encode(srsran_ue_sl_t* q,
   //- Calculates an RIV value from the parameters (and the q->sl_comm_resource_pool.num_sub_channel) and stores it in q
   srsran_set_sci_riv(q, data->sub_channel_start_idx, data->l_sub_channel);
 
-  if (pscch_encode(q, data->sub_channel_start_idx)) {
+  if (timed_encode(q, sf, data)) {
+    srsran_vec_cf_zero(q->sf_symbols_tx, q->sf_len);
     return SRSRAN_ERROR;
   }
-  if (pssch_encode(q, sf, data)) {
-    return SRSRAN_ERROR;
+
+  uint64_t t = latency_now();
+  srsran_ofdm_tx_sf(&q->ifft);
+  latency_record(LATENCY_OFDM_TX, t);
+
+  srsran_vec_cf_zero(q->sf_symbols_tx, q->sf_len);
+
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Encode several independent SCI+TB grants into one subframe.
+ *
+ * All grants are mapped into the same resource grid and a single IFFT is run at the end, so one UE object
+ * can emulate many UEs in the same TTI at the cost of one FFT per subframe. The grants must occupy
+ * disjoint sub channels. On return q->sci_tx holds the sci of the last grant.
+ *
+ * @param q ue sidelink object
+ * @param sf subframe configuration, shared by all grants
+ * @param grants array of nof_grants grants
+ * @param nof_grants number of grants, at most num_sub_channel
+ * @return SRSRAN_SUCCESS if all grants were encoded
+ */
+int srsran_ue_sl_encode_multi(srsran_ue_sl_t*       q,
+                              srsran_sl_sf_cfg_t*   sf,
+                              srsran_ue_sl_grant_t* grants,
+                              uint32_t              nof_grants)
+{
+  if (q == NULL || sf == NULL || (grants == NULL && nof_grants > 0) ||
+      nof_grants > q->sl_comm_resource_pool.num_sub_channel) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
   }
 
+  // Reject overlapping allocations before touching the grid
+  bool used[SRSRAN_MAX_NUM_SUB_CHANNEL] = {};
+  for (uint32_t i = 0; i < nof_grants; i++) {
+    srsran_pssch_data_t* data = &grants[i].data;
+    if (data->l_sub_channel == 0 ||
+        data->sub_channel_start_idx + data->l_sub_channel > q->sl_comm_resource_pool.num_sub_channel) {
+      ERROR("Invalid allocation for grant %d (sub_channel_start_idx: %d, l_sub_channel: %d)\n",
+            i,
+            data->sub_channel_start_idx,
+            data->l_sub_channel);
+      return SRSRAN_ERROR_INVALID_INPUTS;
+    }
+    for (uint32_t k = data->sub_channel_start_idx; k < data->sub_channel_start_idx + data->l_sub_channel; k++) {
+      if (used[k]) {
+        ERROR("Grant %d overlaps another grant in sub channel %d\n", i, k);
+        return SRSRAN_ERROR_INVALID_INPUTS;
+      }
+      used[k] = true;
+    }
+  }
+
+  // The grid is left zeroed by every encode, so each grant only adds its own REs
+  for (uint32_t i = 0; i < nof_grants; i++) {
+    srsran_ue_sl_copy_sci(&q->sci_tx, &grants[i].sci);
+    srsran_set_sci_riv(q, grants[i].data.sub_channel_start_idx, grants[i].data.l_sub_channel);
+
+    if (timed_encode(q, sf, &grants[i].data)) {
+      srsran_vec_cf_zero(q->sf_symbols_tx, q->sf_len);
+      return SRSRAN_ERROR;
+    }
+  }
+
+  uint64_t t = latency_now();
   srsran_ofdm_tx_sf(&q->ifft);
+  latency_record(LATENCY_OFDM_TX, t);
 
   srsran_vec_cf_zero(q->sf_symbols_tx, q->sf_len);
 
@@ -513,6 +731,11 @@ int srsran_ue_sl_encode(srsran_ue_sl_t* q,
 int srsran_ue_sl_decode_fft_estimate(srsran_ue_sl_t* q)
 {
   if (q) {
+    if (!q->rx_initialized && srsran_ue_sl_init_rx(q)) {
+      ERROR("Error initializing UE RX objects\n");
+      return SRSRAN_ERROR;
+    }
+
     /* Run FFT for all subframe data */
     for (int j = 0; j < q->nof_rx_antennas; j++) {
       srsran_ofdm_rx_sf(&q->fft[j]);
@@ -523,6 +746,166 @@ int srsran_ue_sl_decode_fft_estimate(srsran_ue_sl_t* q)
   return SRSRAN_SUCCESS;
 }
 
+/**
+ * Set the PSCCH DMRS detector threshold used by srsran_ue_sl_decode_subch().
+ *
+ * @param threshold coherence between 0 and 1 a sub channel must exceed to be searched; 0 searches every sub channel
+ */
+void srsran_ue_sl_set_detect_threshold(srsran_ue_sl_t* q, float threshold)
+{
+  q->detect_threshold = threshold;
+}
+
+/**
+ * Sum of the per sub channel RX statistics.
+ */
+void srsran_ue_sl_get_rx_stats(srsran_ue_sl_t* q, srsran_ue_sl_rx_stats_t* stats)
+{
+  bzero(stats, sizeof(srsran_ue_sl_rx_stats_t));
+  for (uint32_t i = 0; i < SRSRAN_MAX_NUM_SUB_CHANNEL; i++) {
+    stats->nof_searches += q->rx_stats[i].nof_searches;
+    stats->nof_gated += q->rx_stats[i].nof_gated;
+    stats->nof_shifts_tried += q->rx_stats[i].nof_shifts_tried;
+    stats->nof_shifts_pruned += q->rx_stats[i].nof_shifts_pruned;
+    stats->nof_pscch_decoded += q->rx_stats[i].nof_pscch_decoded;
+    stats->nof_pssch_decoded += q->rx_stats[i].nof_pssch_decoded;
+    stats->nof_pssch_retries += q->rx_stats[i].nof_pssch_retries;
+  }
+}
+
+/**
+ * PSCCH pre-detector: coherence of the received DMRS between pairs of DMRS symbols.
+ *
+ * PSCCH uses the same DMRS sequence in all DMRS symbols, whatever the cyclic shift, so a transmission shows
+ * up as a strong correlation between the REs of two DMRS symbols of the PSCCH PRBs, while noise does not
+ * (about 0.2 for two PRBs). The result is normalized by the energy, so no noise estimate is needed, and it
+ * only takes the magnitude, so frequency offset and Doppler between the symbols don't matter. With several
+ * RX antennas the correlations and energies of all ports are added up.
+ *
+ * @return coherence between 0 (idle) and 1 (clean transmission)
+ */
+static float pscch_dmrs_coherence(srsran_ue_sl_t* q, uint32_t pscch_prb_start_idx, uint32_t pscch_nof_prb)
+{
+  uint32_t nof_re  = pscch_nof_prb * SRSRAN_NRE;
+  uint32_t sym_len = q->cell.nof_prb * SRSRAN_NRE;
+  float    corr    = 0.0f;
+  float    energy  = 0.0f;
+
+  for (uint32_t port = 0; port < q->nof_rx_antennas; port++) {
+    for (uint32_t i = 0; i + 1 < SL_NOF_DMRS_SYMBOLS_TM34; i += 2) {
+      cf_t* a = &q->sf_symbols_rx[port][sl_dmrs_symbols_tm34[i] * sym_len + pscch_prb_start_idx * SRSRAN_NRE];
+      cf_t* b = &q->sf_symbols_rx[port][sl_dmrs_symbols_tm34[i + 1] * sym_len + pscch_prb_start_idx * SRSRAN_NRE];
+
+      cf_t c = srsran_vec_dot_prod_conj_ccc(a, b, nof_re);
+      corr += sqrtf(__real__ c * __real__ c + __imag__ c * __imag__ c);
+      energy += sqrtf(srsran_vec_avg_power_cf(a, nof_re) * srsran_vec_avg_power_cf(b, nof_re)) * nof_re;
+    }
+  }
+
+  return energy > 0.0f ? corr / energy : 0.0f;
+}
+
+/**
+ * PSSCH-RSRP: average received power per RE of the PSSCH DMRS, averaged over the RX ports
+ * (3GPP TS 36.214 Section 5.1.29). Linear, relative to the FFT output.
+ */
+static float pssch_rsrp(srsran_ue_sl_t* q, uint32_t prb_start_idx, uint32_t nof_prb)
+{
+  uint32_t nof_re  = nof_prb * SRSRAN_NRE;
+  uint32_t sym_len = q->cell.nof_prb * SRSRAN_NRE;
+  float    power   = 0.0f;
+
+  for (uint32_t port = 0; port < q->nof_rx_antennas; port++) {
+    for (uint32_t i = 0; i < SL_NOF_DMRS_SYMBOLS_TM34; i++) {
+      power += srsran_vec_avg_power_cf(&q->sf_symbols_rx[port][sl_dmrs_symbols_tm34[i] * sym_len + prb_start_idx * SRSRAN_NRE],
+                                       nof_re);
+    }
+  }
+  return power / (q->nof_rx_antennas * SL_NOF_DMRS_SYMBOLS_TM34);
+}
+
+/**
+ * S-RSSI of a sub channel in the subframe of the last srsran_ue_sl_decode_fft_estimate(): total received power
+ * per SC-FDMA symbol over the sub channel's PRBs, averaged over symbols 1 to 12 (the first one is for AGC
+ * settling, the last one is the guard) and the RX ports (3GPP TS 36.214 Section 5.1.28). Linear, relative to the
+ * FFT output.
+ */
+float srsran_ue_sl_subch_rssi(srsran_ue_sl_t* q, uint32_t sub_channel_idx)
+{
+  uint32_t nof_symbols = 2 * SRSRAN_CP_NSYMB(q->cell.cp);
+  uint32_t sym_len     = q->cell.nof_prb * SRSRAN_NRE;
+  uint32_t nof_re      = q->sl_comm_resource_pool.size_sub_channel * SRSRAN_NRE;
+  uint32_t k0          = (q->sl_comm_resource_pool.start_prb_sub_channel +
+                 sub_channel_idx * q->sl_comm_resource_pool.size_sub_channel) * SRSRAN_NRE;
+  float    power       = 0.0f;
+
+  if (q->nof_rx_antennas == 0) {
+    return 0.0f;
+  }
+  for (uint32_t port = 0; port < q->nof_rx_antennas; port++) {
+    for (uint32_t l = 1; l + 1 < nof_symbols; l++) {
+      power += srsran_vec_avg_power_cf(&q->sf_symbols_rx[port][l * sym_len + k0], nof_re) * nof_re;
+    }
+  }
+  return power / (q->nof_rx_antennas * (nof_symbols - 2));
+}
+
+/**
+ * Channel estimation and equalization of nof_prb PRBs from prb_start_idx into the sub channel's equalization
+ * buffer, with the DMRS configured in chest.
+ *
+ * With one RX antenna this is srsran_chest_sl_ls_estimate_equalize(). With more, every port gets its own LS
+ * estimate h_p and the ports are maximal-ratio combined per RE, sum_p conj(h_p) r_p / sum_p |h_p|^2, which is
+ * the equalized symbol weighted towards the ports that hear the transmitter best. Only the allocated REs are
+ * combined; the decoders don't read the rest of the buffer.
+ */
+static void estimate_equalize(srsran_ue_sl_t*    q,
+                              srsran_chest_sl_t* chest,
+                              uint32_t           sub_channel_idx,
+                              uint32_t           prb_start_idx,
+                              uint32_t           nof_prb)
+{
+  cf_t* equalized = q->equalized_sf_buffer[sub_channel_idx];
+
+  if (q->nof_rx_antennas == 1) {
+    srsran_chest_sl_ls_estimate_equalize(chest, q->sf_symbols_rx[0], equalized);
+    return;
+  }
+
+  cf_t*    conj_prod   = q->mrc_buffer[sub_channel_idx];
+  float*   power       = q->mrc_power[sub_channel_idx];
+  float*   port_power  = (float*)conj_prod; // free once conj_prod has been added up
+  uint32_t sym_len     = q->cell.nof_prb * SRSRAN_NRE;
+  uint32_t nof_re      = nof_prb * SRSRAN_NRE;
+  uint32_t nof_symbols = 2 * SRSRAN_CP_NSYMB(q->cell.cp);
+
+  for (uint32_t port = 0; port < q->nof_rx_antennas; port++) {
+    srsran_chest_sl_ls_estimate(chest, q->sf_symbols_rx[port]);
+
+    for (uint32_t l = 0; l < nof_symbols; l++) {
+      uint32_t k  = l * sym_len + prb_start_idx * SRSRAN_NRE;
+      cf_t*    rx = &q->sf_symbols_rx[port][k];
+      cf_t*    ce = &chest->ce[k];
+
+      if (port == 0) {
+        srsran_vec_prod_conj_ccc(rx, ce, &equalized[k], nof_re);
+        srsran_vec_abs_square_cf(ce, &power[k], nof_re);
+      } else {
+        srsran_vec_prod_conj_ccc(rx, ce, &conj_prod[k], nof_re);
+        srsran_vec_sum_ccc(&equalized[k], &conj_prod[k], &equalized[k], nof_re);
+        srsran_vec_abs_square_cf(ce, &port_power[k], nof_re);
+        srsran_vec_sum_fff(&power[k], &port_power[k], &power[k], nof_re);
+      }
+    }
+  }
+
+  for (uint32_t l = 0; l < nof_symbols; l++) {
+    uint32_t k = l * sym_len + prb_start_idx * SRSRAN_NRE;
+    srsran_vec_sc_add_fff(&power[k], SL_MRC_POWER_FLOOR, &power[k], nof_re);
+    srsran_vec_div_cfc(&equalized[k], &power[k], &equalized[k], nof_re);
+  }
+}
+
 /* Estimate PSCCH channel
  */
 void estimate_pscch(srsran_ue_sl_t* q, uint32_t sub_channel_idx, uint32_t pscch_prb_start_idx, uint32_t cyclic_shift)
@@ -531,7 +914,11 @@ void estimate_pscch(srsran_ue_sl_t* q, uint32_t sub_channel_idx, uint32_t pscch_
   pscch_chest_sl_cfg.cyclic_shift  = cyclic_shift;
   pscch_chest_sl_cfg.prb_start_idx = pscch_prb_start_idx;
   srsran_chest_sl_set_cfg(&q->pscch_chest_rx[sub_channel_idx], pscch_chest_sl_cfg);
-  srsran_chest_sl_ls_estimate_equalize(&q->pscch_chest_rx[sub_channel_idx], q->sf_symbols_rx[0], q->equalized_sf_buffer);
+  estimate_equalize(q,
+                    &q->pscch_chest_rx[sub_channel_idx],
+                    sub_channel_idx,
+                    pscch_prb_start_idx,
+                    q->pscch_rx[sub_channel_idx].pscch_nof_prb);
 }
 
 void estimate_pssch(srsran_ue_sl_t* q,
@@ -547,7 +934,7 @@ void estimate_pssch(srsran_ue_sl_t* q,
   pssch_chest_sl_cfg.prb_start_idx = pssch_prb_start_idx;
   pssch_chest_sl_cfg.nof_prb       = nof_prb_pssch;
   srsran_chest_sl_set_cfg(&q->pssch_chest_rx[sub_channel_idx], pssch_chest_sl_cfg);
-  srsran_chest_sl_ls_estimate_equalize(&q->pssch_chest_rx[sub_channel_idx], q->sf_symbols_rx[0], q->equalized_sf_buffer);
+  estimate_equalize(q, &q->pssch_chest_rx[sub_channel_idx], sub_channel_idx, pssch_prb_start_idx, nof_prb_pssch);
 }
 
 /* Decode PSCCH signal
@@ -566,7 +953,7 @@ static int pscch_decode(srsran_ue_sl_t* q,
     estimate_pscch(q, sub_channel_idx, pscch_prb_start_idx, cyclic_shift);
 
     uint8_t sci_rx[SRSRAN_SCI_MAX_LEN] = {};
-    if (srsran_pscch_decode(&q->pscch_rx[sub_channel_idx], q->equalized_sf_buffer, sci_rx, pscch_prb_start_idx)) {
+    if (srsran_pscch_decode(&q->pscch_rx[sub_channel_idx], q->equalized_sf_buffer[sub_channel_idx], sci_rx, pscch_prb_start_idx)) {
       DEBUG("Error decoding PSCCH (cyclic shift: %d, pscch_prb_start_idx: %d)\n", cyclic_shift, pscch_prb_start_idx);
       return SRSRAN_ERROR;
     } else {
@@ -640,7 +1027,7 @@ static int pssch_decode(srsran_ue_sl_t* q,
           q->pssch_rx[sub_channel_idx].pssch_cfg.sf_idx);
 
 
-    if (srsran_pssch_decode(&q->pssch_rx[sub_channel_idx], q->equalized_sf_buffer, sl_res->data[sub_channel_idx], SRSRAN_SL_SCH_MAX_TB_LEN)) {
+    if (srsran_pssch_decode(&q->pssch_rx[sub_channel_idx], q->equalized_sf_buffer[sub_channel_idx], sl_res->data[sub_channel_idx], SRSRAN_SL_SCH_MAX_TB_LEN)) {
       DEBUG("Error decoding PSSCH\n");
       ret = SRSRAN_ERROR;
     } else {
@@ -651,6 +1038,30 @@ static int pssch_decode(srsran_ue_sl_t* q,
   return ret;
 }
 
+/* Decode the PSSCH with the SCI last decoded in the sub channel, and count it
+ */
+static int pssch_decode_stats(srsran_ue_sl_t* q,
+                              srsran_sl_sf_cfg_t* sf,
+                              uint32_t sub_channel_idx,
+                              srsran_ue_sl_res_t* sl_res)
+{
+  if (pssch_decode(q, sf, sub_channel_idx, sl_res) != SRSRAN_SUCCESS) {
+    return SRSRAN_ERROR;
+  }
+  q->rx_stats[sub_channel_idx].nof_pssch_decoded++;
+  sl_res->pssch_rsrp[sub_channel_idx] = pssch_rsrp(
+      q, q->pssch_rx[sub_channel_idx].pssch_cfg.prb_start_idx, q->pssch_rx[sub_channel_idx].pssch_cfg.nof_prb);
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Decode the PSCCH and PSSCH starting in one sub channel. Needs srsran_ue_sl_decode_fft_estimate() first.
+ *
+ * Only the objects and buffers of sub_channel_idx are touched, so different sub channels of the same
+ * subframe may be decoded from different threads at the same time.
+ *
+ * @return SRSRAN_SUCCESS if a TB was decoded, results in sl_res->sci[sub_channel_idx] and sl_res->data[sub_channel_idx]
+ */
 int srsran_ue_sl_decode_subch(srsran_ue_sl_t* q,
                               srsran_sl_sf_cfg_t* sf,
                               uint32_t sub_channel_idx,
@@ -658,6 +1069,10 @@ int srsran_ue_sl_decode_subch(srsran_ue_sl_t* q,
 {
   int ret = SRSRAN_ERROR;
 
+  if (!q->rx_initialized) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
   uint32_t pscch_prb_start_idx;
   if (q->sl_comm_resource_pool.adjacency_pscch_pssch) {
     pscch_prb_start_idx = sub_channel_idx * q->sl_comm_resource_pool.size_sub_channel;
@@ -665,11 +1080,26 @@ int srsran_ue_sl_decode_subch(srsran_ue_sl_t* q,
     pscch_prb_start_idx = sub_channel_idx * 2;
   }
 
-  for (uint32_t cyclic_shift = 0; cyclic_shift <= 9; cyclic_shift += 3) {
+  srsran_ue_sl_rx_stats_t* stats = &q->rx_stats[sub_channel_idx];
+  stats->nof_searches++;
+
+  // Skip the whole cyclic shift search on sub channels without a PSCCH
+  if (q->detect_threshold > 0.0f &&
+      pscch_dmrs_coherence(q, pscch_prb_start_idx, q->pscch_rx[sub_channel_idx].pscch_nof_prb) < q->detect_threshold) {
+    stats->nof_gated++;
+    stats->nof_shifts_pruned += SL_NOF_PSCCH_CYCLIC_SHIFTS;
+    return SRSRAN_ERROR;
+  }
+
+  // Only one PSCCH can start in a sub channel, so stop at the first cyclic shift with a valid CRC
+  for (uint32_t i = 0; i < SL_NOF_PSCCH_CYCLIC_SHIFTS; i++) {
+    uint32_t cyclic_shift = i * 3;
+    stats->nof_shifts_tried++;
     if (pscch_decode(q, sub_channel_idx, cyclic_shift, pscch_prb_start_idx, sl_res) == SRSRAN_SUCCESS) {
-      if (pssch_decode(q, sf, sub_channel_idx, sl_res) == SRSRAN_SUCCESS) {
-        ret = SRSRAN_SUCCESS;
-      }
+      stats->nof_pscch_decoded++;
+      stats->nof_shifts_pruned += SL_NOF_PSCCH_CYCLIC_SHIFTS - 1 - i;
+      ret = pssch_decode_stats(q, sf, sub_channel_idx, sl_res);
+      break;
     }
   }
 //  if (ret == SRSRAN_ERROR) {
@@ -680,4 +1110,24 @@ int srsran_ue_sl_decode_subch(srsran_ue_sl_t* q,
   return ret;
 }
 
+/**
+ * Decode the PSSCH of one sub channel again with another subframe configuration, keeping the SCI
+ * srsran_ue_sl_decode_subch() decoded there. Used when the PSCCH decoded but the PSSCH did not, e.g.
+ * to try every subframe index when the tti is not known, without searching the PSCCH again.
+ *
+ * @return SRSRAN_SUCCESS if a TB was decoded, results in sl_res->data[sub_channel_idx]
+ */
+int srsran_ue_sl_decode_subch_pssch(srsran_ue_sl_t* q,
+                                    srsran_sl_sf_cfg_t* sf,
+                                    uint32_t sub_channel_idx,
+                                    srsran_ue_sl_res_t* sl_res)
+{
+  if (!q->rx_initialized || sub_channel_idx >= SRSRAN_MAX_NUM_SUB_CHANNEL) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  q->rx_stats[sub_channel_idx].nof_pssch_retries++;
+  return pssch_decode_stats(q, sf, sub_channel_idx, sl_res);
+}
+
 //}
\ No newline at end of file
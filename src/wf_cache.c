@@ -0,0 +1,355 @@
+/******************************************************************************
+ *  File:         wf_cache.c
+ *
+ *  Description:  Pre-encoded waveform cache (see wf_cache.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <string.h>
+
+#include <srsran/phy/utils/bit.h>
+
+#include "latency_stats.h"
+#include "wf_cache.h"
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t h, const void* ptr, size_t len)
+{
+  const uint8_t* p = (const uint8_t*)ptr;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static uint64_t fnv1a_u32(uint64_t h, uint32_t v)
+{
+  return fnv1a(h, &v, sizeof(v));
+}
+
+static uint32_t key_bucket(const wf_cache_t* q, const wf_cache_key_t* key)
+{
+  uint64_t h = fnv1a_u32(key->tb_hash, key->sub_channel_start_idx);
+  h          = fnv1a_u32(h, key->l_sub_channel);
+  h          = fnv1a_u32(h, key->sf_idx);
+  h          = fnv1a_u32(h, key->rv_idx);
+  return (uint32_t)(h & (q->nof_buckets - 1));
+}
+
+// Packed TB against one bit per byte, so a lookup doesn't have to pack the caller's TB first
+static bool tb_equal(const uint8_t* packed, const uint8_t* bits, uint32_t nof_bits)
+{
+  for (uint32_t i = 0; i < nof_bits; i += 8) {
+    uint8_t byte = 0;
+    for (uint32_t b = 0; b < 8; b++) {
+      byte = (uint8_t)(byte << 1) | (i + b < nof_bits ? bits[i + b] : 0);
+    }
+    if (byte != packed[i / 8]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The hash only narrows it down: two transmissions can share one, so the SCI and the TB bits are compared too
+static bool key_equal(const wf_cache_entry_t* e, const wf_cache_key_t* key)
+{
+  const wf_cache_key_t* a = &e->key;
+  return a->tb_hash == key->tb_hash && a->sub_channel_start_idx == key->sub_channel_start_idx &&
+         a->l_sub_channel == key->l_sub_channel && a->sf_idx == key->sf_idx && a->rv_idx == key->rv_idx &&
+         a->tb_len == key->tb_len && memcmp(&a->sci, &key->sci, sizeof(wf_cache_sci_t)) == 0 &&
+         tb_equal(e->tb_packed, key->tb, key->tb_len);
+}
+
+static void entry_free(wf_cache_entry_t* e)
+{
+  free(e->samples);
+  if (e->tb_packed) {
+    free(e->tb_packed);
+  }
+  free(e);
+}
+
+static void lru_unlink(wf_cache_t* q, wf_cache_entry_t* e)
+{
+  if (e->lru_prev) {
+    e->lru_prev->lru_next = e->lru_next;
+  } else {
+    q->lru_head = e->lru_next;
+  }
+  if (e->lru_next) {
+    e->lru_next->lru_prev = e->lru_prev;
+  } else {
+    q->lru_tail = e->lru_prev;
+  }
+  e->lru_prev = NULL;
+  e->lru_next = NULL;
+}
+
+static void lru_push_front(wf_cache_t* q, wf_cache_entry_t* e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = q->lru_head;
+  if (q->lru_head) {
+    q->lru_head->lru_prev = e;
+  }
+  q->lru_head = e;
+  if (q->lru_tail == NULL) {
+    q->lru_tail = e;
+  }
+}
+
+static void bucket_remove(wf_cache_t* q, wf_cache_entry_t* e)
+{
+  wf_cache_entry_t** pp = &q->buckets[key_bucket(q, &e->key)];
+  while (*pp) {
+    if (*pp == e) {
+      *pp = e->bucket_next;
+      break;
+    }
+    pp = &(*pp)->bucket_next;
+  }
+  e->bucket_next = NULL;
+}
+
+/**
+ * Initialize a waveform cache.
+ *
+ * @param sf_len number of samples per subframe (srsran_ue_sl_t.sf_len)
+ * @param max_bytes memory budget for cached subframes, including bookkeeping
+ */
+int wf_cache_init(wf_cache_t* q, uint32_t sf_len, size_t max_bytes)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && sf_len > 0) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(wf_cache_t));
+
+    q->sf_len      = sf_len;
+    q->max_bytes   = max_bytes;
+    q->entry_bytes = sizeof(cf_t) * sf_len + sizeof(wf_cache_entry_t);
+
+    // Size the table for roughly one entry per bucket at full budget
+    size_t   max_entries = max_bytes / q->entry_bytes;
+    uint32_t nof_buckets = 16;
+    while (nof_buckets < max_entries && nof_buckets < (1u << 20)) {
+      nof_buckets <<= 1;
+    }
+    q->nof_buckets = nof_buckets;
+
+    q->buckets = (wf_cache_entry_t**)calloc(q->nof_buckets, sizeof(wf_cache_entry_t*));
+    if (!q->buckets) {
+      perror("calloc");
+      return ret;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  }
+
+  return ret;
+}
+
+void wf_cache_free(wf_cache_t* q)
+{
+  if (q) {
+    wf_cache_entry_t* e = q->lru_head;
+    while (e) {
+      wf_cache_entry_t* next = e->lru_next;
+      entry_free(e);
+      e = next;
+    }
+    if (q->buckets) {
+      free(q->buckets);
+    }
+    bzero(q, sizeof(wf_cache_t));
+  }
+}
+
+/**
+ * Build the cache key for one transmission.
+ *
+ * The SCI fields are part of the key because they are encoded into the PSCCH and select the PSSCH MCS, so two
+ * transmissions with the same TB but different SCI must not share a waveform.
+ *
+ * @param sci the SCI that will be transmitted (srsran_ue_sl_t.sci_tx)
+ * @param sf subframe configuration
+ * @param data PSSCH data, only the first tb_len bits of data->ptr are hashed; the key points at them, so they must
+ *             stay unchanged until the lookup or insert with this key
+ * @param tb_len number of valid TB bits in data->ptr
+ */
+wf_cache_key_t wf_cache_make_key(const srsran_sci_t*        sci,
+                                 const srsran_sl_sf_cfg_t*  sf,
+                                 const srsran_pssch_data_t* data,
+                                 uint32_t                   tb_len)
+{
+  wf_cache_key_t key = {};
+
+  key.sci.format              = (uint32_t)sci->format;
+  key.sci.priority            = sci->priority;
+  key.sci.resource_reserv     = sci->resource_reserv;
+  key.sci.time_gap            = sci->time_gap;
+  key.sci.retransmission      = sci->retransmission ? 1 : 0;
+  key.sci.transmission_format = sci->transmission_format;
+  key.sci.mcs_idx             = sci->mcs_idx;
+
+  uint64_t h = fnv1a(FNV_OFFSET_BASIS, &key.sci, sizeof(wf_cache_sci_t));
+  h          = fnv1a(h, data->ptr, tb_len);
+
+  key.tb_hash               = h;
+  key.sub_channel_start_idx = data->sub_channel_start_idx;
+  key.l_sub_channel         = data->l_sub_channel;
+  key.sf_idx                = sf->tti % 10;
+  key.rv_idx                = sci->retransmission ? 1 : 0;
+  key.tb                    = data->ptr;
+  key.tb_len                = tb_len;
+
+  return key;
+}
+
+/**
+ * Look up a finished subframe. Counts a hit or a miss.
+ *
+ * @return pointer to sf_len cached samples, valid until the next insert, or NULL
+ */
+const cf_t* wf_cache_lookup(wf_cache_t* q, const wf_cache_key_t* key)
+{
+  wf_cache_entry_t* e = q->buckets[key_bucket(q, key)];
+  while (e) {
+    if (key_equal(e, key)) {
+      if (e != q->lru_head) {
+        lru_unlink(q, e);
+        lru_push_front(q, e);
+      }
+      q->hits++;
+      return e->samples;
+    }
+    e = e->bucket_next;
+  }
+  q->misses++;
+  return NULL;
+}
+
+/**
+ * Store a finished subframe, evicting least recently used entries to stay within the byte budget.
+ *
+ * @return pointer to the cached copy, or NULL if a single subframe does not fit in the budget
+ */
+const cf_t* wf_cache_insert(wf_cache_t* q, const wf_cache_key_t* key, const cf_t* samples)
+{
+  if (q->entry_bytes > q->max_bytes) {
+    return NULL;
+  }
+
+  // Recycle the eviction victim instead of going back to the allocator
+  wf_cache_entry_t* e = NULL;
+  while (q->used_bytes + q->entry_bytes > q->max_bytes && q->lru_tail) {
+    wf_cache_entry_t* victim = q->lru_tail;
+    lru_unlink(q, victim);
+    bucket_remove(q, victim);
+    q->used_bytes -= q->entry_bytes;
+    q->evictions++;
+    if (e) {
+      entry_free(e);
+    }
+    e = victim;
+  }
+
+  if (e == NULL) {
+    e = (wf_cache_entry_t*)calloc(1, sizeof(wf_cache_entry_t));
+    if (!e) {
+      perror("calloc");
+      return NULL;
+    }
+    e->samples = srsran_vec_cf_malloc(q->sf_len);
+    if (!e->samples) {
+      perror("malloc");
+      free(e);
+      return NULL;
+    }
+  }
+
+  uint32_t tb_bytes = (key->tb_len + 7) / 8;
+  if (e->tb_capacity < tb_bytes) {
+    uint8_t* tb_packed = (uint8_t*)realloc(e->tb_packed, tb_bytes);
+    if (!tb_packed) {
+      perror("realloc");
+      entry_free(e);
+      return NULL;
+    }
+    e->tb_packed   = tb_packed;
+    e->tb_capacity = tb_bytes;
+  }
+  srsran_bit_pack_vector((uint8_t*)key->tb, e->tb_packed, key->tb_len);
+
+  e->key    = *key;
+  e->key.tb = NULL;
+  srsran_vec_cf_copy(e->samples, samples, q->sf_len);
+
+  uint32_t b     = key_bucket(q, key);
+  e->bucket_next = q->buckets[b];
+  q->buckets[b]  = e;
+  lru_push_front(q, e);
+  q->used_bytes += q->entry_bytes;
+
+  return e->samples;
+}
+
+/**
+ * Cached drop-in for srsran_ue_sl_encode() followed by a copy of ue->signal_buffer_tx.
+ *
+ * On a hit the encoder is not touched at all, so ue->signal_buffer_tx is only meaningful after a miss.
+ *
+ * @param tb_len number of valid TB bits in data->ptr
+ * @param output destination for ue->sf_len samples
+ */
+int wf_cache_encode(wf_cache_t*          q,
+                    srsran_ue_sl_t*      ue,
+                    srsran_sl_sf_cfg_t*  sf,
+                    srsran_pssch_data_t* data,
+                    uint32_t             tb_len,
+                    cf_t*                output)
+{
+  if (q == NULL || ue == NULL || output == NULL || ue->sf_len != q->sf_len) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  wf_cache_key_t key    = wf_cache_make_key(&ue->sci_tx, sf, data, tb_len);
+  const cf_t*    cached = wf_cache_lookup(q, &key);
+  if (cached) {
+    uint64_t t = latency_now();
+    srsran_vec_cf_copy(output, cached, q->sf_len);
+    latency_record(LATENCY_TX_COPY, t);
+    return SRSRAN_SUCCESS;
+  }
+
+  if (srsran_ue_sl_encode(ue, sf, data)) {
+    return SRSRAN_ERROR;
+  }
+  wf_cache_insert(q, &key, ue->signal_buffer_tx);
+  uint64_t t = latency_now();
+  srsran_vec_cf_copy(output, ue->signal_buffer_tx, q->sf_len);
+  latency_record(LATENCY_TX_COPY, t);
+
+  return SRSRAN_SUCCESS;
+}
+
+void wf_cache_print_stats(wf_cache_t* q, FILE* f)
+{
+  uint64_t lookups = q->hits + q->misses;
+  fprintf(f,
+          "waveform cache: %lu hits, %lu misses (%.1f%% of encodes avoided), %lu evictions, %.1f/%.1f MB used\n",
+          (unsigned long)q->hits,
+          (unsigned long)q->misses,
+          lookups ? 100.0 * q->hits / lookups : 0.0,
+          (unsigned long)q->evictions,
+          q->used_bytes / 1e6,
+          q->max_bytes / 1e6);
+}
@@ -0,0 +1,102 @@
+/******************************************************************************
+ *  File:         wf_cache.h
+ *
+ *  Description:  Pre-encoded waveform cache.
+ *
+ *                Maps (SCI, TB, sub_channel_start_idx, l_sub_channel,
+ *                tti % 10, rv) to a finished time-domain subframe, so the
+ *                PSCCH/PSSCH/IFFT chain of srsran_ue_sl_encode() only runs
+ *                once per distinct transmission. Entries are found by a hash
+ *                of the SCI and TB, and every entry keeps its SCI fields and
+ *                its TB packed, so a hash match only counts as a hit if they
+ *                match too. Entries are evicted in LRU order once the byte
+ *                budget is exhausted.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef WF_CACHE_H
+#define WF_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ue_sl.h"
+
+#define WF_CACHE_DEFAULT_BUDGET_BYTES (64u * 1024u * 1024u)
+
+// SCI fields that end up on air, all 32 bits wide so the struct has no padding and compares with memcmp
+typedef struct {
+  uint32_t format;
+  uint32_t priority;
+  uint32_t resource_reserv;
+  uint32_t time_gap;
+  uint32_t retransmission;
+  uint32_t transmission_format;
+  uint32_t mcs_idx;
+} wf_cache_sci_t;
+
+typedef struct {
+  uint64_t       tb_hash; // hash over sci and the TB bits
+  wf_cache_sci_t sci;
+  uint32_t       sub_channel_start_idx;
+  uint32_t       l_sub_channel;
+  uint32_t       sf_idx;
+  uint32_t       rv_idx;
+  const uint8_t* tb;     // the caller's TB bits, one per byte; only looked at during the lookup or insert
+  uint32_t       tb_len; // bits
+} wf_cache_key_t;
+
+typedef struct wf_cache_entry_s {
+  wf_cache_key_t key; // key.tb is not kept
+  cf_t*          samples;
+  uint8_t*       tb_packed; // key.tb_len bits, packed
+  uint32_t       tb_capacity; // bytes allocated for tb_packed
+
+  struct wf_cache_entry_s* bucket_next;
+  struct wf_cache_entry_s* lru_prev;
+  struct wf_cache_entry_s* lru_next;
+} wf_cache_entry_t;
+
+typedef struct {
+  uint32_t sf_len;
+  size_t   max_bytes;
+  size_t   used_bytes;
+  size_t   entry_bytes;
+
+  wf_cache_entry_t** buckets;
+  uint32_t           nof_buckets;
+
+  // Most recently used entry at the head, eviction candidate at the tail
+  wf_cache_entry_t* lru_head;
+  wf_cache_entry_t* lru_tail;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+} wf_cache_t;
+
+int wf_cache_init(wf_cache_t* q, uint32_t sf_len, size_t max_bytes);
+
+void wf_cache_free(wf_cache_t* q);
+
+wf_cache_key_t wf_cache_make_key(const srsran_sci_t*        sci,
+                                 const srsran_sl_sf_cfg_t*  sf,
+                                 const srsran_pssch_data_t* data,
+                                 uint32_t                   tb_len);
+
+const cf_t* wf_cache_lookup(wf_cache_t* q, const wf_cache_key_t* key);
+
+const cf_t* wf_cache_insert(wf_cache_t* q, const wf_cache_key_t* key, const cf_t* samples);
+
+int wf_cache_encode(wf_cache_t*          q,
+                    srsran_ue_sl_t*      ue,
+                    srsran_sl_sf_cfg_t*  sf,
+                    srsran_pssch_data_t* data,
+                    uint32_t             tb_len,
+                    cf_t*                output);
+
+void wf_cache_print_stats(wf_cache_t* q, FILE* f);
+
+#endif // WF_CACHE_H
@@ -0,0 +1,174 @@
+/******************************************************************************
+ *  File:         wf_compose.c
+ *
+ *  Description:  IFFT-free multi-UE subframe composition (see wf_compose.h).
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <string.h>
+
+#include "wf_compose.h"
+}
+
+int wf_compose_init(wf_compose_t*                  q,
+                    srsran_cell_sl_t               cell,
+                    srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                    size_t                         cache_bytes)
+{
+  int ret = SRSRAN_ERROR_INVALID_INPUTS;
+
+  if (q != NULL) {
+    ret = SRSRAN_ERROR;
+
+    bzero(q, sizeof(wf_compose_t));
+
+    if (srsran_ue_sl_init(&q->ue, cell, sl_comm_resource_pool, 0)) {
+      ERROR("Error initializing UE for waveform composition\n");
+      goto clean_exit;
+    }
+    q->sf_len = q->ue.sf_len;
+
+    q->use_cache = cache_bytes > 0;
+    if (q->use_cache && wf_cache_init(&q->cache, q->sf_len, cache_bytes)) {
+      ERROR("Error initializing waveform cache for composition\n");
+      goto clean_exit;
+    }
+
+    ret = SRSRAN_SUCCESS;
+  }
+
+clean_exit:
+  if (ret == SRSRAN_ERROR) {
+    wf_compose_free(q);
+  }
+  return ret;
+}
+
+void wf_compose_free(wf_compose_t* q)
+{
+  if (q) {
+    srsran_ue_sl_free(&q->ue);
+    wf_cache_free(&q->cache);
+    bzero(q, sizeof(wf_compose_t));
+  }
+}
+
+/**
+ * Encode one grant on its own and add its waveform to the cache.
+ */
+static int warm_grant(wf_compose_t* q, srsran_sl_sf_cfg_t* sf, srsran_ue_sl_grant_t* grant, const wf_cache_key_t* key)
+{
+  srsran_ue_sl_copy_sci(&q->ue.sci_tx, &grant->sci);
+  if (srsran_ue_sl_encode(&q->ue, sf, &grant->data)) {
+    return SRSRAN_ERROR;
+  }
+  q->stats.nof_encoded++;
+  wf_cache_insert(&q->cache, key, q->ue.signal_buffer_tx);
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Build a multi-UE subframe, by superposition of cached single-grant waveforms if every grant is cached,
+ * or else with srsran_ue_sl_encode_multi().
+ *
+ * Either way the result is that of srsran_ue_sl_encode_multi() for the same grants, unscaled; see wf_compose_scale().
+ *
+ * @param tb_len number of valid TB bits behind every grant's data.ptr
+ * @param output sf_len samples
+ */
+int wf_compose_subframe(wf_compose_t*         q,
+                        srsran_sl_sf_cfg_t*   sf,
+                        srsran_ue_sl_grant_t* grants,
+                        uint32_t              nof_grants,
+                        uint32_t              tb_len,
+                        cf_t*                 output)
+{
+  if (q == NULL || sf == NULL || output == NULL || (grants == NULL && nof_grants > 0) ||
+      nof_grants > SRSRAN_MAX_NUM_SUB_CHANNEL) {
+    return SRSRAN_ERROR_INVALID_INPUTS;
+  }
+
+  wf_cache_key_t keys[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  const cf_t*    wfs[SRSRAN_MAX_NUM_SUB_CHANNEL];
+  int            miss = q->use_cache ? -1 : 0; // first grant that is not cached, the first one without a cache
+  for (uint32_t i = 0; i < nof_grants && miss < 0; i++) {
+    keys[i] = wf_cache_make_key(&grants[i].sci, sf, &grants[i].data, tb_len);
+    wfs[i]  = wf_cache_lookup(&q->cache, &keys[i]);
+    if (wfs[i] == NULL) {
+      miss = (int)i;
+    }
+  }
+
+  if (nof_grants == 0) {
+    srsran_vec_cf_zero(output, q->sf_len);
+  } else if (miss < 0) {
+    srsran_vec_cf_copy(output, wfs[0], q->sf_len);
+    for (uint32_t i = 1; i < nof_grants; i++) {
+      srsran_vec_sum_ccc(output, wfs[i], output, q->sf_len);
+    }
+  } else {
+    // A single grant encoded on its own is its own cache entry
+    if (nof_grants == 1 && q->use_cache) {
+      if (warm_grant(q, sf, &grants[0], &keys[0])) {
+        ERROR("Error encoding grant 0 for composition\n");
+        return SRSRAN_ERROR;
+      }
+    } else {
+      if (srsran_ue_sl_encode_multi(&q->ue, sf, grants, nof_grants)) {
+        ERROR("Error encoding subframe of %d grants for composition\n", nof_grants);
+        return SRSRAN_ERROR;
+      }
+      q->stats.nof_fallback++;
+    }
+    srsran_vec_cf_copy(output, q->ue.signal_buffer_tx, q->sf_len);
+
+    if (nof_grants > 1 && q->use_cache && warm_grant(q, sf, &grants[miss], &keys[miss])) {
+      ERROR("Error encoding grant %d for composition\n", miss);
+    }
+  }
+
+  q->stats.nof_subframes++;
+  q->stats.nof_grants += nof_grants;
+
+  return SRSRAN_SUCCESS;
+}
+
+/**
+ * Scale a subframe of nof_grants grants, built either way, to its transmit level: by 1/sqrt(nof_grants), since
+ * independent grants add up in power, and further down to WF_COMPOSE_PEAK_LIMIT if its largest I or Q value is still
+ * above it. The backoff alone keeps the level of a grant independent of the others' payloads; the peak limit only
+ * applies to the rare subframes where they add up coherently.
+ *
+ * @return true if the peak limit applied
+ */
+bool wf_compose_scale(cf_t* x, uint32_t sf_len, uint32_t nof_grants)
+{
+  float gain    = nof_grants > 1 ? 1.0f / sqrtf((float)nof_grants) : 1.0f;
+  float peak    = fabsf(((float*)x)[srsran_vec_max_abs_fi((float*)x, 2 * sf_len)]) * gain;
+  bool  limited = peak > WF_COMPOSE_PEAK_LIMIT;
+
+  if (limited) {
+    gain *= WF_COMPOSE_PEAK_LIMIT / peak;
+  }
+  if (gain != 1.0f) {
+    srsran_vec_sc_prod_cfc(x, gain, x, sf_len);
+  }
+  return limited;
+}
+
+void wf_compose_print_stats(wf_compose_t* q, FILE* f)
+{
+  fprintf(f,
+          "waveform composition: %lu subframes from %lu grants, %lu encoded with an uncached grant, %lu grants encoded "
+          "for the cache\n",
+          (unsigned long)q->stats.nof_subframes,
+          (unsigned long)q->stats.nof_grants,
+          (unsigned long)q->stats.nof_fallback,
+          (unsigned long)q->stats.nof_encoded);
+  if (q->use_cache) {
+    wf_cache_print_stats(&q->cache, f);
+  }
+}
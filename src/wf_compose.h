@@ -0,0 +1,72 @@
+/******************************************************************************
+ *  File:         wf_compose.h
+ *
+ *  Description:  IFFT-free multi-UE subframe composition.
+ *
+ *                OFDM modulation is linear, so a subframe carrying several
+ *                grants equals the sum of the subframes carrying each grant
+ *                alone. Single-grant waveforms are kept in a waveform cache
+ *                and a multi-UE subframe whose grants are all cached is built
+ *                by adding them up, which turns the per-TTI cost into a
+ *                memory-bandwidth-bound add loop once the cache is warm. A
+ *                subframe with any uncached grant is encoded with
+ *                srsran_ue_sl_encode_multi() instead, one IFFT for all grants,
+ *                and warms the cache with at most one extra single-grant
+ *                encode. Without a cache budget every subframe is encoded
+ *                that way, for payloads that never repeat.
+ *
+ *                wf_compose_scale() sets the level of a subframe of N grants
+ *                however it was built: a 1/sqrt(N) backoff keeps the average
+ *                power at that of one grant, and a subframe whose grants add
+ *                up coherently past WF_COMPOSE_PEAK_LIMIT is scaled down
+ *                further to it, so it never clips at sc16 full scale.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef WF_COMPOSE_H
+#define WF_COMPOSE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ue_sl.h"
+#include "wf_cache.h"
+
+#define WF_COMPOSE_PEAK_LIMIT (1.0f) // largest I or Q value, full scale of an sc16 sink
+
+typedef struct {
+  uint64_t nof_subframes;
+  uint64_t nof_grants;
+  uint64_t nof_encoded;  // grants encoded on their own to warm the cache
+  uint64_t nof_fallback; // subframes with an uncached grant, encoded with srsran_ue_sl_encode_multi()
+} wf_compose_stats_t;
+
+typedef struct {
+  srsran_ue_sl_t ue;
+  wf_cache_t     cache;
+  bool           use_cache; // false without a cache budget
+  uint32_t       sf_len;
+
+  wf_compose_stats_t stats;
+} wf_compose_t;
+
+int wf_compose_init(wf_compose_t*                  q,
+                    srsran_cell_sl_t               cell,
+                    srsran_sl_comm_resource_pool_t sl_comm_resource_pool,
+                    size_t                         cache_bytes);
+
+void wf_compose_free(wf_compose_t* q);
+
+int wf_compose_subframe(wf_compose_t*         q,
+                        srsran_sl_sf_cfg_t*   sf,
+                        srsran_ue_sl_grant_t* grants,
+                        uint32_t              nof_grants,
+                        uint32_t              tb_len,
+                        cf_t*                 output);
+
+bool wf_compose_scale(cf_t* x, uint32_t sf_len, uint32_t nof_grants);
+
+void wf_compose_print_stats(wf_compose_t* q, FILE* f);
+
+#endif // WF_COMPOSE_H
@@ -0,0 +1,151 @@
+/******************************************************************************
+ *  File:         resampler_test.c
+ *
+ *  Description:  Checks of the streaming resampler (resampler.h): the same
+ *                stream fed in one call or in odd-sized chunks gives the same
+ *                output, and a tone comes out at the right frequency, with
+ *                the filter's group delay and no phase step at the chunk
+ *                boundaries.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "resampler.h"
+#include "test_common.h"
+}
+
+#define NOF_INPUT (20000)
+#define TAPS_PER_PHASE (16)
+
+static cf_t tone(double phase)
+{
+  cf_t x;
+  __real__ x = (float)cos(phase);
+  __imag__ x = (float)sin(phase);
+  return x;
+}
+
+static float distance(cf_t a, cf_t b)
+{
+  float re = __real__ a - __real__ b;
+  float im = __imag__ a - __imag__ b;
+  return sqrtf(re * re + im * im);
+}
+
+// Chunk sizes cycled through, including 1 sample and chunks shorter than the filter history
+static const uint32_t chunk_sizes[] = {1, 3, 17, 1000, 7, 4096, 15, 2};
+
+// Output of nof_input input samples, fed in chunks cycled from chunk_sizes, or all at once if chunked is false
+static uint32_t run(uint32_t in_rate, uint32_t out_rate, const cf_t* input, bool chunked, cf_t* output)
+{
+  resampler_t q;
+  if (resampler_init(&q, in_rate, out_rate, TAPS_PER_PHASE)) {
+    return 0;
+  }
+
+  uint32_t nof_output = 0;
+  uint32_t k          = 0;
+  for (uint32_t pos = 0; pos < NOF_INPUT;) {
+    uint32_t n = chunked ? chunk_sizes[k++ % (sizeof(chunk_sizes) / sizeof(chunk_sizes[0]))] : NOF_INPUT;
+    n          = SRSRAN_MIN(n, NOF_INPUT - pos);
+    nof_output += resampler_process(&q, &input[pos], n, &output[nof_output]);
+    pos += n;
+  }
+
+  resampler_free(&q);
+  return nof_output;
+}
+
+// Any split of the input must give exactly the output of one call
+static int test_chunk_boundaries(uint32_t in_rate, uint32_t out_rate)
+{
+  uint32_t max_output = (uint32_t)((uint64_t)NOF_INPUT * out_rate / in_rate) + 2 * NOF_INPUT / 1000 + 16;
+  cf_t*    input      = srsran_vec_cf_malloc(NOF_INPUT);
+  cf_t*    whole      = srsran_vec_cf_malloc(max_output);
+  cf_t*    chunked    = srsran_vec_cf_malloc(max_output);
+  TESTASSERT(input && whole && chunked);
+
+  srand(1);
+  for (uint32_t i = 0; i < NOF_INPUT; i++) {
+    __real__ input[i] = rand() / (float)RAND_MAX - 0.5f;
+    __imag__ input[i] = rand() / (float)RAND_MAX - 0.5f;
+  }
+
+  uint32_t nof_whole   = run(in_rate, out_rate, input, false, whole);
+  uint32_t nof_chunked = run(in_rate, out_rate, input, true, chunked);
+
+  // One output every M/L input samples
+  double expected = (double)NOF_INPUT * out_rate / in_rate;
+  TESTASSERT(fabs(nof_whole - expected) <= 1.0);
+  TESTASSERT(nof_chunked == nof_whole);
+  for (uint32_t k = 0; k < nof_whole; k++) {
+    TESTASSERT(distance(whole[k], chunked[k]) < 1e-5f);
+  }
+
+  free(input);
+  free(whole);
+  free(chunked);
+  return SRSRAN_SUCCESS;
+}
+
+// A tone in the passband comes out as the same tone, delayed by the prototype filter's center
+static int test_tone(uint32_t in_rate, uint32_t out_rate, double freq)
+{
+  uint32_t max_output = (uint32_t)((uint64_t)NOF_INPUT * out_rate / in_rate) + 2 * NOF_INPUT / 1000 + 16;
+  cf_t*    input      = srsran_vec_cf_malloc(NOF_INPUT);
+  cf_t*    output     = srsran_vec_cf_malloc(max_output);
+  TESTASSERT(input && output);
+
+  for (uint32_t i = 0; i < NOF_INPUT; i++) {
+    input[i] = tone(2.0 * M_PI * freq * i / in_rate);
+  }
+  uint32_t nof_output = run(in_rate, out_rate, input, true, output);
+
+  resampler_t q;
+  TESTASSERT(resampler_init(&q, in_rate, out_rate, TAPS_PER_PHASE) == SRSRAN_SUCCESS);
+  double L     = q.interp;
+  double M     = q.decim;
+  double delay = (L * TAPS_PER_PHASE - 1) / (2.0 * L); // input samples
+  resampler_free(&q);
+
+  // Skip the start-up transient, while the history still holds the initial zeros
+  uint32_t first = (uint32_t)ceil(TAPS_PER_PHASE * L / M);
+  TESTASSERT(nof_output > first);
+  float max_error = 0.0f;
+  for (uint32_t k = first; k < nof_output; k++) {
+    double t  = k * M / L - delay; // input sample the output lines up with
+    max_error = SRSRAN_MAX(max_error, distance(output[k], tone(2.0 * M_PI * freq * t / in_rate)));
+  }
+  printf("tone %.0f Hz, %d -> %d Hz: max error %.2e over %d samples\n",
+         freq,
+         in_rate,
+         out_rate,
+         max_error,
+         nof_output - first);
+  TESTASSERT(max_error < 1e-2f);
+
+  free(input);
+  free(output);
+  return SRSRAN_SUCCESS;
+}
+
+int main()
+{
+  // Spectrum analyzer capture to the sidelink rate, and back down
+  TESTASSERT(test_chunk_boundaries(7000000, 30720000) == SRSRAN_SUCCESS);
+  TESTASSERT(test_chunk_boundaries(30720000, 7000000) == SRSRAN_SUCCESS);
+  TESTASSERT(test_chunk_boundaries(23040000, 30720000) == SRSRAN_SUCCESS);
+
+  TESTASSERT(test_tone(7000000, 30720000, 700000) == SRSRAN_SUCCESS);
+  TESTASSERT(test_tone(7000000, 30720000, -1500000) == SRSRAN_SUCCESS);
+  // Decimating, the taps span only a few output samples, so keep the tone well inside the passband droop
+  TESTASSERT(test_tone(30720000, 7000000, 200000) == SRSRAN_SUCCESS);
+
+  printf("resampler_test passed\n");
+  return SRSRAN_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/******************************************************************************
+ *  File:         sps_sensing_test.c
+ *
+ *  Description:  Checks of the sensing-based resource selection
+ *                (sps_sensing.h), through the selection sps_sensing_tx()
+ *                runs for the first subframe: which candidates a sensed
+ *                reservation excludes, up to the end of our own reservation,
+ *                how far the threshold is raised, and that the pick comes
+ *                from the quietest 20 % of what is left.
+ *
+ *  Reference:    3GPP TS 36.213 Section 14.1.1.6
+ *****************************************************************************/
+
+extern "C" {
+#include <stdio.h>
+#include <string.h>
+
+#include "sps_sensing.h"
+#include "test_common.h"
+}
+
+#define NOF_SUB_CHANNEL (4)
+#define THRESHOLD_DB (-60.0f)
+#define N (1000) // subframe the selection is made in
+#define WSTART (N + SPS_SENSING_DEFAULT_T1)
+#define WINDOW_LEN (SPS_SENSING_DEFAULT_T2 - SPS_SENSING_DEFAULT_T1 + 1) // with a 100 ms interval
+#define NOF_CANDIDATES (WINDOW_LEN * NOF_SUB_CHANNEL)
+
+// seed is spread over 32 bits, so consecutive values give unrelated draws
+static void init(sps_sensing_t* q, uint32_t seed)
+{
+  sps_sensing_cfg_t cfg;
+  sps_sensing_cfg_default(&cfg);
+  cfg.num_sub_channel   = NOF_SUB_CHANNEL;
+  cfg.intvl_ms          = 100;
+  cfg.rsrp_threshold_db = THRESHOLD_DB;
+  cfg.seed              = seed * 2654435761u;
+  sps_sensing_init(q, &cfg);
+}
+
+static sps_sensing_sci_t reservation(uint32_t sub_channel, uint32_t intvl_ms, float rsrp_db)
+{
+  sps_sensing_sci_t sci = {};
+  sci.sub_channel_start_idx = sub_channel;
+  sci.l_sub_channel         = 1;
+  sci.priority              = 1;
+  sci.intvl_ms              = intvl_ms;
+  sci.rsrp_db               = rsrp_db;
+  return sci;
+}
+
+// Sense every subframe of the last second before N, with the SCIs given for some of them
+static void sense(sps_sensing_t* q, const float* rssi, uint64_t sci_sf_idx, const sps_sensing_sci_t* sci, uint32_t nof_sci)
+{
+  for (uint64_t sf_idx = N - SPS_SENSING_WINDOW_MS; sf_idx < N; sf_idx++) {
+    sps_sensing_sense(q, sf_idx, rssi, sci, sf_idx == sci_sf_idx ? nof_sci : 0);
+  }
+}
+
+static bool is_excluded(sps_sensing_t* q, uint64_t sf_idx, uint32_t sub_channel)
+{
+  return q->excluded[(sf_idx - WSTART) * NOF_SUB_CHANNEL + sub_channel] != 0;
+}
+
+static uint32_t nof_excluded(sps_sensing_t* q)
+{
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < NOF_CANDIDATES; i++) {
+    n += q->excluded[i];
+  }
+  return n;
+}
+
+// Nothing sensed: nothing excluded, and the pick is inside the selection window
+static int test_empty()
+{
+  float         rssi[NOF_SUB_CHANNEL] = {1, 1, 1, 1};
+  sps_sensing_t q;
+  init(&q, 1);
+  sense(&q, rssi, 0, NULL, 0);
+
+  uint32_t sub_channel = 0;
+  TESTASSERT(!sps_sensing_tx(&q, N, &sub_channel));
+  TESTASSERT(q.reserved);
+  TESTASSERT(nof_excluded(&q) == 0);
+  TESTASSERT(q.stats.nof_threshold_steps == 0);
+  TESTASSERT(q.next_tx >= WSTART && q.next_tx < WSTART + WINDOW_LEN);
+  TESTASSERT(q.sub_channel_start_idx < NOF_SUB_CHANNEL);
+
+  sps_sensing_free(&q);
+  return SRSRAN_SUCCESS;
+}
+
+/*
+ * Reservations count up to the last of our own transmissions, counter - 1 intervals after the window, and land on
+ * the window subframe their distance modulo our interval puts them on.
+ */
+static int test_horizon()
+{
+  float             rssi[NOF_SUB_CHANNEL] = {1, 1, 1, 1};
+  sps_sensing_sci_t sci[3];
+  sci[0] = reservation(0, 100, THRESHOLD_DB + 10); // 1050, 1150, ...: window subframe 1050
+  sci[1] = reservation(1, 500, THRESHOLD_DB + 10); // 1450, 1950: past the window, folds onto 1050
+  sci[2] = reservation(2, 1000, THRESHOLD_DB + 10); // 1950 only, inside the horizon for a counter of 10 or more
+
+  for (uint32_t seed = 1; seed <= 20; seed++) {
+    sps_sensing_t q;
+    init(&q, seed);
+    sense(&q, rssi, 950, sci, 3);
+    uint32_t sub_channel = 0;
+    sps_sensing_tx(&q, N, &sub_channel);
+
+    uint64_t horizon = WSTART + WINDOW_LEN - 1 + (uint64_t)(q.counter - 1) * 100;
+    TESTASSERT(q.counter >= 5 && q.counter <= 15);
+    TESTASSERT(is_excluded(&q, 1050, 0));
+    TESTASSERT(is_excluded(&q, 1050, 1));
+    TESTASSERT(is_excluded(&q, 1050, 2) == (1950 <= horizon));
+    TESTASSERT(!is_excluded(&q, 1050, 3));
+    TESTASSERT(nof_excluded(&q) == 2u + (1950 <= horizon ? 1 : 0));
+    TESTASSERT(q.stats.nof_threshold_steps == 0);
+
+    sps_sensing_free(&q);
+  }
+  return SRSRAN_SUCCESS;
+}
+
+/*
+ * Sub channel 0 is reserved 5 dB above the threshold in every subframe, the others 50 dB above it. No candidate is
+ * left until the threshold is 6 dB up, which frees sub channel 0: a quarter of the candidates, more than 20 %.
+ */
+static int test_threshold_steps()
+{
+  float             rssi[NOF_SUB_CHANNEL] = {1, 1, 1, 1};
+  sps_sensing_sci_t sci[NOF_SUB_CHANNEL];
+  sci[0] = reservation(0, 100, THRESHOLD_DB + 5);
+  for (uint32_t k = 1; k < NOF_SUB_CHANNEL; k++) {
+    sci[k] = reservation(k, 100, THRESHOLD_DB + 50);
+  }
+
+  sps_sensing_t q;
+  init(&q, 1);
+  for (uint64_t sf_idx = N - SPS_SENSING_WINDOW_MS; sf_idx < N; sf_idx++) {
+    sps_sensing_sense(&q, sf_idx, rssi, sci, NOF_SUB_CHANNEL);
+  }
+  uint32_t sub_channel = 0;
+  sps_sensing_tx(&q, N, &sub_channel);
+
+  TESTASSERT(q.stats.nof_threshold_steps == 2);
+  TESTASSERT(q.stats.nof_candidates == NOF_CANDIDATES);
+  TESTASSERT(q.stats.nof_excluded == NOF_CANDIDATES - WINDOW_LEN);
+  TESTASSERT(q.sub_channel_start_idx == 0);
+
+  sps_sensing_free(&q);
+  return SRSRAN_SUCCESS;
+}
+
+/*
+ * With nothing excluded, the pick is among the 20 % of the candidates with the lowest S-RSSI. Sub channel 3 is
+ * quiet in every subframe, so it holds the quietest 25 % and wins every time.
+ */
+static int test_quietest()
+{
+  float rssi[NOF_SUB_CHANNEL] = {100, 50, 80, 1};
+
+  uint64_t first_tx = 0;
+  bool     spread   = false;
+  for (uint32_t seed = 1; seed <= 50; seed++) {
+    sps_sensing_t q;
+    init(&q, seed);
+    sense(&q, rssi, 0, NULL, 0);
+    uint32_t sub_channel = 0;
+    sps_sensing_tx(&q, N, &sub_channel);
+
+    TESTASSERT(q.sub_channel_start_idx == 3);
+    TESTASSERT(q.next_tx >= WSTART && q.next_tx < WSTART + WINDOW_LEN);
+    if (seed == 1) {
+      first_tx = q.next_tx;
+    } else if (q.next_tx != first_tx) {
+      spread = true;
+    }
+    sps_sensing_free(&q);
+  }
+  // Still a random pick among them, not always the same subframe
+  TESTASSERT(spread);
+  return SRSRAN_SUCCESS;
+}
+
+int main()
+{
+  TESTASSERT(test_empty() == SRSRAN_SUCCESS);
+  TESTASSERT(test_horizon() == SRSRAN_SUCCESS);
+  TESTASSERT(test_threshold_steps() == SRSRAN_SUCCESS);
+  TESTASSERT(test_quietest() == SRSRAN_SUCCESS);
+
+  printf("sps_sensing_test passed\n");
+  return SRSRAN_SUCCESS;
+}
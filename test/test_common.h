@@ -0,0 +1,27 @@
+/******************************************************************************
+ *  File:         test_common.h
+ *
+ *  Description:  Helpers shared by the checks in test/. Every check is a
+ *                function returning SRSRAN_SUCCESS, and TESTASSERT makes it
+ *                return SRSRAN_ERROR with the failed condition and its
+ *                location on stderr.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdio.h>
+
+#include <srsran/phy/utils/debug.h>
+
+#define TESTASSERT(cond)                                                                                               \
+  do {                                                                                                                 \
+    if (!(cond)) {                                                                                                     \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                         \
+      return SRSRAN_ERROR;                                                                                             \
+    }                                                                                                                  \
+  } while (0)
+
+#endif // TEST_COMMON_H
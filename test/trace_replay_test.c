@@ -0,0 +1,217 @@
+/******************************************************************************
+ *  File:         trace_replay_test.c
+ *
+ *  Description:  Checks of the timestamped trace replay (trace_replay.h) and
+ *                of the hex payload decoder it uses: a CSV trace comes out
+ *                row by row in the subframes its timestamps give, with its
+ *                payload, priority and sub channel; malformed lines are
+ *                skipped and counted; the same trace converted to the binary
+ *                format replays identically; and the 8-characters-at-a-time
+ *                hex decoder agrees with a plain one.
+ *
+ *  Reference:
+ *****************************************************************************/
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msg_ingest.h"
+#include "test_common.h"
+#include "trace_replay.h"
+}
+
+#define MAX_BITS (256)
+#define DEFAULT_PRIORITY (5)
+#define MAX_ROWS (16)
+
+// Line 1 is a header, line 3 a comment, lines 8 and 9 are malformed
+static const char* csv_trace = "timestamp,payload,priority,sub_channel\n"
+                               "12.000250,0x0014252a,3,2\n"
+                               "# comment\n"
+                               "12.001250,DEADbeef,,\n"
+                               "12.0035,ff\r\n"
+                               "12.0038999999999,0X0123456789abcdefABCDEF,7\n"
+                               "12.0039,00000000,1, 4\n"
+                               "12.0050,xyz,1,1\n"
+                               "bad,00\n"
+                               "\n"
+                               "12.1002501,8,0,0";
+
+typedef struct {
+  uint64_t sf_idx; // subframe it came out in
+  int64_t  offset_ns;
+  uint32_t nof_bits;
+  uint8_t  priority;
+  uint8_t  sub_channel;
+  uint8_t  bits[MAX_BITS];
+} replayed_t;
+
+typedef struct {
+  int64_t     offset_ns;
+  uint64_t    sf_idx;
+  const char* hex;
+  uint8_t     priority;
+  uint8_t     sub_channel;
+} expected_t;
+
+// Offsets from the first row, to the ns; 3.25 ms rounds down to subframe 3 and 3.65 ms up to 4, and the second row
+// due in subframe 4 is deferred to the next free one
+static const expected_t expected[] = {
+    {0, 0, "0014252a", 3, 2},
+    {1000000, 1, "deadbeef", DEFAULT_PRIORITY, TRACE_REPLAY_ANY},
+    {3250000, 3, "ff", DEFAULT_PRIORITY, TRACE_REPLAY_ANY},
+    {3649999, 4, "0123456789abcdefABCDEF", 7, TRACE_REPLAY_ANY},
+    {3650000, 5, "00000000", 1, 4},
+    {100000100, 100, "8", 0, 0},
+};
+#define NOF_EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+// Plain one character at a time reference decoder
+static uint32_t reference_bits(const char* hex, size_t len, uint8_t* bits)
+{
+  for (size_t i = 0; i < len; i++) {
+    char c = hex[i];
+    int  v = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+    for (int b = 0; b < 4; b++) {
+      bits[i * 4 + b] = (v >> (3 - b)) & 1;
+    }
+  }
+  return (uint32_t)len * 4;
+}
+
+static int write_file(const char* name, const char* contents)
+{
+  FILE* f = fopen(name, "w");
+  TESTASSERT(f != NULL);
+  TESTASSERT(fputs(contents, f) >= 0);
+  TESTASSERT(fclose(f) == 0);
+  return SRSRAN_SUCCESS;
+}
+
+// Replay a trace subframe by subframe, the way the encoder takes rows out of it
+static int replay(const char* name, replayed_t* rows, uint32_t* nof_rows, trace_replay_t* q)
+{
+  TESTASSERT(trace_replay_init(q, name, MAX_BITS, DEFAULT_PRIORITY) == SRSRAN_SUCCESS);
+  TESTASSERT(trace_replay_start(q) == SRSRAN_SUCCESS);
+  while (!__atomic_load_n(&q->parser_done, __ATOMIC_ACQUIRE)) {
+    usleep(1000);
+  }
+
+  *nof_rows = 0;
+  for (uint64_t sf_idx = 0; !trace_replay_finished(q, sf_idx); sf_idx++) {
+    TESTASSERT(sf_idx < 1000);
+    trace_replay_row_t* row = trace_replay_next(q, sf_idx);
+    if (row == NULL) {
+      continue;
+    }
+    TESTASSERT(*nof_rows < MAX_ROWS);
+    replayed_t* r  = &rows[(*nof_rows)++];
+    r->sf_idx      = sf_idx;
+    r->offset_ns   = row->offset_ns;
+    r->nof_bits    = row->nof_bits;
+    r->priority    = row->priority;
+    r->sub_channel = row->sub_channel;
+    memcpy(r->bits, row->bits, MAX_BITS);
+    trace_replay_release(q, row);
+  }
+  trace_replay_stop(q);
+  return SRSRAN_SUCCESS;
+}
+
+static int check_rows(const replayed_t* rows, uint32_t nof_rows)
+{
+  TESTASSERT(nof_rows == NOF_EXPECTED);
+  for (uint32_t i = 0; i < nof_rows; i++) {
+    const expected_t* e = &expected[i];
+    uint8_t           bits[MAX_BITS] = {};
+    uint32_t          nof_bits       = reference_bits(e->hex, strlen(e->hex), bits);
+
+    TESTASSERT(rows[i].sf_idx == e->sf_idx);
+    TESTASSERT(rows[i].offset_ns == e->offset_ns);
+    TESTASSERT(rows[i].priority == e->priority);
+    TESTASSERT(rows[i].sub_channel == e->sub_channel);
+    TESTASSERT(rows[i].nof_bits == nof_bits);
+    // The slot is zero past the payload, whatever longer row used it before
+    TESTASSERT(memcmp(rows[i].bits, bits, MAX_BITS) == 0);
+  }
+  return SRSRAN_SUCCESS;
+}
+
+static int test_csv_and_binary()
+{
+  char csv_name[] = "/tmp/trace_replay_test_XXXXXX";
+  int  fd         = mkstemp(csv_name);
+  TESTASSERT(fd >= 0);
+  close(fd);
+  char bin_name[sizeof(csv_name) + 4];
+  snprintf(bin_name, sizeof(bin_name), "%s.bin", csv_name);
+  TESTASSERT(write_file(csv_name, csv_trace) == SRSRAN_SUCCESS);
+
+  replayed_t     csv_rows[MAX_ROWS], bin_rows[MAX_ROWS];
+  uint32_t       nof_csv = 0, nof_bin = 0;
+  trace_replay_t q;
+
+  TESTASSERT(replay(csv_name, csv_rows, &nof_csv, &q) == SRSRAN_SUCCESS);
+  TESTASSERT(q.format == TRACE_REPLAY_CSV);
+  TESTASSERT(q.parser_stats.nof_rows == NOF_EXPECTED);
+  TESTASSERT(q.parser_stats.nof_malformed == 2);
+  TESTASSERT(q.parser_stats.first_malformed == 8);
+  TESTASSERT(q.encoder_stats.nof_deferred == 1);
+  trace_replay_free(&q);
+  TESTASSERT(check_rows(csv_rows, nof_csv) == SRSRAN_SUCCESS);
+
+  TESTASSERT(trace_replay_convert(csv_name, bin_name, MAX_BITS) == SRSRAN_SUCCESS);
+  TESTASSERT(replay(bin_name, bin_rows, &nof_bin, &q) == SRSRAN_SUCCESS);
+  TESTASSERT(q.format == TRACE_REPLAY_BINARY);
+  TESTASSERT(q.parser_stats.nof_malformed == 0);
+  trace_replay_free(&q);
+  TESTASSERT(check_rows(bin_rows, nof_bin) == SRSRAN_SUCCESS);
+
+  unlink(csv_name);
+  unlink(bin_name);
+  return SRSRAN_SUCCESS;
+}
+
+// Every length around the 8-character blocks, every digit in every position, and a bad character anywhere
+static int test_hex_decoder()
+{
+  static const char digits[] = "0123456789abcdefABCDEF";
+  char              hex[64];
+  uint8_t           bits[MAX_BITS], reference[MAX_BITS];
+
+  srand(1);
+  for (uint32_t n = 0; n < 20000; n++) {
+    size_t len = rand() % (sizeof(hex) - 1) + 1;
+    for (size_t i = 0; i < len; i++) {
+      hex[i] = digits[rand() % (sizeof(digits) - 1)];
+    }
+    TESTASSERT(msg_ingest_hex_to_bits_len(hex, len, bits, MAX_BITS) == (int)reference_bits(hex, len, reference));
+    TESTASSERT(memcmp(bits, reference, len * 4) == 0);
+
+    // Characters next to the digits in ASCII, and bytes with the top bit set
+    static const char bad[] = {'/', ':', '@', 'G', '`', 'g', ' ', (char)0xb0, (char)0xe1};
+    size_t            at    = rand() % len;
+    hex[at]                 = bad[rand() % sizeof(bad)];
+    TESTASSERT(msg_ingest_hex_to_bits_len(hex, len, bits, MAX_BITS) == SRSRAN_ERROR);
+  }
+
+  // Prefix, an x anywhere else, and payloads that don't fit
+  TESTASSERT(msg_ingest_hex_to_bits_len("0xA5", 4, bits, MAX_BITS) == 8);
+  TESTASSERT(bits[0] == 1 && bits[1] == 0 && bits[2] == 1 && bits[3] == 0 && bits[7] == 1);
+  TESTASSERT(msg_ingest_hex_to_bits_len("1x0123456789abcd", 16, bits, MAX_BITS) == SRSRAN_ERROR);
+  TESTASSERT(msg_ingest_hex_to_bits_len("0123456789", 10, bits, 36) == SRSRAN_ERROR);
+  TESTASSERT(msg_ingest_hex_to_bits_len("012345678", 9, bits, 36) == 36);
+  return SRSRAN_SUCCESS;
+}
+
+int main()
+{
+  TESTASSERT(test_hex_decoder() == SRSRAN_SUCCESS);
+  TESTASSERT(test_csv_and_binary() == SRSRAN_SUCCESS);
+
+  printf("trace_replay_test passed\n");
+  return SRSRAN_SUCCESS;
+}